@@ -7,6 +7,7 @@
 //
 // clang-format on
 
+#if defined(_WIN32)
 #ifndef UNICODE
 #define UNICODE 1
 #endif
@@ -28,12 +29,83 @@
 #pragma comment(lib, "Ole32.lib")
 #pragma comment(lib, "avrt.lib")
 #endif
+#else
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif // defined(_WIN32)
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define MY_ARCH_X86   1
+#define MY_ARCH_ARM64 0
+#include <immintrin.h>
+#if defined(_MSC_VER) // cl, clang-cl
+#include <intrin.h>   // __cpuid
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define MY_ARCH_X86   0
+#define MY_ARCH_ARM64 1
+#include <arm_neon.h>
+#else
+#define MY_ARCH_X86   0
+#define MY_ARCH_ARM64 0
+#endif
+
+// Enables an instruction set for a single function. cl accepts the intrinsics without it.
+#if defined(__GNUC__) || defined(__clang__)
+#define MY_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MY_TARGET(isa)
+#endif
+
+// Real-time safety checker (--rt-check on). Built with -DRT_CHECK=ON, only on Linux (glibc).
+#if !defined(MY_RT_CHECK)
+#define MY_RT_CHECK 0
+#endif
+#if MY_RT_CHECK
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <semaphore.h>
+#if !defined(__GLIBC__)
+#error "MY_RT_CHECK requires Linux (glibc)"
+#endif
+#endif
+
+// Trace points of the audio threads (--trace <out.json>). Removed from a build with -DTRACE_EVENTS=OFF.
+#if !defined(MY_TRACE_EVENTS)
+#define MY_TRACE_EVENTS 1
+#endif
+
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <bit>
+#include <chrono>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <fstream>
 #include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <numbers>
+#include <numeric>
 #include <span>
 #include <string>
 #include <thread>
@@ -55,11 +127,13 @@
 
 #define INIT_CLASS_IID
 #include "base/source/fobject.h"
+#include "pluginterfaces/base/ibstream.h"
 #include "pluginterfaces/gui/iplugview.h"
 #include "pluginterfaces/vst/ivstaudioprocessor.h"
 #include "pluginterfaces/vst/ivsteditcontroller.h"
 #include "pluginterfaces/vst/ivstevents.h"
 #include "pluginterfaces/vst/ivsthostapplication.h"
+#include "pluginterfaces/vst/ivstparameterchanges.h"
 
 #if defined(_MSC_VER) && !defined(__clang__) // cl
 #pragma warning(pop)
@@ -76,13 +150,16 @@ const std::vector<std::filesystem::path> global_pluginPaths = {
     localVst3Dir / L"JC-303_Windows_X64/VST3/JC303.vst3/Contents/x86_64-win/JC303.vst3",
 };
 
+// Set by SIGINT (Ctrl+C). The main thread stops the audio backend and quits.
+volatile std::sig_atomic_t global_quitRequested = 0;
+
 enum class Color : int { Normal = 0, Red = 91, Green = 92 };
 
 // Logging function
 void lpr(const Color c, const wchar_t *type, const char *file, const int line, const wchar_t *fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    (void)fwprintf(stderr, L"\x1b[%dm%-5s: %hs(%d): ", static_cast<int>(c), type, file, line);
+    (void)fwprintf(stderr, L"\x1b[%dm%-5ls: %hs(%d): ", static_cast<int>(c), type, file, line);
     (void)vfwprintf(stderr, fmt, args);
     (void)fwprintf(stderr, L"\x1b[0m"); // 0 = reset
     va_end(args);
@@ -91,37 +168,282 @@ void lpr(const Color c, const wchar_t *type, const char *file, const int line, c
 #define MY_ERROR(...) lpr(Color::Red, L"ERROR", __FILE__, __LINE__, __VA_ARGS__)
 #define MY_TRACE(...) lpr(Color::Green, L"TRACE", __FILE__, __LINE__, __VA_ARGS__)
 
-// WASAPI Control Class
-class Wasapi final {
+// Timeline of the audio threads (--trace <out.json>). Each registered thread records its spans to its own ring buffer
+// without locks or allocations. A full ring drops the span and counts it. The flush thread drains the rings
+// periodically and writes the Chrome trace event format (JSON), which ui.perfetto.dev and chrome://tracing open.
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4324) // structure was padded due to alignment specifier
+#endif
+class TraceRecorder final {
+  public:
+    [[nodiscard]] static constexpr bool isAvailable() { return MY_TRACE_EVENTS != 0; }
+    [[nodiscard]] static bool           isEnabled() { return enabled_.load(std::memory_order_relaxed); }
+    // true : The calling thread is registered and its spans are recorded
+    [[nodiscard]] static bool isRecording() { return threadRing_ && isEnabled(); }
+
+    [[nodiscard]] static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // Call it before the threads to trace start
+    static bool start(const std::filesystem::path &path) {
+        const std::lock_guard lock(mutex_);
+        ofs_.open(path, std::ios::binary);
+        if (!ofs_) {
+            MY_ERROR(L"Failed to open \"%ls\"\n", path.wstring().c_str());
+            return false;
+        }
+        ofs_ << "{\"traceEvents\":[";
+        path_       = path;
+        originNs_   = now();
+        firstEvent_ = true;
+        nWritten_   = 0;
+        stopFlush_.store(false, std::memory_order_relaxed);
+        enabled_.store(true, std::memory_order_release);
+        flushThread_ = std::thread(flushThreadProc);
+        return true;
+    }
+
+    // Call it after the traced threads have stopped. Writes the remaining spans and closes the file.
+    static void stop() {
+        if (!enabled_.exchange(false)) {
+            return;
+        }
+        stopFlush_.store(true, std::memory_order_release);
+        flushThread_.join();
+        const std::lock_guard lock(mutex_);
+        drain();
+        ofs_ << "\n]}\n";
+        ofs_.close();
+        uint64_t nDropped = 0;
+        for (const auto &ring : rings_) {
+            nDropped += ring->nDropped.load(std::memory_order_relaxed);
+        }
+        if (!ofs_) {
+            MY_ERROR(L"Failed to write \"%ls\"\n", path_.wstring().c_str());
+        }
+        MY_TRACE(L"Trace : \"%ls\", %llu spans, %llu dropped\n", path_.wstring().c_str(),
+                 static_cast<unsigned long long>(nWritten_), static_cast<unsigned long long>(nDropped));
+    }
+
+    // Gives the calling thread its ring buffer. name must outlive the recorder (a literal or intern()). Does nothing
+    // if tracing is off or the thread is already registered.
+    static void registerThread(const char *name) {
+        if (!isEnabled() || threadRing_) {
+            return;
+        }
+        auto ring        = std::make_unique<Ring>();
+        ring->threadName = name;
+        const std::lock_guard lock(mutex_);
+        ring->tid   = static_cast<unsigned>(rings_.size()) + 1;
+        threadRing_ = rings_.emplace_back(std::move(ring)).get();
+    }
+
+    // Stores a copy of the span or thread name, escaped for JSON, for the lifetime of the process
+    [[nodiscard]] static const char *intern(const std::string &str) {
+        std::string escaped;
+        for (const char c : str) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += static_cast<unsigned char>(c) < 0x20 ? ' ' : c;
+        }
+        const std::lock_guard lock(mutex_);
+        return names_.emplace_back(std::move(escaped)).c_str();
+    }
+
+    // Audio thread : Appends the span to the ring of the calling thread
+    static void record(const char *name, const int64_t beginNs, const int64_t endNs) {
+        Ring *const ring = threadRing_;
+        if (!ring) {
+            return;
+        }
+        const uint32_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) >= Ring::Capacity) {
+            ring->nDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        ring->spans[head % Ring::Capacity] = {.name = name, .beginNs = beginNs, .endNs = endNs};
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+  private:
+    struct Span {
+        const char *name;
+        int64_t     beginNs;
+        int64_t     endNs;
+    };
+
+    // Single producer (the owner thread), single consumer (the flush thread)
+    struct Ring {
+        static constexpr uint32_t Capacity         = 1 << 14;
+        static constexpr size_t   FalseSharingSize = std::hardware_destructive_interference_size;
+
+        std::array<Span, Capacity>                      spans{};
+        alignas(FalseSharingSize) std::atomic<uint32_t> head = 0; // Written by the owner
+        alignas(FalseSharingSize) std::atomic<uint32_t> tail = 0; // Written by the flush thread
+        std::atomic<uint64_t>                           nDropped   = 0;
+        const char                                     *threadName = nullptr;
+        unsigned                                        tid        = 0;
+        bool                                            named      = false; // The thread_name event is written
+    };
+
+    static constexpr auto FlushPeriod = std::chrono::milliseconds(50);
+
+    static void flushThreadProc() {
+        while (!stopFlush_.load(std::memory_order_acquire)) {
+            std::this_thread::sleep_for(FlushPeriod);
+            const std::lock_guard lock(mutex_);
+            drain();
+        }
+    }
+
+    // Call it with mutex_ held
+    static void drain() {
+        std::array<char, 128> buf;
+        for (const auto &ring : rings_) {
+            if (!ring->named) {
+                ofs_ << (firstEvent_ ? "\n" : ",\n") << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << ring->tid
+                     << R"(,"args":{"name":")" << ring->threadName << "\"}}";
+                firstEvent_ = false;
+                ring->named = true;
+            }
+            const uint32_t head = ring->head.load(std::memory_order_acquire);
+            uint32_t       tail = ring->tail.load(std::memory_order_relaxed);
+            for (; tail != head; ++tail) {
+                const Span &span = ring->spans[tail % Ring::Capacity];
+                (void)snprintf(buf.data(), buf.size(), R"(","ph":"X","ts":%.3f,"dur":%.3f,"pid":1,"tid":%u})",
+                               static_cast<double>(span.beginNs - originNs_) / 1e3,
+                               static_cast<double>(span.endNs - span.beginNs) / 1e3, ring->tid);
+                ofs_ << ",\n{\"name\":\"" << span.name << buf.data();
+                ++nWritten_;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+        }
+        ofs_.flush();
+    }
+
+    static inline std::atomic<bool>                  enabled_    = false;
+    static inline std::atomic<bool>                  stopFlush_  = false;
+    static inline thread_local Ring                 *threadRing_ = nullptr;
+    static inline std::mutex                         mutex_;       // Guards the members below
+    static inline std::vector<std::unique_ptr<Ring>> rings_;       // Kept until the process exits
+    static inline std::deque<std::string>            names_;       // intern()
+    static inline std::thread                        flushThread_;
+    static inline std::ofstream                      ofs_;
+    static inline std::filesystem::path              path_;
+    static inline int64_t                            originNs_   = 0;
+    static inline uint64_t                           nWritten_   = 0;
+    static inline bool                               firstEvent_ = true;
+}; // class TraceRecorder
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+// Records the span from the construction to end() or the destruction on the timeline of the calling thread
+class TraceSpan final {
+  public:
+    explicit TraceSpan(const char *name)
+        : name_(name && TraceRecorder::isRecording() ? name : nullptr), beginNs_(name_ ? TraceRecorder::now() : 0) {}
+    ~TraceSpan() { end(); }
+    TraceSpan(const TraceSpan &)            = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    void end() {
+        if (name_) {
+            TraceRecorder::record(name_, beginNs_, TraceRecorder::now());
+            name_ = nullptr;
+        }
+    }
+
+  private:
+    const char *name_;
+    int64_t     beginNs_;
+}; // class TraceSpan
+
+#if MY_TRACE_EVENTS
+#define MY_TRACE_SPAN(var, name) TraceSpan var(name)
+#define MY_TRACE_END(var)        var.end()
+#else
+#define MY_TRACE_SPAN(var, name) static_cast<void>(0)
+#define MY_TRACE_END(var)        static_cast<void>(0)
+#endif
+
+// Audio Backend Interface. A backend owns the audio thread loop and calls the refill callback for each block.
+class AudioBackend {
   public:
     struct RefillArgs {
-        std::span<float> wasapiInterleavedBuf;
+        std::span<float> interleavedBuf;
         double           sampleRate;
         unsigned         nChannels;
         unsigned         nSamples;
+        uint64_t         streamPosition; // Frames rendered before this block
     };
     using RefillFunc = std::function<void(const RefillArgs &refillArgs)>;
 
+    AudioBackend()                                = default;
+    AudioBackend(const AudioBackend &)            = delete;
+    AudioBackend &operator=(const AudioBackend &) = delete;
+    virtual ~AudioBackend()                       = default;
+
+    [[nodiscard]] virtual bool     good() const           = 0;
+    [[nodiscard]] virtual unsigned getBufferSize() const  = 0;
+    [[nodiscard]] virtual unsigned getNumChannels() const = 0;
+    [[nodiscard]] virtual double   getSampleRate() const  = 0;
+    // Frames from the refill callback to the output of the device. e.g. WASAPI plays the refilled end of its buffer
+    // after the whole buffer and the stream latency. The software backends consume the blocks immediately.
+    [[nodiscard]] virtual unsigned getOutputLatencyFrames() const = 0;
+    // true : Blocks are paced by a clock (kRealtime). false : Blocks are pumped as fast as possible (kOffline).
+    [[nodiscard]] virtual bool isRealtime() const = 0;
+    [[nodiscard]] bool         finished() const { return finished_.load(std::memory_order_acquire); }
+    void setAudioThreadRefillCallback(const RefillFunc &refillFunc) { refillFunc_ = refillFunc; }
+    // Requests audioThreadProc() to return. Can be called from any thread.
+    virtual void stop() = 0;
+
+    // Called from the host's audio thread. Returns when stop() is called or the backend has no more blocks to render.
+    void audioThreadProc() {
+        TraceRecorder::registerThread("audio");
+        audioThreadMain();
+        finished_.store(true, std::memory_order_release);
+    }
+
+  protected:
+    virtual void audioThreadMain() = 0;
+
+    RefillFunc refillFunc_{};
+
+  private:
+    std::atomic<bool> finished_ = false;
+}; // class AudioBackend
+
+#if defined(_WIN32)
+// WASAPI Control Class
+class Wasapi final : public AudioBackend {
+  public:
     explicit Wasapi(const int hnsBufferDuration = 100000) { init(hnsBufferDuration); }
 
-    ~Wasapi() { cleanup(); }
+    ~Wasapi() override { cleanup(); }
 
-    [[nodiscard]] bool     good() const { return initialized_; }
-    [[nodiscard]] unsigned getBufferSize() const { return bufferSize_; }
-    [[nodiscard]] unsigned getNumChannels() const { return pFormat_ ? pFormat_->nChannels : 2; }
-    [[nodiscard]] double   getSampleRate() const { return pFormat_ ? pFormat_->nSamplesPerSec : 0; }
-    void                   setAudioThreadRefillCallback(const RefillFunc &refillFunc) { refillFunc_ = refillFunc; }
+    [[nodiscard]] bool     good() const override { return initialized_; }
+    [[nodiscard]] unsigned getBufferSize() const override { return bufferSize_; }
+    [[nodiscard]] unsigned getNumChannels() const override { return pFormat_ ? pFormat_->nChannels : 2; }
+    [[nodiscard]] double   getSampleRate() const override { return pFormat_ ? pFormat_->nSamplesPerSec : 0; }
+    [[nodiscard]] unsigned getOutputLatencyFrames() const override { return bufferSize_ + streamLatencyFrames_; }
+    [[nodiscard]] bool     isRealtime() const override { return true; }
     // ReSharper disable once CppMemberFunctionMayBeConst
-    void stop() {
+    void stop() override {
         if (hCloseAudioThreadEvent) {
             SetEvent(hCloseAudioThreadEvent);
         }
     }
 
+  protected:
     // Called from the host's audio thread. Loops while waiting for WASAPI events or host termination requests. Writes
     // to the audio buffer when a WASAPI event is received.
     // ReSharper disable once CppMemberFunctionMayBeConst
-    void audioThreadProc() {
+    void audioThreadMain() override {
         if (!initialized_) {
             return MY_ERROR(L"!initialized_\n");
         }
@@ -146,6 +468,8 @@ class Wasapi final {
         }
         // If hCloseAudioThreadEvent is signaled, WaitForMultipleObjects returns (WAIT_OBJECT_0 + 1).
         while (WaitForMultipleObjects(std::size(events), events, FALSE, INFINITE) == WAIT_OBJECT_0) {
+            MY_TRACE_SPAN(callbackSpan, "callback");
+            MY_TRACE_SPAN(getBufferSpan, "GetBuffer");
             uint32_t pad = 0;
             if (HRESULT hr = audioClient_->GetCurrentPadding(&pad); FAILED(hr)) {
                 MY_ERROR(L"FAILED(0x%08x), audioClient_->GetCurrentPadding()\n", hr);
@@ -157,21 +481,26 @@ class Wasapi final {
                 MY_ERROR(L"FAILED(0x%08x), audioRenderClient_->GetBuffer()\n", hr);
                 break;
             }
+            MY_TRACE_END(getBufferSpan);
             if (refillFunc_) {
                 const RefillArgs refillArgs{
-                    .wasapiInterleavedBuf = std::span(o, nFrame * nChannels),
-                    .sampleRate           = static_cast<double>(pFormat_->nSamplesPerSec),
-                    .nChannels            = nChannels,
-                    .nSamples             = nFrame,
+                    .interleavedBuf = std::span(o, nFrame * nChannels),
+                    .sampleRate     = static_cast<double>(pFormat_->nSamplesPerSec),
+                    .nChannels      = nChannels,
+                    .nSamples       = nFrame,
+                    .streamPosition = streamPosition_,
                 };
                 refillFunc_(refillArgs);
             } else {
                 memset(o, 0, nFrame * nChannels * sizeof(*o));
             }
+            MY_TRACE_SPAN(releaseBufferSpan, "ReleaseBuffer");
             if (HRESULT hr = audioRenderClient_->ReleaseBuffer(nFrame, 0); FAILED(hr)) {
                 MY_ERROR(L"FAILED(0x%08x), audioRenderClient_->ReleaseBuffer()\n", hr);
                 break;
             }
+            MY_TRACE_END(releaseBufferSpan);
+            streamPosition_ += nFrame;
         }
     end:
         if (hTask) {
@@ -256,6 +585,11 @@ class Wasapi final {
         if (HRESULT hr = audioClient_->GetBufferSize(&bufferSize_); FAILED(hr)) {
             return MY_ERROR(L"FAILED(0x%08x), audioClient_->GetBufferSize()\n", hr);
         }
+
+        // Only used for the latency report
+        if (REFERENCE_TIME hnsLatency = 0; SUCCEEDED(audioClient_->GetStreamLatency(&hnsLatency))) {
+            streamLatencyFrames_ = static_cast<uint32_t>(hnsLatency * pFormat_->nSamplesPerSec / 10000000);
+        }
         initialized_ = true;
     }
 
@@ -292,629 +626,8476 @@ class Wasapi final {
     IAudioRenderClient  *audioRenderClient_     = nullptr;
     WAVEFORMATEX        *pFormat_               = nullptr;
     uint32_t             bufferSize_            = 0;
+    uint32_t             streamLatencyFrames_   = 0; // IAudioClient::GetStreamLatency()
+    uint64_t             streamPosition_        = 0; // Frames written since the start
     bool                 initialized_           = false;
-    RefillFunc           refillFunc_{};
 }; // class Wasapi
+#endif // defined(_WIN32)
 
-// Thread-safe SPSC (Single Producer Single Consumer) queue
-#ifdef _MSC_VER
-#pragma warning(push)
-#pragma warning(disable : 4324) // structure was padded due to alignment specifier
-#endif
-template <class T, unsigned NumberOfElements> class SpscQueue final {
-    static constexpr size_t Capacity         = NumberOfElements + 1;
-    static constexpr size_t FalseSharingSize = std::hardware_destructive_interference_size;
-    static constexpr size_t AlignSize        = std::max(alignof(T), FalseSharingSize);
-
-    struct AlignedStorage {
-        alignas(AlignSize) std::byte storage[sizeof(T)];
-    };
+// Vectorized buffer kernels : Planar <-> interleaved conversion, mixing, and float -> integer PCM conversion.
+// The best instruction set (SSE2 / AVX2 / AVX-512 on x86, NEON on ARM64) is selected at runtime. Each instruction set
+// produces the same samples as the scalar reference. `--bench kernels` verifies it, and measures the speed.
+//
+// A planar buffer holds one channel after another, `stride` samples apart.
+class BufferKernels final {
+  public:
+    enum class Isa { Scalar, Sse2, Avx2, Avx512, Neon };
+    enum class SampleFormat { Float32, Int16, Int24, Int32 };
 
-    static constexpr unsigned next(const unsigned i) { return (i + 1) % Capacity; }
+    // TPDF dither of +-1 LSB. The samples take the 16 xorshift32 states in turn, one each, and a SIMD kernel steps as
+    // many consecutive states at once as it has lanes. So the dithered samples don't depend on the instruction set.
+    struct Dither {
+        static constexpr size_t NumLanes = 16;
 
-  public:
-    SpscQueue()                             = default; // NOLINT(*-pro-type-member-init)
-    SpscQueue(const SpscQueue &)            = delete;
-    SpscQueue &operator=(const SpscQueue &) = delete;
+        alignas(64) std::array<uint32_t, NumLanes> lanes{};
+        size_t next = 0; // State of the next sample
 
-    ~SpscQueue() {
-        if constexpr (!std::is_trivially_destructible_v<T>) {
-            const unsigned end = writeIndex_.load(std::memory_order_relaxed);
-            for (unsigned i = readIndex_.load(std::memory_order_relaxed); i != end; i = next(i)) {
-                std::destroy_at(std::launder(reinterpret_cast<T *>(items_[i].storage)));
+        explicit Dither(const uint32_t seed = 0x9e3779b9u) {
+            for (size_t i = 0; i < lanes.size(); ++i) {
+                lanes[i] = seed * static_cast<uint32_t>(2 * i + 1) | 1u; // xorshift32 requires a non-zero state
             }
         }
+
+        // Returns the states of the next `count` samples, and moves past them. `next` is a multiple of `count`.
+        uint32_t *take(const size_t count) {
+            uint32_t *p = lanes.data() + next;
+            next        = (next + count) % NumLanes;
+            return p;
+        }
+    };
+
+    using InterleaveFunc   = void (*)(float *dst, const float *src, size_t stride, unsigned nChannels, unsigned n);
+    using DeinterleaveFunc = void (*)(float *dst, size_t stride, const float *src, unsigned nChannels, unsigned n);
+    using MixFunc          = void (*)(float *dst, const float *src, size_t n, float gain);
+    using ToIntFunc        = void (*)(void *dst, const float *src, size_t n, Dither *dither);
+
+    struct Table {
+        Isa              isa;
+        const char      *name;
+        InterleaveFunc   interleave;   // Planar -> interleaved
+        DeinterleaveFunc deinterleave; // Interleaved -> planar
+        MixFunc          mix;          // dst[i] += src[i] * gain
+        ToIntFunc        toInt16;      // dither == nullptr : No dither
+        ToIntFunc        toInt24;      // Packed little endian 24-bit
+        ToIntFunc        toInt32;
+    };
+
+    // Tables which this CPU can run, from the scalar reference to the best one.
+    static std::span<const Table> getAvailable() {
+        static const std::vector<Table> tables = detect();
+        return tables;
     }
 
-    [[nodiscard]] bool push(const T &t) {
-        const unsigned currentWriteIndex = writeIndex_.load(std::memory_order_relaxed);
-        const unsigned nextWriteIndex    = next(currentWriteIndex);
-        // false : queue is full
-        if (nextWriteIndex == readIndex_.load(std::memory_order_acquire)) [[unlikely]] {
-            return false;
+    // The best table for this CPU
+    static const Table &get() { return getAvailable().back(); }
+
+    [[nodiscard]] static unsigned getBytesPerSample(const SampleFormat format) {
+        switch (format) {
+        case SampleFormat::Int16:
+            return 2;
+        case SampleFormat::Int24:
+            return 3;
+        default:
+            return 4;
         }
-        new (items_[currentWriteIndex].storage) T(t);
-        writeIndex_.store(nextWriteIndex, std::memory_order_release);
-        return true;
     }
 
-    [[nodiscard]] bool pop(T &item) {
-        const unsigned currentReadIndex = readIndex_.load(std::memory_order_relaxed);
-        // false : queue is empty
-        if (currentReadIndex == writeIndex_.load(std::memory_order_acquire)) [[unlikely]] {
-            return false;
+    // Converts n float samples into the given format with the best table.
+    static void convert(void *dst, const float *src, const size_t n, const SampleFormat format, Dither *dither) {
+        const Table &t = get();
+        switch (format) {
+        case SampleFormat::Float32:
+            std::memcpy(dst, src, n * sizeof(float));
+            break;
+        case SampleFormat::Int16:
+            t.toInt16(dst, src, n, dither);
+            break;
+        case SampleFormat::Int24:
+            t.toInt24(dst, src, n, dither);
+            break;
+        case SampleFormat::Int32:
+            t.toInt32(dst, src, n, dither);
+            break;
         }
-        T *p = std::launder(reinterpret_cast<T *>(items_[currentReadIndex].storage));
-        item = std::move(*p);
-        std::destroy_at(p);
-        readIndex_.store(next(currentReadIndex), std::memory_order_release);
-        return true;
     }
 
   private:
-    AlignedStorage items_[Capacity];
-    alignas(FalseSharingSize) std::atomic<unsigned> readIndex_  = 0;
-    alignas(FalseSharingSize) std::atomic<unsigned> writeIndex_ = 0;
-}; // class SpscQueue
-#ifdef _MSC_VER
-#pragma warning(pop)
-#endif
+    // Scale and clamping range of the integer formats. The upper limit of Int32 is the largest float below 2^31.
+    struct PcmRange {
+        float scale;
+        float lo;
+        float hi;
+    };
 
-// Host Interface
-class MyHost : public Steinberg::Vst::IHostApplication {
-  public:
-    MyHost()          = default;
-    virtual ~MyHost() = default;
+    static constexpr PcmRange pcmRange(const SampleFormat format) {
+        switch (format) {
+        case SampleFormat::Int16:
+            return {32768.0f, -32768.0f, 32767.0f};
+        case SampleFormat::Int24:
+            return {8388608.0f, -8388608.0f, 8388607.0f};
+        default:
+            return {2147483648.0f, -2147483648.0f, 2147483520.0f};
+        }
+    }
 
-  private:
-    uint32_t PLUGIN_API           addRef() override { return 1; }
-    uint32_t PLUGIN_API           release() override { return 1; }
-    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
-        if (Steinberg::FUnknownPrivate::iidEqual(tuid, FUnknown::iid) ||
-            Steinberg::FUnknownPrivate::iidEqual(tuid, IHostApplication::iid)) {
-            *obj = static_cast<IHostApplication *>(this);
-            return Steinberg::kResultOk;
+    static std::vector<Table> detect() {
+        std::vector<Table> tables{{Isa::Scalar, "scalar", interleaveScalar, deinterleaveScalar, mixScalar,
+                                   toIntScalar<SampleFormat::Int16>, toIntScalar<SampleFormat::Int24>,
+                                   toIntScalar<SampleFormat::Int32>}};
+#if MY_ARCH_X86
+        if (cpuSupports(Isa::Sse2)) {
+            tables.push_back({Isa::Sse2, "sse2", interleaveSse2, deinterleaveSse2, mixSse2,
+                              toIntSse2<SampleFormat::Int16>, toIntSse2<SampleFormat::Int24>,
+                              toIntSse2<SampleFormat::Int32>});
         }
-        *obj = nullptr;
-        return Steinberg::kNoInterface;
+        if (cpuSupports(Isa::Avx2)) {
+            tables.push_back({Isa::Avx2, "avx2", interleaveAvx2, deinterleaveAvx2, mixAvx2,
+                              toIntAvx2<SampleFormat::Int16>, toIntAvx2<SampleFormat::Int24>,
+                              toIntAvx2<SampleFormat::Int32>});
+        }
+        if (cpuSupports(Isa::Avx512)) {
+            // Interleaving is bound by the memory access, and AVX2 already saturates it. The 24-bit packing needs a
+            // byte shuffle, which AVX-512F lacks, so the AVX2 kernel is faster.
+            tables.push_back({Isa::Avx512, "avx512", interleaveAvx2, deinterleaveAvx2, mixAvx512,
+                              toIntAvx512<SampleFormat::Int16>, toIntAvx2<SampleFormat::Int24>,
+                              toIntAvx512<SampleFormat::Int32>});
+        }
+#elif MY_ARCH_ARM64
+        tables.push_back({Isa::Neon, "neon", interleaveNeon, deinterleaveNeon, mixNeon, toIntNeon<SampleFormat::Int16>,
+                          toIntNeon<SampleFormat::Int24>, toIntNeon<SampleFormat::Int32>});
+#endif
+        return tables;
     }
 
-    Steinberg::tresult PLUGIN_API getName(Steinberg::Vst::String128 name) override {
-        _snwprintf_s(reinterpret_cast<wchar_t *>(name), 127, 127, L"Minimal VST3 Host");
-        return Steinberg::kResultTrue;
+    // Scalar reference
+
+    static uint32_t xorshift32(uint32_t &s) {
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        return s;
     }
 
-    Steinberg::tresult PLUGIN_API createInstance(Steinberg::TUID, Steinberg::TUID, void **) override {
-        return Steinberg::kResultFalse;
+    // Triangular distribution in (-1, +1), as the difference of two 16-bit uniform random numbers.
+    static float tpdf(uint32_t &s) {
+        const uint32_t x = xorshift32(s);
+        return static_cast<float>(static_cast<int32_t>(x & 0xffff) - static_cast<int32_t>(x >> 16)) *
+               (1.0f / 65536.0f);
     }
-}; // class MyHost
 
-// Component Handler Interface
-class MyComponentHandler : public Steinberg::Vst::IComponentHandler {
-  public:
-    MyComponentHandler()          = default;
-    virtual ~MyComponentHandler() = default;
+    template <unsigned NumChannels>
+    static void interleaveFixed(float *dst, const float *src, const size_t stride, const unsigned begin,
+                                const unsigned end) {
+        for (unsigned iSample = begin; iSample < end; ++iSample) {
+            for (unsigned iChannel = 0; iChannel < NumChannels; ++iChannel) {
+                dst[iSample * NumChannels + iChannel] = src[iChannel * stride + iSample];
+            }
+        }
+    }
 
-  private:
-    uint32_t PLUGIN_API           addRef() override { return 1; }
-    uint32_t PLUGIN_API           release() override { return 1; }
-    Steinberg::tresult PLUGIN_API beginEdit(Steinberg::Vst::ParamID) override { return Steinberg::kResultOk; }
-    Steinberg::tresult PLUGIN_API endEdit(Steinberg::Vst::ParamID) override { return Steinberg::kResultOk; }
-    Steinberg::tresult PLUGIN_API restartComponent(int32_t) override { return Steinberg::kResultOk; }
-    Steinberg::tresult PLUGIN_API performEdit(Steinberg::Vst::ParamID, Steinberg::Vst::ParamValue) override {
-        return Steinberg::kResultOk;
+    template <unsigned NumChannels>
+    static void deinterleaveFixed(float *dst, const size_t stride, const float *src, const unsigned begin,
+                                  const unsigned end) {
+        for (unsigned iSample = begin; iSample < end; ++iSample) {
+            for (unsigned iChannel = 0; iChannel < NumChannels; ++iChannel) {
+                dst[iChannel * stride + iSample] = src[iSample * NumChannels + iChannel];
+            }
+        }
     }
 
-    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
-        if (Steinberg::FUnknownPrivate::iidEqual(tuid, IComponentHandler::iid)) {
-            *obj = static_cast<IComponentHandler *>(this);
-            return Steinberg::kResultOk;
+    // Converts the samples [begin, end). The SIMD kernels use it for the remainder.
+    static void interleaveRange(float *dst, const float *src, const size_t stride, const unsigned nChannels,
+                                const unsigned begin, const unsigned end) {
+        switch (nChannels) {
+        case 1:
+            std::copy(src + begin, src + end, dst + begin);
+            break;
+        case 2:
+            interleaveFixed<2>(dst, src, stride, begin, end);
+            break;
+        case 3:
+            interleaveFixed<3>(dst, src, stride, begin, end);
+            break;
+        case 4:
+            interleaveFixed<4>(dst, src, stride, begin, end);
+            break;
+        case 5:
+            interleaveFixed<5>(dst, src, stride, begin, end);
+            break;
+        case 6:
+            interleaveFixed<6>(dst, src, stride, begin, end);
+            break;
+        case 7:
+            interleaveFixed<7>(dst, src, stride, begin, end);
+            break;
+        case 8:
+            interleaveFixed<8>(dst, src, stride, begin, end);
+            break;
+        default:
+            for (unsigned iSample = begin; iSample < end; ++iSample) {
+                for (unsigned iChannel = 0; iChannel < nChannels; ++iChannel) {
+                    dst[iSample * nChannels + iChannel] = src[iChannel * stride + iSample];
+                }
+            }
+            break;
         }
-        *obj = nullptr;
-        return Steinberg::kNoInterface;
     }
-}; // class MyComponentHandler
 
-// Plugin GUI Frame Interface
-class MyPlugFrame : public Steinberg::IPlugFrame {
-  public:
-    MyPlugFrame()          = default;
-    virtual ~MyPlugFrame() = default;
-    std::function<Steinberg::tresult(Steinberg::IPlugView *view, Steinberg::ViewRect *newSize)> resizeViewCallback_;
+    static void deinterleaveRange(float *dst, const size_t stride, const float *src, const unsigned nChannels,
+                                  const unsigned begin, const unsigned end) {
+        switch (nChannels) {
+        case 1:
+            std::copy(src + begin, src + end, dst + begin);
+            break;
+        case 2:
+            deinterleaveFixed<2>(dst, stride, src, begin, end);
+            break;
+        case 3:
+            deinterleaveFixed<3>(dst, stride, src, begin, end);
+            break;
+        case 4:
+            deinterleaveFixed<4>(dst, stride, src, begin, end);
+            break;
+        case 5:
+            deinterleaveFixed<5>(dst, stride, src, begin, end);
+            break;
+        case 6:
+            deinterleaveFixed<6>(dst, stride, src, begin, end);
+            break;
+        case 7:
+            deinterleaveFixed<7>(dst, stride, src, begin, end);
+            break;
+        case 8:
+            deinterleaveFixed<8>(dst, stride, src, begin, end);
+            break;
+        default:
+            for (unsigned iSample = begin; iSample < end; ++iSample) {
+                for (unsigned iChannel = 0; iChannel < nChannels; ++iChannel) {
+                    dst[iChannel * stride + iSample] = src[iSample * nChannels + iChannel];
+                }
+            }
+            break;
+        }
+    }
 
-  private:
-    uint32_t PLUGIN_API           addRef() override { return 1; }
-    uint32_t PLUGIN_API           release() override { return 1; }
-    Steinberg::tresult PLUGIN_API resizeView(Steinberg::IPlugView *view, Steinberg::ViewRect *newSize) override {
-        return resizeViewCallback_ ? resizeViewCallback_(view, newSize) : Steinberg::kResultFalse;
+    static void interleaveScalar(float *dst, const float *src, const size_t stride, const unsigned nChannels,
+                                 const unsigned nSamples) {
+        interleaveRange(dst, src, stride, nChannels, 0, nSamples);
     }
 
-    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
-        if (Steinberg::FUnknownPrivate::iidEqual(tuid, IPlugFrame::iid)) {
-            *obj = static_cast<IPlugFrame *>(this);
-            return Steinberg::kResultOk;
+    static void deinterleaveScalar(float *dst, const size_t stride, const float *src, const unsigned nChannels,
+                                   const unsigned nSamples) {
+        deinterleaveRange(dst, stride, src, nChannels, 0, nSamples);
+    }
+
+    static void mixRange(float *dst, const float *src, const size_t begin, const size_t end, const float gain) {
+        for (size_t i = begin; i < end; ++i) {
+            dst[i] = dst[i] + src[i] * gain;
         }
-        *obj = nullptr;
-        return Steinberg::kNoInterface;
     }
-}; // class MyPlugFrame
 
-// Wrapper for the Plugin DLL
-class Vst3Dll final {
-  public:
-    Vst3Dll()                           = default;
-    Vst3Dll(const Vst3Dll &)            = delete;
-    Vst3Dll &operator=(const Vst3Dll &) = delete;
-    ~Vst3Dll() { free(); }
+    static void mixScalar(float *dst, const float *src, const size_t n, const float gain) {
+        mixRange(dst, src, 0, n, gain);
+    }
 
-    Steinberg::IPluginFactory *load(const std::filesystem::path &dllPath) {
-        free();
-        if (hModule_ = LoadLibraryW(dllPath.c_str()); !hModule_) {
-            MY_ERROR(L"LoadLibraryW(%s)\n", dllPath.c_str());
-            return nullptr;
-        } else if (const auto p = GetProcAddress(hModule_, "GetPluginFactory"); !p) {
-            MY_ERROR(L"GetProcAddress('GetPluginFactory'), %s\n", dllPath.c_str());
-            return nullptr;
+    // Stores a quantized sample. Int24 is packed into 3 bytes, little endian.
+    template <SampleFormat Format> static void storePcm(void *dst, const size_t i, const int32_t q) {
+        if constexpr (Format == SampleFormat::Int16) {
+            static_cast<int16_t *>(dst)[i] = static_cast<int16_t>(q);
+        } else if constexpr (Format == SampleFormat::Int24) {
+            uint8_t *p = static_cast<uint8_t *>(dst) + i * 3;
+            p[0]       = static_cast<uint8_t>(q);
+            p[1]       = static_cast<uint8_t>(q >> 8);
+            p[2]       = static_cast<uint8_t>(q >> 16);
         } else {
-            using GetPluginFactoryProc  = Steinberg::IPluginFactory *(PLUGIN_API *)();
-            const auto getPluginFactory = reinterpret_cast<GetPluginFactoryProc>(reinterpret_cast<void *>(p));
-            return getPluginFactory();
+            static_cast<int32_t *>(dst)[i] = q;
         }
     }
 
-  private:
-    void free() {
-        if (hModule_) {
-            FreeLibrary(std::exchange(hModule_, nullptr));
+    // Scales, dithers, clamps and rounds to nearest even. The clamping order matches MAXPS / MINPS, so NaN -> lo.
+    template <SampleFormat Format>
+    static void toIntRange(void *dst, const float *src, const size_t begin, const size_t end, Dither *dither) {
+        constexpr PcmRange r = pcmRange(Format);
+        for (size_t i = begin; i < end; ++i) {
+            float v = src[i] * r.scale;
+            if (dither) {
+                v = v + tpdf(*dither->take(1));
+            }
+            v = v > r.lo ? v : r.lo;
+            v = v < r.hi ? v : r.hi;
+            storePcm<Format>(dst, i, static_cast<int32_t>(std::lrint(v)));
         }
     }
 
-    HMODULE hModule_ = nullptr;
-}; // class Vst3Dll
+    template <SampleFormat Format> static constexpr size_t int24Guard() {
+        return Format == SampleFormat::Int24 ? 1 : 0;
+    }
 
-// Class that holds the plugin and manages audio processing and GUI
-class Vst3Plugin final {
-  public:
-    struct InitParams {
-        unsigned                          index;
-        std::filesystem::path             pluginPath;
-        Steinberg::Vst::IHostApplication *hostApplication;
-        int                               bufferSize;
-        double                            sampleRate;
-    };
+    // Number of samples which a SIMD kernel of `width` lanes converts one by one first, so that its lanes take the
+    // dither states from a multiple of `width`
+    static size_t ditherLead(const Dither *dither, const size_t width, const size_t n) {
+        return dither ? std::min(n, (width - dither->next % width) % width) : 0;
+    }
 
-    struct ProcessArgs {
-        std::span<float *>          vstInChannelPtrs;
-        std::span<float *>          vstOutChannelPtrs;
-        unsigned                    nSamples;
-        double                      sampleRate;
-        double                      tempo;
-        Steinberg::Vst::IEventList *inputEvents;
-        Steinberg::Vst::IEventList *outputEvents;
-        double                      ppqPosition;
+    // Packs the quantized samples of a SIMD register into 3 bytes each, with overlapping 4-byte stores (little endian).
+    // The last store writes one byte past them, so the caller leaves at least one sample to the remainder loop.
+    template <size_t NumLanes> static void storeInt24Lanes(void *dst, const size_t i, const int32_t (&q)[NumLanes]) {
+        uint8_t *p = static_cast<uint8_t *>(dst) + i * 3;
+        for (size_t k = 0; k < NumLanes; ++k) {
+            std::memcpy(p + k * 3, &q[k], 4);
+        }
+    }
+
+    template <SampleFormat Format>
+    static void toIntScalar(void *dst, const float *src, const size_t n, Dither *dither) {
+        toIntRange<Format>(dst, src, 0, n, dither);
+    }
+
+#if MY_ARCH_X86
+    static MY_TARGET("xsave") bool cpuSupports(const Isa isa) {
+#if defined(_MSC_VER) // cl, clang-cl
+        int r1[4] = {};
+        int r7[4] = {};
+        __cpuid(r1, 0);
+        const int maxLeaf = r1[0];
+        __cpuid(r1, 1);
+        if (maxLeaf >= 7) {
+            __cpuidex(r7, 7, 0);
+        }
+        const bool     osxsave = (r1[2] >> 27) & 1;
+        const uint64_t xcr0    = osxsave ? _xgetbv(0) : 0;
+        switch (isa) {
+        case Isa::Sse2:
+            return (r1[3] >> 26) & 1;
+        case Isa::Avx2:
+            return (xcr0 & 0x06) == 0x06 && ((r7[1] >> 5) & 1);
+        case Isa::Avx512:
+            return (xcr0 & 0xe6) == 0xe6 && ((r7[1] >> 16) & 1);
+        default:
+            return false;
+        }
+#else
+        __builtin_cpu_init();
+        switch (isa) {
+        case Isa::Sse2:
+            return __builtin_cpu_supports("sse2");
+        case Isa::Avx2:
+            return __builtin_cpu_supports("avx2");
+        case Isa::Avx512:
+            return __builtin_cpu_supports("avx512f");
+        default:
+            return false;
+        }
+#endif
+    }
+
+    // SSE2
+
+    static MY_TARGET("sse2") __m128 tpdfSse2(__m128i &s) {
+        s               = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+        s               = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+        s               = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+        const __m128i d = _mm_sub_epi32(_mm_and_si128(s, _mm_set1_epi32(0xffff)), _mm_srli_epi32(s, 16));
+        return _mm_mul_ps(_mm_cvtepi32_ps(d), _mm_set1_ps(1.0f / 65536.0f));
+    }
+
+    static MY_TARGET("sse2") void interleaveSse2(float *dst, const float *src, const size_t stride,
+                                                 const unsigned nChannels, const unsigned nSamples) {
+        unsigned s = 0;
+        if (nChannels == 2) {
+            for (; s + 4 <= nSamples; s += 4) {
+                const __m128 l = _mm_loadu_ps(src + s);
+                const __m128 r = _mm_loadu_ps(src + stride + s);
+                _mm_storeu_ps(dst + s * 2, _mm_unpacklo_ps(l, r));
+                _mm_storeu_ps(dst + s * 2 + 4, _mm_unpackhi_ps(l, r));
+            }
+        } else if (nChannels == 4 || nChannels == 8) {
+            // 4x4 transpose for each group of 4 channels
+            for (; s + 4 <= nSamples; s += 4) {
+                for (unsigned g = 0; g < nChannels; g += 4) {
+                    __m128 r0 = _mm_loadu_ps(src + (g + 0) * stride + s);
+                    __m128 r1 = _mm_loadu_ps(src + (g + 1) * stride + s);
+                    __m128 r2 = _mm_loadu_ps(src + (g + 2) * stride + s);
+                    __m128 r3 = _mm_loadu_ps(src + (g + 3) * stride + s);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(dst + (s + 0) * nChannels + g, r0);
+                    _mm_storeu_ps(dst + (s + 1) * nChannels + g, r1);
+                    _mm_storeu_ps(dst + (s + 2) * nChannels + g, r2);
+                    _mm_storeu_ps(dst + (s + 3) * nChannels + g, r3);
+                }
+            }
+        }
+        interleaveRange(dst, src, stride, nChannels, s, nSamples);
+    }
+
+    static MY_TARGET("sse2") void deinterleaveSse2(float *dst, const size_t stride, const float *src,
+                                                   const unsigned nChannels, const unsigned nSamples) {
+        unsigned s = 0;
+        if (nChannels == 2) {
+            for (; s + 4 <= nSamples; s += 4) {
+                const __m128 v0 = _mm_loadu_ps(src + s * 2);
+                const __m128 v1 = _mm_loadu_ps(src + s * 2 + 4);
+                _mm_storeu_ps(dst + s, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+                _mm_storeu_ps(dst + stride + s, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+            }
+        } else if (nChannels == 4 || nChannels == 8) {
+            for (; s + 4 <= nSamples; s += 4) {
+                for (unsigned g = 0; g < nChannels; g += 4) {
+                    __m128 r0 = _mm_loadu_ps(src + (s + 0) * nChannels + g);
+                    __m128 r1 = _mm_loadu_ps(src + (s + 1) * nChannels + g);
+                    __m128 r2 = _mm_loadu_ps(src + (s + 2) * nChannels + g);
+                    __m128 r3 = _mm_loadu_ps(src + (s + 3) * nChannels + g);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(dst + (g + 0) * stride + s, r0);
+                    _mm_storeu_ps(dst + (g + 1) * stride + s, r1);
+                    _mm_storeu_ps(dst + (g + 2) * stride + s, r2);
+                    _mm_storeu_ps(dst + (g + 3) * stride + s, r3);
+                }
+            }
+        }
+        deinterleaveRange(dst, stride, src, nChannels, s, nSamples);
+    }
+
+    static MY_TARGET("sse2") void mixSse2(float *dst, const float *src, const size_t n, const float gain) {
+        const __m128 g = _mm_set1_ps(gain);
+        size_t       i = 0;
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+        }
+        mixRange(dst, src, i, n, gain);
+    }
+
+    template <SampleFormat Format>
+    static MY_TARGET("sse2") void toIntSse2(void *dst, const float *src, const size_t n, Dither *dither) {
+        constexpr PcmRange r     = pcmRange(Format);
+        const __m128       scale = _mm_set1_ps(r.scale);
+        const __m128       lo    = _mm_set1_ps(r.lo);
+        const __m128       hi    = _mm_set1_ps(r.hi);
+        size_t             i     = ditherLead(dither, 4, n);
+        toIntRange<Format>(dst, src, 0, i, dither);
+        for (; i + 4 + int24Guard<Format>() <= n; i += 4) {
+            __m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+            if (dither) {
+                auto   *lanes = reinterpret_cast<__m128i *>(dither->take(4));
+                __m128i state = _mm_load_si128(lanes);
+                v             = _mm_add_ps(v, tpdfSse2(state));
+                _mm_store_si128(lanes, state);
+            }
+            const __m128i q = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, lo), hi));
+            if constexpr (Format == SampleFormat::Int16) {
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(static_cast<int16_t *>(dst) + i), _mm_packs_epi32(q, q));
+            } else if constexpr (Format == SampleFormat::Int24) {
+                alignas(16) int32_t tmp[4];
+                _mm_store_si128(reinterpret_cast<__m128i *>(tmp), q);
+                storeInt24Lanes(dst, i, tmp);
+            } else {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(static_cast<int32_t *>(dst) + i), q);
+            }
+        }
+        toIntRange<Format>(dst, src, i, n, dither);
+    }
+
+    // AVX2
+
+    static MY_TARGET("avx2") __m256 tpdfAvx2(__m256i &s) {
+        s               = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+        s               = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+        s               = _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+        const __m256i d = _mm256_sub_epi32(_mm256_and_si256(s, _mm256_set1_epi32(0xffff)), _mm256_srli_epi32(s, 16));
+        return _mm256_mul_ps(_mm256_cvtepi32_ps(d), _mm256_set1_ps(1.0f / 65536.0f));
+    }
+
+    static MY_TARGET("avx2") void interleaveAvx2(float *dst, const float *src, const size_t stride,
+                                                 const unsigned nChannels, const unsigned nSamples) {
+        if (nChannels != 2) {
+            return interleaveSse2(dst, src, stride, nChannels, nSamples);
+        }
+        unsigned s = 0;
+        for (; s + 8 <= nSamples; s += 8) {
+            const __m256 l  = _mm256_loadu_ps(src + s);
+            const __m256 r  = _mm256_loadu_ps(src + stride + s);
+            const __m256 lo = _mm256_unpacklo_ps(l, r); // L0 R0 L1 R1 | L4 R4 L5 R5
+            const __m256 hi = _mm256_unpackhi_ps(l, r); // L2 R2 L3 R3 | L6 R6 L7 R7
+            _mm256_storeu_ps(dst + s * 2, _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(dst + s * 2 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+        interleaveRange(dst, src, stride, nChannels, s, nSamples);
+    }
+
+    static MY_TARGET("avx2") void deinterleaveAvx2(float *dst, const size_t stride, const float *src,
+                                                   const unsigned nChannels, const unsigned nSamples) {
+        if (nChannels != 2) {
+            return deinterleaveSse2(dst, stride, src, nChannels, nSamples);
+        }
+        unsigned s = 0;
+        for (; s + 8 <= nSamples; s += 8) {
+            const __m256 v0 = _mm256_loadu_ps(src + s * 2);
+            const __m256 v1 = _mm256_loadu_ps(src + s * 2 + 8);
+            const __m256 t0 = _mm256_permute2f128_ps(v0, v1, 0x20); // L0 R0 L1 R1 | L4 R4 L5 R5
+            const __m256 t1 = _mm256_permute2f128_ps(v0, v1, 0x31); // L2 R2 L3 R3 | L6 R6 L7 R7
+            _mm256_storeu_ps(dst + s, _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm256_storeu_ps(dst + stride + s, _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        deinterleaveRange(dst, stride, src, nChannels, s, nSamples);
+    }
+
+    static MY_TARGET("avx2") void mixAvx2(float *dst, const float *src, const size_t n, const float gain) {
+        const __m256 g = _mm256_set1_ps(gain);
+        size_t       i = 0;
+        for (; i + 8 <= n; i += 8) {
+            _mm256_storeu_ps(dst + i,
+                             _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), g)));
+        }
+        mixRange(dst, src, i, n, gain);
+    }
+
+    template <SampleFormat Format>
+    static MY_TARGET("avx2") void toIntAvx2(void *dst, const float *src, const size_t n, Dither *dither) {
+        constexpr PcmRange r     = pcmRange(Format);
+        const __m256       scale = _mm256_set1_ps(r.scale);
+        const __m256       lo    = _mm256_set1_ps(r.lo);
+        const __m256       hi    = _mm256_set1_ps(r.hi);
+        size_t             i     = ditherLead(dither, 8, n);
+        toIntRange<Format>(dst, src, 0, i, dither);
+        for (; i + 8 <= n; i += 8) {
+            __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+            if (dither) {
+                auto   *lanes = reinterpret_cast<__m256i *>(dither->take(8));
+                __m256i state = _mm256_load_si256(lanes);
+                v             = _mm256_add_ps(v, tpdfAvx2(state));
+                _mm256_store_si256(lanes, state);
+            }
+            const __m256i q = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, lo), hi));
+            if constexpr (Format == SampleFormat::Int16) {
+                // packs works within the 128-bit lanes. Gather the two halves into the low lane.
+                const __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(q, q), _MM_SHUFFLE(3, 1, 2, 0));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(static_cast<int16_t *>(dst) + i),
+                                 _mm256_castsi256_si128(p));
+            } else if constexpr (Format == SampleFormat::Int24) {
+                // The low 3 bytes of each sample are packed within each 128-bit lane, followed by 4 zero bytes. The
+                // zero bytes of the first lane are overwritten by the second, so exactly 24 bytes are written.
+                const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, //
+                                                      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+                const __m256i p    = _mm256_shuffle_epi8(q, pack);
+                const __m128i h    = _mm256_extracti128_si256(p, 1);
+                const int32_t t    = _mm_cvtsi128_si32(_mm_srli_si128(h, 8));
+                uint8_t      *d    = static_cast<uint8_t *>(dst) + i * 3;
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(d), _mm256_castsi256_si128(p));
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(d + 12), h);
+                std::memcpy(d + 20, &t, 4);
+            } else {
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(static_cast<int32_t *>(dst) + i), q);
+            }
+        }
+        toIntRange<Format>(dst, src, i, n, dither);
+    }
+
+    // AVX-512
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized" // False positive of _mm512_undefined_*() in GCC 12
+#endif
+    static MY_TARGET("avx512f") __m512 tpdfAvx512(__m512i &s) {
+        s               = _mm512_xor_si512(s, _mm512_slli_epi32(s, 13));
+        s               = _mm512_xor_si512(s, _mm512_srli_epi32(s, 17));
+        s               = _mm512_xor_si512(s, _mm512_slli_epi32(s, 5));
+        const __m512i d = _mm512_sub_epi32(_mm512_and_si512(s, _mm512_set1_epi32(0xffff)), _mm512_srli_epi32(s, 16));
+        return _mm512_mul_ps(_mm512_cvtepi32_ps(d), _mm512_set1_ps(1.0f / 65536.0f));
+    }
+
+    static MY_TARGET("avx512f") void mixAvx512(float *dst, const float *src, const size_t n, const float gain) {
+        const __m512 g = _mm512_set1_ps(gain);
+        size_t       i = 0;
+        for (; i + 16 <= n; i += 16) {
+            _mm512_storeu_ps(dst + i,
+                             _mm512_add_ps(_mm512_loadu_ps(dst + i), _mm512_mul_ps(_mm512_loadu_ps(src + i), g)));
+        }
+        mixRange(dst, src, i, n, gain);
+    }
+
+    template <SampleFormat Format>
+    static MY_TARGET("avx512f") void toIntAvx512(void *dst, const float *src, const size_t n, Dither *dither) {
+        static_assert(Format != SampleFormat::Int24, "24-bit samples are packed by toIntAvx2");
+        constexpr PcmRange r     = pcmRange(Format);
+        const __m512       scale = _mm512_set1_ps(r.scale);
+        const __m512       lo    = _mm512_set1_ps(r.lo);
+        const __m512       hi    = _mm512_set1_ps(r.hi);
+        size_t             i     = ditherLead(dither, 16, n);
+        toIntRange<Format>(dst, src, 0, i, dither);
+        for (; i + 16 <= n; i += 16) {
+            __m512 v = _mm512_mul_ps(_mm512_loadu_ps(src + i), scale);
+            if (dither) {
+                uint32_t *lanes = dither->take(16);
+                __m512i   state = _mm512_load_si512(lanes);
+                v               = _mm512_add_ps(v, tpdfAvx512(state));
+                _mm512_store_si512(lanes, state);
+            }
+            const __m512i q = _mm512_cvtps_epi32(_mm512_min_ps(_mm512_max_ps(v, lo), hi));
+            if constexpr (Format == SampleFormat::Int16) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(static_cast<int16_t *>(dst) + i),
+                                    _mm512_cvtsepi32_epi16(q));
+            } else {
+                _mm512_storeu_si512(static_cast<int32_t *>(dst) + i, q);
+            }
+        }
+        toIntRange<Format>(dst, src, i, n, dither);
+    }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // MY_ARCH_X86
+
+#if MY_ARCH_ARM64
+    static float32x4_t tpdfNeon(uint32x4_t &s) {
+        s                 = veorq_u32(s, vshlq_n_u32(s, 13));
+        s                 = veorq_u32(s, vshrq_n_u32(s, 17));
+        s                 = veorq_u32(s, vshlq_n_u32(s, 5));
+        const int32x4_t d = vsubq_s32(vreinterpretq_s32_u32(vandq_u32(s, vdupq_n_u32(0xffff))),
+                                      vreinterpretq_s32_u32(vshrq_n_u32(s, 16)));
+        return vmulq_n_f32(vcvtq_f32_s32(d), 1.0f / 65536.0f);
+    }
+
+    static void interleaveNeon(float *dst, const float *src, const size_t stride, const unsigned nChannels,
+                               const unsigned nSamples) {
+        unsigned s = 0;
+        if (nChannels == 2) {
+            for (; s + 4 <= nSamples; s += 4) {
+                vst2q_f32(dst + s * 2, (float32x4x2_t{{vld1q_f32(src + s), vld1q_f32(src + stride + s)}}));
+            }
+        } else if (nChannels == 3) {
+            for (; s + 4 <= nSamples; s += 4) {
+                vst3q_f32(dst + s * 3, (float32x4x3_t{{vld1q_f32(src + s), vld1q_f32(src + stride + s),
+                                                       vld1q_f32(src + stride * 2 + s)}}));
+            }
+        } else if (nChannels == 4) {
+            for (; s + 4 <= nSamples; s += 4) {
+                vst4q_f32(dst + s * 4, (float32x4x4_t{{vld1q_f32(src + s), vld1q_f32(src + stride + s),
+                                                       vld1q_f32(src + stride * 2 + s),
+                                                       vld1q_f32(src + stride * 3 + s)}}));
+            }
+        }
+        interleaveRange(dst, src, stride, nChannels, s, nSamples);
+    }
+
+    static void deinterleaveNeon(float *dst, const size_t stride, const float *src, const unsigned nChannels,
+                                 const unsigned nSamples) {
+        unsigned s = 0;
+        if (nChannels == 2) {
+            for (; s + 4 <= nSamples; s += 4) {
+                const float32x4x2_t v = vld2q_f32(src + s * 2);
+                vst1q_f32(dst + s, v.val[0]);
+                vst1q_f32(dst + stride + s, v.val[1]);
+            }
+        } else if (nChannels == 3) {
+            for (; s + 4 <= nSamples; s += 4) {
+                const float32x4x3_t v = vld3q_f32(src + s * 3);
+                for (unsigned c = 0; c < 3; ++c) {
+                    vst1q_f32(dst + stride * c + s, v.val[c]);
+                }
+            }
+        } else if (nChannels == 4) {
+            for (; s + 4 <= nSamples; s += 4) {
+                const float32x4x4_t v = vld4q_f32(src + s * 4);
+                for (unsigned c = 0; c < 4; ++c) {
+                    vst1q_f32(dst + stride * c + s, v.val[c]);
+                }
+            }
+        }
+        deinterleaveRange(dst, stride, src, nChannels, s, nSamples);
+    }
+
+    static void mixNeon(float *dst, const float *src, const size_t n, const float gain) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), vmulq_n_f32(vld1q_f32(src + i), gain)));
+        }
+        mixRange(dst, src, i, n, gain);
+    }
+
+    template <SampleFormat Format> static void toIntNeon(void *dst, const float *src, const size_t n, Dither *dither) {
+        constexpr PcmRange r     = pcmRange(Format);
+        const float32x4_t  lo    = vdupq_n_f32(r.lo);
+        const float32x4_t  hi    = vdupq_n_f32(r.hi);
+        size_t             i     = ditherLead(dither, 4, n);
+        toIntRange<Format>(dst, src, 0, i, dither);
+        for (; i + 4 + int24Guard<Format>() <= n; i += 4) {
+            float32x4_t v = vmulq_n_f32(vld1q_f32(src + i), r.scale);
+            if (dither) {
+                uint32_t  *lanes = dither->take(4);
+                uint32x4_t state = vld1q_u32(lanes);
+                v                = vaddq_f32(v, tpdfNeon(state));
+                vst1q_u32(lanes, state);
+            }
+            // FMAXNM / FMINNM return the number for NaN, as MAXPS / MINPS do.
+            const int32x4_t q = vcvtnq_s32_f32(vminnmq_f32(vmaxnmq_f32(v, lo), hi));
+            if constexpr (Format == SampleFormat::Int16) {
+                vst1_s16(static_cast<int16_t *>(dst) + i, vqmovn_s32(q));
+            } else if constexpr (Format == SampleFormat::Int24) {
+                int32_t tmp[4];
+                vst1q_s32(tmp, q);
+                storeInt24Lanes(dst, i, tmp);
+            } else {
+                vst1q_s32(static_cast<int32_t *>(dst) + i, q);
+            }
+        }
+        toIntRange<Format>(dst, src, i, n, dither);
+    }
+#endif // MY_ARCH_ARM64
+}; // class BufferKernels
+
+// Minimal RIFF/WAVE writer (32-bit IEEE float or 16/24/32-bit PCM, interleaved). Chunk sizes are patched in close().
+class WavFileWriter final {
+  public:
+    WavFileWriter()                                 = default;
+    WavFileWriter(const WavFileWriter &)            = delete;
+    WavFileWriter &operator=(const WavFileWriter &) = delete;
+    ~WavFileWriter() { close(); }
+
+    [[nodiscard]] bool good() const { return ofs_.is_open() && ofs_.good(); }
+
+    bool open(const std::filesystem::path &path, const unsigned nChannels, const double sampleRate,
+              const BufferKernels::SampleFormat sampleFormat = BufferKernels::SampleFormat::Float32,
+              const bool                        dither       = false) {
+        close();
+        if (ofs_.open(path, std::ios::binary | std::ios::trunc); !ofs_) {
+            MY_ERROR(L"Failed to open \"%ls\"\n", path.wstring().c_str());
+            return false;
+        }
+        nChannels_    = nChannels;
+        sampleRate_   = static_cast<uint32_t>(sampleRate);
+        sampleFormat_ = sampleFormat;
+        dither_       = dither && sampleFormat != BufferKernels::SampleFormat::Float32;
+        dataBytes_    = 0;
+        writeHeader();
+        return good();
+    }
+
+    bool write(const std::span<const float> interleavedBuf) {
+        const char *data   = reinterpret_cast<const char *>(interleavedBuf.data());
+        auto        nBytes = static_cast<std::streamsize>(interleavedBuf.size_bytes());
+        if (sampleFormat_ != BufferKernels::SampleFormat::Float32) {
+            convertBuf_.resize(interleavedBuf.size() * BufferKernels::getBytesPerSample(sampleFormat_));
+            BufferKernels::convert(convertBuf_.data(), interleavedBuf.data(), interleavedBuf.size(), sampleFormat_,
+                                   dither_ ? &ditherState_ : nullptr);
+            data   = convertBuf_.data();
+            nBytes = static_cast<std::streamsize>(convertBuf_.size());
+        }
+        ofs_.write(data, nBytes);
+        dataBytes_ += static_cast<uint64_t>(nBytes);
+        return good();
+    }
+
+    void close() {
+        if (ofs_.is_open()) {
+            ofs_.seekp(0);
+            writeHeader();
+            ofs_.close();
+        }
+    }
+
+  private:
+    void writeHeader() {
+        const bool     isFloat       = sampleFormat_ == BufferKernels::SampleFormat::Float32;
+        const uint16_t formatTag     = isFloat ? 3 : 1; // WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM
+        const auto     bitsPerSample = static_cast<uint16_t>(BufferKernels::getBytesPerSample(sampleFormat_) * 8);
+        const auto     blockAlign    = static_cast<uint16_t>(nChannels_ * bitsPerSample / 8);
+        const auto     dataBytes     = static_cast<uint32_t>(std::min<uint64_t>(dataBytes_, 0xffffffffu - 36));
+        const auto     put32         = [&](const uint32_t v) { ofs_.write(reinterpret_cast<const char *>(&v), 4); };
+        const auto     put16         = [&](const uint16_t v) { ofs_.write(reinterpret_cast<const char *>(&v), 2); };
+        ofs_.write("RIFF", 4);
+        put32(36 + dataBytes);
+        ofs_.write("WAVEfmt ", 8);
+        put32(16);
+        put16(formatTag);
+        put16(static_cast<uint16_t>(nChannels_));
+        put32(sampleRate_);
+        put32(sampleRate_ * blockAlign);
+        put16(blockAlign);
+        put16(bitsPerSample);
+        ofs_.write("data", 4);
+        put32(dataBytes);
+    }
+
+    std::ofstream               ofs_;
+    uint64_t                    dataBytes_    = 0;
+    uint32_t                    sampleRate_   = 0;
+    unsigned                    nChannels_    = 0;
+    BufferKernels::SampleFormat sampleFormat_ = BufferKernels::SampleFormat::Float32;
+    bool                        dither_       = false;
+    BufferKernels::Dither       ditherState_;
+    std::vector<char>           convertBuf_;
+}; // class WavFileWriter
+
+// Common part of the backends which don't need any audio device.
+// Blocks are either pumped as fast as possible, or paced by a software clock (std::chrono::steady_clock).
+class SoftwareBackend : public AudioBackend {
+  public:
+    struct Params {
+        double   sampleRate;
+        unsigned bufferSize;
+        unsigned nChannels;
+        double   seconds; // <= 0 : Runs until stop() is called
+    };
+
+    [[nodiscard]] bool     good() const override { return params_.sampleRate > 0 && params_.bufferSize > 0; }
+    [[nodiscard]] unsigned getBufferSize() const override { return params_.bufferSize; }
+    [[nodiscard]] unsigned getNumChannels() const override { return params_.nChannels; }
+    [[nodiscard]] double   getSampleRate() const override { return params_.sampleRate; }
+    [[nodiscard]] unsigned getOutputLatencyFrames() const override { return 0; }
+    [[nodiscard]] bool     isRealtime() const override { return paced_; }
+    void                   stop() override { stopRequested_.store(true, std::memory_order_release); }
+
+  protected:
+    SoftwareBackend(const Params &params, const bool paced)
+        : params_(params), paced_(paced), interleavedBuf_(static_cast<size_t>(params.bufferSize) * params.nChannels) {}
+
+    // Receives the rendered block. Returns false to stop the backend.
+    virtual bool consume(std::span<const float> interleavedBuf) = 0;
+    virtual void report(uint64_t nFrames, double elapsedSec) const {
+        const double renderedSec = static_cast<double>(nFrames) / params_.sampleRate;
+        const double safeElapsed = std::max(elapsedSec, 1e-9);
+        MY_TRACE(L"Rendered %llu frames (%.3f sec) in %.3f sec : %.0f frames/sec, realtime factor %.2fx\n",
+                 static_cast<unsigned long long>(nFrames), renderedSec, elapsedSec,
+                 static_cast<double>(nFrames) / safeElapsed, renderedSec / safeElapsed);
+    }
+
+    void audioThreadMain() override {
+        using Clock                = std::chrono::steady_clock;
+        const double totalSec      = std::max(params_.seconds, 0.0);
+        const auto   nTotalFrames  = static_cast<uint64_t>(std::llround(totalSec * params_.sampleRate));
+        const auto   blockDuration = std::chrono::duration<double>(params_.bufferSize / params_.sampleRate);
+        const auto   startTime     = Clock::now();
+        uint64_t     nFrames       = 0;
+        for (uint64_t iBlock = 0; !stopRequested_.load(std::memory_order_acquire); ++iBlock) {
+            if (nTotalFrames > 0 && nFrames >= nTotalFrames) {
+                break;
+            }
+            if (paced_) {
+                // Sleep until the next block is due, then spin for the last part to reduce the wake-up jitter.
+                const auto deadline = startTime + std::chrono::duration_cast<Clock::duration>(blockDuration * iBlock);
+                std::this_thread::sleep_until(deadline - std::chrono::microseconds(500));
+                while (Clock::now() < deadline) {
+                    std::this_thread::yield();
+                }
+                const double lateSec = std::chrono::duration<double>(Clock::now() - deadline).count();
+                jitterMaxSec_        = std::max(jitterMaxSec_, lateSec);
+                jitterSumSec_ += lateSec;
+                ++jitterCount_;
+            }
+            const auto nSamples =
+                nTotalFrames > 0 ? static_cast<unsigned>(std::min<uint64_t>(params_.bufferSize, nTotalFrames - nFrames))
+                                 : params_.bufferSize;
+            const RefillArgs refillArgs{
+                .interleavedBuf = std::span(interleavedBuf_.data(), static_cast<size_t>(nSamples) * params_.nChannels),
+                .sampleRate     = params_.sampleRate,
+                .nChannels      = params_.nChannels,
+                .nSamples       = nSamples,
+                .streamPosition = nFrames,
+            };
+            MY_TRACE_SPAN(callbackSpan, "callback");
+            if (refillFunc_) {
+                refillFunc_(refillArgs);
+            } else {
+                std::fill(refillArgs.interleavedBuf.begin(), refillArgs.interleavedBuf.end(), 0.0f);
+            }
+            MY_TRACE_END(callbackSpan);
+            MY_TRACE_SPAN(consumeSpan, "consume");
+            if (!consume(refillArgs.interleavedBuf)) {
+                break;
+            }
+            MY_TRACE_END(consumeSpan);
+            nFrames += nSamples;
+        }
+        report(nFrames, std::chrono::duration<double>(Clock::now() - startTime).count());
+    }
+
+    const Params       params_;
+    const bool         paced_;
+    std::vector<float> interleavedBuf_;
+    std::atomic<bool>  stopRequested_ = false;
+    double             jitterMaxSec_  = 0.0;
+    double             jitterSumSec_  = 0.0;
+    uint64_t           jitterCount_   = 0;
+}; // class SoftwareBackend
+
+// Discards the rendered blocks. Runs the plugin chain as fast as possible.
+class NullBackend final : public SoftwareBackend {
+  public:
+    explicit NullBackend(const Params &params) : SoftwareBackend(params, false) {}
+
+  protected:
+    bool consume(std::span<const float>) override { return true; }
+}; // class NullBackend
+
+// Writes the rendered blocks into a WAV file as fast as possible (offline render).
+class WavFileBackend final : public SoftwareBackend {
+  public:
+    WavFileBackend(const Params &params, const std::filesystem::path &wavPath,
+                   const BufferKernels::SampleFormat sampleFormat, const bool dither)
+        : SoftwareBackend(params, false), wavPath_(wavPath) {
+        wavFileWriter_.open(wavPath_, params.nChannels, params.sampleRate, sampleFormat, dither);
+    }
+
+    [[nodiscard]] bool good() const override {
+        return SoftwareBackend::good() && params_.seconds > 0 && wavFileWriter_.good();
+    }
+
+  protected:
+    bool consume(const std::span<const float> interleavedBuf) override {
+        if (!wavFileWriter_.write(interleavedBuf)) {
+            MY_ERROR(L"Failed to write \"%ls\"\n", wavPath_.wstring().c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void report(const uint64_t nFrames, const double elapsedSec) const override {
+        MY_TRACE(L"Output : \"%ls\"\n", wavPath_.wstring().c_str());
+        SoftwareBackend::report(nFrames, elapsedSec);
+    }
+
+    void audioThreadMain() override {
+        SoftwareBackend::audioThreadMain();
+        wavFileWriter_.close();
+    }
+
+  private:
+    std::filesystem::path wavPath_;
+    WavFileWriter         wavFileWriter_;
+}; // class WavFileBackend
+
+// Paces the blocks with a software clock in place of an audio device. Reports the wake-up jitter of the audio thread.
+class TimerBackend final : public SoftwareBackend {
+  public:
+    explicit TimerBackend(const Params &params) : SoftwareBackend(params, true) {}
+
+  protected:
+    bool consume(std::span<const float>) override { return true; }
+
+    void report(const uint64_t nFrames, const double elapsedSec) const override {
+        SoftwareBackend::report(nFrames, elapsedSec);
+        const double meanSec = jitterCount_ ? jitterSumSec_ / static_cast<double>(jitterCount_) : 0.0;
+        MY_TRACE(L"Wake-up jitter : mean %.1f usec, max %.1f usec (%llu blocks)\n", meanSec * 1e6,
+                 jitterMaxSec_ * 1e6, static_cast<unsigned long long>(jitterCount_));
+    }
+}; // class TimerBackend
+
+// Thread-safe SPSC (Single Producer Single Consumer) queue.
+//
+// The capacity is rounded up to a power of two, so the free running indices are mapped to the slots with a mask.
+// Each side caches the other side's index, and loads it again (acquire) only when the cached one says the queue is
+// full or empty. `pushN` / `popN` move a batch of items with a single index update.
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4324) // structure was padded due to alignment specifier
+#endif
+template <class T, unsigned NumberOfElements> class SpscQueue final {
+    static constexpr unsigned Capacity         = std::bit_ceil(NumberOfElements);
+    static constexpr unsigned Mask             = Capacity - 1;
+    static constexpr size_t   FalseSharingSize = std::hardware_destructive_interference_size;
+
+    struct AlignedStorage {
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    T *slot(const unsigned i) { return std::launder(reinterpret_cast<T *>(items_[i & Mask].storage)); }
+
+  public:
+    SpscQueue()                             = default; // NOLINT(*-pro-type-member-init)
+    SpscQueue(const SpscQueue &)            = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    ~SpscQueue() {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            const unsigned end = writeIndex_.load(std::memory_order_relaxed);
+            for (unsigned i = readIndex_.load(std::memory_order_relaxed); i != end; ++i) {
+                std::destroy_at(slot(i));
+            }
+        }
+    }
+
+    // Producer
+    [[nodiscard]] bool push(const T &t) {
+        const unsigned currentWriteIndex = writeIndex_.load(std::memory_order_relaxed);
+        if (currentWriteIndex - cachedReadIndex_ == Capacity) [[unlikely]] {
+            cachedReadIndex_ = readIndex_.load(std::memory_order_acquire);
+            // false : queue is full
+            if (currentWriteIndex - cachedReadIndex_ == Capacity) {
+                return false;
+            }
+        }
+        new (items_[currentWriteIndex & Mask].storage) T(t);
+        writeIndex_.store(currentWriteIndex + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer : Returns the number of pushed items. It's less than items.size() if the queue is full.
+    [[nodiscard]] size_t pushN(const std::span<const T> items) {
+        const unsigned currentWriteIndex = writeIndex_.load(std::memory_order_relaxed);
+        if (Capacity - (currentWriteIndex - cachedReadIndex_) < items.size()) {
+            cachedReadIndex_ = readIndex_.load(std::memory_order_acquire);
+        }
+        const auto n = static_cast<unsigned>(std::min<size_t>(Capacity - (currentWriteIndex - cachedReadIndex_),
+                                                              items.size()));
+        for (unsigned i = 0; i < n; ++i) {
+            new (items_[(currentWriteIndex + i) & Mask].storage) T(items[i]);
+        }
+        writeIndex_.store(currentWriteIndex + n, std::memory_order_release);
+        return n;
+    }
+
+    // Consumer
+    [[nodiscard]] bool pop(T &item) {
+        const unsigned currentReadIndex = readIndex_.load(std::memory_order_relaxed);
+        if (currentReadIndex == cachedWriteIndex_) [[unlikely]] {
+            cachedWriteIndex_ = writeIndex_.load(std::memory_order_acquire);
+            // false : queue is empty
+            if (currentReadIndex == cachedWriteIndex_) {
+                return false;
+            }
+        }
+        T *p = slot(currentReadIndex);
+        item = std::move(*p);
+        std::destroy_at(p);
+        readIndex_.store(currentReadIndex + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer : Returns the number of popped items, up to out.size(). 0 : queue is empty
+    [[nodiscard]] size_t popN(const std::span<T> out) {
+        const unsigned currentReadIndex = readIndex_.load(std::memory_order_relaxed);
+        if (cachedWriteIndex_ - currentReadIndex < out.size()) {
+            cachedWriteIndex_ = writeIndex_.load(std::memory_order_acquire);
+        }
+        const auto n = static_cast<unsigned>(std::min<size_t>(cachedWriteIndex_ - currentReadIndex, out.size()));
+        for (unsigned i = 0; i < n; ++i) {
+            T *p   = slot(currentReadIndex + i);
+            out[i] = std::move(*p);
+            std::destroy_at(p);
+        }
+        readIndex_.store(currentReadIndex + n, std::memory_order_release);
+        return n;
+    }
+
+  private:
+    AlignedStorage items_[Capacity];
+    alignas(FalseSharingSize) std::atomic<unsigned> writeIndex_       = 0; // Producer's cache line
+    unsigned                                        cachedReadIndex_  = 0;
+    alignas(FalseSharingSize) std::atomic<unsigned> readIndex_        = 0; // Consumer's cache line
+    unsigned                                        cachedWriteIndex_ = 0;
+}; // class SpscQueue
+
+// Thread-safe MPSC (Multiple Producer Single Consumer) queue, e.g. for several UI / control threads feeding one plugin.
+//
+// Bounded ring of D. Vyukov's design. The sequence number of each slot tells whether the slot is free for the
+// producer of the current lap, or is ready for the consumer. Producers claim slots by CAS on the write index, and the
+// consumer needs no read-modify-write at all.
+template <class T, unsigned NumberOfElements> class MpscQueue final {
+    static constexpr unsigned Capacity         = std::bit_ceil(NumberOfElements);
+    static constexpr unsigned Mask             = Capacity - 1;
+    static constexpr size_t   FalseSharingSize = std::hardware_destructive_interference_size;
+
+    struct Slot {
+        std::atomic<unsigned> seq;
+        alignas(T) std::byte  storage[sizeof(T)];
+    };
+
+  public:
+    MpscQueue() { // NOLINT(*-pro-type-member-init)
+        for (unsigned i = 0; i < Capacity; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    MpscQueue(const MpscQueue &)            = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    ~MpscQueue() {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            for (unsigned i = readIndex_;; ++i) {
+                Slot &slot = slots_[i & Mask];
+                if (slot.seq.load(std::memory_order_relaxed) != i + 1) {
+                    break;
+                }
+                std::destroy_at(std::launder(reinterpret_cast<T *>(slot.storage)));
+            }
+        }
+    }
+
+    // Any producer thread
+    [[nodiscard]] bool push(const T &t) { return pushN(std::span(&t, 1)) == 1; }
+
+    // Any producer thread : Claims consecutive slots for the items with a single CAS. Returns the number of pushed
+    // items. It's less than items.size() if the queue is full.
+    [[nodiscard]] size_t pushN(const std::span<const T> items) {
+        unsigned currentWriteIndex = writeIndex_.load(std::memory_order_relaxed);
+        for (;;) {
+            // Count the free slots. A slot which is free for this lap can't be taken by anyone else until the write
+            // index moves, so the CAS below validates the count.
+            unsigned n = 0;
+            while (n < items.size() && n < Capacity) {
+                const unsigned seq = slots_[(currentWriteIndex + n) & Mask].seq.load(std::memory_order_acquire);
+                if (seq != currentWriteIndex + n) {
+                    break;
+                }
+                ++n;
+            }
+            if (n == 0) {
+                // The slot is still owned by the consumer (queue is full), or by another producer which has claimed
+                // it already. Only the former is a failure.
+                const unsigned seq = slots_[currentWriteIndex & Mask].seq.load(std::memory_order_acquire);
+                if (static_cast<int>(seq - currentWriteIndex) < 0) {
+                    return 0;
+                }
+                currentWriteIndex = writeIndex_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (writeIndex_.compare_exchange_weak(currentWriteIndex, currentWriteIndex + n,
+                                                  std::memory_order_relaxed)) {
+                for (unsigned i = 0; i < n; ++i) {
+                    Slot &slot = slots_[(currentWriteIndex + i) & Mask];
+                    new (slot.storage) T(items[i]);
+                    slot.seq.store(currentWriteIndex + i + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    // Consumer
+    [[nodiscard]] bool pop(T &item) { return popN(std::span(&item, 1)) == 1; }
+
+    // Consumer : Returns the number of popped items, up to out.size(). Stops at a slot which a producer has claimed
+    // but not filled yet, so the items are always popped in order of their slots.
+    [[nodiscard]] size_t popN(const std::span<T> out) {
+        size_t n = 0;
+        for (; n < out.size(); ++n) {
+            Slot &slot = slots_[(readIndex_ + n) & Mask];
+            if (slot.seq.load(std::memory_order_acquire) != readIndex_ + n + 1) {
+                break;
+            }
+            T *p   = std::launder(reinterpret_cast<T *>(slot.storage));
+            out[n] = std::move(*p);
+            std::destroy_at(p);
+            slot.seq.store(readIndex_ + n + Capacity, std::memory_order_release);
+        }
+        readIndex_ += static_cast<unsigned>(n);
+        return n;
+    }
+
+  private:
+    Slot slots_[Capacity];
+    alignas(FalseSharingSize) std::atomic<unsigned> writeIndex_ = 0;
+    alignas(FalseSharingSize) unsigned              readIndex_  = 0; // Consumer only
+}; // class MpscQueue
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+// Host Interface
+class MyHost : public Steinberg::Vst::IHostApplication {
+  public:
+    MyHost()          = default;
+    virtual ~MyHost() = default;
+
+  private:
+    uint32_t PLUGIN_API           addRef() override { return 1; }
+    uint32_t PLUGIN_API           release() override { return 1; }
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        if (Steinberg::FUnknownPrivate::iidEqual(tuid, FUnknown::iid) ||
+            Steinberg::FUnknownPrivate::iidEqual(tuid, IHostApplication::iid)) {
+            *obj = static_cast<IHostApplication *>(this);
+            return Steinberg::kResultOk;
+        }
+        *obj = nullptr;
+        return Steinberg::kNoInterface;
+    }
+
+    Steinberg::tresult PLUGIN_API getName(Steinberg::Vst::String128 name) override {
+        constexpr std::u16string_view hostName = u"Minimal VST3 Host";
+        std::copy(hostName.begin(), hostName.end(), name);
+        name[hostName.size()] = 0;
+        return Steinberg::kResultTrue;
+    }
+
+    Steinberg::tresult PLUGIN_API createInstance(Steinberg::TUID, Steinberg::TUID, void **) override {
+        return Steinberg::kResultFalse;
+    }
+}; // class MyHost
+
+// Monotonic clock for the event timestamps
+inline int64_t monotonicNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Live event with the monotonic time of its capture. The audio thread maps the time to the sample offset.
+struct TimedEvent {
+    Steinberg::Vst::Event event;
+    int64_t               timeNs;
+};
+
+// Parameter edit of the controller, with the monotonic time of the edit
+struct ParamChange {
+    Steinberg::Vst::ParamID    id;
+    Steinberg::Vst::ParamValue value;
+    int64_t                    timeNs;
+};
+using ParamChangeQueue = MpscQueue<ParamChange, 1024>;
+
+// IParamValueQueue of one parameter for one block. The points are preallocated, and kept in order of sample offset.
+class MyParamValueQueue : public Steinberg::Vst::IParamValueQueue {
+  public:
+    MyParamValueQueue()          = default;
+    virtual ~MyParamValueQueue() = default;
+
+    void reset(const Steinberg::Vst::ParamID id) {
+        id_      = id;
+        nPoints_ = 0;
+    }
+
+    Steinberg::Vst::ParamID PLUGIN_API getParameterId() override { return id_; }
+    Steinberg::int32 PLUGIN_API        getPointCount() override { return nPoints_; }
+
+    Steinberg::tresult PLUGIN_API getPoint(const Steinberg::int32 index, Steinberg::int32 &sampleOffset,
+                                           Steinberg::Vst::ParamValue &value) override {
+        if (index < 0 || index >= nPoints_) {
+            return Steinberg::kResultFalse;
+        }
+        sampleOffset = points_[index].sampleOffset;
+        value        = points_[index].value;
+        return Steinberg::kResultOk;
+    }
+
+    // A point at or before the last point's offset replaces the last value. If the queue is full, the last point
+    // takes the new value, so the final value of the block is never lost.
+    Steinberg::tresult PLUGIN_API addPoint(const Steinberg::int32 sampleOffset, const Steinberg::Vst::ParamValue value,
+                                           Steinberg::int32 &index) override {
+        if (nPoints_ > 0 && (sampleOffset <= points_[nPoints_ - 1].sampleOffset || nPoints_ >= MaxPoints)) {
+            points_[nPoints_ - 1].value = value;
+            index                       = nPoints_ - 1;
+            return Steinberg::kResultOk;
+        }
+        points_[nPoints_] = {sampleOffset, value};
+        index             = nPoints_++;
+        return Steinberg::kResultOk;
+    }
+
+  private:
+    uint32_t PLUGIN_API addRef() override { return 1; }
+    uint32_t PLUGIN_API release() override { return 1; }
+
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        if (Steinberg::FUnknownPrivate::iidEqual(tuid, Steinberg::Vst::IParamValueQueue::iid) ||
+            Steinberg::FUnknownPrivate::iidEqual(tuid, FUnknown::iid)) {
+            *obj = this;
+            return Steinberg::kResultOk;
+        }
+        *obj = nullptr;
+        return Steinberg::kNoInterface;
+    }
+
+    struct Point {
+        Steinberg::int32           sampleOffset;
+        Steinberg::Vst::ParamValue value;
+    };
+
+    static constexpr Steinberg::int32 MaxPoints = 32;
+    Steinberg::Vst::ParamID           id_       = 0;
+    Steinberg::int32                  nPoints_  = 0;
+    std::array<Point, MaxPoints>      points_   = {};
+}; // class MyParamValueQueue
+
+// IParameterChanges of one block. A pool of preallocated queues, so the audio thread never allocates.
+class MyParameterChanges : public Steinberg::Vst::IParameterChanges {
+  public:
+    MyParameterChanges()          = default;
+    virtual ~MyParameterChanges() = default;
+
+    void clear() { nQueues_ = 0; }
+
+    Steinberg::int32 PLUGIN_API getParameterCount() override { return nQueues_; }
+
+    Steinberg::Vst::IParamValueQueue *PLUGIN_API getParameterData(const Steinberg::int32 index) override {
+        return index >= 0 && index < nQueues_ ? &queues_[index] : nullptr;
+    }
+
+    // Returns the queue of the parameter. A new queue is taken from the pool. nullptr : The pool is exhausted.
+    Steinberg::Vst::IParamValueQueue *PLUGIN_API addParameterData(const Steinberg::Vst::ParamID &id,
+                                                                  Steinberg::int32              &index) override {
+        for (Steinberg::int32 i = 0; i < nQueues_; ++i) {
+            if (queues_[i].getParameterId() == id) {
+                index = i;
+                return &queues_[i];
+            }
+        }
+        if (nQueues_ >= MaxQueues) {
+            return nullptr;
+        }
+        index = nQueues_++;
+        queues_[index].reset(id);
+        return &queues_[index];
+    }
+
+  private:
+    uint32_t PLUGIN_API addRef() override { return 1; }
+    uint32_t PLUGIN_API release() override { return 1; }
+
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        if (Steinberg::FUnknownPrivate::iidEqual(tuid, Steinberg::Vst::IParameterChanges::iid) ||
+            Steinberg::FUnknownPrivate::iidEqual(tuid, FUnknown::iid)) {
+            *obj = this;
+            return Steinberg::kResultOk;
+        }
+        *obj = nullptr;
+        return Steinberg::kNoInterface;
+    }
+
+    static constexpr Steinberg::int32        MaxQueues = 128;
+    Steinberg::int32                         nQueues_  = 0;
+    std::array<MyParamValueQueue, MaxQueues> queues_   = {};
+}; // class MyParameterChanges
+
+// IBStream on the end of a byte buffer. A stream for writing appends to the buffer, so the states of several plugins
+// can be written back to back into one arena (ChainSnapshot). A stream for reading reads a part of a buffer.
+class MyMemoryStream : public Steinberg::IBStream {
+  public:
+    explicit MyMemoryStream(std::vector<uint8_t> &arena) : arena_(&arena), begin_(arena.size()) {}
+    explicit MyMemoryStream(const std::span<const uint8_t> data) : data_(data) {}
+    virtual ~MyMemoryStream() = default;
+
+    Steinberg::tresult PLUGIN_API read(void *buffer, const Steinberg::int32 numBytes,
+                                       Steinberg::int32 *numBytesRead) override {
+        const std::span<const uint8_t> data  = getData();
+        const int64_t                  avail = std::max<int64_t>(static_cast<int64_t>(data.size()) - position_, 0);
+        const auto                     n     = static_cast<Steinberg::int32>(std::clamp<int64_t>(numBytes, 0, avail));
+        if (n > 0) {
+            std::memcpy(buffer, data.data() + position_, static_cast<size_t>(n));
+            position_ += n;
+        }
+        if (numBytesRead) {
+            *numBytesRead = n;
+        }
+        return n == numBytes ? Steinberg::kResultOk : Steinberg::kResultFalse;
+    }
+
+    Steinberg::tresult PLUGIN_API write(void *buffer, const Steinberg::int32 numBytes,
+                                        Steinberg::int32 *numBytesWritten) override {
+        if (numBytesWritten) {
+            *numBytesWritten = 0;
+        }
+        if (!arena_ || numBytes < 0) {
+            return Steinberg::kResultFalse;
+        }
+        const size_t end = begin_ + static_cast<size_t>(position_) + static_cast<size_t>(numBytes);
+        if (arena_->size() < end) {
+            arena_->resize(end);
+        }
+        std::memcpy(arena_->data() + begin_ + position_, buffer, static_cast<size_t>(numBytes));
+        position_ += numBytes;
+        if (numBytesWritten) {
+            *numBytesWritten = numBytes;
+        }
+        return Steinberg::kResultOk;
+    }
+
+    Steinberg::tresult PLUGIN_API seek(const Steinberg::int64 pos, const Steinberg::int32 mode,
+                                       Steinberg::int64 *result) override {
+        const auto    size = static_cast<int64_t>(getData().size());
+        const int64_t base = mode == kIBSeekSet ? 0 : mode == kIBSeekCur ? position_ : size;
+        if (mode != kIBSeekSet && mode != kIBSeekCur && mode != kIBSeekEnd) {
+            return Steinberg::kInvalidArgument;
+        }
+        // A writer may seek beyond the end. The gap is filled with zeros when it's written.
+        if (base + pos < 0 || (!arena_ && base + pos > size)) {
+            return Steinberg::kResultFalse;
+        }
+        position_ = base + pos;
+        if (result) {
+            *result = position_;
+        }
+        return Steinberg::kResultOk;
+    }
+
+    Steinberg::tresult PLUGIN_API tell(Steinberg::int64 *pos) override {
+        if (!pos) {
+            return Steinberg::kInvalidArgument;
+        }
+        *pos = position_;
+        return Steinberg::kResultOk;
+    }
+
+  private:
+    [[nodiscard]] std::span<const uint8_t> getData() const {
+        return arena_ ? std::span<const uint8_t>(*arena_).subspan(begin_) : data_;
+    }
+
+    uint32_t PLUGIN_API addRef() override { return 1; }
+    uint32_t PLUGIN_API release() override { return 1; }
+
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        if (Steinberg::FUnknownPrivate::iidEqual(tuid, Steinberg::IBStream::iid) ||
+            Steinberg::FUnknownPrivate::iidEqual(tuid, FUnknown::iid)) {
+            *obj = this;
+            return Steinberg::kResultOk;
+        }
+        *obj = nullptr;
+        return Steinberg::kNoInterface;
+    }
+
+    std::vector<uint8_t>    *arena_ = nullptr; // nullptr : Read only
+    size_t                   begin_ = 0;       // Of the stream in the arena
+    std::span<const uint8_t> data_;
+    Steinberg::int64         position_ = 0;
+}; // class MyMemoryStream
+
+// Latest values of the output parameters of a plugin (meters, gain reduction, ...). The audio thread publishes them,
+// and any other thread reads a consistent snapshot at any rate, without locks and without blocking the audio thread.
+//
+// Double-buffered : The audio thread fills the back buffer and flips it to the front. Each buffer has a sequence
+// number (seqlock), so a reader which is overtaken by two publishes while copying notices it and retries.
+class ParamMirror final {
+  public:
+    static constexpr unsigned MaxParams = 256;
+
+    struct Entry {
+        Steinberg::Vst::ParamID    id;
+        Steinberg::Vst::ParamValue value;
+    };
+
+    struct Snapshot {
+        uint64_t                     version = 0; // Incremented by each publish. 0 : Nothing is published yet
+        unsigned                     nParams = 0;
+        std::array<Entry, MaxParams> params  = {};
+    };
+
+    ParamMirror()                               = default;
+    ParamMirror(const ParamMirror &)            = delete;
+    ParamMirror &operator=(const ParamMirror &) = delete;
+
+    // Audio thread : Takes the last point of each queue. Publishes a new snapshot only if a value has changed.
+    void publish(Steinberg::Vst::IParameterChanges &changes) {
+        bool changed = false;
+        for (Steinberg::int32 iQueue = 0; iQueue < changes.getParameterCount(); ++iQueue) {
+            Steinberg::Vst::IParamValueQueue *queue  = changes.getParameterData(iQueue);
+            Steinberg::int32                  offset = 0;
+            Steinberg::Vst::ParamValue        value  = 0.0;
+            if (!queue || queue->getPointCount() <= 0 ||
+                queue->getPoint(queue->getPointCount() - 1, offset, value) != Steinberg::kResultOk) {
+                continue;
+            }
+            changed |= setLatest(queue->getParameterId(), value);
+        }
+        if (!changed) {
+            return;
+        }
+        const unsigned iBack = 1 - front_.load(std::memory_order_relaxed);
+        Buffer        &back  = buffers_[iBack];
+        const uint64_t seq   = back.seq.load(std::memory_order_relaxed);
+        back.seq.store(seq + 1, std::memory_order_relaxed); // Odd : Being written
+        std::atomic_thread_fence(std::memory_order_release);
+        back.version.store(++version_, std::memory_order_relaxed);
+        back.nParams.store(nLatest_, std::memory_order_relaxed);
+        for (unsigned i = 0; i < nLatest_; ++i) {
+            back.ids[i].store(latest_[i].id, std::memory_order_relaxed);
+            back.values[i].store(latest_[i].value, std::memory_order_relaxed);
+        }
+        back.seq.store(seq + 2, std::memory_order_release);
+        front_.store(iBack, std::memory_order_release);
+    }
+
+    // Any thread : Copies the latest snapshot. false : Nothing is published yet.
+    bool read(Snapshot &out) const {
+        for (;;) {
+            const Buffer  &front = buffers_[front_.load(std::memory_order_acquire)];
+            const uint64_t seq   = front.seq.load(std::memory_order_acquire);
+            if (seq & 1) [[unlikely]] {
+                continue;
+            }
+            out.version = front.version.load(std::memory_order_relaxed);
+            out.nParams = std::min(front.nParams.load(std::memory_order_relaxed), MaxParams);
+            for (unsigned i = 0; i < out.nParams; ++i) {
+                out.params[i] = {front.ids[i].load(std::memory_order_relaxed),
+                                 front.values[i].load(std::memory_order_relaxed)};
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (front.seq.load(std::memory_order_relaxed) == seq) {
+                return out.version != 0;
+            }
+        }
+    }
+
+    // Number of output parameters which didn't fit into the mirror. Read it after the audio thread has stopped.
+    [[nodiscard]] uint64_t getDroppedParams() const { return droppedParams_; }
+
+  private:
+    struct Buffer {
+        std::atomic<uint64_t>                                          seq     = 0;
+        std::atomic<uint64_t>                                          version = 0;
+        std::atomic<unsigned>                                          nParams = 0;
+        std::array<std::atomic<Steinberg::Vst::ParamID>, MaxParams>    ids     = {};
+        std::array<std::atomic<Steinberg::Vst::ParamValue>, MaxParams> values  = {};
+    };
+
+    // Returns true if the value is new or has changed
+    bool setLatest(const Steinberg::Vst::ParamID id, const Steinberg::Vst::ParamValue value) {
+        for (unsigned i = 0; i < nLatest_; ++i) {
+            if (latest_[i].id == id) {
+                const bool changed = latest_[i].value != value;
+                latest_[i].value   = value;
+                return changed;
+            }
+        }
+        if (nLatest_ >= MaxParams) {
+            ++droppedParams_;
+            return false;
+        }
+        latest_[nLatest_++] = {id, value};
+        return true;
+    }
+
+    // Audio thread only
+    std::array<Entry, MaxParams> latest_        = {};
+    unsigned                     nLatest_       = 0;
+    uint64_t                     version_       = 0;
+    uint64_t                     droppedParams_ = 0;
+
+    // Shared with the readers
+    std::array<Buffer, 2> buffers_;
+    std::atomic<unsigned> front_ = 0;
+}; // class ParamMirror
+
+// Cheap tick counter for the timing of the audio thread : The time stamp counter on x86, the virtual counter on ARM64,
+// otherwise std::chrono::steady_clock. calibrate() measures the tick period once, before the audio thread starts.
+class CycleClock final {
+  public:
+    [[nodiscard]] static uint64_t now() {
+#if MY_ARCH_X86
+        return __rdtsc();
+#elif MY_ARCH_ARM64 && (defined(__GNUC__) || defined(__clang__))
+        uint64_t ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        return static_cast<uint64_t>(monotonicNowNs());
+#endif
+    }
+
+    [[nodiscard]] static uint64_t toNs(const uint64_t ticks) {
+        return static_cast<uint64_t>(static_cast<double>(ticks) * nsPerTick_.load(std::memory_order_relaxed));
+    }
+
+    // Compares the ticks with the monotonic clock over a short sleep. Call it before the ticks are converted.
+    static void calibrate() {
+        if (calibrated_.exchange(true)) {
+            return;
+        }
+        const int64_t  ns0    = monotonicNowNs();
+        const uint64_t ticks0 = now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        const int64_t  ns1    = monotonicNowNs();
+        const uint64_t ticks1 = now();
+        if (ticks1 > ticks0 && ns1 > ns0) {
+            nsPerTick_.store(static_cast<double>(ns1 - ns0) / static_cast<double>(ticks1 - ticks0));
+        }
+    }
+
+  private:
+    static inline std::atomic<double> nsPerTick_  = 1.0;
+    static inline std::atomic<bool>   calibrated_ = false;
+}; // class CycleClock
+
+// Lock-free histogram of durations. One thread at a time records, any thread reads.
+//
+// Log-linear buckets : Below 32 nsec each nanosecond has its own bucket. Above that, each power of two is split into
+// 16 buckets, and a percentile is the middle of its bucket (within 3.2% of the recorded values). The readers see the
+// counts one by one, not as a snapshot, which is good enough for percentiles.
+class LatencyHistogram final {
+  public:
+    static constexpr unsigned SubBits       = 4;
+    static constexpr unsigned NumSubBuckets = 1u << SubBits;
+    static constexpr unsigned NumLinear     = 2 * NumSubBuckets;
+    static constexpr unsigned NumBuckets    = NumLinear + (64 - SubBits - 1) * NumSubBuckets;
+
+    LatencyHistogram()                                    = default;
+    LatencyHistogram(const LatencyHistogram &)            = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+    // Audio thread. The previous recorder must happen-before the next one (e.g. the same graph node in each block).
+    void record(const uint64_t ns) {
+        increment(counts_[bucketOf(ns)], 1);
+        increment(count_, 1);
+        increment(sumNs_, ns);
+        if (ns > maxNs_.load(std::memory_order_relaxed)) {
+            maxNs_.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    [[nodiscard]] uint64_t getCount() const { return count_.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t getSumNs() const { return sumNs_.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t getMaxNs() const { return maxNs_.load(std::memory_order_relaxed); }
+
+    // Any thread : Middle of the bucket which holds the given fraction (0.0 - 1.0) of the recorded durations.
+    [[nodiscard]] uint64_t getPercentileNs(const double fraction) const {
+        std::array<uint64_t, NumBuckets> counts;
+        uint64_t                         total = 0;
+        for (unsigned i = 0; i < NumBuckets; ++i) {
+            counts[i] = counts_[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        const auto rank = static_cast<uint64_t>(std::ceil(fraction * static_cast<double>(total)));
+        uint64_t   seen = 0;
+        for (unsigned i = 0; i < NumBuckets; ++i) {
+            if (seen += counts[i]; counts[i] > 0 && seen >= rank) {
+                return std::min(middleOf(i), getMaxNs());
+            }
+        }
+        return 0;
+    }
+
+  private:
+    static void increment(std::atomic<uint64_t> &a, const uint64_t n) {
+        a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); // Single writer : No RMW needed
+    }
+
+    // The bucket of [2^e, 2^(e+1)) is selected by the SubBits bits below the top bit
+    static unsigned bucketOf(const uint64_t ns) {
+        if (ns < NumLinear) {
+            return static_cast<unsigned>(ns);
+        }
+        const unsigned e = static_cast<unsigned>(std::bit_width(ns)) - 1; // > SubBits
+        const unsigned m = static_cast<unsigned>(ns >> (e - SubBits)) & (NumSubBuckets - 1);
+        return NumLinear + (e - SubBits - 1) * NumSubBuckets + m;
+    }
+
+    static uint64_t middleOf(const unsigned bucket) {
+        if (bucket < NumLinear) {
+            return bucket;
+        }
+        const unsigned e     = (bucket - NumLinear) / NumSubBuckets + SubBits + 1;
+        const uint64_t m     = (bucket - NumLinear) % NumSubBuckets;
+        const uint64_t lower = (NumSubBuckets + m) << (e - SubBits);
+        return lower + (uint64_t{1} << (e - SubBits)) / 2;
+    }
+
+    std::array<std::atomic<uint64_t>, NumBuckets> counts_ = {};
+    std::atomic<uint64_t>                         count_  = 0;
+    std::atomic<uint64_t>                         sumNs_  = 0;
+    std::atomic<uint64_t>                         maxNs_  = 0;
+}; // class LatencyHistogram
+
+// Timing of a periodic job against its block period : The histogram of its durations, the DSP load (time spent /
+// audio time), the peak load of a single block and the overruns (blocks which took longer than their period).
+// Used for the process() call of each plugin and for the whole refill callback.
+class ProcessTiming final {
+  public:
+    struct Report {
+        uint64_t nBlocks;
+        uint64_t p50Ns;
+        uint64_t p99Ns;
+        uint64_t maxNs;
+        double   loadPercent;     // Time spent / audio time
+        double   peakLoadPercent; // Of the slowest block
+        uint64_t overruns;        // Blocks which took longer than their period
+    };
+
+    // Audio thread
+    void record(const uint64_t elapsedNs, const uint64_t blockNs) {
+        histogram_.record(elapsedNs);
+        audioNs_.store(audioNs_.load(std::memory_order_relaxed) + blockNs, std::memory_order_relaxed);
+        if (elapsedNs > blockNs) {
+            overruns_.store(overruns_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        // A ratio, like the average load, so that the peak can't be printed below it
+        if (const double load = blockNs ? static_cast<double>(elapsedNs) / static_cast<double>(blockNs) : 0.0;
+            load > peakLoad_.load(std::memory_order_relaxed)) {
+            peakLoad_.store(load, std::memory_order_relaxed);
+        }
+    }
+
+    // Any thread
+    [[nodiscard]] Report report() const {
+        const uint64_t audioNs = audioNs_.load(std::memory_order_relaxed);
+        return {
+            .nBlocks         = histogram_.getCount(),
+            .p50Ns           = histogram_.getPercentileNs(0.50),
+            .p99Ns           = histogram_.getPercentileNs(0.99),
+            .maxNs           = histogram_.getMaxNs(),
+            .loadPercent     = audioNs ? 100.0 * static_cast<double>(histogram_.getSumNs()) / audioNs : 0.0,
+            .peakLoadPercent = 100.0 * peakLoad_.load(std::memory_order_relaxed),
+            .overruns        = overruns_.load(std::memory_order_relaxed),
+        };
+    }
+
+    // Any thread : Total time of the recorded jobs
+    [[nodiscard]] uint64_t getSumNs() const { return histogram_.getSumNs(); }
+
+  private:
+    LatencyHistogram      histogram_;
+    std::atomic<uint64_t> audioNs_  = 0;
+    std::atomic<uint64_t> overruns_ = 0;
+    std::atomic<double>   peakLoad_ = 0.0; // Elapsed time / block period of the slowest block
+}; // class ProcessTiming
+
+// Real-time safety checker (--rt-check on). Flags the threads while they run a plugin's process(), and reports the
+// calls which can block them : Memory allocation, locks, waits, sleeps and file I/O.
+//
+// The calls are intercepted by symbol interposition, like an LD_PRELOAD library : The executable defines malloc(),
+// pthread_mutex_lock() etc., the dynamic linker binds the calls of the plugins to them, and the hooks forward to the
+// functions in libc. Only on Linux (glibc), in a build with -DRT_CHECK=ON (MY_RT_CHECK=1).
+// Each call is counted. The first call of each kind in each plugin is reported with its call stack.
+class RtSafetyChecker final {
+  public:
+    enum class Kind : unsigned { Alloc, Free, Lock, Wait, Sleep, FileIo, NumKinds };
+
+    static constexpr unsigned MaxPlugins = 64;
+    static constexpr unsigned MaxFrames  = 32;
+    static constexpr unsigned NumKinds   = static_cast<unsigned>(Kind::NumKinds);
+
+    // Marks the calling thread while it processes the plugin
+    class Scope final {
+      public:
+        explicit Scope(const unsigned pluginIndex) : prev_(std::exchange(current_, pluginIndex + 1)) {}
+        ~Scope() { current_ = prev_; }
+        Scope(const Scope &)            = delete;
+        Scope &operator=(const Scope &) = delete;
+
+      private:
+        unsigned prev_;
+    };
+
+    [[nodiscard]] static constexpr bool isAvailable() { return MY_RT_CHECK != 0; }
+
+    // Call it before the audio thread starts
+    static void enable() {
+#if MY_RT_CHECK
+        std::array<void *, 1> frames;
+        (void)backtrace(frames.data(), 1); // The first call loads the unwinder, which allocates
+#endif
+        enabled_.store(true, std::memory_order_release);
+    }
+
+#if MY_RT_CHECK
+    // Called by the hooks, on any thread
+    [[gnu::noinline]] static void check(const Kind kind) {
+        const unsigned plugin = current_;
+        if (plugin == 0 || inHook_ || !enabled_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        inHook_    = true; // backtrace() may call the hooks again
+        Site &site = sites_[std::min(plugin - 1, MaxPlugins - 1)][static_cast<unsigned>(kind)];
+        site.count.fetch_add(1, std::memory_order_relaxed);
+        if (unsigned expected = Site::Empty;
+            site.state.compare_exchange_strong(expected, Site::Writing, std::memory_order_acquire)) {
+            site.nFrames = std::max(backtrace(site.frames.data(), MaxFrames), 0);
+            site.state.store(Site::Ready, std::memory_order_release);
+        }
+        inHook_ = false;
+    }
+#endif
+
+    // UI thread : Prints the call stacks which have been captured since the last call.
+    // `getName(pluginIndex)` returns the name of the plugin.
+    static void printNewViolations(const std::function<std::wstring(unsigned)> &getName) {
+#if MY_RT_CHECK
+        for (unsigned iPlugin = 0; iPlugin < MaxPlugins; ++iPlugin) {
+            for (unsigned iKind = 0; iKind < NumKinds; ++iKind) {
+                Site &site = sites_[iPlugin][iKind];
+                if (site.state.load(std::memory_order_acquire) != Site::Ready) {
+                    continue;
+                }
+                site.state.store(Site::Printed, std::memory_order_relaxed);
+                MY_ERROR(L"RT safety : [#%u] %ls : %ls in process()\n", iPlugin, getName(iPlugin).c_str(),
+                         kindNames[iKind]);
+                // Skips check() and the hook
+                const int nSkip = std::min(site.nFrames, 2);
+                if (char **symbols = backtrace_symbols(site.frames.data() + nSkip, site.nFrames - nSkip)) {
+                    for (int i = 0; i < site.nFrames - nSkip; ++i) {
+                        MY_ERROR(L"  #%-2d %hs\n", i, demangle(symbols[i]).c_str());
+                    }
+                    ::free(symbols);
+                }
+            }
+        }
+#else
+        (void)getName;
+#endif
+    }
+
+    // UI thread : Prints the number of the calls of each kind for each plugin
+    static void printCounts(const std::function<std::wstring(unsigned)> &getName) {
+        for (unsigned iPlugin = 0; iPlugin < MaxPlugins; ++iPlugin) {
+            std::wstring line;
+            for (unsigned iKind = 0; iKind < NumKinds; ++iKind) {
+                if (const uint64_t n = sites_[iPlugin][iKind].count.load(std::memory_order_relaxed); n > 0) {
+                    line += (line.empty() ? L" " : L", ") + std::to_wstring(n) + L" " + kindNames[iKind];
+                }
+            }
+            if (!line.empty()) {
+                MY_ERROR(L"RT safety : [#%u] %ls :%ls\n", iPlugin, getName(iPlugin).c_str(), line.c_str());
+            }
+        }
+    }
+
+  private:
+    struct Site {
+        enum : unsigned { Empty, Writing, Ready, Printed };
+
+        std::atomic<uint64_t>         count   = 0;
+        std::atomic<unsigned>         state   = Empty;
+        int                           nFrames = 0;
+        std::array<void *, MaxFrames> frames  = {};
+    };
+
+    static constexpr const wchar_t *kindNames[NumKinds] = {
+        L"memory allocation", L"memory free", L"lock", L"wait", L"sleep", L"file I/O",
+    };
+
+#if MY_RT_CHECK
+    // "module(mangled+0x1c) [0x...]" -> "module(demangled+0x1c) [0x...]"
+    static std::string demangle(const std::string &symbol) {
+        const size_t begin = symbol.find('(');
+        const size_t end   = symbol.find('+', begin);
+        if (begin == std::string::npos || end == std::string::npos || end == begin + 1) {
+            return symbol;
+        }
+        int   status    = 0;
+        char *demangled = abi::__cxa_demangle(symbol.substr(begin + 1, end - begin - 1).c_str(), nullptr, nullptr,
+                                              &status);
+        if (!demangled) {
+            return symbol;
+        }
+        std::string s = symbol.substr(0, begin + 1) + demangled + symbol.substr(end);
+        ::free(demangled);
+        return s;
+    }
+#endif
+
+    static inline std::atomic<bool>                           enabled_ = false;
+    static inline thread_local unsigned                       current_ = 0;     // Plugin index + 1. 0 : None
+    static inline thread_local bool                           inHook_  = false;
+    static std::array<std::array<Site, NumKinds>, MaxPlugins> sites_; // Constant initialized, before any hook runs
+}; // class RtSafetyChecker
+
+inline std::array<std::array<RtSafetyChecker::Site, RtSafetyChecker::NumKinds>, RtSafetyChecker::MaxPlugins>
+    RtSafetyChecker::sites_;
+
+#if MY_RT_CHECK
+// Functions of glibc's allocator, which the allocation hooks forward to
+extern "C" {
+void *__libc_malloc(size_t size);                    // NOLINT(*-reserved-identifier)
+void *__libc_calloc(size_t n, size_t size);          // NOLINT(*-reserved-identifier)
+void *__libc_realloc(void *p, size_t size);          // NOLINT(*-reserved-identifier)
+void *__libc_memalign(size_t alignment, size_t size); // NOLINT(*-reserved-identifier)
+void  __libc_free(void *p);                          // NOLINT(*-reserved-identifier)
+}
+
+// Looks up the next definition of a hooked function, i.e. the one in libc. `version` : Symbol version or nullptr
+template <typename Func>
+Func *rtNextFunction(std::atomic<Func *> &cache, const char *name, const char *version = nullptr) {
+    Func *func = cache.load(std::memory_order_relaxed);
+    if (!func) {
+        void *sym = version ? dlvsym(RTLD_NEXT, name, version) : nullptr;
+        func      = reinterpret_cast<Func *>(sym ? sym : dlsym(RTLD_NEXT, name));
+        cache.store(func, std::memory_order_relaxed);
+    }
+    return func;
+}
+
+// The hooks. Their C++ names differ from the libc functions, and the asm labels give them the symbol names, so they
+// don't collide with the declarations (and the inline wrappers of _FORTIFY_SOURCE) in the libc headers.
+extern "C" {
+void *rtHookMalloc(size_t size) __asm__("malloc");
+void *rtHookCalloc(size_t n, size_t size) __asm__("calloc");
+void *rtHookRealloc(void *p, size_t size) __asm__("realloc");
+void *rtHookMemalign(size_t alignment, size_t size) __asm__("memalign");
+void *rtHookAlignedAlloc(size_t alignment, size_t size) __asm__("aligned_alloc");
+int   rtHookPosixMemalign(void **p, size_t alignment, size_t size) __asm__("posix_memalign");
+void  rtHookFree(void *p) __asm__("free");
+int   rtHookMutexLock(pthread_mutex_t *mutex) __asm__("pthread_mutex_lock");
+int   rtHookRwlockRdlock(pthread_rwlock_t *rwlock) __asm__("pthread_rwlock_rdlock");
+int   rtHookRwlockWrlock(pthread_rwlock_t *rwlock) __asm__("pthread_rwlock_wrlock");
+int   rtHookCondWait(pthread_cond_t *cond, pthread_mutex_t *mutex) __asm__("pthread_cond_wait");
+int   rtHookCondTimedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const timespec *t) __asm__(
+    "pthread_cond_timedwait");
+int   rtHookSemWait(sem_t *sem) __asm__("sem_wait");
+int   rtHookNanosleep(const timespec *t, timespec *rem) __asm__("nanosleep");
+int   rtHookClockNanosleep(clockid_t clock, int flags, const timespec *t, timespec *rem) __asm__("clock_nanosleep");
+int   rtHookUsleep(useconds_t usec) __asm__("usleep");
+int   rtHookOpen(const char *path, int flags, ...) __asm__("open");
+int   rtHookOpenat(int dirFd, const char *path, int flags, ...) __asm__("openat");
+FILE *rtHookFopen(const char *path, const char *mode) __asm__("fopen");
+ssize_t rtHookRead(int fd, void *buf, size_t n) __asm__("read");
+ssize_t rtHookWrite(int fd, const void *buf, size_t n) __asm__("write");
+int     rtHookFsync(int fd) __asm__("fsync");
+}
+
+using RtKind = RtSafetyChecker::Kind;
+
+void *rtHookMalloc(const size_t size) {
+    RtSafetyChecker::check(RtKind::Alloc);
+    return __libc_malloc(size);
+}
+
+void *rtHookCalloc(const size_t n, const size_t size) {
+    RtSafetyChecker::check(RtKind::Alloc);
+    return __libc_calloc(n, size);
+}
+
+void *rtHookRealloc(void *p, const size_t size) {
+    RtSafetyChecker::check(RtKind::Alloc);
+    return __libc_realloc(p, size);
+}
+
+void *rtHookMemalign(const size_t alignment, const size_t size) {
+    RtSafetyChecker::check(RtKind::Alloc);
+    return __libc_memalign(alignment, size);
+}
+
+void *rtHookAlignedAlloc(const size_t alignment, const size_t size) {
+    RtSafetyChecker::check(RtKind::Alloc);
+    return __libc_memalign(alignment, size);
+}
+
+int rtHookPosixMemalign(void **p, const size_t alignment, const size_t size) {
+    RtSafetyChecker::check(RtKind::Alloc);
+    if (alignment % sizeof(void *) != 0 || !std::has_single_bit(alignment)) {
+        return EINVAL;
+    }
+    *p = __libc_memalign(alignment, size);
+    return *p || size == 0 ? 0 : ENOMEM;
+}
+
+void rtHookFree(void *p) {
+    if (p) {
+        RtSafetyChecker::check(RtKind::Free);
+    }
+    __libc_free(p);
+}
+
+int rtHookMutexLock(pthread_mutex_t *mutex) {
+    static std::atomic<decltype(&rtHookMutexLock)> next = nullptr;
+    RtSafetyChecker::check(RtKind::Lock);
+    return rtNextFunction(next, "pthread_mutex_lock")(mutex);
+}
+
+int rtHookRwlockRdlock(pthread_rwlock_t *rwlock) {
+    static std::atomic<decltype(&rtHookRwlockRdlock)> next = nullptr;
+    RtSafetyChecker::check(RtKind::Lock);
+    return rtNextFunction(next, "pthread_rwlock_rdlock")(rwlock);
+}
+
+int rtHookRwlockWrlock(pthread_rwlock_t *rwlock) {
+    static std::atomic<decltype(&rtHookRwlockWrlock)> next = nullptr;
+    RtSafetyChecker::check(RtKind::Lock);
+    return rtNextFunction(next, "pthread_rwlock_wrlock")(rwlock);
+}
+
+// dlsym() may return the old version of the condition variable functions, which uses a different layout
+int rtHookCondWait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    static std::atomic<decltype(&rtHookCondWait)> next = nullptr;
+    RtSafetyChecker::check(RtKind::Wait);
+    return rtNextFunction(next, "pthread_cond_wait", "GLIBC_2.3.2")(cond, mutex);
+}
+
+int rtHookCondTimedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const timespec *t) {
+    static std::atomic<decltype(&rtHookCondTimedwait)> next = nullptr;
+    RtSafetyChecker::check(RtKind::Wait);
+    return rtNextFunction(next, "pthread_cond_timedwait", "GLIBC_2.3.2")(cond, mutex, t);
+}
+
+int rtHookSemWait(sem_t *sem) {
+    static std::atomic<decltype(&rtHookSemWait)> next = nullptr;
+    RtSafetyChecker::check(RtKind::Wait);
+    return rtNextFunction(next, "sem_wait")(sem);
+}
+
+int rtHookNanosleep(const timespec *t, timespec *rem) {
+    static std::atomic<decltype(&rtHookNanosleep)> next = nullptr;
+    RtSafetyChecker::check(RtKind::Sleep);
+    return rtNextFunction(next, "nanosleep")(t, rem);
+}
+
+int rtHookClockNanosleep(const clockid_t clock, const int flags, const timespec *t, timespec *rem) {
+    static std::atomic<decltype(&rtHookClockNanosleep)> next = nullptr;
+    RtSafetyChecker::check(RtKind::Sleep);
+    return rtNextFunction(next, "clock_nanosleep")(clock, flags, t, rem);
+}
+
+int rtHookUsleep(const useconds_t usec) {
+    static std::atomic<decltype(&rtHookUsleep)> next = nullptr;
+    RtSafetyChecker::check(RtKind::Sleep);
+    return rtNextFunction(next, "usleep")(usec);
+}
+
+// The mode is only passed with O_CREAT or O_TMPFILE
+int rtHookOpen(const char *path, const int flags, ...) {
+    static std::atomic<decltype(&rtHookOpen)> next = nullptr;
+    RtSafetyChecker::check(RtKind::FileIo);
+    va_list args;
+    va_start(args, flags);
+    const mode_t mode = (flags & (O_CREAT | O_TMPFILE)) ? va_arg(args, mode_t) : 0;
+    va_end(args);
+    return rtNextFunction(next, "open")(path, flags, mode);
+}
+
+int rtHookOpenat(const int dirFd, const char *path, const int flags, ...) {
+    static std::atomic<decltype(&rtHookOpenat)> next = nullptr;
+    RtSafetyChecker::check(RtKind::FileIo);
+    va_list args;
+    va_start(args, flags);
+    const mode_t mode = (flags & (O_CREAT | O_TMPFILE)) ? va_arg(args, mode_t) : 0;
+    va_end(args);
+    return rtNextFunction(next, "openat")(dirFd, path, flags, mode);
+}
+
+FILE *rtHookFopen(const char *path, const char *mode) {
+    static std::atomic<decltype(&rtHookFopen)> next = nullptr;
+    RtSafetyChecker::check(RtKind::FileIo);
+    return rtNextFunction(next, "fopen")(path, mode);
+}
+
+ssize_t rtHookRead(const int fd, void *buf, const size_t n) {
+    static std::atomic<decltype(&rtHookRead)> next = nullptr;
+    RtSafetyChecker::check(RtKind::FileIo);
+    return rtNextFunction(next, "read")(fd, buf, n);
+}
+
+ssize_t rtHookWrite(const int fd, const void *buf, const size_t n) {
+    static std::atomic<decltype(&rtHookWrite)> next = nullptr;
+    RtSafetyChecker::check(RtKind::FileIo);
+    return rtNextFunction(next, "write")(fd, buf, n);
+}
+
+int rtHookFsync(const int fd) {
+    static std::atomic<decltype(&rtHookFsync)> next = nullptr;
+    RtSafetyChecker::check(RtKind::FileIo);
+    return rtNextFunction(next, "fsync")(fd);
+}
+#endif // MY_RT_CHECK
+
+// Component Handler Interface. Forwards the parameter edits of the controller to the audio thread.
+class MyComponentHandler : public Steinberg::Vst::IComponentHandler {
+  public:
+    MyComponentHandler()          = default;
+    virtual ~MyComponentHandler() = default;
+
+    ParamChangeQueue &getParamChangeQueue() { return paramChangeQueue_; }
+    // UI thread : true once after the plugin has reported a new latency
+    bool takeLatencyChanged() { return latencyChanged_.exchange(false, std::memory_order_acq_rel); }
+
+  private:
+    uint32_t PLUGIN_API           addRef() override { return 1; }
+    uint32_t PLUGIN_API           release() override { return 1; }
+    Steinberg::tresult PLUGIN_API beginEdit(Steinberg::Vst::ParamID) override { return Steinberg::kResultOk; }
+    Steinberg::tresult PLUGIN_API endEdit(Steinberg::Vst::ParamID) override { return Steinberg::kResultOk; }
+    // Should come from the UI thread, but some plugins call it from the audio thread, so it only sets a flag. The
+    // restart is done by Vst3Plugin::updateLatency().
+    Steinberg::tresult PLUGIN_API restartComponent(const int32_t flags) override {
+        if (flags & Steinberg::Vst::kLatencyChanged) {
+            latencyChanged_.store(true, std::memory_order_release);
+        }
+        return Steinberg::kResultOk;
+    }
+    // UI thread : The edit reaches the processor through the lock-free queue at the next block.
+    Steinberg::tresult PLUGIN_API performEdit(const Steinberg::Vst::ParamID    id,
+                                              const Steinberg::Vst::ParamValue value) override {
+        if (!paramChangeQueue_.push({id, value, monotonicNowNs()})) {
+            MY_ERROR(L"paramChangeQueue_ is full\n");
+            return Steinberg::kResultFalse;
+        }
+        return Steinberg::kResultOk;
+    }
+
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        if (Steinberg::FUnknownPrivate::iidEqual(tuid, IComponentHandler::iid)) {
+            *obj = static_cast<IComponentHandler *>(this);
+            return Steinberg::kResultOk;
+        }
+        *obj = nullptr;
+        return Steinberg::kNoInterface;
+    }
+
+    ParamChangeQueue  paramChangeQueue_;
+    std::atomic<bool> latencyChanged_ = false;
+}; // class MyComponentHandler
+
+// Plugin GUI Frame Interface
+class MyPlugFrame : public Steinberg::IPlugFrame {
+  public:
+    MyPlugFrame()          = default;
+    virtual ~MyPlugFrame() = default;
+    std::function<Steinberg::tresult(Steinberg::IPlugView *view, Steinberg::ViewRect *newSize)> resizeViewCallback_;
+
+  private:
+    uint32_t PLUGIN_API           addRef() override { return 1; }
+    uint32_t PLUGIN_API           release() override { return 1; }
+    Steinberg::tresult PLUGIN_API resizeView(Steinberg::IPlugView *view, Steinberg::ViewRect *newSize) override {
+        return resizeViewCallback_ ? resizeViewCallback_(view, newSize) : Steinberg::kResultFalse;
+    }
+
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        if (Steinberg::FUnknownPrivate::iidEqual(tuid, IPlugFrame::iid)) {
+            *obj = static_cast<IPlugFrame *>(this);
+            return Steinberg::kResultOk;
+        }
+        *obj = nullptr;
+        return Steinberg::kNoInterface;
+    }
+}; // class MyPlugFrame
+
+// Speaker arrangement of a bus with the given number of channels : The common layout of the count, or the first
+// nChannels speakers
+inline Steinberg::Vst::SpeakerArrangement getSpeakerArrangement(const unsigned nChannels) {
+    switch (nChannels) {
+    case 1:
+        return Steinberg::Vst::SpeakerArr::kMono;
+    case 2:
+        return Steinberg::Vst::SpeakerArr::kStereo;
+    case 4:
+        return Steinberg::Vst::SpeakerArr::k40Music;
+    case 6:
+        return Steinberg::Vst::SpeakerArr::k51;
+    case 8:
+        return Steinberg::Vst::SpeakerArr::k71Cine;
+    default:
+        return nChannels >= 64 ? ~Steinberg::Vst::SpeakerArrangement{0}
+                               : (Steinberg::Vst::SpeakerArrangement{1} << nChannels) - 1;
+    }
+}
+
+// In-process synthetic VST3 plugins (--synth <spec>), to exercise and measure the host without any plugin DLL.
+//
+//   pass        : Effect which copies its input to its output
+//   burn:<usec> : Effect which copies its input, and busy-waits for a fixed time in each block
+//   events:<n>  : Instrument which plays a quiet sine, and emits n note events per block on its event output
+//   alloc:<n>   : Effect which copies its input, and allocates / frees n blocks of memory in each block
+//   delay:<n>   : Effect which delays its input by n frames, and reports them as its latency, like a lookahead plugin
+//   drums:<n>   : Instrument with n output buses (1 main + n-1 aux), like a multi-output drum instrument. Bus #b plays
+//                 a quiet sine of b+1 times the pitch of `events`
+//   duck        : Effect with a sidechain (aux) input, which ducks its input by the level of the sidechain
+//   notes       : Instrument which plays a quiet sine for each held note of its event input, from the sample offset of
+//                 the note on to the one of the note off
+//
+// A single component which implements IComponent, IAudioProcessor and IEditController. It has no editor.
+class SyntheticPlugin final : public Steinberg::Vst::IComponent,
+                              public Steinberg::Vst::IAudioProcessor,
+                              public Steinberg::Vst::IEditController {
+  public:
+    enum class Kind { PassThrough, Burner, EventGenerator, Allocator, Delay, Drums, Ducker, NotePlayer };
+
+    struct Config {
+        Kind     kind   = Kind::PassThrough;
+        unsigned amount = 0; // usec (Burner), events (EventGenerator), allocations (Allocator) per block.
+                             // Frames (Delay). Output buses (Drums)
+    };
+
+    // Time spent in process(). Shared by the instances of a factory.
+    struct Stats {
+        std::atomic<uint64_t> processNs = 0;
+        std::atomic<uint64_t> nBlocks   = 0;
+    };
+
+    SyntheticPlugin(const Config &config, Stats &stats)
+        : config_(config), stats_(stats),
+          inputArrs_(config.kind == Kind::Ducker ? 2 : isEffect() ? 1 : 0, Steinberg::Vst::SpeakerArr::kStereo),
+          outputArrs_(config.kind == Kind::Drums ? config.amount : 1, Steinberg::Vst::SpeakerArr::kStereo) {}
+    virtual ~SyntheticPlugin() = default;
+
+    // Parses "<kind>[:<amount>]". Returns false if the spec is invalid.
+    static bool parse(const std::string_view spec, Config &config) {
+        const size_t           colon = spec.find(':');
+        const std::string_view kind  = spec.substr(0, colon);
+        const std::string      arg(colon == std::string_view::npos ? std::string_view{} : spec.substr(colon + 1));
+        const int              value = arg.empty() ? -1 : std::atoi(arg.c_str());
+        if (kind == "pass" && arg.empty()) {
+            config = {Kind::PassThrough, 0};
+        } else if (kind == "burn" && value >= 0) {
+            config = {Kind::Burner, static_cast<unsigned>(value)};
+        } else if (kind == "events" && value >= 0) {
+            config = {Kind::EventGenerator, static_cast<unsigned>(value)};
+        } else if (kind == "alloc" && value >= 0) {
+            config = {Kind::Allocator, static_cast<unsigned>(value)};
+        } else if (kind == "delay" && value >= 0) {
+            config = {Kind::Delay, static_cast<unsigned>(value)};
+        } else if (kind == "drums" && value >= 1 && value <= static_cast<int>(MaxBuses)) {
+            config = {Kind::Drums, static_cast<unsigned>(value)};
+        } else if (kind == "duck" && arg.empty()) {
+            config = {Kind::Ducker, 0};
+        } else if (kind == "notes" && arg.empty()) {
+            config = {Kind::NotePlayer, 0};
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    static const char *getKindName(const Kind kind) {
+        switch (kind) {
+        case Kind::Burner:
+            return "burn";
+        case Kind::EventGenerator:
+            return "events";
+        case Kind::Allocator:
+            return "alloc";
+        case Kind::Delay:
+            return "delay";
+        case Kind::Drums:
+            return "drums";
+        case Kind::Ducker:
+            return "duck";
+        case Kind::NotePlayer:
+            return "notes";
+        default:
+            return "pass";
+        }
+    }
+
+    // FUnknown
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        using Steinberg::FUnknownPrivate::iidEqual;
+        if (iidEqual(tuid, FUnknown::iid) || iidEqual(tuid, IPluginBase::iid) ||
+            iidEqual(tuid, Steinberg::Vst::IComponent::iid)) {
+            *obj = static_cast<Steinberg::Vst::IComponent *>(this);
+        } else if (iidEqual(tuid, Steinberg::Vst::IAudioProcessor::iid)) {
+            *obj = static_cast<Steinberg::Vst::IAudioProcessor *>(this);
+        } else if (iidEqual(tuid, Steinberg::Vst::IEditController::iid)) {
+            *obj = static_cast<Steinberg::Vst::IEditController *>(this);
+        } else {
+            *obj = nullptr;
+            return Steinberg::kNoInterface;
+        }
+        addRef();
+        return Steinberg::kResultOk;
+    }
+    uint32_t PLUGIN_API addRef() override { return ++refCount_; }
+    uint32_t PLUGIN_API release() override {
+        const uint32_t n = --refCount_;
+        if (n == 0) {
+            delete this;
+        }
+        return n;
+    }
+
+    // IPluginBase
+    Steinberg::tresult PLUGIN_API initialize(FUnknown *) override { return Steinberg::kResultOk; }
+    Steinberg::tresult PLUGIN_API terminate() override { return Steinberg::kResultOk; }
+
+    // IComponent
+    Steinberg::tresult PLUGIN_API getControllerClassId(Steinberg::TUID) override { return Steinberg::kResultFalse; }
+    Steinberg::tresult PLUGIN_API setIoMode(Steinberg::Vst::IoMode) override { return Steinberg::kResultOk; }
+
+    Steinberg::int32 PLUGIN_API getBusCount(const Steinberg::Vst::MediaType    type,
+                                            const Steinberg::Vst::BusDirection dir) override {
+        if (type == Steinberg::Vst::kAudio) {
+            return static_cast<Steinberg::int32>(getArrangements(dir).size());
+        }
+        return dir == Steinberg::Vst::kInput || config_.kind == Kind::EventGenerator ? 1 : 0;
+    }
+
+    Steinberg::tresult PLUGIN_API getBusInfo(const Steinberg::Vst::MediaType    type,
+                                             const Steinberg::Vst::BusDirection dir, const Steinberg::int32 index,
+                                             Steinberg::Vst::BusInfo &bus) override {
+        if (index < 0 || index >= getBusCount(type, dir)) {
+            return Steinberg::kInvalidArgument;
+        }
+        const bool audio = type == Steinberg::Vst::kAudio;
+        bus              = {};
+        bus.mediaType    = type;
+        bus.direction    = dir;
+        bus.channelCount = audio ? Steinberg::Vst::SpeakerArr::getChannelCount(getArrangements(dir)[index]) : 16;
+        bus.busType      = index == 0 ? Steinberg::Vst::kMain : Steinberg::Vst::kAux;
+        bus.flags        = index == 0 ? Steinberg::Vst::BusInfo::kDefaultActive : 0;
+        return Steinberg::kResultOk;
+    }
+
+    Steinberg::tresult PLUGIN_API getRoutingInfo(Steinberg::Vst::RoutingInfo &,
+                                                 Steinberg::Vst::RoutingInfo &) override {
+        return Steinberg::kResultFalse;
+    }
+    Steinberg::tresult PLUGIN_API activateBus(Steinberg::Vst::MediaType, Steinberg::Vst::BusDirection, Steinberg::int32,
+                                              Steinberg::TBool) override {
+        return Steinberg::kResultOk;
+    }
+    Steinberg::tresult PLUGIN_API setActive(Steinberg::TBool) override { return Steinberg::kResultOk; }
+
+    // The state is the kind and the amount. The host restores it only into an instance which isn't processing yet
+    // (Vst3Plugin::prepareState), so process() reads the amount without synchronization.
+    Steinberg::tresult PLUGIN_API setState(Steinberg::IBStream *state) override {
+        std::array<uint32_t, 2> values = {};
+        if (!state || state->read(values.data(), sizeof(values)) != Steinberg::kResultOk ||
+            values[0] != static_cast<uint32_t>(config_.kind)) {
+            return Steinberg::kResultFalse;
+        }
+        config_.amount = values[1];
+        allocate();
+        return Steinberg::kResultOk;
+    }
+    Steinberg::tresult PLUGIN_API getState(Steinberg::IBStream *state) override {
+        std::array<uint32_t, 2> values = {static_cast<uint32_t>(config_.kind), config_.amount};
+        return state ? state->write(values.data(), sizeof(values)) : Steinberg::kInvalidArgument;
+    }
+
+    // IAudioProcessor : Takes any arrangement of up to MaxChannels channels for each bus
+    Steinberg::tresult PLUGIN_API setBusArrangements(Steinberg::Vst::SpeakerArrangement *inputs,
+                                                     const Steinberg::int32               numIns,
+                                                     Steinberg::Vst::SpeakerArrangement *outputs,
+                                                     const Steinberg::int32               numOuts) override {
+        const auto valid = [](const Steinberg::Vst::SpeakerArrangement arr) {
+            const Steinberg::int32 n = Steinberg::Vst::SpeakerArr::getChannelCount(arr);
+            return n >= 1 && n <= static_cast<Steinberg::int32>(MaxChannels);
+        };
+        if (numIns != static_cast<Steinberg::int32>(inputArrs_.size()) ||
+            numOuts != static_cast<Steinberg::int32>(outputArrs_.size()) ||
+            !std::all_of(inputs, inputs + numIns, valid) || !std::all_of(outputs, outputs + numOuts, valid)) {
+            return Steinberg::kResultFalse;
+        }
+        std::copy_n(inputs, numIns, inputArrs_.begin());
+        std::copy_n(outputs, numOuts, outputArrs_.begin());
+        return Steinberg::kResultTrue;
+    }
+    Steinberg::tresult PLUGIN_API getBusArrangement(const Steinberg::Vst::BusDirection dir,
+                                                    const Steinberg::int32             index,
+                                                    Steinberg::Vst::SpeakerArrangement &arr) override {
+        const std::vector<Steinberg::Vst::SpeakerArrangement> &arrs = getArrangements(dir);
+        if (index < 0 || index >= static_cast<Steinberg::int32>(arrs.size())) {
+            return Steinberg::kInvalidArgument;
+        }
+        arr = arrs[index];
+        return Steinberg::kResultOk;
+    }
+    Steinberg::tresult PLUGIN_API canProcessSampleSize(const Steinberg::int32 symbolicSampleSize) override {
+        return symbolicSampleSize == Steinberg::Vst::kSample32 ? Steinberg::kResultTrue : Steinberg::kResultFalse;
+    }
+    Steinberg::uint32 PLUGIN_API getLatencySamples() override {
+        return config_.kind == Kind::Delay ? config_.amount : 0;
+    }
+    Steinberg::uint32 PLUGIN_API getTailSamples() override {
+        return config_.kind == Kind::Delay ? config_.amount : Steinberg::Vst::kNoTail; // The delayed signal
+    }
+    Steinberg::tresult PLUGIN_API setProcessing(Steinberg::TBool) override { return Steinberg::kResultOk; }
+
+    // Allocates everything which process() needs, except the memory which the Allocator allocates on purpose.
+    Steinberg::tresult PLUGIN_API setupProcessing(Steinberg::Vst::ProcessSetup &setup) override {
+        sampleRate_ = setup.sampleRate;
+        allocate();
+        return Steinberg::kResultOk;
+    }
+
+    Steinberg::tresult PLUGIN_API process(Steinberg::Vst::ProcessData &data) override {
+        const auto startAt = std::chrono::steady_clock::now();
+        const auto n       = static_cast<size_t>(std::max(data.numSamples, 0));
+        if (data.numOutputs > 0 && data.outputs[0].channelBuffers32) {
+            const Steinberg::Vst::AudioBusBuffers *inp =
+                isEffect() && data.numInputs > 0 && data.inputs[0].channelBuffers32 ? &data.inputs[0] : nullptr;
+            Steinberg::Vst::AudioBusBuffers &out = data.outputs[0];
+            const Steinberg::Vst::AudioBusBuffers *sidechain =
+                config_.kind == Kind::Ducker && data.numInputs > 1 && data.inputs[1].channelBuffers32 &&
+                        data.inputs[1].numChannels > 0
+                    ? &data.inputs[1]
+                    : nullptr;
+            for (Steinberg::int32 iChannel = 0; iChannel < out.numChannels; ++iChannel) {
+                float *dst = out.channelBuffers32[iChannel];
+                if (inp && iChannel < inp->numChannels && config_.kind == Kind::Delay && config_.amount > 0) {
+                    delay(inp->channelBuffers32[iChannel], dst, n, static_cast<size_t>(iChannel));
+                } else if (inp && iChannel < inp->numChannels) {
+                    std::memmove(dst, inp->channelBuffers32[iChannel], n * sizeof(float));
+                } else if (config_.kind == Kind::NotePlayer) {
+                    renderNotes(out, iChannel, n, data.inputEvents);
+                } else if (!isEffect()) {
+                    renderSine(out, iChannel, n, 1);
+                } else {
+                    std::fill_n(dst, n, 0.0f);
+                }
+                if (sidechain) {
+                    duck(dst, sidechain->channelBuffers32[std::min(iChannel, sidechain->numChannels - 1)], n);
+                }
+            }
+            out.silenceFlags = 0;
+        }
+        // The aux outputs of Drums play the higher sines
+        for (Steinberg::int32 iBus = 1; config_.kind == Kind::Drums && iBus < data.numOutputs; ++iBus) {
+            Steinberg::Vst::AudioBusBuffers &out = data.outputs[iBus];
+            for (Steinberg::int32 iChannel = 0; out.channelBuffers32 && iChannel < out.numChannels; ++iChannel) {
+                renderSine(out, iChannel, n, static_cast<unsigned>(iBus) + 1);
+            }
+            out.silenceFlags = 0;
+        }
+        phase_    = std::fmod(phase_ + static_cast<double>(n) * SineHz / sampleRate_, 1.0);
+        delayPos_ = config_.amount > 0 ? (delayPos_ + n) % config_.amount : 0;
+
+        switch (config_.kind) {
+        case Kind::Burner: {
+            const auto endAt = startAt + std::chrono::microseconds(config_.amount);
+            while (std::chrono::steady_clock::now() < endAt) {
+            }
+            break;
+        }
+        case Kind::EventGenerator:
+            emitEvents(data.outputEvents, static_cast<Steinberg::int32>(n));
+            break;
+        case Kind::Allocator:
+            // Each new block replaces (and frees) the block of the previous call.
+            for (size_t i = 0; i < allocations_.size(); ++i) {
+                allocations_[i]    = std::make_unique<std::byte[]>(AllocationBytes);
+                allocations_[i][0] = static_cast<std::byte>(i);
+            }
+            break;
+        default:
+            break;
+        }
+
+        const auto endAt = std::chrono::steady_clock::now();
+        stats_.processNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(endAt - startAt).count(),
+                                   std::memory_order_relaxed);
+        stats_.nBlocks.fetch_add(1, std::memory_order_relaxed);
+        return Steinberg::kResultOk;
+    }
+
+    // IEditController : No parameters and no editor
+    Steinberg::tresult PLUGIN_API setComponentState(Steinberg::IBStream *) override { return Steinberg::kResultOk; }
+    Steinberg::int32 PLUGIN_API   getParameterCount() override { return 0; }
+    Steinberg::tresult PLUGIN_API getParameterInfo(Steinberg::int32, Steinberg::Vst::ParameterInfo &) override {
+        return Steinberg::kInvalidArgument;
+    }
+    Steinberg::tresult PLUGIN_API getParamStringByValue(Steinberg::Vst::ParamID, Steinberg::Vst::ParamValue,
+                                                        Steinberg::Vst::String128) override {
+        return Steinberg::kInvalidArgument;
+    }
+    Steinberg::tresult PLUGIN_API getParamValueByString(Steinberg::Vst::ParamID, Steinberg::Vst::TChar *,
+                                                        Steinberg::Vst::ParamValue &) override {
+        return Steinberg::kInvalidArgument;
+    }
+    Steinberg::Vst::ParamValue PLUGIN_API normalizedParamToPlain(Steinberg::Vst::ParamID,
+                                                                 const Steinberg::Vst::ParamValue value) override {
+        return value;
+    }
+    Steinberg::Vst::ParamValue PLUGIN_API plainParamToNormalized(Steinberg::Vst::ParamID,
+                                                                 const Steinberg::Vst::ParamValue value) override {
+        return value;
+    }
+    Steinberg::Vst::ParamValue PLUGIN_API getParamNormalized(Steinberg::Vst::ParamID) override { return 0.0; }
+
+    Steinberg::tresult PLUGIN_API setParamNormalized(Steinberg::Vst::ParamID, Steinberg::Vst::ParamValue) override {
+        return Steinberg::kInvalidArgument;
+    }
+    Steinberg::tresult PLUGIN_API setComponentHandler(Steinberg::Vst::IComponentHandler *) override {
+        return Steinberg::kResultOk;
+    }
+    Steinberg::IPlugView *PLUGIN_API createView(Steinberg::FIDString) override { return nullptr; }
+
+  private:
+    static constexpr double SineHz          = 440.0;
+    static constexpr float  SineGain        = 0.1f;
+    static constexpr size_t AllocationBytes = 4096;
+    static constexpr size_t MaxChannels     = 8;  // Of each bus, and of the delay line
+    static constexpr size_t MaxBuses        = 16; // Output buses of Drums
+    static constexpr size_t MaxVoices       = 16; // Held notes of NotePlayer
+
+    // Held note of NotePlayer. velocity 0 : Free
+    struct Voice {
+        Steinberg::int16 pitch;
+        float            velocity;
+        double           phase; // 0.0 - 1.0
+        double           delta; // Per sample
+    };
+
+    [[nodiscard]] bool isEffect() const {
+        return config_.kind != Kind::EventGenerator && config_.kind != Kind::Drums && config_.kind != Kind::NotePlayer;
+    }
+
+    // Arrangements of the audio buses. Stereo until the host sets others.
+    [[nodiscard]] std::vector<Steinberg::Vst::SpeakerArrangement> &getArrangements(
+        const Steinberg::Vst::BusDirection dir) {
+        return dir == Steinberg::Vst::kInput ? inputArrs_ : outputArrs_;
+    }
+
+    void allocate() {
+        allocations_.resize(config_.kind == Kind::Allocator ? config_.amount : 0);
+        delayLine_.assign(config_.kind == Kind::Delay ? size_t{config_.amount} * MaxChannels : 0, 0.0f);
+        delayPos_ = 0;
+    }
+
+    // Exchanges each sample with the one which was written `amount` frames ago
+    void delay(const float *inp, float *dst, const size_t n, const size_t iChannel) {
+        if (iChannel >= MaxChannels) {
+            std::fill_n(dst, n, 0.0f);
+            return;
+        }
+        float *line = delayLine_.data() + iChannel * config_.amount;
+        for (size_t i = 0, pos = delayPos_; i < n; ++i, pos = pos + 1 == config_.amount ? 0 : pos + 1) {
+            dst[i]    = line[pos];
+            line[pos] = inp[i];
+        }
+    }
+
+    // Plays a sine of `harmonic` times SineHz on one channel of the bus. The other channels copy the first one.
+    void renderSine(const Steinberg::Vst::AudioBusBuffers &out, const Steinberg::int32 iChannel, const size_t n,
+                    const unsigned harmonic) const {
+        float *dst = out.channelBuffers32[iChannel];
+        if (iChannel > 0) {
+            std::memcpy(dst, out.channelBuffers32[0], n * sizeof(float));
+            return;
+        }
+        const double delta = harmonic * SineHz / sampleRate_;
+        for (size_t i = 0; i < n; ++i) {
+            const double phase = harmonic * phase_ + delta * static_cast<double>(i);
+            dst[i]             = SineGain * static_cast<float>(sinTurn(phase - std::floor(phase)));
+        }
+    }
+
+    // Plays the held notes on one channel of the bus. Each event takes effect at its sample offset, so the output
+    // follows the timing of the events to the sample. The other channels copy the first one.
+    void renderNotes(const Steinberg::Vst::AudioBusBuffers &out, const Steinberg::int32 iChannel, const size_t n,
+                     Steinberg::Vst::IEventList *inputEvents) {
+        float *dst = out.channelBuffers32[iChannel];
+        if (iChannel > 0) {
+            std::memcpy(dst, out.channelBuffers32[0], n * sizeof(float));
+            return;
+        }
+        const Steinberg::int32 nEvents = inputEvents ? inputEvents->getEventCount() : 0;
+        size_t                 pos     = 0;
+        for (Steinberg::int32 iEvent = 0; iEvent <= nEvents; ++iEvent) {
+            Steinberg::Vst::Event e   = {};
+            const bool            has = iEvent < nEvents && inputEvents->getEvent(iEvent, e) == Steinberg::kResultOk;
+            const size_t          end = has ? std::clamp<size_t>(std::max(e.sampleOffset, 0), pos, n) : n;
+            for (; pos < end; ++pos) {
+                float sum = 0.0f;
+                for (Voice &v : voices_) {
+                    if (v.velocity > 0.0f) {
+                        sum += v.velocity * static_cast<float>(sinTurn(v.phase));
+                        v.phase += v.delta;
+                        if (v.phase >= 1.0) {
+                            v.phase -= 1.0;
+                        }
+                    }
+                }
+                dst[pos] = SineGain * sum;
+            }
+            if (has) {
+                playNote(e);
+            }
+        }
+    }
+
+    // The sines avoid the math library, so that they render the same samples on every platform and the golden hashes
+    // of the tests can be shared. sin(2 pi x) of a phase x in [0, 1) : The phase is folded into [-1/4, 1/4], where the
+    // Taylor series up to the 13th power is exact to 1e-9.
+    [[nodiscard]] static double sinTurn(const double x) {
+        const double t  = x < 0.25 ? x : (x < 0.75 ? 0.5 - x : x - 1.0);
+        const double y  = 2.0 * std::numbers::pi * t;
+        const double y2 = y * y;
+        static constexpr std::array<double, 7> Terms = {
+            1.0 / 6227020800.0, -1.0 / 39916800.0, 1.0 / 362880.0, -1.0 / 5040.0, 1.0 / 120.0, -1.0 / 6.0, 1.0,
+        };
+        double sum = 0.0;
+        for (const double term : Terms) {
+            sum = sum * y2 + term;
+        }
+        return y * sum;
+    }
+
+    // Frequency of a note relative to A4 (pitch 69) : The ratio of the semitone times a power of 2, which is exact
+    [[nodiscard]] static double noteRatio(const Steinberg::int16 pitch) {
+        static constexpr std::array<double, 12> Semitones = {
+            1.0,                1.0594630943592953, 1.122462048309373,  1.189207115002721,
+            1.2599210498948732, 1.3348398541700344, 1.4142135623730951, 1.4983070768766815,
+            1.5874010519681994, 1.681792830507429,  1.7817974362806785, 1.8877486253633868,
+        };
+        const int steps  = pitch - 69;
+        const int octave = steps >= 0 ? steps / 12 : -((11 - steps) / 12);
+        return std::ldexp(Semitones[static_cast<size_t>(steps - octave * 12)], octave);
+    }
+
+    // A note on takes a free voice, or the oldest one if all are held. A note off frees the voices of its pitch.
+    void playNote(const Steinberg::Vst::Event &e) {
+        const bool noteOn  = e.type == Steinberg::Vst::Event::kNoteOnEvent;
+        const bool noteOff = e.type == Steinberg::Vst::Event::kNoteOffEvent;
+        if (noteOn && e.noteOn.velocity > 0.0f) {
+            const Voice voice{
+                .pitch    = e.noteOn.pitch,
+                .velocity = e.noteOn.velocity,
+                .phase    = 0.0,
+                .delta    = SineHz * noteRatio(e.noteOn.pitch) / sampleRate_,
+            };
+            const auto free = std::ranges::find_if(voices_, [](const Voice &v) { return v.velocity == 0.0f; });
+            (free != voices_.end() ? *free : voices_[nVoicesStarted_ % MaxVoices]) = voice;
+            ++nVoicesStarted_;
+        } else if (noteOn || noteOff) { // A note on with velocity 0 is a note off
+            const Steinberg::int16 pitch = noteOff ? e.noteOff.pitch : e.noteOn.pitch;
+            for (Voice &v : voices_) {
+                if (v.pitch == pitch) {
+                    v.velocity = 0.0f;
+                }
+            }
+        }
+    }
+
+    // Ducks the samples by the level of the sidechain
+    static void duck(float *dst, const float *sidechain, const size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            dst[i] *= 1.0f - std::min(std::abs(sidechain[i]), 1.0f);
+        }
+    }
+
+    // Spreads the events evenly over the block. Alternates note on / off over one octave.
+    void emitEvents(Steinberg::Vst::IEventList *outputEvents, const Steinberg::int32 nSamples) {
+        if (!outputEvents) {
+            return;
+        }
+        for (unsigned i = 0; i < config_.amount; ++i, ++nEvents_) {
+            Steinberg::Vst::Event e = {};
+            e.sampleOffset          = static_cast<Steinberg::int32>(i * nSamples / config_.amount);
+            e.flags                 = Steinberg::Vst::Event::kIsLive;
+            const auto pitch        = static_cast<Steinberg::int16>(60 + (nEvents_ / 2) % 12);
+            if (nEvents_ % 2 == 0) {
+                e.type            = Steinberg::Vst::Event::kNoteOnEvent;
+                e.noteOn.pitch    = pitch;
+                e.noteOn.velocity = 0.8f;
+                e.noteOn.noteId   = pitch;
+            } else {
+                e.type             = Steinberg::Vst::Event::kNoteOffEvent;
+                e.noteOff.pitch    = pitch;
+                e.noteOff.velocity = 0.0f;
+                e.noteOff.noteId   = pitch;
+            }
+            outputEvents->addEvent(e);
+        }
+    }
+
+    Config                                          config_;
+    Stats                                          &stats_;
+    std::atomic<uint32_t>                           refCount_   = 1;
+    double                                          sampleRate_ = 48000.0;
+    double                                          phase_      = 0.0;
+    uint64_t                                        nEvents_    = 0;
+    std::array<Voice, MaxVoices>                    voices_{};
+    uint64_t                                        nVoicesStarted_ = 0;
+    std::vector<std::unique_ptr<std::byte[]>>       allocations_;
+    std::vector<float>                              delayLine_; // [channel][amount] frames
+    size_t                                          delayPos_ = 0;
+    std::vector<Steinberg::Vst::SpeakerArrangement> inputArrs_;
+    std::vector<Steinberg::Vst::SpeakerArrangement> outputArrs_;
+}; // class SyntheticPlugin
+
+// Plugin factory of one kind of synthetic plugin. Owned by the host, so its reference counting is dummy.
+class SyntheticPluginFactory final : public Steinberg::IPluginFactory {
+  public:
+    explicit SyntheticPluginFactory(const SyntheticPlugin::Config &config) : config_(config) {}
+    virtual ~SyntheticPluginFactory() = default;
+
+    [[nodiscard]] const SyntheticPlugin::Stats &getStats() const { return stats_; }
+
+    Steinberg::tresult PLUGIN_API getFactoryInfo(Steinberg::PFactoryInfo *info) override {
+        *info = Steinberg::PFactoryInfo("MinimalVst3Host", "", "", Steinberg::PFactoryInfo::kNoFlags);
+        return Steinberg::kResultOk;
+    }
+    Steinberg::int32 PLUGIN_API countClasses() override { return 1; }
+
+    Steinberg::tresult PLUGIN_API getClassInfo(const Steinberg::int32 index, Steinberg::PClassInfo *info) override {
+        if (index != 0) {
+            return Steinberg::kInvalidArgument;
+        }
+        const std::string name = std::string("Synthetic ") + SyntheticPlugin::getKindName(config_.kind);
+        *info                  = Steinberg::PClassInfo(classId(), Steinberg::PClassInfo::kManyInstances,
+                                                       kVstAudioEffectClass, name.c_str());
+        return Steinberg::kResultOk;
+    }
+
+    Steinberg::tresult PLUGIN_API createInstance(Steinberg::FIDString cid, Steinberg::FIDString iid,
+                                                 void **obj) override {
+        if (!Steinberg::FUnknownPrivate::iidEqual(cid, classId())) {
+            *obj = nullptr;
+            return Steinberg::kNoInterface;
+        }
+        auto                    *plugin = new SyntheticPlugin(config_, stats_);
+        const Steinberg::tresult result = plugin->queryInterface(iid, obj);
+        plugin->release();
+        return result;
+    }
+
+  private:
+    static const Steinberg::TUID &classId() {
+        static const Steinberg::TUID cid = INLINE_UID(0x4D696E69, 0x6D616C53, 0x796E7468, 0x506C7567);
+        return cid;
+    }
+
+    uint32_t PLUGIN_API addRef() override { return 1; }
+    uint32_t PLUGIN_API release() override { return 1; }
+
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        if (Steinberg::FUnknownPrivate::iidEqual(tuid, Steinberg::IPluginFactory::iid) ||
+            Steinberg::FUnknownPrivate::iidEqual(tuid, FUnknown::iid)) {
+            *obj = this;
+            return Steinberg::kResultOk;
+        }
+        *obj = nullptr;
+        return Steinberg::kNoInterface;
+    }
+
+    const SyntheticPlugin::Config config_;
+    SyntheticPlugin::Stats        stats_;
+}; // class SyntheticPluginFactory
+
+// Wrapper for the plugin module : A DLL on Windows, a shared object on Linux. Takes a bundle (*.vst3 directory) or
+// the path of the binary itself, and calls the entry and exit functions of the module around its lifetime.
+class Vst3Module final {
+  public:
+    Vst3Module()                              = default;
+    Vst3Module(const Vst3Module &)            = delete;
+    Vst3Module &operator=(const Vst3Module &) = delete;
+    ~Vst3Module() { free(); }
+
+    // Folder of the module binary in a bundle
+#if defined(_WIN32) && MY_ARCH_ARM64
+    static constexpr std::string_view ArchFolder = "arm64-win";
+#elif defined(_WIN32)
+    static constexpr std::string_view ArchFolder = "x86_64-win";
+#elif MY_ARCH_ARM64
+    static constexpr std::string_view ArchFolder = "aarch64-linux";
+#else
+    static constexpr std::string_view ArchFolder = "x86_64-linux";
+#endif
+
+    // Contents/x86_64-win/<name>.vst3 on Windows, Contents/x86_64-linux/<name>.so on Linux. A path which isn't a
+    // directory is the binary itself (e.g. single file modules of older plugins).
+    static std::filesystem::path getBinaryPath(const std::filesystem::path &bundle) {
+        if (!std::filesystem::is_directory(bundle)) {
+            return bundle;
+        }
+#if defined(_WIN32)
+        return bundle / "Contents" / ArchFolder / bundle.filename();
+#else
+        return bundle / "Contents" / ArchFolder / bundle.filename().replace_extension(".so");
+#endif
+    }
+
+    Steinberg::IPluginFactory *load(const std::filesystem::path &bundle) {
+        free();
+        const std::filesystem::path binaryPath = getBinaryPath(bundle);
+        if (!open(binaryPath)) {
+            return nullptr;
+        }
+        if (!enter()) {
+            MY_ERROR(L"The entry function of the module failed, %ls\n", binaryPath.wstring().c_str());
+            free();
+            return nullptr;
+        }
+        entered_                    = true;
+        using GetPluginFactoryProc  = Steinberg::IPluginFactory *(PLUGIN_API *)();
+        const auto getPluginFactory = reinterpret_cast<GetPluginFactoryProc>(getSymbol("GetPluginFactory"));
+        if (!getPluginFactory) {
+            MY_ERROR(L"GetPluginFactory is not exported, %ls\n", binaryPath.wstring().c_str());
+            return nullptr;
+        }
+        return getPluginFactory();
+    }
+
+  private:
+    void free() {
+        if (std::exchange(entered_, false)) {
+            exit();
+        }
+        close();
+    }
+
+#if defined(_WIN32)
+    bool open(const std::filesystem::path &binaryPath) {
+        if (hModule_ = LoadLibraryW(binaryPath.c_str()); !hModule_) {
+            MY_ERROR(L"LoadLibraryW(%ls)\n", binaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (hModule_) {
+            FreeLibrary(std::exchange(hModule_, nullptr));
+        }
+    }
+
+    [[nodiscard]] void *getSymbol(const char *name) const {
+        return reinterpret_cast<void *>(GetProcAddress(hModule_, name));
+    }
+
+    // InitDll() and ExitDll() are optional on Windows
+    [[nodiscard]] bool enter() const {
+        using InitDllProc  = bool (*)();
+        const auto initDll = reinterpret_cast<InitDllProc>(getSymbol("InitDll"));
+        return !initDll || initDll();
+    }
+
+    void exit() const {
+        using ExitDllProc = bool (*)();
+        if (const auto exitDll = reinterpret_cast<ExitDllProc>(getSymbol("ExitDll"))) {
+            (void)exitDll();
+        }
+    }
+
+    HMODULE hModule_ = nullptr;
+#else
+    bool open(const std::filesystem::path &binaryPath) {
+        if (handle_ = dlopen(binaryPath.c_str(), RTLD_LAZY | RTLD_LOCAL); !handle_) {
+            MY_ERROR(L"dlopen(%ls), %hs\n", binaryPath.wstring().c_str(), dlerror());
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (handle_) {
+            dlclose(std::exchange(handle_, nullptr));
+        }
+    }
+
+    [[nodiscard]] void *getSymbol(const char *name) const { return dlsym(handle_, name); }
+
+    // ModuleEntry() and ModuleExit() are required on Linux. ModuleEntry() takes the handle of dlopen().
+    [[nodiscard]] bool enter() const {
+        using ModuleEntryProc  = bool (*)(void *);
+        const auto moduleEntry = reinterpret_cast<ModuleEntryProc>(getSymbol("ModuleEntry"));
+        return moduleEntry && moduleEntry(handle_);
+    }
+
+    void exit() const {
+        using ModuleExitProc = bool (*)();
+        if (const auto moduleExit = reinterpret_cast<ModuleExitProc>(getSymbol("ModuleExit"))) {
+            (void)moduleExit();
+        }
+    }
+
+    void *handle_ = nullptr;
+#endif
+    bool entered_ = false;
+}; // class Vst3Module
+
+// Class that holds the plugin and manages audio processing and GUI
+class Vst3Plugin final {
+  public:
+    // When the editor is created. Open : In init(). Lazy : On openEditor(). None : Never (headless).
+    enum class EditorMode { Open, Lazy, None };
+
+    struct InitParams {
+        unsigned                          index;
+        std::filesystem::path             pluginPath;
+        Steinberg::Vst::IHostApplication *hostApplication;
+        int                               bufferSize;
+        double                            sampleRate;
+        unsigned                          nChannels;     // Of the main audio buses. The plugin may choose others
+        Steinberg::int32                  processMode;   // kRealtime or kOffline
+        Steinberg::IPluginFactory        *pluginFactory; // In-process factory. nullptr : Load it from pluginPath
+        EditorMode                        editorMode;
+    };
+
+    // Audio bus of the plugin, with the channel count of its negotiated arrangement
+    struct AudioBus {
+        unsigned nChannels;
+        bool     aux; // Sidechain input, or extra output (e.g. of a multi-output instrument). Otherwise main
+
+        bool operator==(const AudioBus &) const = default;
+    };
+
+    struct ProcessArgs {
+        std::span<float *>                 vstInChannelPtrs;  // Channels of all input buses, bus after bus
+        std::span<float *>                 vstOutChannelPtrs; // Channels of all output buses, bus after bus
+        unsigned                           nSamples;
+        double                             sampleRate;
+        double                             tempo;
+        Steinberg::Vst::IEventList        *inputEvents;
+        Steinberg::Vst::IEventList        *outputEvents;
+        double                             ppqPosition;
+        Steinberg::int32                   processMode;
+        Steinberg::Vst::IParameterChanges *inputParameterChanges;
+        uint32_t                           stateGeneration;   // A new generation swaps in the prepared state
+        uint64_t                           inputSilenceFlags; // Bit i : vstInChannelPtrs[i] is digital silence
+        bool                               skipIdle;          // process() may be skipped while the plugin is idle
+    };
+    using EventQueue = MpscQueue<TimedEvent, 4096>;
+
+    Vst3Plugin(const InitParams &initParams) { init(initParams); }
+    ~Vst3Plugin() { cleanup(); }
+
+    EventQueue                       &getEventQueue() { return eventQueue_; }
+    ParamChangeQueue                 &getParamChangeQueue() { return myComponentHandler_.getParamChangeQueue(); }
+    const ParamMirror                &getParamMirror() const { return paramMirror_; }
+    const ProcessTiming              &getProcessTiming() const { return processTiming_; }
+    MyParameterChanges               &getOutputParamChanges() { return outParamChanges_; } // Of the last process()
+    [[nodiscard]] bool                hasEventOutput() const { return hasEventOutput_; }
+    [[nodiscard]] bool                good() const { return initialized_; }
+    [[nodiscard]] bool                isEffect() const { return isEffect_; } // Has a main audio input
+    [[nodiscard]] bool                isStateSwitchPending() const { return shadow_ != nullptr; }
+    [[nodiscard]] const std::wstring &getName() const { return name_; }
+    // Audio buses as negotiated by init(). ProcessArgs has the channels of all buses, bus after bus.
+    [[nodiscard]] std::span<const AudioBus> getInputBuses() const { return inputBuses_; }
+    [[nodiscard]] std::span<const AudioBus> getOutputBuses() const { return outputBuses_; }
+    [[nodiscard]] unsigned                  getNumInputChannels() const { return nInputChannels_; }
+    [[nodiscard]] unsigned                  getNumOutputChannels() const { return nOutputChannels_; }
+    // Reported by the plugin (IAudioProcessor::getLatencySamples). Can be read by any thread.
+    [[nodiscard]] uint32_t getLatencySamples() const { return latencySamples_.load(std::memory_order_relaxed); }
+    // Reported by the plugin (IAudioProcessor::getTailSamples). Can be read by any thread.
+    [[nodiscard]] uint32_t getTailSamples() const { return tailSamples_.load(std::memory_order_relaxed); }
+    // Blocks in which process() was skipped because the plugin was idle. Can be read by any thread.
+    [[nodiscard]] uint64_t getSkippedBlocks() const { return skippedBlocks_.load(std::memory_order_relaxed); }
+
+    // Callback when the plugin side requests a GUI resize
+    Steinberg::tresult resizeView(const Steinberg::ViewRect *newSize) const {
+#if defined(_WIN32)
+        const HWND hWnd = hWnd_;
+        if (!hWnd) {
+            return Steinberg::kResultFalse;
+        }
+        RECT       rc      = {0, 0, newSize->right - newSize->left, newSize->bottom - newSize->top};
+        const auto style   = static_cast<DWORD>(GetWindowLongPtrW(hWnd, GWL_STYLE));
+        const auto exStyle = static_cast<DWORD>(GetWindowLongPtrW(hWnd, GWL_EXSTYLE));
+        AdjustWindowRectExForDpi(&rc, style, FALSE, exStyle, GetDpiForWindow(hWnd));
+        constexpr auto uFlags = SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED;
+        SetWindowPos(hWnd, nullptr, 0, 0, rc.right - rc.left, rc.bottom - rc.top, uFlags);
+        return Steinberg::kResultOk;
+#else
+        (void)newSize;
+        return Steinberg::kResultFalse;
+#endif
+    }
+
+    // Creates the editor and its window on the UI thread, or does nothing if it's already open. Plugins without an
+    // editor (e.g. the synthetic ones) run without a window. Returns false if the editor can't be attached.
+    bool openEditor() {
+        if (editorMode_ == EditorMode::None || plugView_) {
+            return true;
+        }
+#if defined(_WIN32)
+        if (plugView_ = vstEditController_->createView(Steinberg::Vst::ViewType::kEditor); !plugView_) {
+            MY_TRACE(L"\"%ls\" has no editor\n", name_.c_str());
+            return true;
+        }
+        return openEditorWindow(index_);
+#else
+        MY_TRACE(L"\"%ls\" : Editors aren't supported on this platform\n", name_.c_str());
+        return true;
+#endif
+    }
+
+    // Detaches the editor and destroys its window. The plugin keeps processing audio.
+    void closeEditor() {
+        if (plugView_) {
+            plugView_->removed();
+            plugView_->setFrame(nullptr);
+            plugView_ = nullptr;
+        }
+#if defined(_WIN32)
+        if (const HWND hWnd = std::exchange(hWnd_, nullptr)) {
+            DestroyWindow(hWnd);
+        }
+#endif
+    }
+
+    // UI thread : Appends the state of the component, then the state of the controller to the arena. componentSize
+    // is the size of the former. The component may be processing, as the VST3 threading model allows.
+    bool saveState(std::vector<uint8_t> &arena, size_t &componentSize) const {
+        const size_t   begin = arena.size();
+        MyMemoryStream componentStream(arena);
+        if (vstComponent_->getState(&componentStream) != Steinberg::kResultOk) {
+            arena.resize(begin);
+            MY_ERROR(L"\"%ls\" : getState() of the component failed\n", name_.c_str());
+            return false;
+        }
+        componentSize = arena.size() - begin;
+        // Not every controller has a state of its own. A single component has one state for both.
+        if (isSameObject(vstComponent_, vstEditController_)) {
+            return true;
+        }
+        if (MyMemoryStream controllerStream(arena);
+            vstEditController_->getState(&controllerStream) != Steinberg::kResultOk) {
+            arena.resize(begin + componentSize);
+        }
+        return true;
+    }
+
+    // UI thread : Creates a shadow instance of the plugin off the audio thread, and restores the states into it. The
+    // audio thread swaps the shadow in at the first block of the next state generation (ProcessArgs::stateGeneration),
+    // so the current instance keeps playing meanwhile, and the switch needs no reload of the module.
+    // Returns false if a switch is already pending, or the shadow can't be created or doesn't take the state.
+    bool prepareState(const std::span<const uint8_t> componentState, const std::span<const uint8_t> controllerState) {
+        if (shadow_) {
+            MY_ERROR(L"\"%ls\" : A state switch is already pending\n", name_.c_str());
+            return false;
+        }
+        InitParams shadowParams    = initParams_;
+        shadowParams.pluginFactory = pluginFactory_.get();
+        shadowParams.editorMode    = EditorMode::None;
+        auto shadow                = std::make_unique<Vst3Plugin>(shadowParams);
+        if (!shadow->good() || shadow->isEffect_ != isEffect_ || shadow->hasEventOutput_ != hasEventOutput_ ||
+            shadow->inputBuses_ != inputBuses_ || shadow->outputBuses_ != outputBuses_) {
+            MY_ERROR(L"\"%ls\" : Can't create the shadow instance\n", name_.c_str());
+            return false;
+        }
+        if (MyMemoryStream componentStream(componentState);
+            shadow->vstComponent_->setState(&componentStream) != Steinberg::kResultOk) {
+            MY_ERROR(L"\"%ls\" : setState() of the component failed\n", name_.c_str());
+            return false;
+        }
+        if (!isSameObject(shadow->vstComponent_, shadow->vstEditController_)) {
+            Steinberg::Vst::IEditController *controller = shadow->vstEditController_.get();
+            if (MyMemoryStream componentStream(componentState);
+                controller->setComponentState(&componentStream) != Steinberg::kResultOk) {
+                MY_TRACE(L"\"%ls\" : setComponentState() of the controller failed\n", name_.c_str());
+            }
+            if (MyMemoryStream controllerStream(controllerState);
+                !controllerState.empty() && controller->setState(&controllerStream) != Steinberg::kResultOk) {
+                MY_TRACE(L"\"%ls\" : setState() of the controller failed\n", name_.c_str());
+            }
+        }
+        pendingProcessor_.store(shadow->vstAudioProcessor_.get(), std::memory_order_release);
+        shadow_ = std::move(shadow);
+        return true;
+    }
+
+    // UI thread : Drops a prepared state before its generation has started
+    void cancelStateSwitch() {
+        if (pendingProcessor_.exchange(nullptr, std::memory_order_acq_rel)) {
+            shadow_.reset();
+        }
+    }
+
+    // UI thread : Completes the switch after the audio thread has swapped the shadow in. The current instance becomes
+    // the shadow and is released, and an open editor is reopened on the new instance. Returns true if it has completed.
+    bool finishStateSwitch() {
+        if (!shadow_ || !retiredProcessor_.exchange(nullptr, std::memory_order_acquire)) {
+            return false;
+        }
+        const bool editorOpen = plugView_ != nullptr;
+        closeEditor();
+        std::swap(vstComponent_, shadow_->vstComponent_);
+        std::swap(vstEditController_, shadow_->vstEditController_);
+        std::swap(vstAudioProcessor_, shadow_->vstAudioProcessor_);
+        vstEditController_->setComponentHandler(&myComponentHandler_);
+        shadow_.reset();
+        uiParamsVersion_ = 0;
+        (void)readLatency(); // The new instance may have another latency and tail
+        if (editorOpen && !openEditor()) {
+            MY_ERROR(L"Can't reopen the editor of \"%ls\"\n", name_.c_str());
+        }
+        return true;
+    }
+
+    // UI thread : Restarts the plugin after it has reported a new latency (restartComponent(kLatencyChanged)). The
+    // audio thread suspends the plugin at the next block, then it's deactivated and reactivated as the VST3 spec
+    // requires, and its latency is read again. Polled by the UI loop. Returns true if the latency has changed.
+    bool updateLatency() {
+        // The restart waits for a state switch to complete, so that it restarts the instance which is processing
+        if (!shadow_ && restart_.load(std::memory_order_relaxed) == Restart::None &&
+            myComponentHandler_.takeLatencyChanged()) {
+            restart_.store(Restart::Requested, std::memory_order_release);
+        }
+        if (restart_.load(std::memory_order_acquire) != Restart::Suspended) {
+            return false;
+        }
+        vstAudioProcessor_->setProcessing(false);
+        vstComponent_->setActive(false);
+        vstComponent_->setActive(true);
+        vstAudioProcessor_->setProcessing(true);
+        restart_.store(Restart::None, std::memory_order_release);
+        return readLatency();
+    }
+
+    // Processes one block. Returns true if the output is digital silence.
+    //
+    // A plugin is idle when its input has been silent, without events and parameter changes, for longer than its
+    // latency plus its tail (the signal still inside the plugin), and its last output was silent. Then process() is
+    // skipped (ProcessArgs::skipIdle) and the output is silent, until the next event, parameter change or signal wakes
+    // the plugin up in the same block. Plugins with an event output or an infinite tail may play without input, so
+    // they're never idle.
+    bool audioThreadVstProcess(const ProcessArgs &processArgs) {
+        const RtSafetyChecker::Scope rtScope(index_);
+        // The UI thread is restarting the plugin (updateLatency), so its output is silent meanwhile
+        if (Restart restart = restart_.load(std::memory_order_acquire); restart != Restart::None) {
+            if (restart == Restart::Requested) {
+                restart_.store(Restart::Suspended, std::memory_order_release);
+            }
+            return silence(processArgs);
+        }
+        // Block boundary of a state switch : The retired processor isn't called anymore. Also while the plugin is idle,
+        // so a switch completes in a quiet session.
+        if (processArgs.stateGeneration != stateGeneration_) {
+            stateGeneration_ = processArgs.stateGeneration;
+            if (Steinberg::Vst::IAudioProcessor *p = pendingProcessor_.exchange(nullptr, std::memory_order_acquire)) {
+                retiredProcessor_.store(std::exchange(audioProcessor_, p), std::memory_order_release);
+            }
+        }
+        const uint64_t inputMask = getChannelMask(static_cast<int32_t>(nInputChannels_));
+        const bool     quiet     = (processArgs.inputSilenceFlags & inputMask) == inputMask &&
+                               (!processArgs.inputEvents || processArgs.inputEvents->getEventCount() == 0) &&
+                               (!processArgs.inputParameterChanges ||
+                                processArgs.inputParameterChanges->getParameterCount() == 0);
+        const uint64_t quietFrames = quietFrames_; // Before this block
+        quietFrames_               = quiet ? quietFrames + processArgs.nSamples : 0;
+        const uint32_t tail        = tailSamples_.load(std::memory_order_relaxed);
+        if (processArgs.skipIdle && quiet && outputSilent_ && !hasEventOutput_ &&
+            tail != Steinberg::Vst::kInfiniteTail && quietFrames > uint64_t{getLatencySamples()} + tail) {
+            skippedBlocks_.store(skippedBlocks_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return silence(processArgs);
+        }
+        const std::span<float *>           vstInChannelPtrs      = processArgs.vstInChannelPtrs;
+        const std::span<float *>           vstOutChannelPtrs     = processArgs.vstOutChannelPtrs;
+        const unsigned                     nSamples              = processArgs.nSamples;
+        const double                       sampleRate            = processArgs.sampleRate;
+        const double                       tempo                 = processArgs.tempo;
+        Steinberg::Vst::IEventList        *inputEvents           = processArgs.inputEvents;
+        Steinberg::Vst::IEventList        *outputEvents          = processArgs.outputEvents;
+        const double                       ppqPosition           = processArgs.ppqPosition;
+        const Steinberg::int32             processMode           = processArgs.processMode;
+        Steinberg::Vst::IParameterChanges *inputParameterChanges = processArgs.inputParameterChanges;
+
+        // The channels of each bus are a part of the channel pointers
+        for (size_t iBus = 0, iChannel = 0; iBus < inputBusBuffers_.size(); ++iBus) {
+            Steinberg::Vst::AudioBusBuffers &bus   = inputBusBuffers_[iBus];
+            const uint64_t                   flags = iChannel < 64 ? processArgs.inputSilenceFlags >> iChannel : 0;
+            bus.numChannels                        = static_cast<int32_t>(inputBuses_[iBus].nChannels);
+            bus.silenceFlags                       = flags & getChannelMask(bus.numChannels);
+            bus.channelBuffers32                   = vstInChannelPtrs.data() + iChannel;
+            iChannel += inputBuses_[iBus].nChannels;
+        }
+        for (size_t iBus = 0, iChannel = 0; iBus < outputBusBuffers_.size(); ++iBus) {
+            Steinberg::Vst::AudioBusBuffers &bus = outputBusBuffers_[iBus];
+            bus.numChannels                      = static_cast<int32_t>(outputBuses_[iBus].nChannels);
+            bus.silenceFlags                     = 0;
+            bus.channelBuffers32                 = vstOutChannelPtrs.data() + iChannel;
+            iChannel += outputBuses_[iBus].nChannels;
+        }
+
+        Steinberg::Vst::ProcessContext context = {};
+        context.state      = Steinberg::Vst::ProcessContext::kPlaying | Steinberg::Vst::ProcessContext::kTempoValid |
+                             Steinberg::Vst::ProcessContext::kProjectTimeMusicValid;
+        context.sampleRate = sampleRate;
+        context.projectTimeMusic = ppqPosition;
+        context.tempo            = tempo;
+
+        Steinberg::Vst::ProcessData vstProcessData = {};
+        vstProcessData.processMode                 = processMode;
+        vstProcessData.symbolicSampleSize          = Steinberg::Vst::kSample32;
+        vstProcessData.numInputs                   = static_cast<int32_t>(inputBusBuffers_.size());
+        vstProcessData.inputs                      = inputBusBuffers_.empty() ? nullptr : inputBusBuffers_.data();
+        vstProcessData.numOutputs                  = static_cast<int32_t>(outputBusBuffers_.size());
+        vstProcessData.outputs                     = outputBusBuffers_.empty() ? nullptr : outputBusBuffers_.data();
+        vstProcessData.inputEvents                 = inputEvents;
+        vstProcessData.outputEvents                = outputEvents;
+        vstProcessData.inputParameterChanges       = inputParameterChanges;
+        vstProcessData.outputParameterChanges      = &outParamChanges_;
+        vstProcessData.processContext              = &context;
+        vstProcessData.numSamples                  = static_cast<int>(nSamples);
+        outParamChanges_.clear();
+        MY_TRACE_SPAN(processSpan, traceName_);
+        const uint64_t startTicks = CycleClock::now();
+        audioProcessor_->process(vstProcessData);
+        MY_TRACE_END(processSpan);
+        processTiming_.record(CycleClock::toNs(CycleClock::now() - startTicks),
+                              static_cast<uint64_t>(1e9 * nSamples / sampleRate));
+        paramMirror_.publish(outParamChanges_);
+
+        // Not every plugin sets the silence flags, so the output is also checked. The check stops at the first sample
+        // of a playing signal. A channel flagged as silent is cleared, since the host may have left another signal in
+        // its buffer (ProcessGraph shares the memory of buffers which aren't in use at the same time).
+        bool silent = true;
+        for (const Steinberg::Vst::AudioBusBuffers &bus : outputBusBuffers_) {
+            for (int32_t iChannel = 0; iChannel < bus.numChannels; ++iChannel) {
+                float *p = bus.channelBuffers32[iChannel];
+                if (iChannel < 64 && (bus.silenceFlags >> iChannel) & 1) {
+                    std::fill_n(p, nSamples, 0.0f);
+                } else if (silent) {
+                    silent = std::all_of(p, p + nSamples, [](const float x) { return x == 0.0f; });
+                }
+            }
+        }
+        outputSilent_ = silent;
+        return outputSilent_;
+    }
+
+    // UI thread : Passes the latest output parameter values (meters etc.) to the controller, so the editor shows them.
+    void syncOutputParams() {
+        if (!paramMirror_.read(uiParams_) || uiParams_.version == uiParamsVersion_) {
+            return;
+        }
+        uiParamsVersion_ = uiParams_.version;
+        for (unsigned i = 0; i < uiParams_.nParams; ++i) {
+            vstEditController_->setParamNormalized(uiParams_.params[i].id, uiParams_.params[i].value);
+        }
+    }
+
+  private:
+    // Latency restart of updateLatency(). Requested by the UI thread, Suspended by the audio thread.
+    enum class Restart { None, Requested, Suspended };
+
+    // Returns true if the latency has changed. The tail is read along with it, since both are valid after activation.
+    // The audio thread reads the tail at the next block, after a restart or a state switch.
+    bool readLatency() {
+        tailSamples_.store(vstAudioProcessor_->getTailSamples(), std::memory_order_relaxed);
+        const uint32_t latency = vstAudioProcessor_->getLatencySamples();
+        return latencySamples_.exchange(latency, std::memory_order_relaxed) != latency;
+    }
+
+    // Sets the speaker arrangements of the audio buses : nChannels on the main buses, and the plugin's own default on
+    // the aux buses. A plugin which refuses them is asked for its arrangements, which are set instead. Then the
+    // buses of the plugin are known, and the bus buffers of process() are allocated.
+    bool negotiateBuses(const unsigned nChannels) {
+        using namespace Steinberg::Vst;
+        std::array<std::vector<SpeakerArrangement>, 2> arrs;  // [BusDirection]
+        std::array<std::vector<BusInfo>, 2>            infos; // [BusDirection]
+        for (const BusDirection dir : {kInput, kOutput}) {
+            for (int32_t iBus = 0, nBuses = vstComponent_->getBusCount(kAudio, dir); iBus < nBuses; ++iBus) {
+                BusInfo info = {};
+                if (vstComponent_->getBusInfo(kAudio, dir, iBus, info) != Steinberg::kResultOk) {
+                    MY_ERROR(L"\"%ls\", getBusInfo(%d, %d)\n", name_.c_str(), dir, iBus);
+                    return false;
+                }
+                infos[dir].push_back(info);
+                arrs[dir].push_back(info.busType == kMain
+                                        ? getSpeakerArrangement(nChannels)
+                                        : getSpeakerArrangement(static_cast<unsigned>(std::max(info.channelCount, 1))));
+            }
+        }
+        const auto setBusArrangements = [&] {
+            std::vector<SpeakerArrangement> &inp = arrs[kInput];
+            std::vector<SpeakerArrangement> &out = arrs[kOutput];
+            return vstAudioProcessor_->setBusArrangements(inp.data(), static_cast<int32_t>(inp.size()), out.data(),
+                                                          static_cast<int32_t>(out.size()));
+        };
+        if (setBusArrangements() != Steinberg::kResultTrue) {
+            for (const BusDirection dir : {kInput, kOutput}) {
+                for (size_t iBus = 0; iBus < arrs[dir].size(); ++iBus) {
+                    vstAudioProcessor_->getBusArrangement(dir, static_cast<int32_t>(iBus), arrs[dir][iBus]);
+                }
+            }
+            (void)setBusArrangements();
+            MY_TRACE(L"\"%ls\" refused %u channels and keeps its own bus arrangements\n", name_.c_str(), nChannels);
+        }
+        for (const BusDirection dir : {kInput, kOutput}) {
+            std::vector<AudioBus> &buses = dir == kInput ? inputBuses_ : outputBuses_;
+            unsigned              &total = dir == kInput ? nInputChannels_ : nOutputChannels_;
+            buses.clear();
+            total = 0;
+            for (size_t iBus = 0; iBus < arrs[dir].size(); ++iBus) {
+                const auto n = static_cast<unsigned>(SpeakerArr::getChannelCount(arrs[dir][iBus]));
+                buses.push_back({.nChannels = n, .aux = infos[dir][iBus].busType != kMain});
+                total += n;
+            }
+        }
+        isEffect_ = std::ranges::any_of(inputBuses_, [](const AudioBus &bus) { return !bus.aux; });
+        inputBusBuffers_.assign(inputBuses_.size(), {});
+        outputBusBuffers_.assign(outputBuses_.size(), {});
+        return true;
+    }
+
+    static uint64_t getChannelMask(const int32_t nChannels) {
+        return nChannels >= 64 ? ~uint64_t{0} : (uint64_t{1} << nChannels) - 1;
+    }
+
+    // Audio thread : Outputs silence instead of calling process(). Returns true, like audioThreadVstProcess().
+    bool silence(const ProcessArgs &processArgs) {
+        for (float *p : processArgs.vstOutChannelPtrs) {
+            std::fill_n(p, processArgs.nSamples, 0.0f);
+        }
+        outParamChanges_.clear();
+        outputSilent_ = true;
+        return true;
+    }
+
+    // Check if pointers refer to the same object (retrieve and compare IUnknown pointers)
+    static bool isSameObject(const auto &p0, const auto &p1) {
+        Steinberg::IPtr<Steinberg::FUnknown> u0;
+        Steinberg::IPtr<Steinberg::FUnknown> u1;
+        p0->queryInterface(Steinberg::FUnknown::iid, reinterpret_cast<void **>(&u0));
+        p1->queryInterface(Steinberg::FUnknown::iid, reinterpret_cast<void **>(&u1));
+        return u0 == u1;
+    }
+
+    void init(const InitParams &initParams) {
+        index_       = initParams.index;
+        vst3DllPath_ = initParams.pluginPath;
+        initParams_  = initParams;
+
+        // The sequence for initialization and setup is complex.
+        // Refer to the left side (downward arrows) of: Audio Processor Call Sequence
+        // https://steinbergmedia.github.io/vst3_dev_portal/pages/Technical+Documentation/Workflow+Diagrams/Audio+Processor+Call+Sequence.html
+        {
+            // Kept for the shadow instances of the state switches
+            pluginFactory_ = initParams.pluginFactory ? initParams.pluginFactory : vst3Module_.load(vst3DllPath_);
+            Steinberg::IPluginFactory *pluginFactory = pluginFactory_.get();
+            if (!pluginFactory) {
+                return MY_ERROR(L"pluginPath=%ls, vst3Module_.load()\n", vst3DllPath_.wstring().c_str());
+            }
+
+            // Create Component (Audio Engine / Processor)
+            for (int iClass = 0, nClass = pluginFactory->countClasses(); iClass < nClass; ++iClass) {
+                Steinberg::PClassInfo c;
+                pluginFactory->getClassInfo(iClass, &c);
+                if (strcmp(c.category, kVstAudioEffectClass) == 0) {
+                    std::string str(c.name);
+                    name_ = std::wstring(str.begin(), str.end());
+                    if (TraceRecorder::isEnabled()) {
+                        traceName_ = TraceRecorder::intern("process [#" + std::to_string(index_) + "] " + str);
+                    }
+                    pluginFactory->createInstance(c.cid, Steinberg::Vst::IComponent::iid,
+                                                  reinterpret_cast<void **>(&vstComponent_));
+                    break;
+                }
+            }
+            if (!vstComponent_) {
+                return MY_ERROR(L"pluginPath=%ls, vstComponent_ == %p\n", vst3DllPath_.wstring().c_str(),
+                                vstComponent_.get());
+            }
+
+            // Initialize Component. IComponent::initialize must be called first
+            vstComponent_->initialize(initParams.hostApplication);
+            hasEventOutput_ = vstComponent_->getBusCount(Steinberg::Vst::kEvent, Steinberg::Vst::kOutput) > 0;
+
+            // Create GUI Controller (Edit Controller)
+            if (Steinberg::TUID id; vstComponent_->getControllerClassId(id) == Steinberg::kResultOk) {
+                pluginFactory->createInstance(id, Steinberg::Vst::IEditController::iid,
+                                              reinterpret_cast<void **>(&vstEditController_));
+            }
+        }
+        if (!vstEditController_) {
+            // If the controller isn't created yet, check if the component itself
+            // implements it
+            vstComponent_->queryInterface(Steinberg::Vst::IEditController::iid,
+                                          reinterpret_cast<void **>(&vstEditController_));
+        }
+        if (!vstEditController_) {
+            return MY_ERROR(L"pluginPath=%ls, vstEditController_=%p\n", vst3DllPath_.wstring().c_str(),
+                            vstEditController_.get());
+        }
+        if (!isSameObject(vstComponent_, vstEditController_)) {
+            vstEditController_->initialize(initParams.hostApplication);
+        }
+        vstEditController_->setComponentHandler(&myComponentHandler_);
+
+        // Connection for parameter synchronization between the processing side and UI side Connection is not needed
+        // if they are the same object (Single Component)
+        if (!isSameObject(vstComponent_, vstEditController_)) {
+            Steinberg::IPtr<Steinberg::Vst::IConnectionPoint> cp1;
+            vstComponent_->queryInterface(Steinberg::Vst::IConnectionPoint::iid, reinterpret_cast<void **>(&cp1));
+            if (!cp1) {
+                return MY_ERROR(L"pluginPath=%ls, cp1=%p\n", vst3DllPath_.wstring().c_str(), cp1.get());
+            }
+
+            Steinberg::IPtr<Steinberg::Vst::IConnectionPoint> cp2;
+            vstEditController_->queryInterface(Steinberg::Vst::IConnectionPoint::iid, reinterpret_cast<void **>(&cp2));
+            if (!cp2) {
+                return MY_ERROR(L"pluginPath=%ls, cp2=%p\n", vst3DllPath_.wstring().c_str(), cp2.get());
+            }
+
+            cp1->connect(cp2);
+            cp2->connect(cp1);
+        }
+
+        vstComponent_->queryInterface(Steinberg::Vst::IAudioProcessor::iid,
+                                      reinterpret_cast<void **>(&vstAudioProcessor_));
+        if (!vstAudioProcessor_) {
+            return MY_ERROR(L"pluginPath=%ls, vstComponent_->queryInterface()\n", vst3DllPath_.wstring().c_str());
+        }
+        audioProcessor_ = vstAudioProcessor_.get();
+
+        if (!negotiateBuses(initParams.nChannels)) {
+            return;
+        }
+        {
+            Steinberg::Vst::ProcessSetup processSetup = {.processMode        = initParams.processMode,
+                                                         .symbolicSampleSize = Steinberg::Vst::kSample32,
+                                                         .maxSamplesPerBlock = initParams.bufferSize,
+                                                         .sampleRate         = initParams.sampleRate};
+            vstAudioProcessor_->setupProcessing(processSetup);
+        }
+
+        // Activate Buses. All audio buses are activated, so the aux buses (sidechain inputs, extra outputs) are
+        // processed too. Of the event buses, the host uses the first one.
+        for (int type : {Steinberg::Vst::kAudio, Steinberg::Vst::kEvent}) {
+            for (int dir : {Steinberg::Vst::kInput, Steinberg::Vst::kOutput}) {
+                const Steinberg::int32 nBuses  = vstComponent_->getBusCount(type, dir);
+                const Steinberg::int32 nActive = type == Steinberg::Vst::kAudio ? nBuses : std::min(nBuses, 1);
+                for (Steinberg::int32 iBus = 0; iBus < nActive; ++iBus) {
+                    vstComponent_->activateBus(type, dir, iBus, true);
+                }
+            }
+        }
+        vstComponent_->setActive(true);
+        activated_ = true;
+        vstAudioProcessor_->setProcessing(true);
+        processing_ = true;
+        (void)readLatency();
+
+        // Lazy and headless plugins skip createView() and the window, which are a large part of the startup time
+        editorMode_ = initParams.editorMode;
+        if (editorMode_ == EditorMode::Open && !openEditor()) {
+            return;
+        }
+
+        initialized_ = true;
+        MY_TRACE(L"\"%ls\" (%ls) is loaded from \"%ls\"\n", name_.c_str(), isEffect() ? L"effect" : L"instrument",
+                 vst3DllPath_.wstring().c_str());
+    }
+
+#if defined(_WIN32)
+    // Opens the plugin's editor in a new window. The keyboard of the window plays notes.
+    bool openEditorWindow(const unsigned index) {
+        plugView_->setFrame(&myPlugFrame_);
+
+        myPlugFrame_.resizeViewCallback_ = [&](auto *, const Steinberg::ViewRect *vr) { return resizeView(vr); };
+
+        {
+            WNDCLASSW wc     = {};
+            wc.lpfnWndProc   = s_wndProc;
+            wc.hInstance     = GetModuleHandle(nullptr);
+            wc.hCursor       = LoadCursor(nullptr, IDC_ARROW);
+            wc.lpszClassName = L"MinimalVST3HostWindow";
+            (void)RegisterClassW(&wc);
+
+            Steinberg::ViewRect viewRect;
+            plugView_->getSize(&viewRect);
+
+            RECT            rc    = {0, 0, viewRect.right - viewRect.left, viewRect.bottom - viewRect.top};
+            constexpr DWORD style = WS_OVERLAPPEDWINDOW;
+            AdjustWindowRectExForDpi(&rc, style, FALSE, 0, GetDpiForSystem());
+
+            const std::wstring caption = std::wstring(L"[#") + std::to_wstring(index) + L"] " + name_;
+
+            hWnd_ =
+                CreateWindowExW(0, wc.lpszClassName, caption.c_str(), style | WS_VISIBLE, CW_USEDEFAULT, CW_USEDEFAULT,
+                                rc.right - rc.left, rc.bottom - rc.top, nullptr, nullptr, wc.hInstance, this);
+        }
+
+        if (plugView_->attached(hWnd_, Steinberg::kPlatformTypeHWND) != Steinberg::kResultOk) {
+            MY_ERROR(L"pluginPath=%ls, plugView_->attached()\n", vst3DllPath_.wstring().c_str());
+            return false;
+        }
+        return true;
+    }
+#endif
+
+    void cleanup() const {
+        // Regarding release order, refer to the right side (upward arrows) of:
+        // Audio Processor Call Sequence
+        // https://steinbergmedia.github.io/vst3_dev_portal/pages/Technical+Documentation/Workflow+Diagrams/Audio+Processor+Call+Sequence.html
+        if (plugView_) {
+            plugView_->removed();
+        }
+        if (processing_ && vstAudioProcessor_) {
+            vstAudioProcessor_->setProcessing(false);
+        }
+        if (vstComponent_ && vstEditController_ && !isSameObject(vstComponent_, vstEditController_)) {
+            Steinberg::IPtr<Steinberg::Vst::IConnectionPoint> cp1;
+            vstComponent_->queryInterface(Steinberg::Vst::IConnectionPoint::iid, reinterpret_cast<void **>(&cp1));
+            if (!cp1) {
+                return MY_ERROR(L"pluginPath=%ls, cp1=%p\n", vst3DllPath_.wstring().c_str(), cp1.get());
+            }
+
+            Steinberg::IPtr<Steinberg::Vst::IConnectionPoint> cp2;
+            vstEditController_->queryInterface(Steinberg::Vst::IConnectionPoint::iid, reinterpret_cast<void **>(&cp2));
+            if (!cp2) {
+                return MY_ERROR(L"pluginPath=%ls, cp2=%p\n", vst3DllPath_.wstring().c_str(), cp2.get());
+            }
+
+            cp2->disconnect(cp1);
+            cp1->disconnect(cp2);
+        }
+        if (activated_ && vstComponent_) {
+            vstComponent_->setActive(false);
+        }
+        if (vstComponent_ && vstEditController_ && !isSameObject(vstComponent_, vstEditController_)) {
+            vstEditController_->terminate();
+        }
+        if (vstComponent_) {
+            vstComponent_->terminate();
+        }
+#if defined(_WIN32)
+        if (hWnd_) {
+            DestroyWindow(hWnd_);
+        }
+#endif
+    }
+
+#if defined(_WIN32)
+    void keyScan() {
+        const int64_t timeNs = monotonicNowNs();
+        if (GetKeyState(VK_ESCAPE) & 0x8000) {
+            PostQuitMessage(0);
+        }
+        for (Key &key : keys) {
+            if (const bool newStatus = (GetKeyState(key.vk_) & 0x8000) != 0; key.status_ != newStatus) {
+                key.status_             = newStatus;
+                Steinberg::Vst::Event e = {};
+                e.busIndex              = 0;
+                e.sampleOffset          = 0;
+                e.ppqPosition           = 0;
+                e.flags                 = Steinberg::Vst::Event::kIsLive;
+                if (key.status_) {
+                    e.type            = Steinberg::Vst::Event::kNoteOnEvent;
+                    e.noteOn.channel  = 0;
+                    e.noteOn.pitch    = key.midiNote_;
+                    e.noteOn.velocity = 1.0f;
+                    e.noteOn.noteId   = key.midiNote_;
+                } else {
+                    e.type             = Steinberg::Vst::Event::kNoteOffEvent;
+                    e.noteOff.channel  = 0;
+                    e.noteOff.pitch    = key.midiNote_;
+                    e.noteOff.velocity = 0.0f;
+                    e.noteOff.noteId   = key.midiNote_;
+                }
+                MY_TRACE(L"Note %-3s:  %3d\n", key.status_ ? L"On" : L"Off", key.midiNote_);
+                if (!eventQueue_.push({e, timeNs})) {
+                    MY_ERROR(L"  eventQueue_ is full\n");
+                }
+            }
+        }
+    }
+
+    // ReSharper disable once CppParameterMayBeConst
+    static LRESULT CALLBACK s_wndProc(HWND hWnd, const UINT msg, const WPARAM wParam, const LPARAM lParam) {
+        if (msg == WM_NCCREATE) {
+            if (const auto cs = reinterpret_cast<CREATESTRUCT *>(lParam)) {
+                const auto lp = reinterpret_cast<LONG_PTR>(cs->lpCreateParams);
+                SetWindowLongPtrW(hWnd, GWLP_USERDATA, lp);
+            }
+        }
+        auto *p = reinterpret_cast<Vst3Plugin *>(GetWindowLongPtrW(hWnd, GWLP_USERDATA));
+        return p ? p->wndProc(hWnd, msg, wParam, lParam) : DefWindowProcW(hWnd, msg, wParam, lParam);
+    }
+
+    // ReSharper disable once CppParameterMayBeConst
+    LRESULT wndProc(HWND hWnd, const UINT msg, const WPARAM wParam, const LPARAM lParam) {
+        switch (msg) {
+        case WM_SIZE:
+            if (Steinberg::IPlugView *plugView = plugView_.get()) {
+                RECT rc;
+                GetClientRect(hWnd, &rc);
+                Steinberg::ViewRect viewRect = {0, 0, static_cast<int>(rc.right - rc.left),
+                                                static_cast<int>(rc.bottom - rc.top)};
+                plugView->onSize(&viewRect);
+            }
+            break;
+        case WM_CLOSE:
+            // A lazily opened editor only closes itself. The audio keeps running until the host is stopped.
+            if (editorMode_ == EditorMode::Lazy) {
+                closeEditor();
+            } else {
+                PostQuitMessage(0);
+            }
+            return 0;
+        case WM_KEYDOWN:
+        case WM_KEYUP:
+            keyScan();
+            break;
+        default:
+            break;
+        }
+        return DefWindowProcW(hWnd, msg, wParam, lParam);
+    }
+
+    struct Key {
+        const int     vk_{};
+        const int16_t midiNote_{};
+        bool          status_{false};
+    };
+#endif
+
+    Vst3Module                                       vst3Module_; // Unloaded after the objects of the plugin
+    Steinberg::IPtr<Steinberg::IPluginFactory>       pluginFactory_;
+    InitParams                                       initParams_ = {};
+    EventQueue                                       eventQueue_;
+    Steinberg::IPtr<Steinberg::Vst::IComponent>      vstComponent_;
+    Steinberg::IPtr<Steinberg::Vst::IEditController> vstEditController_;
+    Steinberg::IPtr<Steinberg::Vst::IAudioProcessor> vstAudioProcessor_;
+    Steinberg::IPtr<Steinberg::IPlugView>            plugView_;
+    // State switch. The audio thread only calls audioProcessor_, which is vstAudioProcessor_ except during a switch.
+    std::unique_ptr<Vst3Plugin>                      shadow_; // Prepared instance, or the retired one
+    Steinberg::Vst::IAudioProcessor                 *audioProcessor_ = nullptr;
+    std::atomic<Steinberg::Vst::IAudioProcessor *>   pendingProcessor_ = nullptr; // Swapped in by the audio thread
+    std::atomic<Steinberg::Vst::IAudioProcessor *>   retiredProcessor_ = nullptr; // Swapped out by the audio thread
+    uint32_t                                         stateGeneration_  = 0;
+    std::atomic<uint32_t>                            latencySamples_   = 0;
+    std::atomic<uint32_t>                            tailSamples_      = Steinberg::Vst::kNoTail;
+    std::atomic<Restart>                             restart_          = Restart::None;
+    // Idle skip of audioThreadVstProcess()
+    uint64_t                                         quietFrames_   = 0; // Frames of silent input without events
+    bool                                             outputSilent_  = false;
+    std::atomic<uint64_t>                            skippedBlocks_ = 0;
+    MyComponentHandler                               myComponentHandler_;
+    MyParameterChanges                               outParamChanges_; // Filled by the plugin in process()
+    ParamMirror                                      paramMirror_;
+    ParamMirror::Snapshot                            uiParams_;
+    uint64_t                                         uiParamsVersion_ = 0;
+    ProcessTiming                                    processTiming_; // Of process(). Read by any thread
+    const char                                      *traceName_  = nullptr; // Span of process() (--trace)
+    unsigned                                         index_      = 0;
+    EditorMode                                       editorMode_ = EditorMode::None;
+#if defined(_WIN32)
+    HWND                                             hWnd_ = nullptr;
+    // clang-format off
+    std::vector<Key> keys{
+            {'2',61},{'3',63},         {'5',66},{'6',68},{'7',70},
+        {'Q',60},{'W',62},{'E',64},{'R',65},{'T',67},{'Y',69},{'U',71}, {'I',72},
+
+            {'S',49},{'D',51},         {'G',54},{'H',56},{'J',58},
+        {'Z',48},{'X',50},{'C',52},{'V',53},{'B',55},{'N',57},{'M',59}, {VK_OEM_COMMA,60},
+    };
+    // clang-format on
+#endif
+    std::filesystem::path                        vst3DllPath_;
+    std::wstring                                 name_;
+    MyPlugFrame                                  myPlugFrame_;
+    std::vector<AudioBus>                        inputBuses_;
+    std::vector<AudioBus>                        outputBuses_;
+    std::vector<Steinberg::Vst::AudioBusBuffers> inputBusBuffers_; // Of process(), one per bus
+    std::vector<Steinberg::Vst::AudioBusBuffers> outputBusBuffers_;
+    unsigned                                     nInputChannels_  = 0; // Of all input buses
+    unsigned                                     nOutputChannels_ = 0;
+    bool                                         isEffect_        = false;
+    bool                                         hasEventOutput_  = false;
+    bool                                         activated_       = false;
+    bool                                         processing_      = false;
+    bool                                         initialized_     = false;
+}; // class Vst3Plugin
+
+// Simple event list for passing events within AppMain::audioThreadAppRefill
+class MySimpleEventList : public Steinberg::Vst::IEventList {
+  public:
+    MySimpleEventList()          = default;
+    virtual ~MySimpleEventList() = default;
+    void clear() { eventCount_ = 0; }
+
+    Steinberg::tresult PLUGIN_API addEvent(Steinberg::Vst::Event &e) override {
+        if (eventCount_ >= MaxEvents) {
+            return Steinberg::kResultFalse;
+        }
+        events_[eventCount_++] = e;
+        return Steinberg::kResultOk;
+    }
+
+    // Merges the events of several sources, each in order, by their sample offsets. An insertion sort, since it's
+    // stable, doesn't allocate, and takes one pass over a list which is already in order.
+    void sortBySampleOffset() {
+        for (int32_t i = 1; i < eventCount_; ++i) {
+            const Steinberg::Vst::Event e = events_[i];
+            int32_t                     j = i;
+            for (; j > 0 && events_[j - 1].sampleOffset > e.sampleOffset; --j) {
+                events_[j] = events_[j - 1];
+            }
+            events_[j] = e;
+        }
+    }
+
+  private:
+    uint32_t PLUGIN_API addRef() override { return 1; }
+    uint32_t PLUGIN_API release() override { return 1; }
+    int32_t PLUGIN_API  getEventCount() override { return eventCount_; }
+
+    Steinberg::tresult PLUGIN_API getEvent(const Steinberg::int32 index, Steinberg::Vst::Event &e) override {
+        if (index < 0 || index >= eventCount_) {
+            return Steinberg::kResultFalse;
+        }
+        e = events_[index];
+        return Steinberg::kResultOk;
+    }
+
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        if (Steinberg::FUnknownPrivate::iidEqual(tuid, Steinberg::Vst::IEventList::iid) ||
+            Steinberg::FUnknownPrivate::iidEqual(tuid, FUnknown::iid)) {
+            *obj = this;
+            return Steinberg::kResultOk;
+        }
+        *obj = nullptr;
+        return Steinberg::kNoInterface;
+    }
+
+    static constexpr int32_t                     MaxEvents   = 1024;
+    int32_t                                      eventCount_ = 0;
+    std::array<Steinberg::Vst::Event, MaxEvents> events_     = {};
+}; // class MySimpleEventList
+
+// Snapshot of the states of a plugin chain (--preset, `save` / `load` on the console). The states of all plugins are
+// written back to back into one arena, which is kept between the captures, so capturing again doesn't reallocate.
+// A snapshot is switched to through shadow instances of the plugins (Vst3Plugin::prepareState), without a reload.
+class ChainSnapshot final {
+  public:
+    [[nodiscard]] bool   empty() const { return entries_.empty(); }
+    [[nodiscard]] size_t getNumBytes() const { return arena_.size(); }
+
+    // UI thread : Captures the states of the plugins in the order of the chain
+    bool capture(const std::span<const std::unique_ptr<Vst3Plugin>> plugins) {
+        arena_.clear();
+        entries_.clear();
+        for (const std::unique_ptr<Vst3Plugin> &plugin : plugins) {
+            Entry entry{.name = getKey(*plugin), .begin = arena_.size()};
+            if (!plugin->saveState(arena_, entry.componentSize)) {
+                arena_.clear();
+                entries_.clear();
+                return false;
+            }
+            entry.end = arena_.size();
+            entries_.push_back(std::move(entry));
+        }
+        return true;
+    }
+
+    // UI thread : Prepares a shadow instance of each plugin with its state. The caller then starts a new state
+    // generation, so that every plugin swaps its shadow in at the same block. If the snapshot doesn't match the chain
+    // or a plugin doesn't take its state, no plugin is switched.
+    bool prepareSwitch(const std::span<const std::unique_ptr<Vst3Plugin>> plugins) const {
+        if (entries_.size() != plugins.size()) {
+            MY_ERROR(L"The snapshot has %zu plugins, the chain has %zu\n", entries_.size(), plugins.size());
+            return false;
+        }
+        for (size_t i = 0; i < plugins.size(); ++i) {
+            if (entries_[i].name != getKey(*plugins[i])) {
+                MY_ERROR(L"[#%zu] The snapshot is of \"%hs\", not of \"%ls\"\n", i, entries_[i].name.c_str(),
+                         plugins[i]->getName().c_str());
+                return false;
+            }
+        }
+        for (size_t i = 0; i < plugins.size(); ++i) {
+            const Entry                   &entry = entries_[i];
+            const std::span<const uint8_t> state = std::span(arena_).subspan(entry.begin, entry.end - entry.begin);
+            if (!plugins[i]->prepareState(state.first(entry.componentSize), state.subspan(entry.componentSize))) {
+                for (size_t j = 0; j < i; ++j) {
+                    plugins[j]->cancelStateSwitch();
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Writes a temporary file and renames it, so a reader never sees a partial snapshot
+    bool save(const std::filesystem::path &path) const {
+        std::filesystem::path tmpPath = path;
+        tmpPath += ".tmp";
+        {
+            std::ofstream ofs(tmpPath, std::ios::binary);
+            ofs.write(Magic, sizeof(Magic));
+            writeValue(ofs, static_cast<uint32_t>(entries_.size()));
+            for (const Entry &entry : entries_) {
+                writeValue(ofs, static_cast<uint32_t>(entry.name.size()));
+                ofs.write(entry.name.data(), static_cast<std::streamsize>(entry.name.size()));
+                writeValue(ofs, static_cast<uint64_t>(entry.componentSize));
+                writeValue(ofs, static_cast<uint64_t>(entry.end - entry.begin - entry.componentSize));
+                ofs.write(reinterpret_cast<const char *>(arena_.data() + entry.begin),
+                          static_cast<std::streamsize>(entry.end - entry.begin));
+            }
+            if (!ofs.good()) {
+                MY_ERROR(L"Can't write the snapshot \"%ls\"\n", path.wstring().c_str());
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        return !ec;
+    }
+
+    bool load(const std::filesystem::path &path) {
+        arena_.clear();
+        entries_.clear();
+        std::ifstream ifs(path, std::ios::binary);
+        char          magic[sizeof(Magic)] = {};
+        uint32_t      nEntries             = 0;
+        if (!ifs.read(magic, sizeof(magic)) || std::memcmp(magic, Magic, sizeof(Magic)) != 0 ||
+            !readValue(ifs, nEntries)) {
+            MY_ERROR(L"\"%ls\" isn't a snapshot\n", path.wstring().c_str());
+            return false;
+        }
+        for (uint32_t i = 0; i < nEntries; ++i) {
+            Entry    entry;
+            uint32_t nameSize       = 0;
+            uint64_t componentSize  = 0;
+            uint64_t controllerSize = 0;
+            if (readValue(ifs, nameSize) && nameSize <= MaxNameSize) {
+                entry.name.resize(nameSize);
+                (void)ifs.read(entry.name.data(), nameSize);
+            }
+            if (!ifs || !readValue(ifs, componentSize) || !readValue(ifs, controllerSize) ||
+                componentSize + controllerSize > MaxStateSize) {
+                MY_ERROR(L"\"%ls\" is broken\n", path.wstring().c_str());
+                arena_.clear();
+                entries_.clear();
+                return false;
+            }
+            entry.begin         = arena_.size();
+            entry.componentSize = componentSize;
+            entry.end           = entry.begin + componentSize + controllerSize;
+            arena_.resize(entry.end);
+            (void)ifs.read(reinterpret_cast<char *>(arena_.data() + entry.begin),
+                           static_cast<std::streamsize>(entry.end - entry.begin));
+            entries_.push_back(std::move(entry));
+        }
+        if (!ifs) {
+            MY_ERROR(L"\"%ls\" is truncated\n", path.wstring().c_str());
+            arena_.clear();
+            entries_.clear();
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    // The state of a plugin in the arena : [begin, begin + componentSize) is the component's state, the rest up to
+    // `end` is the controller's state.
+    struct Entry {
+        std::string name; // Of the plugin class, to check that a snapshot matches the chain
+        size_t      begin         = 0;
+        size_t      componentSize = 0;
+        size_t      end           = 0;
+    };
+
+    static constexpr char     Magic[8]     = {'M', 'V', '3', 'H', 'S', 'N', 'P', '1'};
+    static constexpr uint32_t MaxNameSize  = 1024;
+    static constexpr uint64_t MaxStateSize = uint64_t{1} << 32;
+
+    // The class names are narrow strings (PClassInfo::name)
+    static std::string getKey(const Vst3Plugin &plugin) {
+        std::string key;
+        for (const wchar_t c : plugin.getName()) {
+            key += static_cast<char>(c);
+        }
+        return key;
+    }
+
+    template <class T> static void writeValue(std::ofstream &ofs, const T value) {
+        ofs.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <class T> static bool readValue(std::ifstream &ifs, T &value) {
+        return static_cast<bool>(ifs.read(reinterpret_cast<char *>(&value), sizeof(value)));
+    }
+
+    std::vector<uint8_t> arena_;
+    std::vector<Entry>   entries_;
+}; // class ChainSnapshot
+
+// Maps timestamped live events to sample offsets within the block.
+//
+// The stream clock maps the backend's stream position (frames) to the monotonic clock. It follows the earliest
+// callbacks, since the jitter of the callbacks only delays them, and slowly follows the drift between the audio device
+// and the monotonic clock. An xrun re-anchors it.
+//
+// Default mode  : A block covers the block period before it's due. Each event is delayed by about one block, instead
+//                 of landing at offset 0 of whichever block comes next. Events which arrive while the callback is
+//                 late are clamped into the block.
+// Fixed latency : Each event is delivered exactly `latency` after its capture. Events beyond the block are kept
+//                 until their block comes. Late events (latency < block period + callback jitter) go to offset 0.
+class LiveEventScheduler final {
+  public:
+    struct BlockTiming {
+        uint64_t streamPosition; // Frames before this block
+        unsigned nSamples;
+        double   sampleRate;
+        int64_t  nowNs; // Monotonic time of the callback
+    };
+
+    // 0 : Default mode
+    void setFixedLatency(const double latencySec) { fixedLatencyNs_ = static_cast<int64_t>(latencySec * 1e9); }
+
+    [[nodiscard]] uint64_t getLateEvents() const { return lateEvents_; }
+    [[nodiscard]] uint64_t getDroppedEvents() const { return droppedEvents_; }
+    // Callbacks which came more than 2 blocks behind the stream clock (xruns). Can be read by any thread.
+    [[nodiscard]] uint64_t getLateCallbacks() const { return lateCallbacks_.load(std::memory_order_relaxed); }
+    // Capture time which maps to the first sample of the last scheduled block
+    [[nodiscard]] int64_t getCaptureTimeNs() const { return captureTimeNs_; }
+
+    // Audio thread : Keeps the events sorted by their capture time.
+    void push(const TimedEvent &timedEvent) {
+        if (nPending_ >= pending_.size()) {
+            ++droppedEvents_;
+            return;
+        }
+        size_t i = nPending_++;
+        for (; i > 0 && pending_[i - 1].timeNs > timedEvent.timeNs; --i) {
+            pending_[i] = pending_[i - 1];
+        }
+        pending_[i] = timedEvent;
+    }
+
+    // Audio thread : Moves the events which are due in this block into `out`, in order of their sample offsets.
+    // An empty block (e.g. a WASAPI callback without free frames) has no offset for them, so they wait for the next.
+    void schedule(const BlockTiming &blockTiming, MySimpleEventList &out) {
+        if (blockTiming.nSamples == 0) {
+            return;
+        }
+        const double  nsPerFrame  = 1e9 / blockTiming.sampleRate;
+        const auto    blockNs     = static_cast<int64_t>(blockTiming.nSamples * nsPerFrame);
+        const int64_t blockTimeNs = updateStreamClock(blockTiming, nsPerFrame, blockNs);
+        const int64_t delayNs     = fixedLatencyNs_ > 0 ? fixedLatencyNs_ : blockNs;
+        captureTimeNs_            = blockTimeNs - delayNs;
+
+        size_t nDue = 0;
+        for (; nDue < nPending_; ++nDue) {
+            TimedEvent &te     = pending_[nDue];
+            const auto  offset = static_cast<int64_t>(
+                std::floor(static_cast<double>(te.timeNs + delayNs - blockTimeNs) / nsPerFrame));
+            if (offset >= static_cast<int64_t>(blockTiming.nSamples)) {
+                if (fixedLatencyNs_ > 0) {
+                    break; // Not due yet. This and later events wait for their block.
+                }
+                te.event.sampleOffset = static_cast<Steinberg::int32>(blockTiming.nSamples - 1);
+            } else if (offset < 0) {
+                lateEvents_ += fixedLatencyNs_ > 0 ? 1 : 0;
+                te.event.sampleOffset = 0;
+            } else {
+                te.event.sampleOffset = static_cast<Steinberg::int32>(offset);
+            }
+            out.addEvent(te.event);
+        }
+        std::copy(pending_.begin() + static_cast<ptrdiff_t>(nDue),
+                  pending_.begin() + static_cast<ptrdiff_t>(nPending_), pending_.begin());
+        nPending_ -= nDue;
+    }
+
+  private:
+    // Returns the monotonic time at which this block is due on the stream clock.
+    int64_t updateStreamClock(const BlockTiming &blockTiming, const double nsPerFrame, const int64_t blockNs) {
+        const auto streamNs = [&] {
+            return anchorNs_ + static_cast<int64_t>(
+                                   static_cast<double>(blockTiming.streamPosition - anchorPosition_) * nsPerFrame);
+        };
+        const int64_t errorNs = blockTiming.nowNs - streamNs();
+        if (!anchored_ || errorNs > 2 * blockNs || errorNs < -2 * blockNs) {
+            if (anchored_ && errorNs > 0) {
+                lateCallbacks_.store(lateCallbacks_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+            anchored_       = true;
+            anchorNs_       = blockTiming.nowNs;
+            anchorPosition_ = blockTiming.streamPosition;
+        } else if (errorNs < 0) {
+            anchorNs_ += errorNs; // The callbacks are only ever late, so the earliest one is the closest to the device
+        } else {
+            anchorNs_ += errorNs / 1024; // Follows the clock drift slowly, not the callback jitter
+        }
+        return streamNs();
+    }
+
+    std::array<TimedEvent, 1024> pending_{};
+    size_t                       nPending_       = 0;
+    int64_t                      fixedLatencyNs_ = 0;
+    int64_t                      captureTimeNs_  = 0;
+    bool                         anchored_       = false;
+    int64_t                      anchorNs_       = 0;
+    uint64_t                     anchorPosition_ = 0;
+    uint64_t                     lateEvents_     = 0;
+    uint64_t                     droppedEvents_  = 0;
+    std::atomic<uint64_t>        lateCallbacks_  = 0;
+}; // class LiveEventScheduler
+
+// Read-only memory mapping of a whole file
+class MappedFile final {
+  public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile &)            = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    [[nodiscard]] std::span<const uint8_t> getBytes() const { return {data_, size_}; }
+
+#if defined(_WIN32)
+    bool open(const std::filesystem::path &path) {
+        close();
+        hFile_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER size = {};
+        if (hFile_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile_, &size) || size.QuadPart <= 0) {
+            close();
+            return false;
+        }
+        hMapping_ = CreateFileMappingW(hFile_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        void *p   = hMapping_ ? MapViewOfFile(hMapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!p) {
+            close();
+            return false;
+        }
+        data_ = static_cast<const uint8_t *>(p);
+        size_ = static_cast<size_t>(size.QuadPart);
+        return true;
+    }
+
+    void close() {
+        if (data_) {
+            UnmapViewOfFile(std::exchange(data_, nullptr));
+        }
+        if (hMapping_) {
+            CloseHandle(std::exchange(hMapping_, nullptr));
+        }
+        if (hFile_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(std::exchange(hFile_, INVALID_HANDLE_VALUE));
+        }
+        size_ = 0;
+    }
+
+  private:
+    HANDLE hFile_    = INVALID_HANDLE_VALUE;
+    HANDLE hMapping_ = nullptr;
+#else
+    bool open(const std::filesystem::path &path) {
+        close();
+        const int   fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st = {};
+        void       *p  = fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0
+                             ? mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0)
+                             : MAP_FAILED;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        (void)posix_madvise(p, static_cast<size_t>(st.st_size), POSIX_MADV_SEQUENTIAL);
+        data_ = static_cast<const uint8_t *>(p);
+        size_ = static_cast<size_t>(st.st_size);
+        return true;
+    }
+
+    void close() {
+        if (data_) {
+            munmap(const_cast<uint8_t *>(std::exchange(data_, nullptr)), size_);
+        }
+        size_ = 0;
+    }
+
+  private:
+#endif
+    const uint8_t *data_ = nullptr;
+    size_t         size_ = 0;
+}; // class MappedFile
+
+// Standard MIDI File (format 0 or 1) as an event source (--midi <file.mid>, "midi" of a --batch job).
+//
+// The file is memory mapped and parsed once, before the audio starts : The note events of all tracks are merged into
+// one flat array sorted by time, and the frame and the PPQ position of each event are computed through the tempo map.
+// The audio thread plays the array with a Cursor, which only advances an index, so it neither locks nor allocates.
+// Note on / off and polyphonic pressure become VST3 events. Controllers, pitch bend and SysEx are skipped, since
+// VST3 takes them as parameters.
+class MidiFile final {
+  public:
+    struct TimedMidiEvent {
+        uint64_t              frame;
+        Steinberg::Vst::Event event; // ppqPosition is set. sampleOffset is set by the Cursor
+    };
+
+    // Plays the events of a MidiFile block by block. Audio thread.
+    class Cursor final {
+      public:
+        Cursor() = default;
+        explicit Cursor(const MidiFile *midiFile) : midiFile_(midiFile) {}
+
+        // Adds the events of [frame, frame + nSamples) to the list with their sample offsets. A block which doesn't
+        // continue the previous one seeks first. Returns the number of the events which didn't fit into the list.
+        unsigned audioThreadFill(const uint64_t frame, const unsigned nSamples, Steinberg::Vst::IEventList &list) {
+            if (!midiFile_) {
+                return 0;
+            }
+            const std::vector<TimedMidiEvent> &events = midiFile_->events_;
+            if (frame != nextFrame_) {
+                const auto it = std::ranges::lower_bound(events, frame, {}, &TimedMidiEvent::frame);
+                next_         = static_cast<size_t>(it - events.begin());
+            }
+            const uint64_t end      = frame + nSamples;
+            unsigned       nDropped = 0;
+            for (; next_ < events.size() && events[next_].frame < end; ++next_) {
+                Steinberg::Vst::Event e = events[next_].event;
+                e.sampleOffset          = static_cast<Steinberg::int32>(events[next_].frame - frame);
+                if (list.addEvent(e) != Steinberg::kResultOk) {
+                    ++nDropped;
+                }
+            }
+            nextFrame_ = end;
+            return nDropped;
+        }
+
+      private:
+        const MidiFile *midiFile_  = nullptr;
+        size_t          next_      = 0; // Index of the next event
+        uint64_t        nextFrame_ = 0; // Frame where the next block continues without a seek
+    };
+
+    [[nodiscard]] bool     empty() const { return events_.empty(); }
+    [[nodiscard]] size_t   getNumEvents() const { return events_.size(); }
+    [[nodiscard]] uint64_t getLengthFrames() const { return events_.empty() ? 0 : events_.back().frame + 1; }
+
+    // Any thread : Tempo (BPM) and PPQ position of the transport at the frame. Without allocation.
+    [[nodiscard]] double getTempoAt(const uint64_t frame) const { return findSegment(toSec(frame)).tempo; }
+    [[nodiscard]] double getPpqAt(const uint64_t frame) const {
+        const double        sec = toSec(frame);
+        const TempoSegment &seg = findSegment(sec);
+        return seg.ppq + (sec - seg.sec) * seg.tempo / 60.0;
+    }
+
+    bool load(const std::filesystem::path &path, const double sampleRate) {
+        sampleRate_ = sampleRate;
+        events_.clear();
+        segments_.clear();
+        MappedFile mappedFile;
+        if (!mappedFile.open(path)) {
+            MY_ERROR(L"Can't open the MIDI file \"%ls\"\n", path.wstring().c_str());
+            return false;
+        }
+        if (const char *error = parse(mappedFile.getBytes())) {
+            MY_ERROR(L"\"%ls\" : %hs\n", path.wstring().c_str(), error);
+            events_.clear();
+            return false;
+        }
+        MY_TRACE(L"MIDI file : \"%ls\", %zu events, %.1f sec\n", path.wstring().c_str(), events_.size(),
+                 static_cast<double>(getLengthFrames()) / sampleRate_);
+        return true;
+    }
+
+  private:
+    // Part of the tempo map with a constant tempo, from a tempo change (or the start) to the next one
+    struct TempoSegment {
+        uint64_t tick;
+        double   sec; // At the tick
+        double   ppq; // At the tick
+        double   tempo;
+        double   secPerTick;
+    };
+
+    // Event of a track before the merge
+    struct RawEvent {
+        uint64_t              tick;
+        uint32_t              order; // In the file, for a stable merge
+        Steinberg::Vst::Event event;
+    };
+
+    // Reads the big-endian fields and the variable-length quantities of a chunk. Stops at its end.
+    class Reader final {
+      public:
+        explicit Reader(const std::span<const uint8_t> bytes) : bytes_(bytes) {}
+
+        [[nodiscard]] bool   good() const { return good_; }
+        [[nodiscard]] bool   atEnd() const { return pos_ >= bytes_.size(); }
+        [[nodiscard]] size_t getPos() const { return pos_; }
+
+        uint32_t read(const unsigned nBytes) {
+            uint32_t v = 0;
+            for (unsigned i = 0; i < nBytes; ++i) {
+                v = v << 8 | readByte();
+            }
+            return v;
+        }
+        uint8_t readByte() {
+            if (pos_ >= bytes_.size()) {
+                good_ = false;
+                return 0;
+            }
+            return bytes_[pos_++];
+        }
+        uint32_t readVarLen() {
+            uint32_t v = 0;
+            for (int i = 0; i < 4; ++i) {
+                const uint8_t b = readByte();
+                v               = v << 7 | (b & 0x7f);
+                if (!(b & 0x80)) {
+                    return v;
+                }
+            }
+            good_ = false; // More than 4 bytes
+            return v;
+        }
+        std::span<const uint8_t> readBytes(const size_t n) {
+            if (n > bytes_.size() - pos_) {
+                good_ = false;
+                pos_  = bytes_.size();
+                return {};
+            }
+            pos_ += n;
+            return bytes_.subspan(pos_ - n, n);
+        }
+
+      private:
+        std::span<const uint8_t> bytes_;
+        size_t                   pos_  = 0;
+        bool                     good_ = true;
+    };
+
+    // Returns nullptr, or the reason why the file can't be played
+    const char *parse(const std::span<const uint8_t> bytes) {
+        Reader         file(bytes);
+        const auto     id     = file.readBytes(4);
+        const uint32_t length = file.read(4);
+        Reader         header(file.readBytes(length)); // Longer headers of later versions are skipped
+        if (!file.good() || length < 6 || std::memcmp(id.data(), "MThd", 4) != 0) {
+            return "Not a standard MIDI file";
+        }
+        const uint32_t format   = header.read(2);
+        const uint32_t nTracks  = header.read(2);
+        const uint32_t division = header.read(2);
+        if (format > 1 || division == 0) {
+            return format > 1 ? "Format 2 (independent sequences) isn't supported" : "Invalid header";
+        }
+        std::vector<RawEvent>                      rawEvents;
+        std::vector<std::pair<uint64_t, uint32_t>> tempos; // (tick, usec per quarter note)
+        for (uint32_t iTrack = 0; iTrack < nTracks && !file.atEnd();) {
+            const auto     id     = file.readBytes(4);
+            const uint32_t length = file.read(4);
+            Reader         chunk(file.readBytes(length));
+            if (!file.good()) {
+                return "Truncated chunk";
+            }
+            if (std::memcmp(id.data(), "MTrk", 4) != 0) {
+                continue; // Unknown chunks are skipped
+            }
+            if (const char *error = parseTrack(chunk, rawEvents, tempos)) {
+                return error;
+            }
+            ++iTrack;
+        }
+        buildTempoMap(division, tempos);
+
+        // In order of time. A note off comes before a note on at the same tick, so a note which is struck again
+        // isn't cut off, like the note script of RenderFarm.
+        std::ranges::sort(rawEvents, [](const RawEvent &a, const RawEvent &b) {
+            const auto isOn = [](const RawEvent &e) { return e.event.type == Steinberg::Vst::Event::kNoteOnEvent; };
+            return std::tuple(a.tick, isOn(a), a.order) < std::tuple(b.tick, isOn(b), b.order);
+        });
+        events_.reserve(rawEvents.size());
+        for (const RawEvent &raw : rawEvents) {
+            const TempoSegment &seg = findSegmentByTick(raw.tick);
+            const double        sec = seg.sec + static_cast<double>(raw.tick - seg.tick) * seg.secPerTick;
+            TimedMidiEvent     &e   = events_.emplace_back();
+            e.frame                 = static_cast<uint64_t>(std::llround(sec * sampleRate_));
+            e.event                 = raw.event;
+            e.event.ppqPosition     = seg.ppq + (sec - seg.sec) * seg.tempo / 60.0;
+        }
+        return nullptr;
+    }
+
+    static const char *parseTrack(Reader &track, std::vector<RawEvent> &rawEvents,
+                                  std::vector<std::pair<uint64_t, uint32_t>> &tempos) {
+        uint64_t tick          = 0;
+        uint8_t  runningStatus = 0;
+        while (!track.atEnd()) {
+            tick += track.readVarLen();
+            uint8_t status = track.readByte();
+            if (status == 0xff) { // Meta event
+                const uint8_t type = track.readByte();
+                const auto    data = track.readBytes(track.readVarLen());
+                if (type == 0x51 && data.size() == 3) {
+                    tempos.emplace_back(tick, uint32_t{data[0]} << 16 | uint32_t{data[1]} << 8 | data[2]);
+                } else if (type == 0x2f) {
+                    break; // End of track
+                }
+                continue;
+            }
+            if (status == 0xf0 || status == 0xf7) { // SysEx
+                (void)track.readBytes(track.readVarLen());
+                runningStatus = 0;
+                continue;
+            }
+            uint8_t data1 = 0;
+            if (status < 0x80) { // Running status : The byte is the first data byte
+                data1  = status;
+                status = runningStatus;
+            } else {
+                data1 = track.readByte();
+            }
+            if (status < 0x80 || status >= 0xf0) {
+                return track.good() ? "Invalid status byte" : "Truncated track";
+            }
+            runningStatus       = status;
+            const uint8_t type  = status & 0xf0;
+            const uint8_t data2 = type == 0xc0 || type == 0xd0 ? 0 : track.readByte();
+            if (!track.good()) {
+                return "Truncated track";
+            }
+            Steinberg::Vst::Event e       = {};
+            const auto            channel = static_cast<Steinberg::int16>(status & 0x0f);
+            const auto            pitch   = static_cast<Steinberg::int16>(data1 & 0x7f);
+            const float           value   = static_cast<float>(data2 & 0x7f) / 127.0f;
+            if (type == 0x80 || (type == 0x90 && data2 == 0)) { // A note on with velocity 0 is a note off
+                e.type             = Steinberg::Vst::Event::kNoteOffEvent;
+                e.noteOff.channel  = channel;
+                e.noteOff.pitch    = pitch;
+                e.noteOff.velocity = value;
+                e.noteOff.noteId   = -1;
+            } else if (type == 0x90) {
+                e.type            = Steinberg::Vst::Event::kNoteOnEvent;
+                e.noteOn.channel  = channel;
+                e.noteOn.pitch    = pitch;
+                e.noteOn.velocity = value;
+                e.noteOn.noteId   = -1;
+            } else if (type == 0xa0) {
+                e.type                  = Steinberg::Vst::Event::kPolyPressureEvent;
+                e.polyPressure.channel  = channel;
+                e.polyPressure.pitch    = pitch;
+                e.polyPressure.pressure = value;
+                e.polyPressure.noteId   = -1;
+            } else {
+                continue; // Controllers, program changes, channel pressure and pitch bend
+            }
+            rawEvents.push_back({.tick = tick, .order = static_cast<uint32_t>(rawEvents.size()), .event = e});
+        }
+        return track.good() ? nullptr : "Truncated track";
+    }
+
+    // Ticks per quarter note, or SMPTE frames per second (negative) and ticks per frame. SMPTE time ignores the tempo
+    // changes, and its PPQ positions assume 120 BPM.
+    void buildTempoMap(const uint32_t division, std::vector<std::pair<uint64_t, uint32_t>> &tempos) {
+        if (division & 0x8000) {
+            const int    fps        = -static_cast<int8_t>(division >> 8);
+            const double secPerTick = 1.0 / ((fps == 29 ? 29.97 : fps) * (division & 0xff));
+            segments_.push_back({.tick = 0, .sec = 0.0, .ppq = 0.0, .tempo = 120.0, .secPerTick = secPerTick});
+            return;
+        }
+        std::ranges::stable_sort(tempos, {}, &std::pair<uint64_t, uint32_t>::first);
+        const auto toSegment = [division](const uint32_t usecPerQuarter) {
+            return std::pair(60e6 / std::max(usecPerQuarter, 1u), usecPerQuarter / 1e6 / division);
+        };
+        const auto [tempo, secPerTick] = toSegment(500000); // 120 BPM until the first tempo change
+        segments_.push_back({.tick = 0, .sec = 0.0, .ppq = 0.0, .tempo = tempo, .secPerTick = secPerTick});
+        for (const auto &[tick, usecPerQuarter] : tempos) {
+            const TempoSegment &last = segments_.back();
+            const auto [t, spt]      = toSegment(usecPerQuarter);
+            const TempoSegment next{
+                .tick       = tick,
+                .sec        = last.sec + static_cast<double>(tick - last.tick) * last.secPerTick,
+                .ppq        = last.ppq + static_cast<double>(tick - last.tick) / division,
+                .tempo      = t,
+                .secPerTick = spt,
+            };
+            if (tick == last.tick) {
+                segments_.back() = next; // The last change at a tick wins
+            } else {
+                segments_.push_back(next);
+            }
+        }
+    }
+
+    [[nodiscard]] double toSec(const uint64_t frame) const { return static_cast<double>(frame) / sampleRate_; }
+
+    [[nodiscard]] const TempoSegment &findSegment(const double sec) const {
+        const auto it = std::ranges::upper_bound(segments_, sec, {}, &TempoSegment::sec);
+        return it == segments_.begin() ? DefaultSegment : *std::prev(it);
+    }
+
+    [[nodiscard]] const TempoSegment &findSegmentByTick(const uint64_t tick) const {
+        const auto it = std::ranges::upper_bound(segments_, tick, {}, &TempoSegment::tick);
+        return it == segments_.begin() ? DefaultSegment : *std::prev(it);
+    }
+
+    // Before load()
+    static constexpr TempoSegment DefaultSegment = {
+        .tick       = 0,
+        .sec        = 0.0,
+        .ppq        = 0.0,
+        .tempo      = 120.0,
+        .secPerTick = 0.0,
+    };
+
+    double                      sampleRate_ = 48000.0;
+    std::vector<TimedMidiEvent> events_;   // In order of frame
+    std::vector<TempoSegment>   segments_; // In order of tick and sec
+}; // class MidiFile
+
+// Adapts the variable block size of the device callbacks to the fixed block size of the plugin chain (--fixed-block).
+// The chain renders whole blocks on demand into an interleaved FIFO, and each callback takes its frames from there.
+// The output isn't delayed, since the FIFO isn't primed. Instead, a block is rendered up to (block size - 1) frames
+// before its first frame is played, which is the extra latency of the live input (getExtraLatencyFrames()).
+class BlockAdapter final {
+  public:
+    // UI thread : maxDeviceSamples is the largest block of the device callbacks
+    void init(const unsigned blockSize, const unsigned maxDeviceSamples, const unsigned nChannels) {
+        blockSize_ = blockSize;
+        nChannels_ = nChannels;
+        level_     = 0;
+        // The FIFO holds less than one block after a callback, and the callback renders until it has its frames
+        fifo_.assign(static_cast<size_t>(blockSize + maxDeviceSamples) * nChannels, 0.0f);
+    }
+
+    [[nodiscard]] bool     enabled() const { return blockSize_ > 0; }
+    [[nodiscard]] unsigned getBlockSize() const { return blockSize_; }
+    [[nodiscard]] unsigned getExtraLatencyFrames() const { return blockSize_ > 0 ? blockSize_ - 1 : 0; }
+
+    // Audio thread : Fills the device's block. `render` is called with the arguments of each fixed block. Its
+    // streamPosition is the device position at which the block is played.
+    template <class Render> void refill(const AudioBackend::RefillArgs &device, Render &&render) {
+        const unsigned nSamples = device.nSamples;
+        while (level_ < nSamples) {
+            const AudioBackend::RefillArgs block{
+                .interleavedBuf = std::span(fifo_).subspan(static_cast<size_t>(level_) * nChannels_,
+                                                           static_cast<size_t>(blockSize_) * nChannels_),
+                .sampleRate     = device.sampleRate,
+                .nChannels      = nChannels_,
+                .nSamples       = blockSize_,
+                .streamPosition = device.streamPosition + level_,
+            };
+            render(block);
+            level_ += blockSize_;
+        }
+        const size_t nValues = static_cast<size_t>(nSamples) * nChannels_;
+        std::copy_n(fifo_.begin(), nValues, device.interleavedBuf.begin());
+        // Less than one block is left over
+        level_ -= nSamples;
+        std::copy_n(fifo_.begin() + static_cast<ptrdiff_t>(nValues), static_cast<size_t>(level_) * nChannels_,
+                    fifo_.begin());
+    }
+
+  private:
+    std::vector<float> fifo_; // Interleaved frames rendered ahead of the device
+    unsigned           blockSize_ = 0;
+    unsigned           nChannels_ = 0;
+    unsigned           level_     = 0; // Frames in the FIFO
+}; // class BlockAdapter
+
+// Busy-wait hint for spin loops
+inline void cpuRelax() {
+#if MY_ARCH_X86
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Pins the calling thread to the given logical core. Returns false if the OS refuses it.
+inline bool pinCurrentThreadToCore(const unsigned core) {
+#if defined(_WIN32)
+    if (core >= sizeof(DWORD_PTR) * 8) {
+        return false;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << core) != 0;
+#elif defined(__linux__)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core, &cpuSet);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+    (void)core;
+    return false;
+#endif
+}
+
+// Chase-Lev work-stealing deque of node indices. The owner pushes and pops at the bottom, thieves steal from the top.
+// The capacity is fixed, and must be larger than the number of items which can be queued at the same time.
+class WorkStealingDeque final {
+  public:
+    explicit WorkStealingDeque(const unsigned minCapacity)
+        : mask_(std::bit_ceil(std::max(minCapacity, 2u)) - 1),
+          items_(std::make_unique<std::atomic<unsigned>[]>(static_cast<size_t>(mask_) + 1)) {}
+
+    // Owner thread only
+    void push(const unsigned item) {
+        const int64_t b = bottom_.load(std::memory_order_relaxed);
+        items_[static_cast<size_t>(b) & mask_].store(item, std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner thread only
+    bool pop(unsigned &item) {
+        const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = items_[static_cast<size_t>(b) & mask_].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Last item : Race against the thieves
+            const bool won =
+                top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread
+    bool steal(unsigned &item) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        item = items_[static_cast<size_t>(t) & mask_].load(std::memory_order_relaxed);
+        return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+  private:
+    const unsigned                             mask_;
+    std::unique_ptr<std::atomic<unsigned>[]>   items_;
+    alignas(64) std::atomic<int64_t>           top_    = 0;
+    alignas(64) std::atomic<int64_t>           bottom_ = 0;
+}; // class WorkStealingDeque
+
+// Compensation delay of one signal where signals with different plugin latencies are summed (ProcessGraph). A ring of
+// planar channels, preallocated for the largest delay. The delay can be changed by any thread, and takes effect at the
+// next block. Processed by one thread at a time, in block order.
+class DelayLine final {
+  public:
+    void init(const unsigned maxDelay, const unsigned maxSamples, const unsigned nChannels) {
+        maxDelay_     = maxDelay;
+        capacity_     = maxDelay + maxSamples;
+        nChannels_    = nChannels;
+        write_        = 0;
+        silentFrames_ = capacity_;
+        ring_.assign(static_cast<size_t>(capacity_) * nChannels, 0.0f);
+    }
+
+    [[nodiscard]] unsigned getMaxDelay() const { return maxDelay_; }
+    [[nodiscard]] unsigned getDelay() const { return delay_.load(std::memory_order_relaxed); }
+    // Returns false if the delay is clamped to getMaxDelay()
+    bool setDelay(const unsigned frames) {
+        delay_.store(std::min(frames, maxDelay_), std::memory_order_relaxed);
+        return frames <= maxDelay_;
+    }
+
+    // Writes the planar block `inp` into the ring, and copies (add = false) or adds (add = true) the block which was
+    // written getDelay() frames earlier into `dst`. The ring is always written, so a later delay finds its history.
+    // Returns true if the delayed block is silent. Then it isn't added, and nothing is done while the ring is silent.
+    bool process(const float *inp, const bool inpSilent, float *dst, const unsigned nSamples, const bool add,
+                 const BufferKernels::Table &kernels) {
+        const size_t delay        = delay_.load(std::memory_order_relaxed);
+        const size_t read         = (write_ + capacity_ - delay) % capacity_;
+        const bool   ringSilent   = silentFrames_ >= capacity_;
+        const size_t silentFrames = inpSilent ? std::min(silentFrames_ + nSamples, capacity_ + nSamples) : 0;
+        const bool   delaySilent  = silentFrames >= delay + nSamples;
+        silentFrames_             = silentFrames;
+        if (ringSilent && inpSilent) {
+            if (!add) {
+                std::fill_n(dst, static_cast<size_t>(nSamples) * nChannels_, 0.0f);
+            }
+            write_ = (write_ + nSamples) % capacity_;
+            return true;
+        }
+        for (unsigned iChannel = 0; iChannel < nChannels_; ++iChannel) {
+            float       *ring = ring_.data() + static_cast<size_t>(iChannel) * capacity_;
+            const float *src  = inp + static_cast<size_t>(iChannel) * nSamples;
+            float       *out  = dst + static_cast<size_t>(iChannel) * nSamples;
+            // The ring wraps around at most once in a block
+            const size_t nWrite = std::min<size_t>(nSamples, capacity_ - write_);
+            std::copy_n(src, nWrite, ring + write_);
+            std::copy_n(src + nWrite, nSamples - nWrite, ring);
+            const size_t nRead = std::min<size_t>(nSamples, capacity_ - read);
+            if (add && delaySilent) {
+                continue;
+            }
+            if (add) {
+                kernels.mix(out, ring + read, nRead, 1.0f);
+                kernels.mix(out + nRead, ring, nSamples - nRead, 1.0f);
+            } else {
+                std::copy_n(ring + read, nRead, out);
+                std::copy_n(ring, nSamples - nRead, out + nRead);
+            }
+        }
+        write_ = (write_ + nSamples) % capacity_;
+        return delaySilent;
+    }
+
+  private:
+    std::vector<float>    ring_; // [channel][capacity_] frames
+    size_t                capacity_     = 0;
+    size_t                write_        = 0;
+    size_t                silentFrames_ = 0; // Silent frames written last. capacity_ or more : The ring is silent
+    unsigned              maxDelay_     = 0;
+    unsigned              nChannels_    = 0;
+    std::atomic<unsigned> delay_        = 0;
+}; // class DelayLine
+
+// Planar buffers of a processing graph, allocated once from a single 64-byte aligned block. Each buffer is requested
+// with the steps (e.g. node indices) where it's in use, and buffers whose steps don't overlap share the same memory.
+// The layout is repeated for each block in flight.
+class BufferArena final {
+  public:
+    using Handle = unsigned;
+
+    static constexpr size_t Alignment = 64; // Cache line, and the widest SIMD vector
+
+    void clear() {
+        requests_.clear();
+        memory_.reset();
+        layoutBytes_ = 0;
+    }
+
+    // Returns the handle of a buffer of nFloats, which is in use from step `first` to step `last`
+    Handle request(const size_t nFloats, const unsigned first, const unsigned last) {
+        const size_t nBytes = (nFloats * sizeof(float) + Alignment - 1) / Alignment * Alignment;
+        requests_.push_back({.nBytes = nBytes, .offset = 0, .first = first, .last = last});
+        return static_cast<Handle>(requests_.size() - 1);
+    }
+
+    // Places the buffers, largest first, at the lowest offset where they don't overlap a buffer in use at the same
+    // steps. Then allocates nCopies of the layout, zero-filled. reuse = false : Every buffer gets its own memory, for
+    // steps which may run in any order.
+    void allocate(const unsigned nCopies, const bool reuse) {
+        std::vector<size_t> order(requests_.size());
+        std::iota(order.begin(), order.end(), size_t{0});
+        std::ranges::stable_sort(order, std::greater{}, [this](const size_t i) { return requests_[i].nBytes; });
+        layoutBytes_ = 0;
+        for (size_t iPlaced = 0; iPlaced < order.size(); ++iPlaced) {
+            Request &req = requests_[order[iPlaced]];
+            req.offset   = 0;
+            for (bool moved = true; moved;) {
+                moved = false;
+                for (const size_t i : std::span(order).first(iPlaced)) {
+                    const Request &other = requests_[i];
+                    if ((!reuse || (req.first <= other.last && other.first <= req.last)) &&
+                        req.offset < other.offset + other.nBytes && other.offset < req.offset + req.nBytes) {
+                        req.offset = other.offset + other.nBytes;
+                        moved      = true;
+                    }
+                }
+            }
+            layoutBytes_ = std::max(layoutBytes_, req.offset + req.nBytes);
+        }
+        nCopies_            = nCopies;
+        const size_t nBytes = std::max(layoutBytes_ * nCopies, Alignment);
+        memory_.reset(static_cast<float *>(::operator new[](nBytes, std::align_val_t{Alignment})));
+        std::fill_n(memory_.get(), nBytes / sizeof(float), 0.0f);
+    }
+
+    [[nodiscard]] float *get(const Handle handle, const unsigned copy) const {
+        return memory_.get() + (copy * layoutBytes_ + requests_[handle].offset) / sizeof(float);
+    }
+    [[nodiscard]] size_t getNumBytes() const { return layoutBytes_ * nCopies_; }
+    // Bytes which the buffers would take without sharing
+    [[nodiscard]] size_t getRequestedBytes() const {
+        size_t nBytes = 0;
+        for (const Request &req : requests_) {
+            nBytes += req.nBytes;
+        }
+        return nBytes * nCopies_;
+    }
+
+  private:
+    struct Request {
+        size_t   nBytes;
+        size_t   offset; // In the layout
+        unsigned first;
+        unsigned last;
+    };
+
+    struct AlignedDelete {
+        void operator()(float *p) const { ::operator delete[](p, std::align_val_t{Alignment}); }
+    };
+
+    std::vector<Request>                    requests_;
+    std::unique_ptr<float[], AlignedDelete> memory_;
+    size_t                                  layoutBytes_ = 0;
+    unsigned                                nCopies_     = 0;
+}; // class BufferArena
+
+// Processing graph (DAG) of the plugin chain.
+//
+// The graph is derived from the serial chain without changing its result. An instrument ignores the audio input, and
+// its output is summed with the incoming signal. So instrument layers only depend on their event source, and are
+// independent of each other. An effect depends on every node which contributes to its input signal.
+//
+// Each node owns its output buffer and output event list. Independent nodes run in parallel on the worker threads
+// with work stealing. The audio thread kicks the root nodes, helps to process the nodes, and waits for the final mix.
+//
+// Buses : The signal feeds the first main input bus of a plugin, and a sidechain source (BuildParams::sidechains) the
+// first aux input bus. The output buses of a plugin which don't match the signal (e.g. a multi-output instrument) are
+// summed into the node's output. The planar buffers come from a BufferArena, where buffers of nodes which don't run
+// at the same time share memory.
+//
+// Plugin delay compensation : Where signals are summed, each signal is delayed by the difference between its plugin
+// latency and the largest one, so a lookahead plugin doesn't smear the mix (updateLatencies()).
+class ProcessGraph final {
+  public:
+    struct BlockArgs {
+        unsigned                    nSamples;
+        double                      sampleRate;
+        double                      tempo;
+        double                      ppqPosition;
+        Steinberg::int32            processMode;
+        Steinberg::Vst::IEventList *inputEvents;     // Events from UI
+        int64_t                     captureTimeNs;   // Capture time of the UI input which maps to the first sample
+        uint32_t                    stateGeneration; // Of the state switches. Travels with the block through the stages
+    };
+
+    // The output of node `source` feeds the first aux input bus of node `node`. The source comes first in the chain.
+    struct Sidechain {
+        unsigned node;
+        unsigned source;
+    };
+
+    struct BuildParams {
+        unsigned                   maxSamples;
+        unsigned                   nChannels;
+        unsigned                   nWorkers;   // Worker threads for the parallel execution
+        unsigned                   nStages;    // Pipeline stages. 2 or more enables the pipelined execution
+        bool                       skipIdle;   // Skips the process() of idle plugins (ProcessArgs::skipIdle)
+        std::span<const Sidechain> sidechains; // Invalid ones are reported and ignored
+    };
+
+    // Room of the compensation delays for latencies which grow after build()
+    static constexpr unsigned DelayHeadroomFrames = 8192;
+
+    ProcessGraph()                                = default;
+    ProcessGraph(const ProcessGraph &)            = delete;
+    ProcessGraph &operator=(const ProcessGraph &) = delete;
+    ~ProcessGraph() { stopWorkers(); }
+
+    void build(const std::span<const std::unique_ptr<Vst3Plugin>> plugins, const BuildParams &buildParams) {
+        stopWorkers();
+        nodes_.clear();
+        frames_.clear();
+        arena_.clear();
+        maxSamples_ = buildParams.maxSamples;
+        nChannels_  = buildParams.nChannels;
+        skipIdle_   = buildParams.skipIdle;
+
+        const size_t bufSize = static_cast<size_t>(maxSamples_) * nChannels_;
+
+        std::vector<unsigned> signalSources; // Nodes whose outputs are summed into the current signal
+        int                   eventSource = -1;
+        for (const std::unique_ptr<Vst3Plugin> &plugin : plugins) {
+            const auto iNode  = static_cast<unsigned>(nodes_.size());
+            auto       node   = std::make_unique<Node>();
+            node->plugin      = plugin.get();
+            node->eventSource = eventSource;
+            if (plugin->isEffect()) {
+                node->audioSources = signalSources;
+            }
+            const std::span<const Vst3Plugin::AudioBus> outputBuses = plugin->getOutputBuses();
+            node->directOut = outputBuses.size() == 1 && !outputBuses[0].aux && outputBuses[0].nChannels == nChannels_;
+            for (const Sidechain &sidechain : buildParams.sidechains) {
+                if (sidechain.node != iNode) {
+                    continue;
+                }
+                if (sidechain.source >= iNode ||
+                    std::ranges::none_of(plugin->getInputBuses(), [](const auto &bus) { return bus.aux; })) {
+                    MY_ERROR(L"Sidechain %u:%u is ignored. The source must come first, and \"%ls\""
+                             L" needs an aux input\n",
+                             sidechain.node, sidechain.source, plugin->getName().c_str());
+                    continue;
+                }
+                node->sidechainSource = static_cast<int>(sidechain.source);
+            }
+            std::vector<unsigned> dependencies = node->audioSources;
+            for (const int source : {eventSource, node->sidechainSource}) {
+                if (source >= 0 && std::ranges::find(dependencies, source) == dependencies.end()) {
+                    dependencies.push_back(static_cast<unsigned>(source));
+                }
+            }
+            node->nDependencies = static_cast<unsigned>(dependencies.size());
+            for (const unsigned iDep : dependencies) {
+                nodes_[iDep]->dependents.push_back(iNode);
+            }
+            if (plugin->isEffect()) {
+                signalSources = {iNode};
+            } else {
+                signalSources.push_back(iNode);
+            }
+            if (plugin->hasEventOutput()) {
+                eventSource = static_cast<int>(iNode);
+            }
+            nodes_.push_back(std::move(node));
+        }
+        mixSources_ = std::move(signalSources);
+
+        // Compensation delays of the sums. No plugin path is longer than all latencies together.
+        unsigned maxDelay = DelayHeadroomFrames;
+        for (const std::unique_ptr<Vst3Plugin> &plugin : plugins) {
+            maxDelay += plugin->getLatencySamples();
+        }
+        const auto initDelays = [&](const size_t nSources) {
+            auto delays = std::vector<DelayLine>(nSources > 1 ? nSources : 0);
+            for (DelayLine &delay : delays) {
+                delay.init(maxDelay, maxSamples_, nChannels_);
+            }
+            return delays;
+        };
+        for (const std::unique_ptr<Node> &node : nodes_) {
+            node->inputDelays = initDelays(node->audioSources.size());
+        }
+        mixDelays_ = initDelays(mixSources_.size());
+        updateLatencies();
+
+        // Split the nodes (already in topological order) into contiguous pipeline stages of similar size.
+        const auto nNodes = static_cast<unsigned>(nodes_.size());
+        nStages_          = std::clamp(buildParams.nStages, 1u, std::max(nNodes, 1u));
+        for (unsigned iNode = 0; iNode < nNodes; ++iNode) {
+            nodes_[iNode]->stage = iNode * nStages_ / nNodes;
+        }
+
+        const unsigned nWorkers = nStages_ > 1 ? 0 : std::min(buildParams.nWorkers, nNodes > 0 ? nNodes - 1 : 0);
+
+        // Buffer lifetimes in steps : Node i runs at step i, and the final mix at step nNodes. An output is in use
+        // until its last reader. The parallel execution runs the nodes in any order, so its buffers don't share memory.
+        std::vector<unsigned> lastReader(nNodes);
+        std::iota(lastReader.begin(), lastReader.end(), 0u);
+        for (unsigned iNode = 0; iNode < nNodes; ++iNode) {
+            const Node &node = *nodes_[iNode];
+            for (const unsigned iSource : node.audioSources) {
+                lastReader[iSource] = std::max(lastReader[iSource], iNode);
+            }
+            if (node.sidechainSource >= 0) {
+                lastReader[node.sidechainSource] = std::max(lastReader[node.sidechainSource], iNode);
+            }
+        }
+        for (const unsigned iSource : mixSources_) {
+            lastReader[iSource] = nNodes;
+        }
+        for (unsigned iNode = 0; iNode < nNodes; ++iNode) {
+            Node        &node    = *nodes_[iNode];
+            const size_t nBusBuf = node.directOut ? 0 : size_t{maxSamples_} * node.plugin->getNumOutputChannels();
+            node.outBuf          = arena_.request(bufSize, iNode, lastReader[iNode]);
+            node.inpBuf          = arena_.request(node.audioSources.size() > 1 ? bufSize : 0, iNode, iNode);
+            node.busBuf          = arena_.request(nBusBuf, iNode, iNode);
+        }
+        const BufferArena::Handle mixBuf  = arena_.request(mixSources_.size() > 1 ? bufSize : 0, nNodes, nNodes);
+        const BufferArena::Handle zeroBuf = arena_.request(std::max<size_t>(bufSize, maxSamples_), 0, nNodes);
+        arena_.allocate(nStages_, nWorkers == 0);
+
+        // Each block in flight owns a frame. The pipeline has one block in flight per stage.
+        for (unsigned iFrame = 0; iFrame < nStages_; ++iFrame) {
+            auto frame        = std::make_unique<Frame>();
+            frame->nodeStates = std::vector<NodeState>(nNodes);
+            for (unsigned iNode = 0; iNode < nNodes; ++iNode) {
+                const Node &node      = *nodes_[iNode];
+                NodeState  &nodeState = frame->nodeStates[iNode];
+                nodeState.outBuf      = arena_.get(node.outBuf, iFrame);
+                nodeState.inpBuf      = arena_.get(node.inpBuf, iFrame);
+                nodeState.busBuf      = arena_.get(node.busBuf, iFrame);
+                nodeState.inpPtrs.resize(node.plugin->getNumInputChannels());
+                nodeState.outPtrs.resize(node.plugin->getNumOutputChannels());
+            }
+            frame->mixBuf  = arena_.get(mixBuf, iFrame);
+            frame->zeroBuf = arena_.get(zeroBuf, iFrame);
+            frames_.push_back(std::move(frame));
+        }
+
+        // The output FIFO absorbs the variable block sizes of the device. It's primed with the pipeline latency.
+        latencyFrames_ = (nStages_ - 1) * maxSamples_;
+        fifo_.assign(static_cast<size_t>(nStages_) * maxSamples_ * nChannels_, 0.0f);
+        fifoCapacity_ = nStages_ * maxSamples_;
+        fifoRead_     = 0;
+        fifoLevel_    = latencyFrames_;
+        nextBlock_    = 0;
+
+        deques_.clear();
+        for (unsigned i = 0; i < nWorkers + 1; ++i) {
+            deques_.push_back(std::make_unique<WorkStealingDeque>(nNodes));
+        }
+        startWorkers();
+    }
+
+    [[nodiscard]] unsigned getNumWorkers() const { return static_cast<unsigned>(workers_.size()); }
+    [[nodiscard]] unsigned getNumStages() const { return nStages_; }
+    // Memory of the planar buffers, and the memory they would take without sharing
+    [[nodiscard]] size_t getArenaBytes() const { return arena_.getNumBytes(); }
+    [[nodiscard]] size_t getArenaRequestedBytes() const { return arena_.getRequestedBytes(); }
+    // Extra output latency of the pipelined execution in frames. (nStages - 1) blocks of maxSamples.
+    [[nodiscard]] unsigned getLatencyFrames() const { return latencyFrames_; }
+    // Latency of the plugins on the longest path to the final mix, which is compensated on the other paths. Can be read
+    // by any thread.
+    [[nodiscard]] unsigned getPluginLatencyFrames() const { return pluginLatency_.load(std::memory_order_relaxed); }
+
+    // UI thread : Sets the compensation delays from the current plugin latencies. Can be called while the audio thread
+    // runs, after a plugin has changed its latency. Returns false if a delay exceeds its preallocated line.
+    bool updateLatencies() {
+        // Latency of each node's output, relative to the input of the graph. An instrument follows its event source.
+        std::vector<unsigned> outLatency(nodes_.size(), 0);
+        bool                  ok  = true;
+        const auto            sum = [&](const std::span<const unsigned> sources, std::vector<DelayLine> &delays) {
+            unsigned latency = 0;
+            for (const unsigned iSource : sources) {
+                latency = std::max(latency, outLatency[iSource]);
+            }
+            for (size_t i = 0; i < delays.size(); ++i) {
+                ok = delays[i].setDelay(latency - outLatency[sources[i]]) && ok;
+            }
+            return latency;
+        };
+        for (size_t iNode = 0; iNode < nodes_.size(); ++iNode) {
+            Node          &node    = *nodes_[iNode];
+            const unsigned latency = node.plugin->isEffect()  ? sum(node.audioSources, node.inputDelays)
+                                     : node.eventSource >= 0 ? outLatency[node.eventSource]
+                                                              : 0;
+            outLatency[iNode]      = latency + node.plugin->getLatencySamples();
+        }
+        pluginLatency_.store(sum(mixSources_, mixDelays_), std::memory_order_relaxed);
+        if (!ok) {
+            MY_ERROR(L"The plugin latencies exceed the compensation delays, and are partly compensated\n");
+        }
+        return ok;
+    }
+
+    // Processes one block, and writes the final mix into the interleaved buffer. In the pipelined execution, the
+    // written samples are the mix of an earlier block, delayed by getLatencyFrames().
+    void audioThreadProcess(const BlockArgs &blockArgs, const std::span<float> interleavedBuf) {
+        if (nStages_ > 1) {
+            return audioThreadProcessPipelined(blockArgs, interleavedBuf);
+        }
+        Frame &frame    = *frames_[0];
+        frame.blockArgs = blockArgs;
+        collectParamChanges(frame);
+        if (workers_.empty()) {
+            // Node indices are already sorted in topological order.
+            for (unsigned iNode = 0; iNode < nodes_.size(); ++iNode) {
+                processNode(iNode, frame);
+            }
+        } else {
+            for (const std::unique_ptr<Node> &node : nodes_) {
+                node->pendingDependencies.store(node->nDependencies, std::memory_order_relaxed);
+            }
+            remainingNodes_.store(static_cast<unsigned>(nodes_.size()), std::memory_order_relaxed);
+            for (unsigned iNode = 0; iNode < nodes_.size(); ++iNode) {
+                if (nodes_[iNode]->nDependencies == 0) {
+                    deques_[0]->push(iNode);
+                }
+            }
+            generation_.fetch_add(1, std::memory_order_release);
+            generation_.notify_all();
+            runNodes(0, frame);
+        }
+        bool         silent = true;
+        const float *mixPtr = sumSignal(mixSources_, mixDelays_, frame, frame.mixBuf, silent);
+        kernels_.interleave(interleavedBuf.data(), mixPtr, blockArgs.nSamples, nChannels_, blockArgs.nSamples);
+    }
+
+  private:
+    struct Node {
+        Vst3Plugin            *plugin          = nullptr;
+        int                    eventSource     = -1; // Node which provides the input events. -1 : Events from UI
+        int                    sidechainSource = -1; // Node which feeds the first aux input bus. -1 : None
+        std::vector<unsigned>  audioSources;         // Nodes whose outputs are summed into the input (effect only)
+        std::vector<DelayLine> inputDelays;          // Compensation delays of the audio sources, if two or more
+        std::vector<unsigned>  dependents;
+        unsigned               nDependencies       = 0;
+        unsigned               stage               = 0;
+        bool                   directOut           = false; // The plugin has one main output bus of nChannels_
+        BufferArena::Handle    inpBuf              = 0;
+        BufferArena::Handle    outBuf              = 0;
+        BufferArena::Handle    busBuf              = 0;
+        std::atomic<unsigned>  pendingDependencies = 0;
+    };
+
+    // Buffers of a node for one block. The planar buffers are in the arena.
+    struct NodeState {
+        float               *inpBuf = nullptr; // Sum of audioSources, if there are two or more
+        float               *outBuf = nullptr; // The signal, nChannels_. Written by the plugin if directOut
+        float               *busBuf = nullptr; // All output buses of the plugin, unless directOut
+        std::vector<float *> inpPtrs;          // Channels of all input buses
+        std::vector<float *> outPtrs;          // Channels of all output buses
+        MySimpleEventList    outEvents;
+        MyParameterChanges   inParamChanges;    // Edits of the controller
+        bool                 outSilent = false; // outBuf is digital silence
+    };
+
+    // Ring slot of a block in flight. In the pipelined execution, `seq` hands the frame over to the next stage.
+    // seq == block * nStages + stage + 1 : The stage may process the block.
+    struct Frame {
+        BlockArgs                         blockArgs{};
+        MySimpleEventList                 inputEvents; // Copy of the UI events (pipelined execution)
+        std::vector<NodeState>            nodeStates;
+        float                            *mixBuf  = nullptr;
+        float                            *zeroBuf = nullptr; // Silence, read by the unconnected input channels
+        alignas(64) std::atomic<uint64_t> seq = 0;
+    };
+
+    // Sums the outputs of the given nodes in the same order as the serial chain did, through their compensation delays.
+    // An instrument's output is added to the incoming signal, an effect's output replaces it.
+    // `silent` : The sum is digital silence.
+    const float *sumSignal(const std::span<const unsigned> sources, std::vector<DelayLine> &delays, const Frame &frame,
+                           float *sumBuf, bool &silent) const {
+        const unsigned nSamples = frame.blockArgs.nSamples;
+        const size_t   bufSize  = static_cast<size_t>(nSamples) * nChannels_;
+        silent                  = true;
+        if (sources.empty()) {
+            return frame.zeroBuf;
+        }
+        const bool       firstIsEffect = nodes_[sources[0]]->plugin->isEffect();
+        const NodeState &first         = frame.nodeStates[sources[0]];
+        if (sources.size() == 1) {
+            // A single source is passed as is. `sumBuf` is only allocated for two or more sources.
+            silent = first.outSilent;
+            return first.outBuf;
+        }
+        if (!firstIsEffect) {
+            std::fill_n(sumBuf, bufSize, 0.0f);
+        }
+        for (size_t iSource = 0; iSource < sources.size(); ++iSource) {
+            const NodeState &source = frame.nodeStates[sources[iSource]];
+            silent = delays[iSource].process(source.outBuf, source.outSilent, sumBuf, nSamples,
+                                             iSource > 0 || !firstIsEffect, kernels_) &&
+                     silent;
+        }
+        return sumBuf;
+    }
+
+    void processNode(const unsigned iNode, Frame &frame) {
+        Node          &node      = *nodes_[iNode];
+        NodeState     &nodeState = frame.nodeStates[iNode];
+        const unsigned nSamples  = frame.blockArgs.nSamples;
+        bool           inpSilent = true;
+        const float   *inp       = sumSignal(node.audioSources, node.inputDelays, frame, nodeState.inpBuf, inpSilent);
+
+        // The signal feeds the first main input bus, and the sidechain source the first aux input bus. The other
+        // channels read silence. Plugins don't write into the input buffers.
+        const NodeState *sidechain = node.sidechainSource >= 0 ? &frame.nodeStates[node.sidechainSource] : nullptr;
+        uint64_t         inpSilenceFlags = 0;
+        size_t           iPtr            = 0;
+        bool             mainSeen        = false;
+        bool             auxSeen         = false;
+        for (const Vst3Plugin::AudioBus &bus : node.plugin->getInputBuses()) {
+            const float *src       = nullptr;
+            bool         srcSilent = true;
+            if (!bus.aux && !std::exchange(mainSeen, true)) {
+                src       = inp;
+                srcSilent = inpSilent;
+            } else if (bus.aux && !std::exchange(auxSeen, true) && sidechain) {
+                src       = sidechain->outBuf;
+                srcSilent = sidechain->outSilent;
+            }
+            for (unsigned iChannel = 0; iChannel < bus.nChannels; ++iChannel, ++iPtr) {
+                const bool connected    = src && iChannel < nChannels_;
+                nodeState.inpPtrs[iPtr] = const_cast<float *>(connected ? src + iChannel * nSamples : frame.zeroBuf);
+                if (iPtr < 64 && (!connected || srcSilent)) {
+                    inpSilenceFlags |= uint64_t{1} << iPtr;
+                }
+            }
+        }
+        float *outBase = node.directOut ? nodeState.outBuf : nodeState.busBuf;
+        for (size_t iChannel = 0; iChannel < nodeState.outPtrs.size(); ++iChannel) {
+            nodeState.outPtrs[iChannel] = outBase + iChannel * nSamples;
+        }
+        nodeState.outEvents.clear();
+        Steinberg::Vst::IEventList *inputEvents =
+            node.eventSource < 0 ? frame.blockArgs.inputEvents : &frame.nodeStates[node.eventSource].outEvents;
+
+        const Vst3Plugin::ProcessArgs processArgs{
+            .vstInChannelPtrs      = std::span(nodeState.inpPtrs),
+            .vstOutChannelPtrs     = std::span(nodeState.outPtrs),
+            .nSamples              = nSamples,
+            .sampleRate            = frame.blockArgs.sampleRate,
+            .tempo                 = frame.blockArgs.tempo,
+            .inputEvents           = inputEvents,
+            .outputEvents          = &nodeState.outEvents,
+            .ppqPosition           = frame.blockArgs.ppqPosition,
+            .processMode           = frame.blockArgs.processMode,
+            .inputParameterChanges = &nodeState.inParamChanges,
+            .stateGeneration       = frame.blockArgs.stateGeneration,
+            .inputSilenceFlags     = inpSilenceFlags,
+            .skipIdle              = skipIdle_,
+        };
+        nodeState.outSilent = node.plugin->audioThreadVstProcess(processArgs);
+        if (!node.directOut) {
+            mixOutputBuses(node, nodeState, nSamples);
+        }
+    }
+
+    // Sums the output buses of the plugin into the node's output. A mono bus goes to every channel, the channels of
+    // other buses go to the same channels. So the extra outputs of a multi-output instrument join its main output.
+    void mixOutputBuses(const Node &node, NodeState &nodeState, const unsigned nSamples) const {
+        std::fill_n(nodeState.outBuf, static_cast<size_t>(nSamples) * nChannels_, 0.0f);
+        if (nodeState.outSilent) {
+            return;
+        }
+        const float *busBuf = nodeState.busBuf;
+        for (const Vst3Plugin::AudioBus &bus : node.plugin->getOutputBuses()) {
+            for (unsigned iChannel = 0; iChannel < nChannels_; ++iChannel) {
+                if (const unsigned iSrc = bus.nChannels == 1 ? 0 : iChannel; iSrc < bus.nChannels) {
+                    kernels_.mix(nodeState.outBuf + iChannel * nSamples, busBuf + iSrc * nSamples, nSamples, 1.0f);
+                }
+            }
+            busBuf += static_cast<size_t>(bus.nChannels) * nSamples;
+        }
+    }
+
+    // Audio thread : Moves the parameter edits of each controller into the frame, before the frame is processed. An
+    // edit is placed at the sample offset of its time, on the same timeline as the live events.
+    void collectParamChanges(Frame &frame) const {
+        const double nsPerFrame = 1e9 / frame.blockArgs.sampleRate;
+        const auto   lastOffset = static_cast<double>(std::max(frame.blockArgs.nSamples, 1u) - 1);
+        for (unsigned iNode = 0; iNode < nodes_.size(); ++iNode) {
+            MyParameterChanges &paramChanges = frame.nodeStates[iNode].inParamChanges;
+            paramChanges.clear();
+            std::array<ParamChange, 64> batch;
+            while (const size_t n = nodes_[iNode]->plugin->getParamChangeQueue().popN(batch)) {
+                for (const ParamChange &pc : std::span(batch).first(n)) {
+                    const double offset =
+                        std::clamp(static_cast<double>(pc.timeNs - frame.blockArgs.captureTimeNs) / nsPerFrame, 0.0,
+                                   lastOffset);
+                    Steinberg::int32 index = 0;
+                    if (Steinberg::Vst::IParamValueQueue *queue = paramChanges.addParameterData(pc.id, index)) {
+                        queue->addPoint(static_cast<Steinberg::int32>(offset), pc.value, index);
+                    }
+                }
+            }
+        }
+    }
+
+    void processStage(const unsigned stage, Frame &frame) {
+        for (unsigned iNode = 0; iNode < nodes_.size(); ++iNode) {
+            if (nodes_[iNode]->stage == stage) {
+                processNode(iNode, frame);
+            }
+        }
+    }
+
+    // Processes ready nodes until all nodes of the current block are done.
+    void runNodes(const unsigned iDeque, Frame &frame) {
+        WorkStealingDeque &own = *deques_[iDeque];
+        while (remainingNodes_.load(std::memory_order_acquire) != 0) {
+            unsigned iNode = 0;
+            bool     found = own.pop(iNode);
+            for (unsigned i = 1; !found && i < deques_.size(); ++i) {
+                found = deques_[(iDeque + i) % deques_.size()]->steal(iNode);
+            }
+            if (!found) {
+                cpuRelax();
+                continue;
+            }
+            processNode(iNode, frame);
+            for (const unsigned iDependent : nodes_[iNode]->dependents) {
+                if (nodes_[iDependent]->pendingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    own.push(iDependent);
+                }
+            }
+            remainingNodes_.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    // Spins for a while, then sleeps until `value` becomes `expected` or the workers are stopped.
+    bool waitFor(const std::atomic<uint64_t> &value, const uint64_t expected) const {
+        for (int spin = 0;; ++spin) {
+            // Check the stop request after loading the value, since stopWorkers() bumps the value.
+            const uint64_t current = value.load(std::memory_order_acquire);
+            if (stopWorkers_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            if (current == expected) {
+                return true;
+            }
+            if (spin < 4096) {
+                cpuRelax();
+            } else {
+                value.wait(current, std::memory_order_acquire);
+            }
+        }
+    }
+
+    // Pipelined execution. At block k, stage s processes block (k - s) on its own core. The audio thread publishes
+    // block k to stage 0, runs the last stage for block (k - nStages + 1), and outputs it through the FIFO.
+    void audioThreadProcessPipelined(const BlockArgs &blockArgs, const std::span<float> interleavedBuf) {
+        const uint64_t k     = nextBlock_++;
+        Frame         &frame = *frames_[k % nStages_];
+        frame.blockArgs      = blockArgs;
+        frame.inputEvents.clear();
+        if (blockArgs.inputEvents) {
+            Steinberg::Vst::Event e = {};
+            for (int32_t i = 0, n = blockArgs.inputEvents->getEventCount(); i < n; ++i) {
+                if (blockArgs.inputEvents->getEvent(i, e) == Steinberg::kResultOk) {
+                    frame.inputEvents.addEvent(e);
+                }
+            }
+        }
+        frame.blockArgs.inputEvents = &frame.inputEvents;
+        collectParamChanges(frame);
+        frame.seq.store(k * nStages_ + 1, std::memory_order_release);
+        frame.seq.notify_all();
+
+        if (k + 1 >= nStages_) {
+            const uint64_t lastBlock = k + 1 - nStages_;
+            Frame         &last      = *frames_[lastBlock % nStages_];
+            if (waitFor(last.seq, lastBlock * nStages_ + nStages_)) {
+                processStage(nStages_ - 1, last);
+                pushFifo(last);
+            }
+        }
+        popFifo(interleavedBuf, blockArgs.nSamples);
+    }
+
+    // Interleaves the final mix into the FIFO. The ring wraps around at most once.
+    void pushFifo(Frame &frame) {
+        bool           silent   = true;
+        const float   *mixPtr   = sumSignal(mixSources_, mixDelays_, frame, frame.mixBuf, silent);
+        const unsigned nSamples = frame.blockArgs.nSamples;
+        const auto     nPush    = static_cast<unsigned>(std::min<size_t>(nSamples, fifoCapacity_ - fifoLevel_));
+        for (unsigned done = 0; done < nPush;) {
+            const size_t   iWrite = (fifoRead_ + fifoLevel_) % fifoCapacity_;
+            const auto     n      = static_cast<unsigned>(std::min<size_t>(nPush - done, fifoCapacity_ - iWrite));
+            kernels_.interleave(&fifo_[iWrite * nChannels_], mixPtr + done, nSamples, nChannels_, n);
+            fifoLevel_ += n;
+            done += n;
+        }
+    }
+
+    void popFifo(const std::span<float> interleavedBuf, const unsigned nSamples) {
+        const auto nPop = static_cast<unsigned>(std::min<size_t>(nSamples, fifoLevel_));
+        for (unsigned done = 0; done < nPop;) {
+            const auto n = static_cast<unsigned>(std::min<size_t>(nPop - done, fifoCapacity_ - fifoRead_));
+            std::copy_n(&fifo_[fifoRead_ * nChannels_], static_cast<size_t>(n) * nChannels_,
+                        &interleavedBuf[static_cast<size_t>(done) * nChannels_]);
+            fifoRead_ = (fifoRead_ + n) % fifoCapacity_;
+            fifoLevel_ -= n;
+            done += n;
+        }
+        // Underrun : Fills the rest with silence
+        std::fill(interleavedBuf.begin() + static_cast<ptrdiff_t>(nPop) * nChannels_, interleavedBuf.end(), 0.0f);
+    }
+
+    void workerThreadProc(const unsigned iWorker) {
+        TraceRecorder::registerThread(TraceRecorder::intern("graph worker #" + std::to_string(iWorker)));
+        const unsigned nCores = std::max(std::thread::hardware_concurrency(), 1u);
+        if (!pinCurrentThreadToCore(iWorker % nCores)) {
+            MY_ERROR(L"Failed to pin the graph worker #%u to core %u\n", iWorker, iWorker % nCores);
+        }
+#if defined(_WIN32)
+        DWORD  taskIndex = 0;
+        HANDLE hTask     = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
+#endif
+        if (nStages_ > 1) {
+            pipelineStageProc(iWorker - 1);
+        } else {
+            parallelWorkerProc(iWorker);
+        }
+#if defined(_WIN32)
+        if (hTask) {
+            AvRevertMmThreadCharacteristics(hTask);
+        }
+#endif
+    }
+
+    void parallelWorkerProc(const unsigned iDeque) {
+        uint32_t seenGeneration = generation_.load(std::memory_order_acquire);
+        while (!stopWorkers_.load(std::memory_order_acquire)) {
+            // Spin for a while before sleeping, since the next block usually comes soon.
+            uint32_t current = generation_.load(std::memory_order_acquire);
+            for (int spin = 0; current == seenGeneration && spin < 4096; ++spin) {
+                cpuRelax();
+                current = generation_.load(std::memory_order_acquire);
+            }
+            if (current == seenGeneration) {
+                generation_.wait(seenGeneration, std::memory_order_acquire);
+                continue;
+            }
+            seenGeneration = current;
+            runNodes(iDeque, *frames_[0]);
+        }
+    }
+
+    // Processes the given stage for every block, in order, and hands the frame over to the next stage.
+    void pipelineStageProc(const unsigned stage) {
+        for (uint64_t block = 0;; ++block) {
+            Frame &frame = *frames_[block % nStages_];
+            if (!waitFor(frame.seq, block * nStages_ + stage + 1)) {
+                return;
+            }
+            processStage(stage, frame);
+            frame.seq.store(block * nStages_ + stage + 2, std::memory_order_release);
+            frame.seq.notify_all();
+        }
+    }
+
+    void startWorkers() {
+        stopWorkers_.store(false, std::memory_order_relaxed);
+        const unsigned nThreads = nStages_ > 1 ? nStages_ - 1 : static_cast<unsigned>(deques_.size()) - 1;
+        for (unsigned iWorker = 1; iWorker <= nThreads; ++iWorker) {
+            workers_.emplace_back([this, iWorker] { workerThreadProc(iWorker); });
+        }
+    }
+
+    void stopWorkers() {
+        stopWorkers_.store(true, std::memory_order_release);
+        generation_.fetch_add(1, std::memory_order_release);
+        generation_.notify_all();
+        for (const std::unique_ptr<Frame> &frame : frames_) {
+            frame->seq.fetch_add(1, std::memory_order_release);
+            frame->seq.notify_all();
+        }
+        for (std::thread &worker : workers_) {
+            worker.join();
+        }
+        workers_.clear();
+    }
+
+    const BufferKernels::Table                     &kernels_ = BufferKernels::get();
+    std::vector<std::unique_ptr<Node>>              nodes_;
+    std::vector<unsigned>                           mixSources_;
+    std::vector<DelayLine>                          mixDelays_; // Compensation delays of mixSources_
+    BufferArena                                     arena_;     // Planar buffers of the frames
+    std::vector<std::unique_ptr<Frame>>             frames_;
+    std::vector<std::unique_ptr<WorkStealingDeque>> deques_; // [0] : Audio thread, [1..] : Worker threads
+    std::vector<std::thread>                        workers_;
+    std::vector<float>                              fifo_;   // Interleaved output FIFO (pipelined execution)
+    size_t                                          fifoCapacity_   = 0;
+    size_t                                          fifoRead_       = 0;
+    size_t                                          fifoLevel_      = 0;
+    uint64_t                                        nextBlock_      = 0;
+    unsigned                                        maxSamples_     = 0;
+    unsigned                                        nChannels_      = 0;
+    unsigned                                        nStages_        = 1;
+    unsigned                                        latencyFrames_  = 0;
+    bool                                            skipIdle_       = false;
+    std::atomic<unsigned>                           pluginLatency_  = 0;
+    alignas(64) std::atomic<uint32_t>               generation_     = 0;
+    alignas(64) std::atomic<unsigned>               remainingNodes_ = 0;
+    std::atomic<bool>                               stopWorkers_    = false;
+}; // class ProcessGraph
+
+// Child process which runs this executable with other arguments : Plugin scan workers and sandboxed plugins.
+// The arguments are paths, so they keep their native encoding. The destructor kills the child if it still runs.
+class ChildProcess final {
+  public:
+    ChildProcess()                                = default;
+    ChildProcess(const ChildProcess &)            = delete;
+    ChildProcess &operator=(const ChildProcess &) = delete;
+    ~ChildProcess() { kill(); }
+
+    static unsigned long getCurrentId() {
+#if defined(_WIN32)
+        return GetCurrentProcessId();
+#else
+        return static_cast<unsigned long>(getpid());
+#endif
+    }
+
+    bool start(const std::vector<std::filesystem::path> &args) {
+#if defined(_WIN32)
+        std::wstring exePath(32768, L'\0');
+        exePath.resize(GetModuleFileNameW(nullptr, exePath.data(), static_cast<DWORD>(exePath.size())));
+        std::wstring cmdLine = L"\"" + exePath + L"\"";
+        for (const std::filesystem::path &arg : args) {
+            cmdLine += L" \"" + arg.wstring() + L"\"";
+        }
+        STARTUPINFOW        si = {};
+        PROCESS_INFORMATION pi = {};
+        si.cb                  = sizeof(si);
+        if (!CreateProcessW(nullptr, cmdLine.data(), nullptr, nullptr, FALSE, CREATE_NO_WINDOW, nullptr, nullptr, &si,
+                            &pi)) {
+            MY_ERROR(L"CreateProcessW(%ls)\n", cmdLine.c_str());
+            return false;
+        }
+        CloseHandle(pi.hThread);
+        hProcess_ = pi.hProcess;
+        return true;
+#else
+        std::error_code          ec;
+        const std::string        exePath = std::filesystem::read_symlink("/proc/self/exe", ec).string();
+        std::vector<std::string> strs    = {exePath};
+        for (const std::filesystem::path &arg : args) {
+            strs.push_back(arg.string());
+        }
+        std::vector<char *> argv;
+        for (std::string &str : strs) {
+            argv.push_back(str.data());
+        }
+        argv.push_back(nullptr);
+        if (ec || posix_spawn(&pid_, exePath.c_str(), nullptr, nullptr, argv.data(), environ) != 0) {
+            MY_ERROR(L"posix_spawn(%hs)\n", exePath.c_str());
+            pid_ = 0;
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    // false : The child has exited, or hasn't been started. Doesn't block or reap the child, so any thread can call it.
+    [[nodiscard]] bool isRunning() const {
+#if defined(_WIN32)
+        return hProcess_ && WaitForSingleObject(hProcess_, 0) == WAIT_TIMEOUT;
+#else
+        siginfo_t info = {};
+        return pid_ > 0 && waitid(P_PID, static_cast<id_t>(pid_), &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+               info.si_pid == 0;
+#endif
+    }
+
+    // Waits until the child exits. false : Timed out. exitCode is -1 if the child has crashed or has been killed.
+    bool wait(const std::chrono::milliseconds timeout, int &exitCode) {
+        exitCode = -1;
+#if defined(_WIN32)
+        if (!hProcess_) {
+            return true;
+        }
+        if (WaitForSingleObject(hProcess_, static_cast<DWORD>(timeout.count())) != WAIT_OBJECT_0) {
+            return false;
+        }
+        DWORD code = 1;
+        GetExitCodeProcess(hProcess_, &code);
+        CloseHandle(std::exchange(hProcess_, nullptr));
+        exitCode = static_cast<int>(code);
+        return true;
+#else
+        if (pid_ <= 0) {
+            return true;
+        }
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        int        status   = 0;
+        for (pid_t result; (result = waitpid(pid_, &status, WNOHANG)) != pid_;) {
+            if (result < 0 && errno != EINTR) {
+                pid_ = 0; // Lost (e.g. ECHILD) : Its exit status is unknown, so exitCode stays -1
+                return true;
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            if (result == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        pid_     = 0;
+        exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        return true;
+#endif
+    }
+
+    // Asks the OS to kill the child. Doesn't wait for it, so the audio thread can call it.
+    void terminate() const {
+#if defined(_WIN32)
+        if (hProcess_) {
+            TerminateProcess(hProcess_, 1);
+        }
+#else
+        if (pid_ > 0) {
+            ::kill(pid_, SIGKILL);
+        }
+#endif
+    }
+
+    // Kills the child and waits for it
+    void kill() {
+        terminate();
+        int exitCode = 0;
+        (void)wait(std::chrono::seconds(10), exitCode);
+    }
+
+  private:
+#if defined(_WIN32)
+    HANDLE hProcess_ = nullptr;
+#else
+    pid_t pid_ = 0;
+#endif
+}; // class ChildProcess
+
+// Host side of a plugin which runs in a child process (--sandbox on), so a crash of the plugin doesn't take down the
+// host. The child runs this executable (--sandbox-worker <name> --sandbox-plugin <path>), which loads the plugin into
+// a Vst3Plugin of its own.
+//
+// Each block travels through shared memory : The host writes the audio, the events and the parameter changes into it,
+// bumps the request sequence number and wakes the worker. The worker processes the audio in place, writes the reply
+// and bumps the reply sequence number. A waiting side spins briefly, then sleeps on a futex (Linux) or an auto-reset
+// event (Windows), and checks every 10 msec whether the other side is still alive. The start of the worker counts as
+// request 1. A worker which dies or hangs is left silent until the host is restarted.
+class PluginSandbox final {
+  public:
+    struct Params {
+        std::filesystem::path pluginPath; // Module, or "synth:<spec>"
+        double                sampleRate;
+        unsigned              maxSamples;
+        unsigned              nChannels;
+        Steinberg::int32      processMode;
+    };
+
+    PluginSandbox()                                 = default;
+    PluginSandbox(const PluginSandbox &)            = delete;
+    PluginSandbox &operator=(const PluginSandbox &) = delete;
+    ~PluginSandbox() {
+        stop();
+        close();
+    }
+
+    // UI thread : Creates the shared memory, starts the worker and waits until it has loaded the plugin
+    bool start(const Params &params) {
+        static std::atomic<unsigned> counter = 0;
+        const unsigned long          pid     = ChildProcess::getCurrentId();
+        name_       = "MinimalVst3Host-" + std::to_string(pid) + "-" + std::to_string(counter++);
+        maxSamples_ = params.maxSamples;
+        nChannels_  = params.nChannels;
+        if (!create()) {
+            return false;
+        }
+        Shared &s     = *shared_;
+        s.hostPid     = ChildProcess::getCurrentId();
+        s.sampleRate  = params.sampleRate;
+        s.maxSamples  = maxSamples_;
+        s.nChannels   = nChannels_;
+        s.processMode = params.processMode;
+        s.request.store(1, std::memory_order_release);
+        const bool started = child_.start({"--sandbox-worker", name_, "--sandbox-plugin", params.pluginPath}) &&
+                             wait(Host, 1, StartTimeout, [this] { return child_.isRunning(); });
+        unlink(); // The worker has mapped the memory, or will never do so
+        if (!started || s.state.load(std::memory_order_acquire) != State::Ready) {
+            MY_ERROR(L"The sandbox of \"%ls\" didn't start\n", params.pluginPath.wstring().c_str());
+            child_.kill();
+            return false;
+        }
+        s.pluginName[NameSize - 1] = '\0';
+        pluginName_                = s.pluginName;
+        return true;
+    }
+
+    [[nodiscard]] bool good() const { return !pluginName_.empty(); }
+    [[nodiscard]] const std::string      &getPluginName() const { return pluginName_; }
+    [[nodiscard]] bool                    isEffect() const { return shared_ && shared_->isEffect; }
+    [[nodiscard]] bool                    hasEventOutput() const { return shared_ && shared_->hasEventOutput; }
+    [[nodiscard]] uint32_t                getLatencySamples() const { return shared_ ? shared_->latencySamples : 0; }
+    [[nodiscard]] uint32_t                getTailSamples() const { return shared_ ? shared_->tailSamples : 0; }
+    [[nodiscard]] unsigned                getMaxSamples() const { return maxSamples_; }
+    [[nodiscard]] unsigned                getNumChannels() const { return nChannels_; }
+    [[nodiscard]] const LatencyHistogram &getOverhead() const { return overhead_; } // Round trip - worker's process()
+
+    // Audio thread : Runs process() in the worker. false : The worker has died or hung, and the outputs are silent.
+    bool audioThreadProcess(Steinberg::Vst::ProcessData &data) {
+        if (!good() || crashed_.load(std::memory_order_relaxed)) {
+            silence(data);
+            return false;
+        }
+        Shared                               &s       = *shared_;
+        const unsigned                        n       = std::min(static_cast<unsigned>(std::max(data.numSamples, 0)),
+                                                                 maxSamples_);
+        const Steinberg::Vst::AudioBusBuffers *inp     = data.numInputs > 0 ? &data.inputs[0] : nullptr;
+        const Steinberg::Vst::ProcessContext  *context = data.processContext;
+        for (unsigned iChannel = 0; iChannel < nChannels_; ++iChannel) {
+            float *dst = getChannel(false, iChannel);
+            if (inp && inp->channelBuffers32 && iChannel < static_cast<unsigned>(inp->numChannels)) {
+                std::memcpy(dst, inp->channelBuffers32[iChannel], n * sizeof(float));
+            } else {
+                std::fill_n(dst, n, 0.0f);
+            }
+        }
+        s.command     = Command::Process;
+        s.nSamples    = n;
+        s.processMode = data.processMode;
+        s.tempo       = context ? context->tempo : 120.0;
+        s.ppqPosition = context ? context->projectTimeMusic : 0.0;
+        packEvents(data.inputEvents, s.input);
+        packParams(data.inputParameterChanges, s.input);
+
+        const uint64_t startTicks = CycleClock::now();
+        const uint32_t seq        = s.request.load(std::memory_order_relaxed) + 1;
+        s.request.store(seq, std::memory_order_release);
+        wake(Worker);
+        if (!wait(Host, seq, BlockTimeout, [this] { return child_.isRunning(); })) {
+            child_.terminate(); // A hung worker can't be trusted with the next block
+            crashed_.store(true, std::memory_order_relaxed);
+            silence(data);
+            return false;
+        }
+        const uint64_t elapsedNs = CycleClock::toNs(CycleClock::now() - startTicks);
+        overhead_.record(elapsedNs > s.processNs ? elapsedNs - s.processNs : 0);
+
+        if (data.numOutputs > 0 && data.outputs[0].channelBuffers32) {
+            Steinberg::Vst::AudioBusBuffers &out = data.outputs[0];
+            for (Steinberg::int32 iChannel = 0; iChannel < out.numChannels; ++iChannel) {
+                if (static_cast<unsigned>(iChannel) < nChannels_) {
+                    std::memcpy(out.channelBuffers32[iChannel], getChannel(true, iChannel), n * sizeof(float));
+                } else {
+                    std::fill_n(out.channelBuffers32[iChannel], n, 0.0f);
+                }
+            }
+        }
+        unpackEvents(s.output, data.outputEvents);
+        unpackParams(s.output, data.outputParameterChanges);
+        return true;
+    }
+
+    // UI thread : Reports a crash or a hang of the worker once
+    void reportCrash() {
+        if (!crashed_.load(std::memory_order_relaxed) || crashReported_) {
+            return;
+        }
+        crashReported_ = true;
+        int exitCode   = -1;
+        (void)child_.wait(StopTimeout, exitCode);
+        MY_ERROR(L"The sandbox of \"%hs\" has crashed or hung (exit code %d). It outputs silence from now on\n",
+                 pluginName_.c_str(), exitCode);
+    }
+
+    // Worker process (--sandbox-worker <name> --sandbox-plugin <path>) : Loads the plugin, and processes the blocks
+    // of the host until the host asks it to quit or dies.
+    static int runWorker(const std::string &name, const std::filesystem::path &pluginPath) {
+        PluginSandbox sandbox;
+        if (!sandbox.open(name)) {
+            return EXIT_FAILURE;
+        }
+        Shared                                 &s = *sandbox.shared_;
+        MyHost                                  myHost;
+        std::unique_ptr<SyntheticPluginFactory> syntheticFactory;
+        if (const std::string path = pluginPath.string(); path.starts_with("synth:")) {
+            if (SyntheticPlugin::Config config; SyntheticPlugin::parse(path.substr(6), config)) {
+                syntheticFactory = std::make_unique<SyntheticPluginFactory>(config);
+            }
+        }
+        const Vst3Plugin::InitParams initParams{
+            .index           = 0,
+            .pluginPath      = pluginPath,
+            .hostApplication = &myHost,
+            .bufferSize      = static_cast<int>(s.maxSamples),
+            .sampleRate      = s.sampleRate,
+            .nChannels       = s.nChannels,
+            .processMode     = s.processMode,
+            .pluginFactory   = syntheticFactory.get(),
+            .editorMode      = Vst3Plugin::EditorMode::None,
+        };
+        Vst3Plugin plugin(initParams);
+        if (plugin.good()) {
+            // The name was widened from the class info, so narrowing it back is lossless
+            const std::wstring &pluginName = plugin.getName();
+            for (size_t i = 0; i < pluginName.size() && i + 1 < NameSize; ++i) {
+                s.pluginName[i] = static_cast<char>(pluginName[i]);
+            }
+            s.isEffect       = plugin.isEffect();
+            s.hasEventOutput = plugin.hasEventOutput();
+            s.latencySamples = plugin.getLatencySamples();
+            s.tailSamples    = plugin.getTailSamples();
+        }
+        s.state.store(plugin.good() ? State::Ready : State::Failed, std::memory_order_relaxed);
+        s.reply.store(1, std::memory_order_release);
+        sandbox.wake(Host);
+        if (!plugin.good()) {
+            return EXIT_FAILURE;
+        }
+
+        MySimpleEventList   inputEvents;
+        MySimpleEventList   outputEvents;
+        MyParameterChanges  inputParams;
+        std::vector<float *> inPtrs;
+        std::vector<float *> outPtrs;
+        // Only the channels of the first main bus are shared with the host. The other channels of the plugin read
+        // silence and write into a scratch buffer.
+        std::vector<float> silentBuf(s.maxSamples);
+        std::vector<float> scratchBuf(s.maxSamples);
+        for (const bool output : {false, true}) {
+            bool mainSeen = false;
+            for (const Vst3Plugin::AudioBus &bus : output ? plugin.getOutputBuses() : plugin.getInputBuses()) {
+                for (unsigned iChannel = 0; iChannel < bus.nChannels; ++iChannel) {
+                    float *p = output ? scratchBuf.data() : silentBuf.data();
+                    if (!bus.aux && !mainSeen && iChannel < sandbox.nChannels_) {
+                        p = sandbox.getChannel(output, iChannel);
+                    }
+                    (output ? outPtrs : inPtrs).push_back(p);
+                }
+                mainSeen = mainSeen || !bus.aux;
+            }
+        }
+        const auto hostAlive = [&sandbox] { return sandbox.isHostAlive(); };
+        for (uint32_t seq = 2;; ++seq) {
+            if (!sandbox.wait(Worker, seq, std::chrono::nanoseconds::max(), hostAlive)) {
+                return EXIT_FAILURE; // The host has died
+            }
+            if (s.command == Command::Quit) {
+                s.reply.store(seq, std::memory_order_release);
+                sandbox.wake(Host);
+                return EXIT_SUCCESS;
+            }
+            inputEvents.clear();
+            outputEvents.clear();
+            inputParams.clear();
+            unpackEvents(s.input, &inputEvents);
+            unpackParams(s.input, &inputParams);
+            const Vst3Plugin::ProcessArgs processArgs{
+                .vstInChannelPtrs      = inPtrs,
+                .vstOutChannelPtrs     = outPtrs,
+                .nSamples              = s.nSamples,
+                .sampleRate            = s.sampleRate,
+                .tempo                 = s.tempo,
+                .inputEvents           = &inputEvents,
+                .outputEvents          = &outputEvents,
+                .ppqPosition           = s.ppqPosition,
+                .processMode           = s.processMode,
+                .inputParameterChanges = &inputParams,
+                .stateGeneration       = 0,
+                .inputSilenceFlags     = 0,
+                .skipIdle              = false,
+            };
+            const uint64_t startTicks = CycleClock::now();
+            plugin.audioThreadVstProcess(processArgs);
+            s.processNs = CycleClock::toNs(CycleClock::now() - startTicks);
+            packEvents(&outputEvents, s.output);
+            packParams(&plugin.getOutputParamChanges(), s.output);
+            s.reply.store(seq, std::memory_order_release);
+            sandbox.wake(Host);
+        }
+    }
+
+  private:
+    static constexpr unsigned MaxEvents    = 512;
+    static constexpr unsigned MaxPoints    = 1024;
+    static constexpr unsigned NameSize     = 128;
+    static constexpr int      SpinCount    = 2000;
+    static constexpr auto     PollPeriod   = std::chrono::milliseconds(10);
+    static constexpr auto     StartTimeout = std::chrono::seconds(30);
+    static constexpr auto     BlockTimeout = std::chrono::seconds(2); // A worker which takes longer has hung
+    static constexpr auto     StopTimeout  = std::chrono::seconds(5);
+
+    enum class State : int32_t { Starting, Ready, Failed };
+    enum class Command : uint32_t { Process, Quit };
+    enum Side : unsigned { Worker, Host }; // The side which waits : For the request, for the reply
+
+    struct Point {
+        Steinberg::Vst::ParamID    id;
+        Steinberg::int32           sampleOffset;
+        Steinberg::Vst::ParamValue value;
+    };
+
+    // Events and parameter points of one direction of a block
+    struct Messages {
+        uint32_t                                     nEvents;
+        uint32_t                                     nPoints;
+        std::array<Steinberg::Vst::Event, MaxEvents> events;
+        std::array<Point, MaxPoints>                 points;
+    };
+
+    // Followed by the audio : nChannels input channels, then nChannels output channels of maxSamples each
+    struct Shared {
+        std::atomic<uint32_t> request; // Sequence number of the last request. The futex word of the worker
+        std::atomic<uint32_t> reply;   // Sequence number of the last reply. The futex word of the host
+        std::atomic<State>    state;
+
+        // Written by the host before it starts the worker
+        uint64_t         hostPid;
+        double           sampleRate;
+        uint32_t         maxSamples;
+        uint32_t         nChannels;
+        Steinberg::int32 processMode;
+
+        // Written by the worker when it has loaded the plugin
+        char     pluginName[NameSize];
+        uint32_t isEffect;
+        uint32_t hasEventOutput;
+        uint32_t latencySamples;
+        uint32_t tailSamples;
+
+        // Request
+        Command  command;
+        uint32_t nSamples;
+        double   tempo;
+        double   ppqPosition;
+        Messages input;
+
+        // Reply
+        uint64_t processNs; // Of the worker's process()
+        Messages output;
+    };
+    static_assert(std::atomic<uint32_t>::is_always_lock_free && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+    static constexpr size_t AudioOffset = (sizeof(Shared) + 63) & ~size_t{63};
+
+    [[nodiscard]] size_t getSize() const {
+        return AudioOffset + 2 * size_t{nChannels_} * maxSamples_ * sizeof(float);
+    }
+
+    [[nodiscard]] float *getChannel(const bool output, const unsigned iChannel) const {
+        auto *audio = reinterpret_cast<float *>(reinterpret_cast<std::byte *>(shared_) + AudioOffset);
+        return audio + (static_cast<size_t>(output ? nChannels_ : 0) + iChannel) * maxSamples_;
+    }
+
+    [[nodiscard]] std::atomic<uint32_t> &getWord(const Side side) const {
+        return side == Worker ? shared_->request : shared_->reply;
+    }
+
+    // Waits until the sequence number of `side` reaches `value`. false : The other side has died, or timed out.
+    template <typename PeerAlive>
+    bool wait(const Side side, const uint32_t value, const std::chrono::nanoseconds timeout,
+              const PeerAlive &peerAlive) const {
+        // Spinning only helps when the peer runs on another core
+        static const int             spinCount = std::thread::hardware_concurrency() > 1 ? SpinCount : 0;
+        const std::atomic<uint32_t> &word      = getWord(side);
+        for (int i = 0; i < spinCount; ++i) {
+            if (word.load(std::memory_order_acquire) == value) {
+                return true;
+            }
+            cpuRelax();
+        }
+        using Clock         = std::chrono::steady_clock;
+        const auto deadline = timeout == std::chrono::nanoseconds::max() ? Clock::time_point::max()
+                                                                         : Clock::now() + timeout;
+        for (;;) {
+            const uint32_t seen = word.load(std::memory_order_acquire);
+            if (seen == value) {
+                return true;
+            }
+#if defined(_WIN32)
+            (void)seen;
+            WaitForSingleObject(events_[side], static_cast<DWORD>(PollPeriod.count()));
+#else
+            timespec ts = {0, std::chrono::duration_cast<std::chrono::nanoseconds>(PollPeriod).count()};
+            syscall(SYS_futex, reinterpret_cast<const uint32_t *>(&word), FUTEX_WAIT, seen, &ts, nullptr, 0);
+#endif
+            if (word.load(std::memory_order_acquire) == value) {
+                return true;
+            }
+            if (!peerAlive() || Clock::now() >= deadline) {
+                return false;
+            }
+        }
+    }
+
+    void wake(const Side side) const {
+#if defined(_WIN32)
+        SetEvent(events_[side]);
+#else
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&getWord(side)), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#endif
+    }
+
+    // UI thread : Asks the worker to quit, and kills it if it doesn't
+    void stop() {
+        if (good() && !crashed_.load(std::memory_order_relaxed) && child_.isRunning()) {
+            shared_->command   = Command::Quit;
+            const uint32_t seq = shared_->request.load(std::memory_order_relaxed) + 1;
+            shared_->request.store(seq, std::memory_order_release);
+            wake(Worker);
+            (void)wait(Host, seq, StopTimeout, [this] { return child_.isRunning(); });
+        }
+        if (int exitCode = 0; !child_.wait(StopTimeout, exitCode)) {
+            child_.kill();
+        }
+    }
+
+    static void silence(Steinberg::Vst::ProcessData &data) {
+        for (Steinberg::int32 iBus = 0; iBus < data.numOutputs; ++iBus) {
+            const Steinberg::Vst::AudioBusBuffers &out = data.outputs[iBus];
+            for (Steinberg::int32 iChannel = 0; out.channelBuffers32 && iChannel < out.numChannels; ++iChannel) {
+                std::fill_n(out.channelBuffers32[iChannel], std::max(data.numSamples, 0), 0.0f);
+            }
+        }
+    }
+
+    // Events which point to other memory (sysex, chord and scale names) can't cross the process boundary
+    static void packEvents(Steinberg::Vst::IEventList *events, Messages &m) {
+        m.nEvents = 0;
+        for (Steinberg::int32 i = 0, n = events ? events->getEventCount() : 0; i < n && m.nEvents < MaxEvents; ++i) {
+            Steinberg::Vst::Event &e = m.events[m.nEvents];
+            if (events->getEvent(i, e) == Steinberg::kResultOk && e.type != Steinberg::Vst::Event::kDataEvent &&
+                e.type != Steinberg::Vst::Event::kChordEvent && e.type != Steinberg::Vst::Event::kScaleEvent) {
+                ++m.nEvents;
+            }
+        }
+    }
+
+    static void unpackEvents(Messages &m, Steinberg::Vst::IEventList *events) {
+        for (uint32_t i = 0; events && i < m.nEvents; ++i) {
+            events->addEvent(m.events[i]);
+        }
+    }
+
+    static void packParams(Steinberg::Vst::IParameterChanges *changes, Messages &m) {
+        m.nPoints = 0;
+        for (Steinberg::int32 i = 0, n = changes ? changes->getParameterCount() : 0; i < n; ++i) {
+            Steinberg::Vst::IParamValueQueue *queue = changes->getParameterData(i);
+            for (Steinberg::int32 j = 0, nPoints = queue ? queue->getPointCount() : 0;
+                 j < nPoints && m.nPoints < MaxPoints; ++j) {
+                Point &p = m.points[m.nPoints];
+                if (queue->getPoint(j, p.sampleOffset, p.value) == Steinberg::kResultOk) {
+                    p.id = queue->getParameterId();
+                    ++m.nPoints;
+                }
+            }
+        }
+    }
+
+    static void unpackParams(const Messages &m, Steinberg::Vst::IParameterChanges *changes) {
+        for (uint32_t i = 0; changes && i < m.nPoints; ++i) {
+            Steinberg::int32 index = 0;
+            if (Steinberg::Vst::IParamValueQueue *queue = changes->addParameterData(m.points[i].id, index)) {
+                queue->addPoint(m.points[i].sampleOffset, m.points[i].value, index);
+            }
+        }
+    }
+
+#if defined(_WIN32)
+    [[nodiscard]] std::wstring getObjectName(const wchar_t *suffix) const {
+        return L"Local\\" + std::wstring(name_.begin(), name_.end()) + suffix;
+    }
+
+    // Host : The memory and the events are named after the sandbox, so the worker can open them by name
+    bool create() {
+        const size_t size = getSize();
+        hMapping_ = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+                                       static_cast<DWORD>(size), getObjectName(L"").c_str());
+        void *p   = hMapping_ ? MapViewOfFile(hMapping_, FILE_MAP_ALL_ACCESS, 0, 0, size) : nullptr;
+        events_   = {CreateEventW(nullptr, FALSE, FALSE, getObjectName(L"-worker").c_str()),
+                     CreateEventW(nullptr, FALSE, FALSE, getObjectName(L"-host").c_str())};
+        if (!p || !events_[Worker] || !events_[Host]) {
+            MY_ERROR(L"Can't create the shared memory of the sandbox \"%hs\"\n", name_.c_str());
+            if (p) {
+                UnmapViewOfFile(p);
+            }
+            return false;
+        }
+        shared_ = new (p) Shared();
+        return true;
+    }
+
+    // Worker
+    bool open(const std::string &name) {
+        name_     = name;
+        hMapping_ = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, getObjectName(L"").c_str());
+        void *p   = hMapping_ ? MapViewOfFile(hMapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+        events_   = {OpenEventW(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, getObjectName(L"-worker").c_str()),
+                     OpenEventW(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, getObjectName(L"-host").c_str())};
+        if (!p || !events_[Worker] || !events_[Host]) {
+            MY_ERROR(L"Can't open the shared memory of the sandbox \"%hs\"\n", name_.c_str());
+            if (p) {
+                UnmapViewOfFile(p);
+            }
+            return false;
+        }
+        shared_     = std::launder(reinterpret_cast<Shared *>(p));
+        maxSamples_ = shared_->maxSamples;
+        nChannels_  = shared_->nChannels;
+        hHost_      = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(shared_->hostPid));
+        return true;
+    }
+
+    // The named objects live as long as a handle refers to them
+    void unlink() {}
+
+    void close() {
+        if (shared_) {
+            UnmapViewOfFile(std::exchange(shared_, nullptr));
+        }
+        for (HANDLE h : {hMapping_, events_[Worker], events_[Host], hHost_}) {
+            if (h) {
+                CloseHandle(h);
+            }
+        }
+        hMapping_ = nullptr;
+        events_   = {};
+        hHost_    = nullptr;
+    }
+
+    [[nodiscard]] bool isHostAlive() const { return !hHost_ || WaitForSingleObject(hHost_, 0) == WAIT_TIMEOUT; }
+#else
+    // Host : The worker opens the memory by name. The name is removed once the worker has mapped it.
+    bool create() {
+        const std::string path = "/" + name_;
+        const int         fd   = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            MY_ERROR(L"shm_open(%hs)\n", path.c_str());
+            return false;
+        }
+        linked_        = true;
+        const size_t s = getSize();
+        void        *p = ftruncate(fd, static_cast<off_t>(s)) == 0
+                             ? mmap(nullptr, s, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                             : MAP_FAILED;
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            MY_ERROR(L"Can't map the shared memory of the sandbox \"%hs\"\n", path.c_str());
+            unlink();
+            return false;
+        }
+        shared_ = new (p) Shared();
+        return true;
+    }
+
+    // Worker
+    bool open(const std::string &name) {
+        name_                  = name;
+        const std::string path = "/" + name_;
+        const int         fd   = shm_open(path.c_str(), O_RDWR, 0);
+        struct stat       st   = {};
+        void             *p    = fd >= 0 && fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= AudioOffset
+                                     ? mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE,
+                                            MAP_SHARED, fd, 0)
+                                     : MAP_FAILED;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (p == MAP_FAILED) {
+            MY_ERROR(L"Can't open the shared memory of the sandbox \"%hs\"\n", path.c_str());
+            return false;
+        }
+        shared_     = std::launder(reinterpret_cast<Shared *>(p));
+        maxSamples_ = shared_->maxSamples;
+        nChannels_  = shared_->nChannels;
+        return true;
+    }
+
+    void unlink() {
+        if (std::exchange(linked_, false)) {
+            shm_unlink(("/" + name_).c_str());
+        }
+    }
+
+    void close() {
+        unlink();
+        if (shared_) {
+            munmap(std::exchange(shared_, nullptr), getSize());
+        }
+    }
+
+    // A worker whose host has died is adopted by another process
+    [[nodiscard]] bool isHostAlive() const { return static_cast<uint64_t>(getppid()) == shared_->hostPid; }
+#endif
+
+    std::string       name_;       // Of the shared memory and the events
+    std::string       pluginName_; // Empty : Not started
+    Shared           *shared_     = nullptr;
+    unsigned          maxSamples_ = 0;
+    unsigned          nChannels_  = 0;
+    ChildProcess      child_;
+    LatencyHistogram  overhead_;
+    std::atomic<bool> crashed_       = false;
+    bool              crashReported_ = false;
+#if defined(_WIN32)
+    HANDLE                hMapping_ = nullptr;
+    std::array<HANDLE, 2> events_   = {}; // [Worker] : Signaled by the host, [Host] : Signaled by the worker
+    HANDLE                hHost_    = nullptr;
+#else
+    bool linked_ = false; // The name of the shared memory exists
+#endif
+}; // class PluginSandbox
+
+// In-process stand-in of a sandboxed plugin. Implements IComponent, IAudioProcessor and IEditController in one object,
+// like SyntheticPlugin, and passes process() to the worker. The bus layout is the one of the plugin in the worker.
+// Parameters and the editor stay in the worker, so the stand-in has neither.
+class SandboxPlugin final : public Steinberg::Vst::IComponent,
+                            public Steinberg::Vst::IAudioProcessor,
+                            public Steinberg::Vst::IEditController {
+  public:
+    explicit SandboxPlugin(PluginSandbox &sandbox) : sandbox_(sandbox) {}
+    virtual ~SandboxPlugin() = default;
+
+    // FUnknown
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        using Steinberg::FUnknownPrivate::iidEqual;
+        if (iidEqual(tuid, FUnknown::iid) || iidEqual(tuid, IPluginBase::iid) ||
+            iidEqual(tuid, Steinberg::Vst::IComponent::iid)) {
+            *obj = static_cast<Steinberg::Vst::IComponent *>(this);
+        } else if (iidEqual(tuid, Steinberg::Vst::IAudioProcessor::iid)) {
+            *obj = static_cast<Steinberg::Vst::IAudioProcessor *>(this);
+        } else if (iidEqual(tuid, Steinberg::Vst::IEditController::iid)) {
+            *obj = static_cast<Steinberg::Vst::IEditController *>(this);
+        } else {
+            *obj = nullptr;
+            return Steinberg::kNoInterface;
+        }
+        addRef();
+        return Steinberg::kResultOk;
+    }
+    uint32_t PLUGIN_API addRef() override { return ++refCount_; }
+    uint32_t PLUGIN_API release() override {
+        const uint32_t n = --refCount_;
+        if (n == 0) {
+            delete this;
+        }
+        return n;
+    }
+
+    // IPluginBase
+    Steinberg::tresult PLUGIN_API initialize(FUnknown *) override { return Steinberg::kResultOk; }
+    Steinberg::tresult PLUGIN_API terminate() override { return Steinberg::kResultOk; }
+
+    // IComponent
+    Steinberg::tresult PLUGIN_API getControllerClassId(Steinberg::TUID) override { return Steinberg::kResultFalse; }
+    Steinberg::tresult PLUGIN_API setIoMode(Steinberg::Vst::IoMode) override { return Steinberg::kResultOk; }
+
+    Steinberg::int32 PLUGIN_API getBusCount(const Steinberg::Vst::MediaType    type,
+                                            const Steinberg::Vst::BusDirection dir) override {
+        if (type == Steinberg::Vst::kAudio) {
+            return dir == Steinberg::Vst::kOutput || sandbox_.isEffect() ? 1 : 0;
+        }
+        return dir == Steinberg::Vst::kInput || sandbox_.hasEventOutput() ? 1 : 0;
+    }
+
+    Steinberg::tresult PLUGIN_API getBusInfo(const Steinberg::Vst::MediaType    type,
+                                             const Steinberg::Vst::BusDirection dir, const Steinberg::int32 index,
+                                             Steinberg::Vst::BusInfo &bus) override {
+        if (index != 0 || getBusCount(type, dir) == 0) {
+            return Steinberg::kInvalidArgument;
+        }
+        bus              = {};
+        bus.mediaType    = type;
+        bus.direction    = dir;
+        bus.channelCount = type == Steinberg::Vst::kAudio ? static_cast<Steinberg::int32>(sandbox_.getNumChannels())
+                                                          : 16;
+        bus.busType      = Steinberg::Vst::kMain;
+        bus.flags        = Steinberg::Vst::BusInfo::kDefaultActive;
+        return Steinberg::kResultOk;
+    }
+
+    Steinberg::tresult PLUGIN_API getRoutingInfo(Steinberg::Vst::RoutingInfo &,
+                                                 Steinberg::Vst::RoutingInfo &) override {
+        return Steinberg::kResultFalse;
+    }
+    Steinberg::tresult PLUGIN_API activateBus(Steinberg::Vst::MediaType, Steinberg::Vst::BusDirection, Steinberg::int32,
+                                              Steinberg::TBool) override {
+        return Steinberg::kResultOk;
+    }
+    Steinberg::tresult PLUGIN_API setActive(Steinberg::TBool) override { return Steinberg::kResultOk; }
+    Steinberg::tresult PLUGIN_API setState(Steinberg::IBStream *) override { return Steinberg::kResultOk; }
+    Steinberg::tresult PLUGIN_API getState(Steinberg::IBStream *) override { return Steinberg::kResultOk; }
+
+    // IAudioProcessor : The worker has already been set up with the same settings
+    Steinberg::tresult PLUGIN_API setBusArrangements(Steinberg::Vst::SpeakerArrangement *, Steinberg::int32,
+                                                     Steinberg::Vst::SpeakerArrangement *, Steinberg::int32) override {
+        return Steinberg::kResultTrue;
+    }
+    Steinberg::tresult PLUGIN_API getBusArrangement(Steinberg::Vst::BusDirection, Steinberg::int32,
+                                                    Steinberg::Vst::SpeakerArrangement &arr) override {
+        arr = getSpeakerArrangement(sandbox_.getNumChannels());
+        return Steinberg::kResultOk;
+    }
+    Steinberg::tresult PLUGIN_API canProcessSampleSize(const Steinberg::int32 symbolicSampleSize) override {
+        return symbolicSampleSize == Steinberg::Vst::kSample32 ? Steinberg::kResultTrue : Steinberg::kResultFalse;
+    }
+    // The latency at the start of the worker
+    Steinberg::uint32 PLUGIN_API  getLatencySamples() override { return sandbox_.getLatencySamples(); }
+    Steinberg::uint32 PLUGIN_API  getTailSamples() override { return sandbox_.getTailSamples(); }
+    Steinberg::tresult PLUGIN_API setProcessing(Steinberg::TBool) override { return Steinberg::kResultOk; }
+
+    Steinberg::tresult PLUGIN_API setupProcessing(Steinberg::Vst::ProcessSetup &setup) override {
+        return setup.maxSamplesPerBlock <= static_cast<Steinberg::int32>(sandbox_.getMaxSamples())
+                   ? Steinberg::kResultOk
+                   : Steinberg::kResultFalse;
+    }
+
+    Steinberg::tresult PLUGIN_API process(Steinberg::Vst::ProcessData &data) override {
+        (void)sandbox_.audioThreadProcess(data);
+        return Steinberg::kResultOk;
+    }
+
+    // IEditController : No parameters and no editor
+    Steinberg::tresult PLUGIN_API setComponentState(Steinberg::IBStream *) override { return Steinberg::kResultOk; }
+    Steinberg::int32 PLUGIN_API   getParameterCount() override { return 0; }
+    Steinberg::tresult PLUGIN_API getParameterInfo(Steinberg::int32, Steinberg::Vst::ParameterInfo &) override {
+        return Steinberg::kInvalidArgument;
+    }
+    Steinberg::tresult PLUGIN_API getParamStringByValue(Steinberg::Vst::ParamID, Steinberg::Vst::ParamValue,
+                                                        Steinberg::Vst::String128) override {
+        return Steinberg::kInvalidArgument;
+    }
+    Steinberg::tresult PLUGIN_API getParamValueByString(Steinberg::Vst::ParamID, Steinberg::Vst::TChar *,
+                                                        Steinberg::Vst::ParamValue &) override {
+        return Steinberg::kInvalidArgument;
+    }
+    Steinberg::Vst::ParamValue PLUGIN_API normalizedParamToPlain(Steinberg::Vst::ParamID,
+                                                                 const Steinberg::Vst::ParamValue value) override {
+        return value;
+    }
+    Steinberg::Vst::ParamValue PLUGIN_API plainParamToNormalized(Steinberg::Vst::ParamID,
+                                                                 const Steinberg::Vst::ParamValue value) override {
+        return value;
+    }
+    Steinberg::Vst::ParamValue PLUGIN_API getParamNormalized(Steinberg::Vst::ParamID) override { return 0.0; }
+
+    Steinberg::tresult PLUGIN_API setParamNormalized(Steinberg::Vst::ParamID, Steinberg::Vst::ParamValue) override {
+        return Steinberg::kInvalidArgument;
+    }
+    Steinberg::tresult PLUGIN_API setComponentHandler(Steinberg::Vst::IComponentHandler *) override {
+        return Steinberg::kResultOk;
+    }
+    Steinberg::IPlugView *PLUGIN_API createView(Steinberg::FIDString) override { return nullptr; }
+
+  private:
+    PluginSandbox        &sandbox_;
+    std::atomic<uint32_t> refCount_ = 1;
+}; // class SandboxPlugin
+
+// Plugin factory of one sandboxed plugin. Starts the worker when it's constructed, and stops it when it's destroyed,
+// so it must outlive the Vst3Plugin. Owned by the host, so its reference counting is dummy.
+class SandboxPluginFactory final : public Steinberg::IPluginFactory {
+  public:
+    explicit SandboxPluginFactory(const PluginSandbox::Params &params) { (void)sandbox_.start(params); }
+    virtual ~SandboxPluginFactory() = default;
+
+    [[nodiscard]] PluginSandbox &getSandbox() { return sandbox_; }
+
+    Steinberg::tresult PLUGIN_API getFactoryInfo(Steinberg::PFactoryInfo *info) override {
+        *info = Steinberg::PFactoryInfo("MinimalVst3Host", "", "", Steinberg::PFactoryInfo::kNoFlags);
+        return Steinberg::kResultOk;
+    }
+    Steinberg::int32 PLUGIN_API countClasses() override { return sandbox_.good() ? 1 : 0; }
+
+    Steinberg::tresult PLUGIN_API getClassInfo(const Steinberg::int32 index, Steinberg::PClassInfo *info) override {
+        if (index != 0 || !sandbox_.good()) {
+            return Steinberg::kInvalidArgument;
+        }
+        *info = Steinberg::PClassInfo(classId(), Steinberg::PClassInfo::kManyInstances, kVstAudioEffectClass,
+                                      sandbox_.getPluginName().c_str());
+        return Steinberg::kResultOk;
+    }
+
+    Steinberg::tresult PLUGIN_API createInstance(Steinberg::FIDString cid, Steinberg::FIDString iid,
+                                                 void **obj) override {
+        if (!Steinberg::FUnknownPrivate::iidEqual(cid, classId()) || !sandbox_.good()) {
+            *obj = nullptr;
+            return Steinberg::kNoInterface;
+        }
+        auto                    *plugin = new SandboxPlugin(sandbox_);
+        const Steinberg::tresult result = plugin->queryInterface(iid, obj);
+        plugin->release();
+        return result;
+    }
+
+  private:
+    static const Steinberg::TUID &classId() {
+        static const Steinberg::TUID cid = INLINE_UID(0x4D696E69, 0x6D616C53, 0x616E6462, 0x6F78506C);
+        return cid;
+    }
+
+    uint32_t PLUGIN_API addRef() override { return 1; }
+    uint32_t PLUGIN_API release() override { return 1; }
+
+    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
+        if (Steinberg::FUnknownPrivate::iidEqual(tuid, Steinberg::IPluginFactory::iid) ||
+            Steinberg::FUnknownPrivate::iidEqual(tuid, FUnknown::iid)) {
+            *obj = this;
+            return Steinberg::kResultOk;
+        }
+        *obj = nullptr;
+        return Steinberg::kNoInterface;
+    }
+
+    PluginSandbox sandbox_;
+}; // class SandboxPluginFactory
+
+// Minimal JSON reader for moduleinfo.json. Also accepts comments and trailing commas, which are allowed in the module
+// info files (JSON5). Numbers are kept as double, and \u escapes are converted to UTF-8.
+class JsonValue final {
+  public:
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    // false : Syntax error
+    static bool parse(const std::string_view text, JsonValue &out) {
+        size_t pos = 0;
+        return parseValue(text, pos, out, 0) && (skipSpace(text, pos), pos == text.size());
+    }
+
+    [[nodiscard]] Type                          getType() const { return type_; }
+    [[nodiscard]] bool                          getBool() const { return bool_; }
+    [[nodiscard]] double                        getNumber() const { return number_; }
+    [[nodiscard]] const std::string            &getString() const { return string_; }
+    [[nodiscard]] const std::vector<JsonValue> &getElements() const { return values_; } // Of an array or an object
+
+    // nullptr : Not an object, or no such key
+    [[nodiscard]] const JsonValue *find(const std::string_view key) const {
+        for (size_t i = 0; i < keys_.size(); ++i) {
+            if (keys_[i] == key) {
+                return &values_[i];
+            }
+        }
+        return nullptr;
+    }
+
+  private:
+    static constexpr unsigned MaxDepth = 64;
+
+    static void skipSpace(const std::string_view s, size_t &pos) {
+        while (pos < s.size()) {
+            if (std::isspace(static_cast<unsigned char>(s[pos]))) {
+                ++pos;
+            } else if (s.substr(pos, 2) == "//") {
+                pos = std::min(s.find('\n', pos), s.size());
+            } else if (s.substr(pos, 2) == "/*") {
+                const size_t end = s.find("*/", pos + 2);
+                pos              = end == std::string_view::npos ? s.size() : end + 2;
+            } else {
+                break;
+            }
+        }
+    }
+
+    static void appendUtf8(std::string &out, const uint32_t c) {
+        if (c < 0x80) {
+            out += static_cast<char>(c);
+        } else if (c < 0x800) {
+            out += static_cast<char>(0xC0 | (c >> 6));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            out += static_cast<char>(0xE0 | (c >> 12));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (c >> 18));
+            out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+
+    static bool parseHex4(const std::string_view s, size_t &pos, uint32_t &out) {
+        if (pos + 4 > s.size()) {
+            return false;
+        }
+        out = 0;
+        for (int i = 0; i < 4; ++i) {
+            const char c = s[pos++];
+            const int  d = (c >= '0' && c <= '9')   ? c - '0'
+                           : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                           : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                                                    : -1;
+            if (d < 0) {
+                return false;
+            }
+            out = out * 16 + static_cast<uint32_t>(d);
+        }
+        return true;
+    }
+
+    static bool parseString(const std::string_view s, size_t &pos, std::string &out) {
+        if (pos >= s.size() || s[pos] != '"') {
+            return false;
+        }
+        for (++pos; pos < s.size();) {
+            const char c = s[pos++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= s.size()) {
+                return false;
+            }
+            switch (const char e = s[pos++]) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t cp = 0;
+                if (!parseHex4(s, pos, cp)) {
+                    return false;
+                }
+                // Surrogate pair
+                if (uint32_t lo = 0; cp >= 0xD800 && cp < 0xDC00 && s.substr(pos, 2) == "\\u" &&
+                                     (pos += 2, parseHex4(s, pos, lo)) && lo >= 0xDC00 && lo < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                }
+                appendUtf8(out, cp);
+                break;
+            }
+            default: out += e; break; // \" \\ \/
+            }
+        }
+        return false;
+    }
+
+    static bool parseValue(const std::string_view s, size_t &pos, JsonValue &out, const unsigned depth) {
+        skipSpace(s, pos);
+        if (pos >= s.size() || depth > MaxDepth) {
+            return false;
+        }
+        const char c = s[pos];
+        if (c == '{' || c == '[') {
+            out.type_       = c == '{' ? Type::Object : Type::Array;
+            const char last = c == '{' ? '}' : ']';
+            for (++pos;;) {
+                skipSpace(s, pos);
+                if (pos < s.size() && s[pos] == last) {
+                    ++pos;
+                    return true;
+                }
+                if (out.type_ == Type::Object) {
+                    std::string key;
+                    if (!parseString(s, pos, key) || (skipSpace(s, pos), pos >= s.size() || s[pos++] != ':')) {
+                        return false;
+                    }
+                    out.keys_.push_back(std::move(key));
+                }
+                if (!parseValue(s, pos, out.values_.emplace_back(), depth + 1)) {
+                    return false;
+                }
+                skipSpace(s, pos);
+                if (pos < s.size() && s[pos] == ',') {
+                    ++pos;
+                } else if (pos >= s.size() || s[pos] != last) {
+                    return false;
+                }
+            }
+        }
+        if (c == '"') {
+            out.type_ = Type::String;
+            return parseString(s, pos, out.string_);
+        }
+        if (s.substr(pos, 4) == "true" || s.substr(pos, 4) == "null") {
+            out.type_ = c == 't' ? Type::Bool : Type::Null;
+            out.bool_ = c == 't';
+            pos += 4;
+            return true;
+        }
+        if (s.substr(pos, 5) == "false") {
+            out.type_ = Type::Bool;
+            pos += 5;
+            return true;
+        }
+        const size_t end = s.find_first_not_of("+-0123456789.eE", pos);
+        const std::string number(s.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos));
+        char *numberEnd = nullptr;
+        out.type_       = Type::Number;
+        out.number_     = std::strtod(number.c_str(), &numberEnd);
+        pos += number.size();
+        return !number.empty() && numberEnd == number.c_str() + number.size();
+    }
+
+    Type                     type_   = Type::Null;
+    bool                     bool_   = false;
+    double                   number_ = 0.0;
+    std::string              string_;
+    std::vector<std::string> keys_;   // Of an object
+    std::vector<JsonValue>   values_; // Of an array or an object
+}; // class JsonValue
+
+// Plugin scanner (--scan <dir>). Collects the classes of the VST3 modules, and keeps them in a cache file.
+//
+// A module is only scanned again when its size or modification time has changed. If the bundle ships
+// Contents/Resources/moduleinfo.json, the classes are read from it without loading the module. Otherwise each module
+// is loaded by a worker process (--scan-module), so a plugin which crashes or hangs can't take the host down. Several
+// worker processes run in parallel. Broken modules are cached too, and skipped until they change.
+//
+// The cache is a text file with one tab-separated record per line :
+//   M <path> <size> <mtime> <status>
+//   C <cid> <category> <name> <vendor> <version> <sdk version> <sub categories> <cardinality> <class flags>
+//     <audio inputs> <audio outputs> <event inputs> <event outputs> <controller cid>
+// The C records belong to the M record before them. The bus counts are -1 if they're unknown (moduleinfo.json).
+class PluginScanner final {
+  public:
+    enum class Status { Loaded, ModuleInfo, Failed };
+
+    struct ClassInfo {
+        std::string cid;           // 32 hex digits, same as FUID::toString() and moduleinfo.json
+        std::string category;      // e.g. kVstAudioEffectClass
+        std::string name;
+        std::string vendor;        // PClassInfo2 or moduleinfo.json
+        std::string version;       // PClassInfo2 or moduleinfo.json
+        std::string sdkVersion;    // PClassInfo2 or moduleinfo.json
+        std::string subCategories; // e.g. "Instrument|Synth"
+        int32_t     cardinality   = 0;
+        uint32_t    classFlags    = 0;
+        int32_t     nAudioInputs  = -1; // -1 : Unknown
+        int32_t     nAudioOutputs = -1;
+        int32_t     nEventInputs  = -1;
+        int32_t     nEventOutputs = -1;
+        std::string controllerCid;
     };
-    using EventQueue = SpscQueue<Steinberg::Vst::Event, 4096>;
 
-    Vst3Plugin(const InitParams &initParams) { init(initParams); }
-    ~Vst3Plugin() { cleanup(); }
+    struct Module {
+        std::string            path; // UTF-8 path of the bundle or the module file
+        uint64_t               size   = 0;
+        int64_t                mtime  = 0;
+        Status                 status = Status::Failed;
+        std::vector<ClassInfo> classes;
+    };
 
-    EventQueue        &getEventQueue() { return eventQueue_; }
-    [[nodiscard]] bool hasEventOutput() const { return hasEventOutput_; }
-    [[nodiscard]] bool good() const { return initialized_; }
-    [[nodiscard]] bool isEffect() const { return isEffect_; }
+    static constexpr auto WorkerTimeout = std::chrono::seconds(30);
 
-    // Callback when the plugin side requests a GUI resize
-    Steinberg::tresult resizeView(const Steinberg::ViewRect *newSize) const {
-        const HWND hWnd = hWnd_;
-        if (!hWnd) {
-            return Steinberg::kResultFalse;
+    // Scans the modules under `roots`, updates the cache, and prints the classes.
+    // nJobs : Parallel worker processes. 0 : Number of cores
+    static int run(const std::vector<std::filesystem::path> &roots, const std::filesystem::path &cachePath,
+                   const unsigned nJobs) {
+        const auto             startTime = std::chrono::steady_clock::now();
+        std::vector<Module>    cached    = readCache(cachePath);
+        std::vector<Module>    modules;
+        std::vector<size_t>    toScan;
+        std::vector<std::filesystem::path> bundles;
+        for (const std::filesystem::path &root : roots) {
+            findBundles(root, bundles);
         }
-        RECT       rc      = {0, 0, newSize->right - newSize->left, newSize->bottom - newSize->top};
-        const auto style   = static_cast<DWORD>(GetWindowLongPtrW(hWnd, GWL_STYLE));
-        const auto exStyle = static_cast<DWORD>(GetWindowLongPtrW(hWnd, GWL_EXSTYLE));
-        AdjustWindowRectExForDpi(&rc, style, FALSE, exStyle, GetDpiForWindow(hWnd));
-        constexpr auto uFlags = SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED;
-        SetWindowPos(hWnd, nullptr, 0, 0, rc.right - rc.left, rc.bottom - rc.top, uFlags);
-        return Steinberg::kResultOk;
+        for (const std::filesystem::path &bundle : bundles) {
+            Module &m = modules.emplace_back();
+            m.path    = toUtf8(bundle);
+            getKey(bundle, m.size, m.mtime);
+            const auto it = std::find_if(cached.begin(), cached.end(), [&](const Module &c) {
+                return c.path == m.path && c.size == m.size && c.mtime == m.mtime;
+            });
+            if (it != cached.end()) {
+                m = std::move(*it);
+                cached.erase(it);
+            } else {
+                toScan.push_back(modules.size() - 1);
+            }
+        }
+
+        // Each job takes the next module. A module is either read from moduleinfo.json, or loaded by a worker process.
+        const unsigned nThreads =
+            std::min<unsigned>(nJobs ? nJobs : std::max(1u, std::thread::hardware_concurrency()),
+                               static_cast<unsigned>(toScan.size()));
+        std::atomic<size_t>      next = 0;
+        std::mutex               printMutex;
+        std::vector<std::thread> threads;
+        for (unsigned iThread = 0; iThread < nThreads; ++iThread) {
+            threads.emplace_back([&, iThread] {
+                for (size_t i; (i = next.fetch_add(1)) < toScan.size();) {
+                    Module &m = modules[toScan[i]];
+                    scanModule(bundles[toScan[i]], iThread, m);
+                    const std::lock_guard lock(printMutex);
+                    MY_TRACE(L"Scanned [%zu/%zu] \"%hs\" : %zu classes (%ls)\n", i + 1, toScan.size(), m.path.c_str(),
+                             m.classes.size(), getStatusName(m.status));
+                }
+            });
+        }
+        for (std::thread &t : threads) {
+            t.join();
+        }
+
+        // Keep the cached modules which are outside of the scanned directories
+        for (Module &c : cached) {
+            const bool scanned = std::any_of(roots.begin(), roots.end(), [&](const std::filesystem::path &root) {
+                return isInside(fromUtf8(c.path), std::filesystem::absolute(root));
+            });
+            if (!scanned) {
+                modules.push_back(std::move(c));
+            }
+        }
+        if (!writeCache(cachePath, modules)) {
+            MY_ERROR(L"Failed to write the scan cache \"%ls\"\n", cachePath.wstring().c_str());
+        }
+        printModules(modules);
+        MY_TRACE(L"Scan : %zu modules, %zu scanned by %u jobs, %zu from the cache, in %.3f sec\n", bundles.size(),
+                 toScan.size(), nThreads, bundles.size() - toScan.size(),
+                 std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+        return EXIT_SUCCESS;
+    }
+
+    // Worker process (--scan-module <path> --scan-out <file>) : Loads the module, and writes the C records of its
+    // classes. "synth:<spec>" scans a synthetic plugin.
+    static int runWorker(const std::filesystem::path &modulePath, const std::filesystem::path &outPath) {
+        Vst3Module                              vst3Module;
+        std::unique_ptr<SyntheticPluginFactory> syntheticFactory;
+        Steinberg::IPluginFactory              *factory = nullptr;
+        if (const std::string path = toUtf8(modulePath); path.starts_with("synth:")) {
+            SyntheticPlugin::Config config;
+            if (SyntheticPlugin::parse(path.substr(6), config)) {
+                syntheticFactory = std::make_unique<SyntheticPluginFactory>(config);
+                factory          = syntheticFactory.get();
+            }
+        } else {
+            factory = vst3Module.load(modulePath);
+        }
+        if (!factory) {
+            MY_ERROR(L"Failed to load \"%ls\"\n", modulePath.wstring().c_str());
+            return EXIT_FAILURE;
+        }
+        Module module;
+        readClasses(*factory, module.classes);
+        std::ofstream ofs(outPath, std::ios::binary);
+        for (const ClassInfo &c : module.classes) {
+            writeClass(ofs, c);
+        }
+        return ofs.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+  private:
+    static constexpr std::string_view CacheHeader = "# MinimalVst3Host plugin scan cache 1";
+
+    static std::string toUtf8(const std::filesystem::path &path) {
+        const std::u8string s = path.u8string();
+        return {s.begin(), s.end()};
+    }
+
+    static std::filesystem::path fromUtf8(const std::string &str) { return std::u8string(str.begin(), str.end()); }
+
+    // true if `path` is `dir` or below it. Compares whole components, so "/a/plug" doesn't contain "/a/plugins2".
+    static bool isInside(const std::filesystem::path &path, const std::filesystem::path &dir) {
+        const std::filesystem::path p = path.lexically_normal();
+        std::filesystem::path       d = dir.lexically_normal();
+        if (!d.has_filename()) {
+            d = d.parent_path(); // "/a/plug/" ends with an empty component
+        }
+        return std::mismatch(d.begin(), d.end(), p.begin(), p.end()).first == d.end();
+    }
+
+    static const wchar_t *getStatusName(const Status status) {
+        switch (status) {
+        case Status::Loaded:
+            return L"loaded";
+        case Status::ModuleInfo:
+            return L"moduleinfo.json";
+        default:
+            return L"failed";
+        }
+    }
+
+    // Bundles (*.vst3 directories) and single file modules (*.vst3 files) under `root`
+    static void findBundles(const std::filesystem::path &root, std::vector<std::filesystem::path> &out) {
+        std::error_code ec;
+        if (root.extension() == ".vst3") {
+            out.push_back(std::filesystem::absolute(root, ec));
+            return;
+        }
+        auto it = std::filesystem::recursive_directory_iterator(
+            root, std::filesystem::directory_options::skip_permission_denied, ec);
+        if (ec) {
+            MY_ERROR(L"Can't scan \"%ls\"\n", root.wstring().c_str());
+            return;
+        }
+        for (; it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            if (it->path().extension() == ".vst3") {
+                out.push_back(std::filesystem::absolute(it->path(), ec));
+                it.disable_recursion_pending();
+            }
+        }
+    }
+
+    static std::filesystem::path getModuleInfoPath(const std::filesystem::path &bundle) {
+        return bundle / "Contents" / "Resources" / "moduleinfo.json";
+    }
+
+    // The cache key is the size and the modification time of the module binary, or of moduleinfo.json if the bundle
+    // has no binary for this platform.
+    static void getKey(const std::filesystem::path &bundle, uint64_t &size, int64_t &mtime) {
+        std::error_code             ec;
+        const std::filesystem::path binary = Vst3Module::getBinaryPath(bundle);
+        const std::filesystem::path file   = std::filesystem::exists(binary, ec) ? binary : getModuleInfoPath(bundle);
+        size                               = std::filesystem::file_size(file, ec);
+        size                               = ec ? 0 : size;
+        const auto time                    = std::filesystem::last_write_time(file, ec);
+        mtime                              = ec ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+    }
+
+    static void scanModule(const std::filesystem::path &bundle, const unsigned iJob, Module &m) {
+        m.classes.clear();
+        if (std::filesystem::exists(getModuleInfoPath(bundle)) && readModuleInfo(getModuleInfoPath(bundle), m)) {
+            m.status = Status::ModuleInfo;
+            return;
+        }
+        std::filesystem::path outPath = std::filesystem::temp_directory_path() /
+                                        ("vst3scan-" + std::to_string(ChildProcess::getCurrentId()) + "-" +
+                                         std::to_string(iJob) + ".tsv");
+        m.status = Status::Failed;
+        if (runWorkerProcess(bundle, outPath)) {
+            std::ifstream ifs(outPath, std::ios::binary);
+            for (std::string line; std::getline(ifs, line);) {
+                if (ClassInfo c; readClass(split(line), c)) {
+                    m.classes.push_back(std::move(c));
+                }
+            }
+            m.status = Status::Loaded;
+        }
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+
+    static std::string cidToString(const Steinberg::TUID cid) {
+        const auto *b = reinterpret_cast<const uint8_t *>(cid);
+#if COM_COMPATIBLE
+        // GUID layout : Data1, Data2 and Data3 are little endian
+        constexpr std::array<int, 16> order = {3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15};
+#else
+        constexpr std::array<int, 16> order = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+#endif
+        std::string s;
+        for (const int i : order) {
+            constexpr char hex[] = "0123456789ABCDEF";
+            s += hex[b[i] >> 4];
+            s += hex[b[i] & 15];
+        }
+        return s;
+    }
+
+    // Reads the classes from the factory. The bus layout is read from a component instance of each audio class.
+    static void readClasses(Steinberg::IPluginFactory &factory, std::vector<ClassInfo> &out) {
+        Steinberg::IPtr<Steinberg::IPluginFactory2> factory2;
+        factory.queryInterface(Steinberg::IPluginFactory2::iid, reinterpret_cast<void **>(&factory2));
+        MyHost host;
+        for (Steinberg::int32 i = 0, n = factory.countClasses(); i < n; ++i) {
+            ClassInfo             c;
+            Steinberg::PClassInfo info;
+            if (factory.getClassInfo(i, &info) != Steinberg::kResultOk) {
+                continue;
+            }
+            c.cid         = cidToString(info.cid);
+            c.category    = info.category;
+            c.name        = info.name;
+            c.cardinality = info.cardinality;
+            if (Steinberg::PClassInfo2 info2; factory2 && factory2->getClassInfo2(i, &info2) == Steinberg::kResultOk) {
+                c.vendor        = info2.vendor;
+                c.version       = info2.version;
+                c.sdkVersion    = info2.sdkVersion;
+                c.subCategories = info2.subCategories;
+                c.classFlags    = info2.classFlags;
+            }
+            Steinberg::IPtr<Steinberg::Vst::IComponent> component;
+            if (c.category == kVstAudioEffectClass &&
+                factory.createInstance(info.cid, Steinberg::Vst::IComponent::iid,
+                                       reinterpret_cast<void **>(&component)) == Steinberg::kResultOk &&
+                component && component->initialize(&host) == Steinberg::kResultOk) {
+                using namespace Steinberg::Vst;
+                c.nAudioInputs  = component->getBusCount(kAudio, kInput);
+                c.nAudioOutputs = component->getBusCount(kAudio, kOutput);
+                c.nEventInputs  = component->getBusCount(kEvent, kInput);
+                c.nEventOutputs = component->getBusCount(kEvent, kOutput);
+                if (Steinberg::TUID id; component->getControllerClassId(id) == Steinberg::kResultOk) {
+                    c.controllerCid = cidToString(id);
+                }
+                component->terminate();
+            }
+            out.push_back(std::move(c));
+        }
+    }
+
+    static bool readModuleInfo(const std::filesystem::path &path, Module &m) {
+        std::ifstream      ifs(path, std::ios::binary);
+        const std::string  text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        JsonValue          root;
+        const JsonValue   *classes = nullptr;
+        if (!JsonValue::parse(text, root) || !(classes = root.find("Classes")) ||
+            classes->getType() != JsonValue::Type::Array) {
+            MY_ERROR(L"Invalid moduleinfo.json \"%ls\"\n", path.wstring().c_str());
+            return false;
+        }
+        const auto str = [](const JsonValue &v, const char *key) {
+            const JsonValue *p = v.find(key);
+            return p && p->getType() == JsonValue::Type::String ? p->getString() : std::string();
+        };
+        const auto num = [](const JsonValue &v, const char *key) {
+            const JsonValue *p = v.find(key);
+            return p && p->getType() == JsonValue::Type::Number ? p->getNumber() : 0.0;
+        };
+        for (const JsonValue &v : classes->getElements()) {
+            ClassInfo &c  = m.classes.emplace_back();
+            c.cid         = str(v, "CID");
+            c.category    = str(v, "Category");
+            c.name        = str(v, "Name");
+            c.vendor      = str(v, "Vendor");
+            c.version     = str(v, "Version");
+            c.sdkVersion  = str(v, "SDKVersion");
+            c.cardinality = static_cast<int32_t>(num(v, "Cardinality"));
+            c.classFlags  = static_cast<uint32_t>(num(v, "Class Flags"));
+            if (const JsonValue *sub = v.find("Sub Categories")) {
+                for (const JsonValue &s : sub->getElements()) {
+                    c.subCategories += (c.subCategories.empty() ? "" : "|") + s.getString();
+                }
+            }
+        }
+        return true;
+    }
+
+    // Runs `<this executable> --scan-module <bundle> --scan-out <outPath>`. false : Failed, crashed or timed out
+    static bool runWorkerProcess(const std::filesystem::path &bundle, const std::filesystem::path &outPath) {
+        ChildProcess child;
+        if (!child.start({"--scan-module", bundle, "--scan-out", outPath})) {
+            return false;
+        }
+        if (int exitCode = -1; child.wait(WorkerTimeout, exitCode)) {
+            return exitCode == 0;
+        }
+        MY_ERROR(L"Scanning \"%ls\" has timed out\n", bundle.wstring().c_str());
+        child.kill();
+        return false;
+    }
+
+    static std::vector<std::string> split(const std::string &line) {
+        std::vector<std::string> fields;
+        for (size_t begin = 0;;) {
+            const size_t end = line.find('\t', begin);
+            fields.push_back(line.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+            if (end == std::string::npos) {
+                return fields;
+            }
+            begin = end + 1;
+        }
+    }
+
+    // Tabs and line breaks would break the records
+    static std::string sanitize(std::string s) {
+        std::replace_if(s.begin(), s.end(), [](const char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+        return s;
+    }
+
+    static void writeClass(std::ostream &os, const ClassInfo &c) {
+        os << "C\t" << c.cid << '\t' << sanitize(c.category) << '\t' << sanitize(c.name) << '\t' << sanitize(c.vendor)
+           << '\t' << sanitize(c.version) << '\t' << sanitize(c.sdkVersion) << '\t' << sanitize(c.subCategories)
+           << '\t' << c.cardinality << '\t' << c.classFlags << '\t' << c.nAudioInputs << '\t' << c.nAudioOutputs
+           << '\t' << c.nEventInputs << '\t' << c.nEventOutputs << '\t' << c.controllerCid << '\n';
+    }
+
+    static bool readClass(const std::vector<std::string> &f, ClassInfo &c) {
+        if (f.size() != 15 || f[0] != "C") {
+            return false;
+        }
+        c = {
+            .cid           = f[1],
+            .category      = f[2],
+            .name          = f[3],
+            .vendor        = f[4],
+            .version       = f[5],
+            .sdkVersion    = f[6],
+            .subCategories = f[7],
+            .cardinality   = static_cast<int32_t>(std::strtol(f[8].c_str(), nullptr, 10)),
+            .classFlags    = static_cast<uint32_t>(std::strtoul(f[9].c_str(), nullptr, 10)),
+            .nAudioInputs  = static_cast<int32_t>(std::strtol(f[10].c_str(), nullptr, 10)),
+            .nAudioOutputs = static_cast<int32_t>(std::strtol(f[11].c_str(), nullptr, 10)),
+            .nEventInputs  = static_cast<int32_t>(std::strtol(f[12].c_str(), nullptr, 10)),
+            .nEventOutputs = static_cast<int32_t>(std::strtol(f[13].c_str(), nullptr, 10)),
+            .controllerCid = f[14],
+        };
+        return true;
+    }
+
+    static std::vector<Module> readCache(const std::filesystem::path &path) {
+        std::vector<Module> modules;
+        std::ifstream       ifs(path, std::ios::binary);
+        std::string         line;
+        if (!std::getline(ifs, line) || line != CacheHeader) {
+            return modules; // No cache, or an old format
+        }
+        while (std::getline(ifs, line)) {
+            const std::vector<std::string> f = split(line);
+            if (f.size() == 5 && f[0] == "M") {
+                Module &m = modules.emplace_back();
+                m.path    = f[1];
+                m.size    = std::strtoull(f[2].c_str(), nullptr, 10);
+                m.mtime   = std::strtoll(f[3].c_str(), nullptr, 10);
+                m.status  = f[4] == "loaded"       ? Status::Loaded
+                            : f[4] == "moduleinfo" ? Status::ModuleInfo
+                                                   : Status::Failed;
+            } else if (ClassInfo c; !modules.empty() && readClass(f, c)) {
+                modules.back().classes.push_back(std::move(c));
+            }
+        }
+        return modules;
+    }
+
+    // Writes a temporary file and renames it, so a reader never sees a partial cache
+    static bool writeCache(const std::filesystem::path &path, const std::vector<Module> &modules) {
+        std::filesystem::path tmpPath = path;
+        tmpPath += ".tmp";
+        {
+            std::ofstream ofs(tmpPath, std::ios::binary);
+            ofs << CacheHeader << '\n';
+            for (const Module &m : modules) {
+                constexpr const char *statusNames[] = {"loaded", "moduleinfo", "failed"};
+                ofs << "M\t" << sanitize(m.path) << '\t' << m.size << '\t' << m.mtime << '\t'
+                    << statusNames[static_cast<int>(m.status)] << '\n';
+                for (const ClassInfo &c : m.classes) {
+                    writeClass(ofs, c);
+                }
+            }
+            if (!ofs.good()) {
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        return !ec;
+    }
+
+    static void printModules(const std::vector<Module> &modules) {
+        for (const Module &m : modules) {
+            MY_TRACE(L"\"%hs\" (%ls)\n", m.path.c_str(), getStatusName(m.status));
+            for (const ClassInfo &c : m.classes) {
+                if (c.category != kVstAudioEffectClass) {
+                    continue;
+                }
+                // Same rule as Vst3Plugin : An effect has an audio input
+                const wchar_t *kind = c.subCategories.find("Instrument") != std::string::npos ? L"instrument"
+                                      : c.nAudioInputs > 0 || c.subCategories.find("Fx") != std::string::npos
+                                          ? L"effect"
+                                          : L"-";
+                MY_TRACE(L"  %hs : %ls, \"%hs\" %hs, \"%hs\", audio %d/%d, event %d/%d\n", c.cid.c_str(), kind,
+                         c.name.c_str(), c.version.c_str(), c.subCategories.c_str(), c.nAudioInputs, c.nAudioOutputs,
+                         c.nEventInputs, c.nEventOutputs);
+            }
+        }
+    }
+}; // class PluginScanner
+
+// Command line options
+struct AppOptions {
+    enum class BackendType { Wasapi, Null, Timer, WavFile };
+    enum class BenchType { None, Kernels, Queue, Chain, Sandbox };
+
+    static constexpr unsigned MaxFixedBlockSize = 8192;
+
+#if defined(_WIN32)
+    BackendType backendType = BackendType::Wasapi; // --backend <wasapi|null|timer>
+#else
+    BackendType backendType = BackendType::Timer;
+#endif
+#if defined(_WIN32)
+    Vst3Plugin::EditorMode editorMode = Vst3Plugin::EditorMode::Open; // --editor <open|lazy|none>
+#else
+    Vst3Plugin::EditorMode editorMode = Vst3Plugin::EditorMode::None;
+#endif
+    std::filesystem::path wavPath;                     // --offline <out.wav> : Faster than realtime render
+    double                seconds           = 10.0;    // --seconds <sec> : 0 = Until stopped
+    double                sampleRate        = 48000.0; // --sample-rate <hz>
+    unsigned              bufferSize        = 512;     // --block-size <frames>
+    unsigned              fixedBlockSize    = 0;       // --fixed-block <frames> : Chain block size. 0 = Device's
+    unsigned              nChannels         = 2;       // --channels <n>
+    unsigned              nWorkers          = 0;       // --threads <n> : Parallel graph workers
+    unsigned              nPipelineStages   = 1;       // --pipeline <n> : Pipelined on n cores (+n-1 blocks)
+    double                eventLatencyMsec  = 0.0;     // --event-latency <msec> : Fixed live event latency. 0 = 1 block
+    double                paramMonitorMsec  = 0.0;     // --param-monitor <msec> : Print output parameters. 0 = Off
+    double                timingMonitorMsec = 0.0;     // --timing-monitor <msec> : Print DSP load and xruns. 0 = Off
+
+    BufferKernels::SampleFormat wavFormat = BufferKernels::SampleFormat::Float32; // --wav-format <f32|s16|s24|s32>
+    bool                        dither    = false;                                // --dither <on|off>
+    BenchType                   benchType = BenchType::None;                      // --bench <kernels|queue|...>
+    std::filesystem::path       benchOut;                                         // --bench-out <out.json>
+    bool                        rtCheck   = false;                                // --rt-check <on|off>
+    bool                        sandbox   = false;                                // --sandbox <on|off>
+    bool                        skipIdle  = true;                                 // --idle-skip <on|off>
+    std::vector<std::string>    synthSpecs; // --synth <spec> : Synthetic plugin, repeatable. Replaces the plugin DLLs
+    std::filesystem::path       midiPath;   // --midi <file.mid> : Standard MIDI File played into the plugin chain
+
+    std::vector<std::filesystem::path> pluginPaths;                         // --plugin <path> : Repeatable
+    std::filesystem::path              presetPath;                          // --preset <file> : Snapshot to load
+    std::filesystem::path              presetOut;                           // --preset-out <file> : Save at exit
+    std::vector<std::filesystem::path> scanRoots;                           // --scan <dir> : Repeatable
+    std::filesystem::path              scanCache = "plugin-scan-cache.tsv"; // --scan-cache <file>
+    unsigned                           scanJobs  = 0;                       // --scan-jobs <n> : 0 = Number of cores
+    std::filesystem::path              scanModule;                          // --scan-module <path> : Worker process
+    std::filesystem::path              scanOut;                             // --scan-out <file> : Worker's output
+    std::string                        sandboxWorker; // --sandbox-worker <name> : Worker process of a sandbox
+    std::filesystem::path              sandboxPlugin; // --sandbox-plugin <path> : Plugin of the sandbox worker
+    std::filesystem::path              batchPath;        // --batch <jobs.json> : Render farm (RenderFarm)
+    unsigned                           batchWorkers = 0; // --batch-workers <n> : 0 = Number of cores
+    std::filesystem::path              tracePath;        // --trace <out.json> : Timeline of the audio threads
+
+    // --sidechain <n>:<source> : The output of plugin #source feeds the aux input of plugin #n. Repeatable
+    std::vector<ProcessGraph::Sidechain> sidechains;
+
+    // --golden <golden.json> : Checks the output and the host overhead of each --batch job against the golden file
+    std::filesystem::path goldenPath;
+    bool                  goldenUpdate    = false; // --golden-update <on|off> : Writes the golden file instead
+    double                goldenTolerance = 50.0;  // --golden-tolerance <percent> : Allowed host overhead increase
+    bool                  goldenOverhead  = true;  // --golden-overhead <on|off> : off = Only the hashes
+
+    static void printUsage() {
+        (void)fwprintf(stderr, L"Usage: MinimalVst3HostForWindows [--backend <wasapi|null|timer>] [--offline <out.wav>]"
+                               L" [--seconds <sec>] [--sample-rate <hz>] [--block-size <frames>] [--channels <n>]"
+                               L" [--fixed-block <frames>] [--threads <n> | --pipeline <stages>]"
+                               L" [--event-latency <msec>]"
+                               L" [--param-monitor <msec>] [--timing-monitor <msec>]"
+                               L" [--wav-format <f32|s16|s24|s32>] [--dither <on|off>] [--rt-check <on|off>]"
+                               L" [--idle-skip <on|off>]"
+                               L" [--editor <open|lazy|none>] [--plugin <bundle.vst3>]..."
+                               L" [--preset <file>] [--preset-out <file>] [--midi <file.mid>]"
+                               L" [--synth <pass|burn:usec|events:n|alloc:n|delay:n|drums:n|duck|notes>]..."
+                               L" [--sidechain <n>:<source>]..."
+                               L" [--sandbox <on|off>] [--bench <kernels|queue|chain|sandbox>] [--bench-out <out.json>]"
+                               L" [--scan <dir>]... [--scan-cache <file>] [--scan-jobs <n>]"
+                               L" [--batch <jobs.json>] [--batch-workers <n>]"
+                               L" [--golden <golden.json>] [--golden-update <on|off>] [--golden-tolerance <percent>]"
+                               L" [--golden-overhead <on|off>]"
+                               L" [--trace <out.json>]\n");
+    }
+
+    bool parse(const int argc, char *argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            const std::string_view arg = argv[i];
+            if (i + 1 >= argc) {
+                MY_ERROR(L"Option \"%hs\" requires a value\n", argv[i]);
+                return false;
+            }
+            if (!set(arg, argv[++i])) {
+                MY_ERROR(L"Invalid option \"%hs %hs\"\n", argv[i - 1], argv[i]);
+                return false;
+            }
+        }
+        return validate();
+    }
+
+  private:
+    bool set(const std::string_view arg, const std::string_view val) {
+        const std::string str(val);
+        if (arg == "--backend") {
+            if (val == "null") {
+                backendType = BackendType::Null;
+            } else if (val == "timer") {
+                backendType = BackendType::Timer;
+            } else if (val == "wasapi") {
+                backendType = BackendType::Wasapi;
+            } else {
+                return false;
+            }
+        } else if (arg == "--editor") {
+            if (val == "open") {
+                editorMode = Vst3Plugin::EditorMode::Open;
+            } else if (val == "lazy") {
+                editorMode = Vst3Plugin::EditorMode::Lazy;
+            } else if (val == "none") {
+                editorMode = Vst3Plugin::EditorMode::None;
+            } else {
+                return false;
+            }
+        } else if (arg == "--offline") {
+            backendType = BackendType::WavFile;
+            wavPath     = str;
+        } else if (arg == "--seconds") {
+            seconds = std::atof(str.c_str());
+        } else if (arg == "--sample-rate") {
+            sampleRate = std::atof(str.c_str());
+        } else if (arg == "--block-size") {
+            bufferSize = static_cast<unsigned>(std::atoi(str.c_str()));
+        } else if (arg == "--fixed-block") {
+            fixedBlockSize = static_cast<unsigned>(std::atoi(str.c_str()));
+        } else if (arg == "--channels") {
+            nChannels = static_cast<unsigned>(std::atoi(str.c_str()));
+        } else if (arg == "--threads") {
+            nWorkers = static_cast<unsigned>(std::atoi(str.c_str()));
+        } else if (arg == "--pipeline") {
+            nPipelineStages = static_cast<unsigned>(std::atoi(str.c_str()));
+        } else if (arg == "--event-latency") {
+            eventLatencyMsec = std::atof(str.c_str());
+        } else if (arg == "--param-monitor") {
+            paramMonitorMsec = std::atof(str.c_str());
+        } else if (arg == "--timing-monitor") {
+            timingMonitorMsec = std::atof(str.c_str());
+        } else if (arg == "--wav-format") {
+            if (val == "f32") {
+                wavFormat = BufferKernels::SampleFormat::Float32;
+            } else if (val == "s16") {
+                wavFormat = BufferKernels::SampleFormat::Int16;
+            } else if (val == "s24") {
+                wavFormat = BufferKernels::SampleFormat::Int24;
+            } else if (val == "s32") {
+                wavFormat = BufferKernels::SampleFormat::Int32;
+            } else {
+                return false;
+            }
+        } else if (arg == "--dither") {
+            if (val != "on" && val != "off") {
+                return false;
+            }
+            dither = val == "on";
+        } else if (arg == "--rt-check") {
+            if (val != "on" && val != "off") {
+                return false;
+            }
+            rtCheck = val == "on";
+        } else if (arg == "--bench") {
+            if (val == "kernels") {
+                benchType = BenchType::Kernels;
+            } else if (val == "queue") {
+                benchType = BenchType::Queue;
+            } else if (val == "chain") {
+                benchType = BenchType::Chain;
+            } else if (val == "sandbox") {
+                benchType = BenchType::Sandbox;
+            } else {
+                return false;
+            }
+        } else if (arg == "--sandbox") {
+            if (val != "on" && val != "off") {
+                return false;
+            }
+            sandbox = val == "on";
+        } else if (arg == "--idle-skip") {
+            if (val != "on" && val != "off") {
+                return false;
+            }
+            skipIdle = val == "on";
+        } else if (arg == "--bench-out") {
+            benchOut = str;
+        } else if (arg == "--synth") {
+            if (SyntheticPlugin::Config config; !SyntheticPlugin::parse(val, config)) {
+                return false;
+            }
+            synthSpecs.push_back(str);
+        } else if (arg == "--sidechain") {
+            const size_t colon = str.find(':');
+            if (colon == std::string::npos || colon == 0 || colon + 1 == str.size()) {
+                return false;
+            }
+            sidechains.push_back({.node   = static_cast<unsigned>(std::atoi(str.substr(0, colon).c_str())),
+                                  .source = static_cast<unsigned>(std::atoi(str.substr(colon + 1).c_str()))});
+        } else if (arg == "--plugin") {
+            pluginPaths.push_back(str);
+        } else if (arg == "--preset") {
+            presetPath = str;
+        } else if (arg == "--preset-out") {
+            presetOut = str;
+        } else if (arg == "--scan") {
+            scanRoots.push_back(str);
+        } else if (arg == "--scan-cache") {
+            scanCache = str;
+        } else if (arg == "--scan-jobs") {
+            scanJobs = static_cast<unsigned>(std::atoi(str.c_str()));
+        } else if (arg == "--scan-module") {
+            scanModule = str;
+        } else if (arg == "--scan-out") {
+            scanOut = str;
+        } else if (arg == "--sandbox-worker") {
+            sandboxWorker = str;
+        } else if (arg == "--sandbox-plugin") {
+            sandboxPlugin = str;
+        } else if (arg == "--batch") {
+            batchPath = str;
+        } else if (arg == "--midi") {
+            midiPath = str;
+        } else if (arg == "--golden") {
+            goldenPath = str;
+        } else if (arg == "--golden-update") {
+            if (val != "on" && val != "off") {
+                return false;
+            }
+            goldenUpdate = val == "on";
+        } else if (arg == "--golden-tolerance") {
+            goldenTolerance = std::atof(str.c_str());
+        } else if (arg == "--golden-overhead") {
+            if (val != "on" && val != "off") {
+                return false;
+            }
+            goldenOverhead = val == "on";
+        } else if (arg == "--trace") {
+            tracePath = str;
+        } else if (arg == "--batch-workers") {
+            batchWorkers = static_cast<unsigned>(std::atoi(str.c_str()));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    [[nodiscard]] bool validate() const {
+        if (sampleRate <= 0.0 || bufferSize == 0 || nChannels == 0) {
+            MY_ERROR(L"Invalid audio settings\n");
+            return false;
+        }
+        if (fixedBlockSize > MaxFixedBlockSize) {
+            MY_ERROR(L"--fixed-block must be %u frames or less\n", MaxFixedBlockSize);
+            return false;
+        }
+        if (nPipelineStages == 0 || (nPipelineStages > 1 && nWorkers > 0)) {
+            MY_ERROR(L"--pipeline <stages> requires 1 or more stages, and can't be combined with --threads\n");
+            return false;
+        }
+        if (eventLatencyMsec < 0.0) {
+            MY_ERROR(L"--event-latency must be 0 or more\n");
+            return false;
+        }
+        if (paramMonitorMsec < 0.0 || timingMonitorMsec < 0.0) {
+            MY_ERROR(L"--param-monitor and --timing-monitor must be 0 or more\n");
+            return false;
+        }
+        if (scanModule.empty() != scanOut.empty()) {
+            MY_ERROR(L"--scan-module and --scan-out must be used together\n");
+            return false;
+        }
+        if (sandboxWorker.empty() != sandboxPlugin.empty()) {
+            MY_ERROR(L"--sandbox-worker and --sandbox-plugin must be used together\n");
+            return false;
+        }
+        if (!batchPath.empty() && (nWorkers > 0 || nPipelineStages > 1 || sandbox || fixedBlockSize > 0)) {
+            MY_ERROR(L"--batch renders each session on one core, and can't be combined with --threads, --pipeline,"
+                     L" --sandbox or --fixed-block\n");
+            return false;
+        }
+        if (!goldenPath.empty() && batchPath.empty()) {
+            MY_ERROR(L"--golden checks the jobs of --batch, and requires it\n");
+            return false;
+        }
+        if (goldenTolerance < 0.0) {
+            MY_ERROR(L"--golden-tolerance must be 0 or more\n");
+            return false;
+        }
+        if (rtCheck && !RtSafetyChecker::isAvailable()) {
+            MY_ERROR(L"--rt-check requires a build with -DRT_CHECK=ON (Linux only)\n");
+            return false;
+        }
+        if (!tracePath.empty() && !TraceRecorder::isAvailable()) {
+            MY_ERROR(L"--trace requires a build with -DTRACE_EVENTS=ON\n");
+            return false;
+        }
+        if (backendType == BackendType::WavFile && seconds <= 0.0) {
+            MY_ERROR(L"--offline requires --seconds\n");
+            return false;
+        }
+#if !defined(_WIN32)
+        if (backendType == BackendType::Wasapi) {
+            MY_ERROR(L"WASAPI backend is not available on this platform\n");
+            return false;
+        }
+#endif
+        return true;
+    }
+}; // struct AppOptions
+
+// Microbenchmark of the buffer kernels (--bench kernels). Measures each instruction set against the scalar loops which
+// the host used before, and verifies that each instruction set produces the same samples as the scalar reference.
+class KernelBench final {
+  public:
+    static int run(const unsigned nSamples, const unsigned nChannels) {
+        const size_t       n = static_cast<size_t>(nSamples) * nChannels;
+        std::vector<float> planar(n);
+        std::vector<float> interleaved(n);
+        std::vector<float> mixed(n);
+        std::vector<char>  pcm(n * 4);
+        for (size_t i = 0; i < n; ++i) {
+            // Slightly over the full scale, to exercise the clamping
+            planar[i] = 1.25f * std::sin(static_cast<float>(i) * 0.013f);
+        }
+        BufferKernels::getAvailable()[0].interleave(interleaved.data(), planar.data(), nSamples, nChannels, nSamples);
+
+        (void)printf("Buffer kernels : %u samples x %u channels, best = %s\n", nSamples, nChannels,
+                     BufferKernels::get().name);
+        (void)printf("%-14s %-7s %12s %9s  %s\n", "kernel", "isa", "nsec/block", "speedup", "result");
+        const auto asBytes = [](const std::vector<float> &v) { return std::as_bytes(std::span(v)); };
+        const auto noReset = [] {};
+        bool       ok      = true;
+
+        std::vector<float> out(n);
+        ok &= benchKernel(
+            "interleave", asBytes(out), noReset,
+            [&](const BufferKernels::Table &t) {
+                t.interleave(out.data(), planar.data(), nSamples, nChannels, nSamples);
+            },
+            [&] {
+                for (unsigned iSample = 0; iSample < nSamples; ++iSample) {
+                    for (unsigned iChannel = 0; iChannel < nChannels; ++iChannel) {
+                        out[iSample * nChannels + iChannel] = planar[iChannel * nSamples + iSample];
+                    }
+                }
+            });
+        ok &= benchKernel(
+            "deinterleave", asBytes(out), noReset,
+            [&](const BufferKernels::Table &t) {
+                t.deinterleave(out.data(), nSamples, interleaved.data(), nChannels, nSamples);
+            },
+            nullptr);
+        ok &= benchKernel(
+            "mix", asBytes(mixed), [&] { mixed = planar; },
+            [&](const BufferKernels::Table &t) { t.mix(mixed.data(), planar.data(), n, 1.0f); },
+            [&] {
+                for (size_t i = 0; i < n; ++i) {
+                    mixed[i] = planar[i] + mixed[i];
+                }
+            });
+        ok &= benchKernel(
+            "mix (gain)", asBytes(mixed), [&] { mixed = planar; },
+            [&](const BufferKernels::Table &t) { t.mix(mixed.data(), planar.data(), n, 0.5f); }, nullptr);
+
+        const auto pcmBytes = [&](const BufferKernels::SampleFormat format) {
+            return std::as_bytes(std::span(pcm).first(n * BufferKernels::getBytesPerSample(format)));
+        };
+        ok &= benchKernel(
+            "float->s16", pcmBytes(BufferKernels::SampleFormat::Int16), noReset,
+            [&](const BufferKernels::Table &t) { t.toInt16(pcm.data(), interleaved.data(), n, nullptr); }, nullptr);
+        ok &= benchKernel(
+            "float->s24", pcmBytes(BufferKernels::SampleFormat::Int24), noReset,
+            [&](const BufferKernels::Table &t) { t.toInt24(pcm.data(), interleaved.data(), n, nullptr); }, nullptr);
+        ok &= benchKernel(
+            "float->s32", pcmBytes(BufferKernels::SampleFormat::Int32), noReset,
+            [&](const BufferKernels::Table &t) { t.toInt32(pcm.data(), interleaved.data(), n, nullptr); }, nullptr);
+        // Two calls with an odd split, so the dither states continue across calls at any lane, as in WavFileWriter
+        BufferKernels::Dither dither;
+        const size_t          split = n / 2 + 3;
+        ok &= benchKernel(
+            "float->s16+tpdf", pcmBytes(BufferKernels::SampleFormat::Int16), [&] { dither = BufferKernels::Dither(); },
+            [&](const BufferKernels::Table &t) {
+                t.toInt16(pcm.data(), interleaved.data(), split, &dither);
+                t.toInt16(pcm.data() + split * 2, interleaved.data() + split, n - split, &dither);
+            },
+            nullptr);
+
+        if (!ok) {
+            MY_ERROR(L"Some kernels don't match the scalar reference\n");
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+  private:
+    // Returns the best average time of a call in nanoseconds.
+    template <class Func> static double measureNs(Func &&func) {
+        using Clock = std::chrono::steady_clock;
+        double best = 1e30;
+        for (int round = 0; round < 5; ++round) {
+            uint64_t   nCalls = 0;
+            const auto start  = Clock::now();
+            auto       now    = start;
+            do {
+                for (int i = 0; i < 64; ++i) {
+                    func();
+                    std::atomic_signal_fence(std::memory_order_seq_cst); // Keeps each call
+                }
+                nCalls += 64;
+                now = Clock::now();
+            } while (now - start < std::chrono::milliseconds(20));
+            best = std::min(best, std::chrono::duration<double, std::nano>(now - start).count() / nCalls);
+        }
+        return best;
+    }
+
+    // Runs the kernel with each table, and compares its output with the scalar table. The speedup is relative to the
+    // legacy loop, or to the scalar table if there is no legacy loop. Empty `out` skips the comparison.
+    template <class Reset, class Invoke, class Legacy>
+    static bool benchKernel(const char *name, const std::span<const std::byte> out, Reset &&reset, Invoke &&invoke,
+                            Legacy &&legacy) {
+        const std::span<const BufferKernels::Table> tables = BufferKernels::getAvailable();
+        reset();
+        invoke(tables[0]);
+        const std::vector<std::byte> expected(out.begin(), out.end());
+
+        double baseNs = 0.0;
+        if constexpr (!std::is_null_pointer_v<std::decay_t<Legacy>>) {
+            baseNs = measureNs(legacy);
+            printRow(name, "legacy", baseNs, baseNs, "");
+        }
+        bool ok = true;
+        for (const BufferKernels::Table &table : tables) {
+            reset();
+            invoke(table);
+            const bool match = std::ranges::equal(out, expected);
+            ok &= match;
+            const double ns = measureNs([&] { invoke(table); });
+            baseNs          = baseNs > 0.0 ? baseNs : ns;
+            printRow(name, table.name, ns, baseNs, out.empty() ? "-" : match ? "match" : "MISMATCH");
+        }
+        return ok;
+    }
+
+    static void printRow(const char *kernel, const char *isa, const double ns, const double baseNs,
+                         const char *result) {
+        (void)printf("%-14s %-7s %12.1f %8.2fx  %s\n", kernel, isa, ns, baseNs / ns, result);
+    }
+}; // class KernelBench
+
+// Benchmark of the lock-free queues (--bench queue). Compares SpscQueue and MpscQueue with the previous SPSC queue,
+// in a stream between threads (several producers contend on MpscQueue), and in the drain of a burst of events.
+class QueueBench final {
+  public:
+    static int run() {
+        (void)printf("Queues : %zu byte items, %u slots, %u hardware threads\n", sizeof(TimedEvent), QueueSize,
+                     std::thread::hardware_concurrency());
+        (void)printf("%-20s %-22s %10s %9s  %s\n", "queue", "test", "nsec/item", "speedup", "result");
+        bool ok = true;
+
+        const Result legacyStream = stream<LegacySpscQueue>(1, 1);
+        ok &= printRow("SpscQueue (legacy)", "stream", legacyStream, legacyStream.ns);
+        ok &= printRow("SpscQueue", "stream", stream<Spsc>(1, 1), legacyStream.ns);
+        ok &= printRow("SpscQueue", "stream, pushN/popN 32", stream<Spsc>(1, 32), legacyStream.ns);
+        for (const unsigned nProducers : {1u, 2u, 4u}) {
+            char test[32];
+            (void)snprintf(test, sizeof(test), "stream, %u producer%s", nProducers, nProducers > 1 ? "s" : "");
+            ok &= printRow("MpscQueue", test, stream<Mpsc>(nProducers, 1), legacyStream.ns);
+        }
+        ok &= printRow("MpscQueue", "stream, 4 x pushN 32", stream<Mpsc>(4, 32), legacyStream.ns);
+
+        const Result legacyBurst = burst<LegacySpscQueue>(1);
+        ok &= printRow("SpscQueue (legacy)", "burst drain", legacyBurst, legacyBurst.ns);
+        ok &= printRow("SpscQueue", "burst drain", burst<Spsc>(1), legacyBurst.ns);
+        ok &= printRow("SpscQueue", "burst drain, popN 64", burst<Spsc>(64), legacyBurst.ns);
+        ok &= printRow("MpscQueue", "burst drain, popN 64", burst<Mpsc>(64), legacyBurst.ns);
+
+        if (!ok) {
+            MY_ERROR(L"Some queues lost or reordered items\n");
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+  private:
+    static constexpr unsigned QueueSize = 4096;
+    static constexpr uint64_t NItems    = 1u << 22;
+
+    struct Result {
+        double ns;
+        bool   ok;
+    };
+
+    // The previous SpscQueue : Modulo indexing, and an acquire load of the other side's index in each call.
+    class LegacySpscQueue final {
+        static constexpr size_t Capacity         = QueueSize + 1;
+        static constexpr size_t FalseSharingSize = std::hardware_destructive_interference_size;
+        static constexpr size_t AlignSize        = std::max(alignof(TimedEvent), FalseSharingSize);
+
+        struct AlignedStorage {
+            alignas(AlignSize) std::byte storage[sizeof(TimedEvent)];
+        };
+
+        static constexpr unsigned next(const unsigned i) { return (i + 1) % Capacity; }
+
+      public:
+        [[nodiscard]] bool push(const TimedEvent &t) {
+            const unsigned currentWriteIndex = writeIndex_.load(std::memory_order_relaxed);
+            const unsigned nextWriteIndex    = next(currentWriteIndex);
+            if (nextWriteIndex == readIndex_.load(std::memory_order_acquire)) [[unlikely]] {
+                return false;
+            }
+            new (items_[currentWriteIndex].storage) TimedEvent(t);
+            writeIndex_.store(nextWriteIndex, std::memory_order_release);
+            return true;
+        }
+
+        [[nodiscard]] bool pop(TimedEvent &item) {
+            const unsigned currentReadIndex = readIndex_.load(std::memory_order_relaxed);
+            if (currentReadIndex == writeIndex_.load(std::memory_order_acquire)) [[unlikely]] {
+                return false;
+            }
+            item = *std::launder(reinterpret_cast<TimedEvent *>(items_[currentReadIndex].storage));
+            readIndex_.store(next(currentReadIndex), std::memory_order_release);
+            return true;
+        }
+
+      private:
+        AlignedStorage items_[Capacity];
+        alignas(FalseSharingSize) std::atomic<unsigned> readIndex_  = 0;
+        alignas(FalseSharingSize) std::atomic<unsigned> writeIndex_ = 0;
+    }; // class LegacySpscQueue
+
+    using Spsc = SpscQueue<TimedEvent, QueueSize>;
+    using Mpsc = MpscQueue<TimedEvent, QueueSize>;
+
+    // Each item carries its producer (busIndex) and its sequence number within the producer (timeNs).
+    static TimedEvent makeItem(const unsigned producer, const uint64_t seq) {
+        TimedEvent te     = {};
+        te.event.busIndex = static_cast<Steinberg::int32>(producer);
+        te.timeNs         = static_cast<int64_t>(seq);
+        return te;
+    }
+
+    template <class Queue> static size_t pushItems(Queue &queue, const std::span<const TimedEvent> items) {
+        if constexpr (requires { queue.pushN(items); }) {
+            if (items.size() > 1) {
+                return queue.pushN(items);
+            }
+        }
+        return queue.push(items[0]) ? 1 : 0;
+    }
+
+    template <class Queue> static size_t popItems(Queue &queue, const std::span<TimedEvent> out) {
+        if constexpr (requires { queue.popN(out); }) {
+            if (out.size() > 1) {
+                return queue.popN(out);
+            }
+        }
+        return queue.pop(out[0]) ? 1 : 0;
     }
 
-    void audioThreadVstProcess(const ProcessArgs &processArgs) const {
-        const std::span<float *>    vstInChannelPtrs  = processArgs.vstInChannelPtrs;
-        const std::span<float *>    vstOutChannelPtrs = processArgs.vstOutChannelPtrs;
-        const unsigned              nSamples          = processArgs.nSamples;
-        const double                sampleRate        = processArgs.sampleRate;
-        const double                tempo             = processArgs.tempo;
-        Steinberg::Vst::IEventList *inputEvents       = processArgs.inputEvents;
-        Steinberg::Vst::IEventList *outputEvents      = processArgs.outputEvents;
-        const double                ppqPosition       = processArgs.ppqPosition;
+    // Streams NItems from the producer threads to this thread. Returns the time per item, and whether each producer's
+    // items have arrived complete and in order.
+    template <class Queue> static Result stream(const unsigned nProducers, const size_t batchSize) {
+        const auto               queue       = std::make_unique<Queue>();
+        const uint64_t           perProducer = NItems / nProducers;
+        std::atomic<bool>        start       = false;
+        std::vector<std::thread> producers;
+        for (unsigned iProducer = 0; iProducer < nProducers; ++iProducer) {
+            producers.emplace_back([&, iProducer] {
+                std::vector<TimedEvent> batch(batchSize);
+                while (!start.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                for (uint64_t seq = 0; seq < perProducer;) {
+                    const size_t n = std::min<uint64_t>(batchSize, perProducer - seq);
+                    for (size_t i = 0; i < n; ++i) {
+                        batch[i] = makeItem(iProducer, seq + i);
+                    }
+                    for (size_t done = 0; done < n;) {
+                        if (const size_t pushed = pushItems(*queue, std::span(batch).subspan(done, n - done))) {
+                            done += pushed;
+                        } else {
+                            std::this_thread::yield();
+                        }
+                    }
+                    seq += n;
+                }
+            });
+        }
 
-        Steinberg::Vst::AudioBusBuffers inpBus = {};
-        inpBus.numChannels                     = isEffect_ ? static_cast<int32_t>(vstInChannelPtrs.size()) : 0;
-        inpBus.channelBuffers32                = isEffect_ ? std::data(vstInChannelPtrs) : nullptr;
+        std::vector<TimedEvent> out(batchSize);
+        std::vector<int64_t>    expected(nProducers, 0);
+        bool                    ok      = true;
+        const auto              startAt = std::chrono::steady_clock::now();
+        start.store(true, std::memory_order_release);
+        for (uint64_t received = 0; received < perProducer * nProducers;) {
+            const size_t n = popItems(*queue, std::span(out));
+            if (n == 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (const TimedEvent &te : std::span(out).first(n)) {
+                const auto iProducer = static_cast<unsigned>(te.event.busIndex);
+                ok &= iProducer < nProducers && te.timeNs == expected[iProducer]++;
+            }
+            received += n;
+        }
+        const auto endAt = std::chrono::steady_clock::now();
+        for (std::thread &producer : producers) {
+            producer.join();
+        }
+        const double ns = std::chrono::duration<double, std::nano>(endAt - startAt).count();
+        return {ns / static_cast<double>(perProducer * nProducers), ok};
+    }
 
-        Steinberg::Vst::AudioBusBuffers outBus = {};
-        outBus.numChannels                     = static_cast<int32_t>(vstOutChannelPtrs.size());
-        outBus.channelBuffers32                = std::data(vstOutChannelPtrs);
+    // Fills the queue (e.g. a chord or an arpeggiator dump), then measures the audio thread's drain of it.
+    template <class Queue> static Result burst(const size_t batchSize) {
+        const auto              queue = std::make_unique<Queue>();
+        std::vector<TimedEvent> out(batchSize);
+        double                  best  = 1e30;
+        bool                    ok    = true;
+        for (int round = 0; round < 200; ++round) {
+            uint64_t nPushed = 0;
+            while (queue->push(makeItem(0, nPushed))) {
+                ++nPushed;
+            }
+            const auto startAt = std::chrono::steady_clock::now();
+            uint64_t   nPopped = 0;
+            while (const size_t n = popItems(*queue, std::span(out))) {
+                for (const TimedEvent &te : std::span(out).first(n)) {
+                    ok &= te.timeNs == static_cast<int64_t>(nPopped++);
+                }
+            }
+            const auto endAt = std::chrono::steady_clock::now();
+            ok &= nPopped == nPushed && nPushed >= QueueSize;
+            best = std::min(best, std::chrono::duration<double, std::nano>(endAt - startAt).count() / nPopped);
+        }
+        return {best, ok};
+    }
 
-        Steinberg::Vst::ProcessContext context = {};
-        context.state      = Steinberg::Vst::ProcessContext::kPlaying | Steinberg::Vst::ProcessContext::kTempoValid |
-                             Steinberg::Vst::ProcessContext::kProjectTimeMusicValid;
-        context.sampleRate = sampleRate;
-        context.projectTimeMusic = ppqPosition;
-        context.tempo            = tempo;
+    static bool printRow(const char *queue, const char *test, const Result &result, const double baseNs) {
+        (void)printf("%-20s %-22s %10.2f %8.2fx  %s\n", queue, test, result.ns, baseNs / result.ns,
+                     result.ok ? "ok" : "ERROR");
+        return result.ok;
+    }
+}; // class QueueBench
 
-        Steinberg::Vst::ProcessData vstProcessData = {};
-        vstProcessData.processMode                 = Steinberg::Vst::kRealtime;
-        vstProcessData.symbolicSampleSize          = Steinberg::Vst::kSample32;
-        vstProcessData.numInputs                   = inpBus.numChannels > 0 ? 1 : 0;
-        vstProcessData.inputs                      = inpBus.numChannels > 0 ? &inpBus : nullptr;
-        vstProcessData.numOutputs                  = 1;
-        vstProcessData.outputs                     = &outBus;
-        vstProcessData.inputEvents                 = inputEvents;
-        vstProcessData.outputEvents                = outputEvents;
-        vstProcessData.processContext              = &context;
-        vstProcessData.numSamples                  = static_cast<int>(nSamples);
-        vstAudioProcessor_->process(vstProcessData);
+// Benchmark of the host overhead with the synthetic plugins (--bench chain). Runs the plugin graph directly, without
+// any audio backend, and sweeps the chain length, the channel count and the block size. The host overhead is the time
+// of a block minus the time which the plugins spent in process(). Writes the results as JSON (--bench-out).
+class ChainBench final {
+  public:
+    static int run(const AppOptions &options) {
+        ChainBench  bench(options);
+        std::string json;
+        if (!bench.runAll(json)) {
+            return EXIT_FAILURE;
+        }
+        if (options.benchOut.empty()) {
+            (void)fputs(json.c_str(), stdout);
+            return EXIT_SUCCESS;
+        }
+        std::ofstream ofs(options.benchOut, std::ios::binary);
+        if (!ofs.write(json.data(), static_cast<std::streamsize>(json.size()))) {
+            MY_ERROR(L"Can't write %ls\n", options.benchOut.wstring().c_str());
+            return EXIT_FAILURE;
+        }
+        MY_TRACE(L"Wrote %ls\n", options.benchOut.wstring().c_str());
+        return EXIT_SUCCESS;
     }
 
   private:
-    // Check if pointers refer to the same object (retrieve and compare IUnknown pointers)
-    static bool isSameObject(const auto &p0, const auto &p1) {
-        Steinberg::IPtr<Steinberg::FUnknown> u0;
-        Steinberg::IPtr<Steinberg::FUnknown> u1;
-        p0->queryInterface(Steinberg::FUnknown::iid, reinterpret_cast<void **>(&u0));
-        p1->queryInterface(Steinberg::FUnknown::iid, reinterpret_cast<void **>(&u1));
-        return u0 == u1;
-    }
+    static constexpr unsigned MaxChainLength = 32;
+    static constexpr unsigned MaxBlockSize   = 2048;
+    static constexpr unsigned KindChain      = 8;
+    static constexpr unsigned KindChannels   = 2;
+    static constexpr unsigned KindBlockSize  = 256;
 
-    void init(const InitParams &initParams) {
-        vst3DllPath_ = initParams.pluginPath;
+    struct Config {
+        const char *sweep;
+        size_t      iKind; // Index of the plugin kind (kinds_)
+        unsigned    chainLength;
+        unsigned    nChannels;
+        unsigned    blockSize;
+    };
 
-        // The sequence for initialization and setup is complex.
-        // Refer to the left side (downward arrows) of: Audio Processor Call Sequence
-        // https://steinbergmedia.github.io/vst3_dev_portal/pages/Technical+Documentation/Workflow+Diagrams/Audio+Processor+Call+Sequence.html
-        {
-            Steinberg::IPtr<Steinberg::IPluginFactory> pluginFactory = vst3Dll_.load(vst3DllPath_);
-            if (!pluginFactory) {
-                return MY_ERROR(L"pluginPath=%s, vst3Dll_.load()\n", vst3DllPath_.c_str());
-            }
+    // Plugins of one kind, created once with the largest block size, and shared by the configurations. The bus
+    // arrangement of a plugin is set at its creation, so there's a set of plugins for each channel count.
+    struct Kind {
+        std::string                                                  spec;
+        std::unique_ptr<SyntheticPluginFactory>                      factory;
+        std::map<unsigned, std::vector<std::unique_ptr<Vst3Plugin>>> plugins; // [nChannels]
+    };
 
-            // Create Component (Audio Engine / Processor)
-            for (int iClass = 0, nClass = pluginFactory->countClasses(); iClass < nClass; ++iClass) {
-                Steinberg::PClassInfo c;
-                pluginFactory->getClassInfo(iClass, &c);
-                if (strcmp(c.category, kVstAudioEffectClass) == 0) {
-                    std::string str(c.name);
-                    name_ = std::wstring(str.begin(), str.end());
-                    pluginFactory->createInstance(c.cid, Steinberg::Vst::IComponent::iid,
-                                                  reinterpret_cast<void **>(&vstComponent_));
-                    break;
-                }
-            }
-            if (!vstComponent_) {
-                return MY_ERROR(L"pluginPath=%s, vstComponent_ == %p\n", vst3DllPath_.c_str(), vstComponent_.get());
-            }
+    explicit ChainBench(const AppOptions &options) : options_(options) {}
 
-            // Initialize Component. IComponent::initialize must be called first
-            vstComponent_->initialize(initParams.hostApplication);
-            isEffect_       = vstComponent_->getBusCount(Steinberg::Vst::kAudio, Steinberg::Vst::kInput) > 0;
-            hasEventOutput_ = vstComponent_->getBusCount(Steinberg::Vst::kEvent, Steinberg::Vst::kOutput) > 0;
+    // Appends the formatted text to `out`
+    static void appendf(std::string &out, const char *fmt, ...) {
+        char    buf[1024];
+        va_list args;
+        va_start(args, fmt);
+        const int n = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        out.append(buf, static_cast<size_t>(std::clamp(n, 0, static_cast<int>(sizeof(buf)) - 1)));
+    }
 
-            // Create GUI Controller (Edit Controller)
-            if (Steinberg::TUID id; vstComponent_->getControllerClassId(id) == Steinberg::kResultOk) {
-                pluginFactory->createInstance(id, Steinberg::Vst::IEditController::iid,
-                                              reinterpret_cast<void **>(&vstEditController_));
+    bool runAll(std::string &out) {
+        // The chain length, channel and block size sweeps use the first kind. Each kind is measured on its own.
+        std::vector<std::string> specs = options_.synthSpecs;
+        if (specs.empty()) {
+            specs = {"pass", "burn:10", "events:16", "alloc:16"};
+        }
+        for (const std::string &spec : specs) {
+            if (!addKind(spec, KindChannels)) {
+                return false;
             }
         }
-        if (!vstEditController_) {
-            // If the controller isn't created yet, check if the component itself
-            // implements it
-            vstComponent_->queryInterface(Steinberg::Vst::IEditController::iid,
-                                          reinterpret_cast<void **>(&vstEditController_));
+        std::vector<Config> configs;
+        for (const unsigned chainLength : {1u, 2u, 4u, 8u, 16u, 32u}) {
+            configs.push_back({"chainLength", 0, chainLength, KindChannels, KindBlockSize});
         }
-        if (!vstEditController_) {
-            return MY_ERROR(L"pluginPath=%s, vstEditController_=%p\n", vst3DllPath_.c_str(), vstEditController_.get());
+        for (const unsigned nChannels : {1u, 2u, 4u, 8u}) {
+            configs.push_back({"channels", 0, KindChain, nChannels, KindBlockSize});
+            if (!addPlugins(kinds_[0], nChannels)) {
+                return false;
+            }
         }
-        if (!isSameObject(vstComponent_, vstEditController_)) {
-            vstEditController_->initialize(initParams.hostApplication);
+        for (const unsigned blockSize : {32u, 64u, 128u, 256u, 512u, 1024u, 2048u}) {
+            configs.push_back({"blockSize", 0, KindChain, KindChannels, blockSize});
+        }
+        for (size_t iKind = 0; iKind < kinds_.size(); ++iKind) {
+            configs.push_back({"kind", iKind, KindChain, KindChannels, KindBlockSize});
         }
-        vstEditController_->setComponentHandler(&myComponentHandler_);
 
-        // Connection for parameter synchronization between the processing side and UI side Connection is not needed
-        // if they are the same object (Single Component)
-        if (!isSameObject(vstComponent_, vstEditController_)) {
-            Steinberg::IPtr<Steinberg::Vst::IConnectionPoint> cp1;
-            vstComponent_->queryInterface(Steinberg::Vst::IConnectionPoint::iid, reinterpret_cast<void **>(&cp1));
-            if (!cp1) {
-                return MY_ERROR(L"pluginPath=%s, cp1=%p\n", vst3DllPath_.c_str(), cp1.get());
-            }
+        appendf(out,
+                "{\n  \"benchmark\": \"chain\",\n  \"sampleRate\": %.0f,\n  \"threads\": %u,\n"
+                "  \"pipelineStages\": %u,\n  \"results\": [\n",
+                options_.sampleRate, options_.nWorkers, options_.nPipelineStages);
+        for (size_t i = 0; i < configs.size(); ++i) {
+            measure(configs[i], out);
+            appendf(out, "%s\n", i + 1 < configs.size() ? "," : "");
+        }
+        appendf(out, "  ]\n}\n");
+        return true;
+    }
 
-            Steinberg::IPtr<Steinberg::Vst::IConnectionPoint> cp2;
-            vstEditController_->queryInterface(Steinberg::Vst::IConnectionPoint::iid, reinterpret_cast<void **>(&cp2));
-            if (!cp2) {
-                return MY_ERROR(L"pluginPath=%s, cp2=%p\n", vst3DllPath_.c_str(), cp2.get());
-            }
+    bool addKind(const std::string &spec, const unsigned nChannels) {
+        Kind kind;
+        kind.spec = spec;
+        if (SyntheticPlugin::Config config; SyntheticPlugin::parse(spec, config)) {
+            kind.factory = std::make_unique<SyntheticPluginFactory>(config);
+        }
+        if (!kind.factory || !addPlugins(kind, nChannels)) {
+            MY_ERROR(L"Can't create the synthetic plugins \"%hs\"\n", spec.c_str());
+            return false;
+        }
+        kinds_.push_back(std::move(kind));
+        return true;
+    }
 
-            cp1->connect(cp2);
-            cp2->connect(cp1);
+    // Creates the plugins of the kind for the channel count, unless they exist
+    bool addPlugins(Kind &kind, const unsigned nChannels) {
+        std::vector<std::unique_ptr<Vst3Plugin>> &plugins = kind.plugins[nChannels];
+        for (auto i = static_cast<unsigned>(plugins.size()); i < MaxChainLength; ++i) {
+            const Vst3Plugin::InitParams initParams{
+                .index           = i,
+                .pluginPath      = std::filesystem::path("synth:" + kind.spec),
+                .hostApplication = &myHost_,
+                .bufferSize      = static_cast<int>(MaxBlockSize),
+                .sampleRate      = options_.sampleRate,
+                .nChannels       = nChannels,
+                .processMode     = Steinberg::Vst::kOffline,
+                .pluginFactory   = kind.factory.get(),
+                .editorMode      = Vst3Plugin::EditorMode::None,
+            };
+            auto p = std::make_unique<Vst3Plugin>(initParams);
+            if (!p->good()) {
+                return false;
+            }
+            plugins.push_back(std::move(p));
         }
+        return true;
+    }
 
-        vstComponent_->queryInterface(Steinberg::Vst::IAudioProcessor::iid,
-                                      reinterpret_cast<void **>(&vstAudioProcessor_));
-        if (!vstAudioProcessor_) {
-            return MY_ERROR(L"pluginPath=%s, vstComponent_->queryInterface()\n", vst3DllPath_.c_str());
+    // Runs the warm-up blocks, then enough blocks for about 100 msec. Writes one JSON object.
+    void measure(const Config &config, std::string &out) {
+        const Kind                     &kind = kinds_[config.iKind];
+        const ProcessGraph::BuildParams buildParams{
+            .maxSamples = config.blockSize,
+            .nChannels  = config.nChannels,
+            .nWorkers   = options_.nWorkers,
+            .nStages    = options_.nPipelineStages,
+            .skipIdle   = false, // Measures the host with busy plugins
+            .sidechains = {},
+        };
+        processGraph_.build(std::span(kind.plugins.at(config.nChannels)).first(config.chainLength), buildParams);
+        std::vector<float> interleavedBuf(static_cast<size_t>(config.blockSize) * config.nChannels);
+        MySimpleEventList  inputEvents;
+        double             ppqPosition = 0.0;
+        const auto         runBlock    = [&] {
+            const ProcessGraph::BlockArgs blockArgs{
+                .nSamples        = config.blockSize,
+                .sampleRate      = options_.sampleRate,
+                .tempo           = 120.0,
+                .ppqPosition     = ppqPosition,
+                .processMode     = Steinberg::Vst::kOffline,
+                .inputEvents     = &inputEvents,
+                .captureTimeNs   = 0,
+                .stateGeneration = 0,
+            };
+            processGraph_.audioThreadProcess(blockArgs, interleavedBuf);
+            ppqPosition += config.blockSize * 120.0 / 60.0 / options_.sampleRate;
+        };
+        for (int i = 0; i < 64; ++i) {
+            runBlock();
         }
 
-        {
-            constexpr Steinberg::Vst::SpeakerArrangement speakerArr = Steinberg::Vst::SpeakerArr::kStereo;
-            Steinberg::Vst::SpeakerArrangement           speakerIn  = isEffect_ ? speakerArr : 0;
-            Steinberg::Vst::SpeakerArrangement           speakerOut = speakerArr;
-            vstAudioProcessor_->setBusArrangements(&speakerIn, speakerIn != 0, &speakerOut, speakerOut != 0);
-            Steinberg::Vst::ProcessSetup processSetup = {.processMode        = Steinberg::Vst::kRealtime,
-                                                         .symbolicSampleSize = Steinberg::Vst::kSample32,
-                                                         .maxSamplesPerBlock = initParams.bufferSize,
-                                                         .sampleRate         = initParams.sampleRate};
-            vstAudioProcessor_->setupProcessing(processSetup);
+        using Clock                           = std::chrono::steady_clock;
+        const SyntheticPlugin::Stats &stats   = kind.factory->getStats();
+        const uint64_t                startNs = stats.processNs.load(std::memory_order_relaxed);
+        const auto                    startAt = Clock::now();
+        uint64_t                      nBlocks = 0;
+        auto                          now     = startAt;
+        do {
+            for (int i = 0; i < 16; ++i) {
+                runBlock();
+            }
+            nBlocks += 16;
+            now = Clock::now();
+        } while (now - startAt < std::chrono::milliseconds(100));
+
+        const double blockNs  = std::chrono::duration<double, std::nano>(now - startAt).count() / nBlocks;
+        const double pluginNs = static_cast<double>(stats.processNs.load(std::memory_order_relaxed) - startNs) /
+                                static_cast<double>(nBlocks);
+        const double hostNs   = std::max(blockNs - pluginNs, 0.0);
+        const double periodNs = 1e9 * config.blockSize / options_.sampleRate;
+        appendf(out,
+                "    {\"sweep\": \"%s\", \"plugin\": \"%s\", \"chainLength\": %u, \"channels\": %u, "
+                "\"blockSize\": %u, \"blocks\": %llu, \"nsPerBlock\": %.1f, \"pluginNsPerBlock\": %.1f, "
+                "\"hostNsPerBlock\": %.1f, \"hostNsPerPlugin\": %.1f, \"hostNsPerSample\": %.3f, \"dspLoad\": %.6f}",
+                config.sweep, kind.spec.c_str(), config.chainLength, config.nChannels, config.blockSize,
+                static_cast<unsigned long long>(nBlocks), blockNs, pluginNs, hostNs, hostNs / config.chainLength,
+                hostNs / config.blockSize, blockNs / periodNs);
+    }
+
+    const AppOptions &options_;
+    MyHost            myHost_;
+    std::vector<Kind> kinds_;        // Destroyed after processGraph_
+    ProcessGraph      processGraph_; // Refers to the plugins of kinds_
+}; // class ChainBench
+
+// Microbenchmark of the plugin sandbox (--bench sandbox). Runs a pass-through synthetic plugin in-process and in a
+// sandbox with the block size and the channels of the options, and reports the time of process() per block, and the
+// round trip overhead of the sandbox (the time per block minus the time of process() in the worker).
+class SandboxBench final {
+  public:
+    static int run(const AppOptions &options) {
+        (void)printf("Sandbox : %u frames x %u channels per block, %u hardware threads\n", options.bufferSize,
+                     options.nChannels, std::thread::hardware_concurrency());
+        (void)printf("%-22s %10s %10s %10s\n", "", "p50 usec", "p99 usec", "max usec");
+
+        SyntheticPlugin::Config config;
+        (void)SyntheticPlugin::parse("pass", config);
+        SyntheticPluginFactory syntheticFactory(config);
+        SandboxPluginFactory   sandboxFactory({
+              .pluginPath  = "synth:pass",
+              .sampleRate  = options.sampleRate,
+              .maxSamples  = options.bufferSize,
+              .nChannels   = options.nChannels,
+              .processMode = Steinberg::Vst::kRealtime,
+        });
+        LatencyHistogram inProcess;
+        LatencyHistogram sandboxed;
+        if (!measure(options, &syntheticFactory, inProcess) || !measure(options, &sandboxFactory, sandboxed)) {
+            MY_ERROR(L"Can't create the plugins\n");
+            return EXIT_FAILURE;
         }
+        printRow("in-process", inProcess);
+        printRow("sandbox", sandboxed);
+        printRow("sandbox round trip", sandboxFactory.getSandbox().getOverhead());
+        return EXIT_SUCCESS;
+    }
 
-        // Activate Buses
-        for (int type : {Steinberg::Vst::kAudio, Steinberg::Vst::kEvent}) {
-            for (int dir : {Steinberg::Vst::kInput, Steinberg::Vst::kOutput}) {
-                if (vstComponent_->getBusCount(type, dir) > 0) {
-                    vstComponent_->activateBus(type, dir, 0, true);
-                }
+  private:
+    static constexpr unsigned NWarmUpBlocks = 1000;
+    static constexpr unsigned NBlocks       = 20000;
+
+    static bool measure(const AppOptions &options, Steinberg::IPluginFactory *factory, LatencyHistogram &histogram) {
+        MyHost                       myHost;
+        const Vst3Plugin::InitParams initParams{
+            .index           = 0,
+            .pluginPath      = "synth:pass",
+            .hostApplication = &myHost,
+            .bufferSize      = static_cast<int>(options.bufferSize),
+            .sampleRate      = options.sampleRate,
+            .nChannels       = options.nChannels,
+            .processMode     = Steinberg::Vst::kRealtime,
+            .pluginFactory   = factory,
+            .editorMode      = Vst3Plugin::EditorMode::None,
+        };
+        Vst3Plugin plugin(initParams);
+        if (!plugin.good()) {
+            return false;
+        }
+        std::vector<float>   buf(2 * static_cast<size_t>(options.bufferSize) * options.nChannels);
+        std::vector<float *> inPtrs;
+        std::vector<float *> outPtrs;
+        for (unsigned iChannel = 0; iChannel < options.nChannels; ++iChannel) {
+            inPtrs.push_back(&buf[static_cast<size_t>(iChannel) * options.bufferSize]);
+            outPtrs.push_back(&buf[static_cast<size_t>(options.nChannels + iChannel) * options.bufferSize]);
+        }
+        MySimpleEventList  inputEvents;
+        MySimpleEventList  outputEvents;
+        MyParameterChanges inputParams;
+        for (unsigned i = 0; i < NWarmUpBlocks + NBlocks; ++i) {
+            outputEvents.clear();
+            const Vst3Plugin::ProcessArgs processArgs{
+                .vstInChannelPtrs      = inPtrs,
+                .vstOutChannelPtrs     = outPtrs,
+                .nSamples              = options.bufferSize,
+                .sampleRate            = options.sampleRate,
+                .tempo                 = 120.0,
+                .inputEvents           = &inputEvents,
+                .outputEvents          = &outputEvents,
+                .ppqPosition           = 0.0,
+                .processMode           = Steinberg::Vst::kRealtime,
+                .inputParameterChanges = &inputParams,
+                .stateGeneration       = 0,
+                .inputSilenceFlags     = 0,
+                .skipIdle              = false,
+            };
+            const uint64_t startTicks = CycleClock::now();
+            plugin.audioThreadVstProcess(processArgs);
+            if (i >= NWarmUpBlocks) {
+                histogram.record(CycleClock::toNs(CycleClock::now() - startTicks));
             }
         }
-        vstComponent_->setActive(true);
-        activated_ = true;
-        vstAudioProcessor_->setProcessing(true);
-        processing_ = true;
+        return true;
+    }
+
+    static void printRow(const char *label, const LatencyHistogram &histogram) {
+        (void)printf("%-22s %10.2f %10.2f %10.2f\n", label, histogram.getPercentileNs(0.50) / 1e3,
+                     histogram.getPercentileNs(0.99) / 1e3, histogram.getMaxNs() / 1e3);
+    }
+}; // class SandboxBench
 
-        // Create Editor Window
-        plugView_ = vstEditController_->createView(Steinberg::Vst::ViewType::kEditor);
-        if (!plugView_) {
-            return MY_ERROR(L"pluginPath=%s, vstEditController_->createView()\n", vst3DllPath_.c_str());
+// Batch render farm (--batch <jobs.json>). Renders many independent sessions in one process : each worker thread is
+// pinned to its own core, takes the next job from the queue, and renders it offline with its own plugins, process
+// graph and WAV file. The job file is a JSON array of objects :
+//   {"out": "a.wav", "seconds": 30, "synth": ["events:0", "burn:20"], "plugins": ["Foo.vst3"],
+//    "notes": [{"time": 0.5, "pitch": 60, "velocity": 0.8, "length": 1.0}], "midi": "a.mid", "blockSize": 256}
+// "synth" replaces "plugins", like --synth. "seconds" defaults to --seconds, "blockSize" to --block-size. The notes
+// are in seconds. "midi" plays a Standard MIDI File along with the notes; each file is parsed once for all jobs.
+//
+// With --golden <golden.json>, the batch is also a regression check : The rendered samples of each job are hashed,
+// and the host overhead of each block (the time of the graph minus the time of the plugins' process()) is recorded.
+// The hash must match the golden file, and the median host overhead must not exceed the golden one by more than
+// --golden-tolerance. --golden-update on writes the golden file instead.
+class RenderFarm final {
+  public:
+    static int run(const AppOptions &options) {
+        RenderFarm farm(options);
+        if (!farm.readJobs(options.batchPath) || !farm.renderAll()) {
+            return EXIT_FAILURE;
         }
-        plugView_->setFrame(&myPlugFrame_);
+        if (options.goldenPath.empty()) {
+            return EXIT_SUCCESS;
+        }
+        const bool good =
+            options.goldenUpdate ? farm.writeGolden(options.goldenPath) : farm.checkGolden(options.goldenPath);
+        return good ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-        myPlugFrame_.resizeViewCallback_ = [&](auto *, const Steinberg::ViewRect *vr) { return resizeView(vr); };
+  private:
+    struct Note {
+        double           timeSec;
+        Steinberg::int16 pitch;
+        float            velocity;
+        double           lengthSec;
+    };
 
-        {
-            WNDCLASSW wc     = {};
-            wc.lpfnWndProc   = s_wndProc;
-            wc.hInstance     = GetModuleHandle(nullptr);
-            wc.hCursor       = LoadCursor(nullptr, IDC_ARROW);
-            wc.lpszClassName = L"MinimalVST3HostWindow";
-            (void)RegisterClassW(&wc);
+    struct Job {
+        std::filesystem::path              outPath;
+        double                             seconds   = 0.0;
+        unsigned                           blockSize = 0;
+        std::vector<std::string>           synthSpecs;
+        std::vector<std::filesystem::path> pluginPaths;
+        std::vector<Note>                  notes;
+        std::filesystem::path              midiPath;
+        const MidiFile                    *midiFile = nullptr; // Of midiFiles_
+    };
 
-            Steinberg::ViewRect viewRect;
-            plugView_->getSize(&viewRect);
+    struct Result {
+        bool     rendered    = false;
+        double   renderedSec = 0.0; // Of audio
+        double   elapsedSec  = 0.0; // Of the render, without loading the plugins
+        uint64_t hash        = 0;   // FNV-1a of the rendered samples (--golden)
+        uint64_t hostNs      = 0;   // Median host overhead per block (--golden)
+    };
 
-            RECT            rc    = {0, 0, viewRect.right - viewRect.left, viewRect.bottom - viewRect.top};
-            constexpr DWORD style = WS_OVERLAPPEDWINDOW;
-            AdjustWindowRectExForDpi(&rc, style, FALSE, 0, GetDpiForSystem());
+    // Entry of the golden file
+    struct Golden {
+        uint64_t hash;
+        uint64_t hostNs;
+        bool     hasHostNs; // false : Written with --golden-overhead off
+    };
 
-            const std::wstring caption = std::wstring(L"[#") + std::to_wstring(initParams.index) + L"] " + name_;
+    // Event of the note script at its frame in the session
+    struct ScriptEvent {
+        uint64_t              frame;
+        Steinberg::Vst::Event event;
+    };
 
-            hWnd_ =
-                CreateWindowExW(0, wc.lpszClassName, caption.c_str(), style | WS_VISIBLE, CW_USEDEFAULT, CW_USEDEFAULT,
-                                rc.right - rc.left, rc.bottom - rc.top, nullptr, nullptr, wc.hInstance, this);
-        }
+    explicit RenderFarm(const AppOptions &options) : options_(options) {}
 
-        if (plugView_->attached(hWnd_, Steinberg::kPlatformTypeHWND) != Steinberg::kResultOk) {
-            return MY_ERROR(L"pluginPath=%s, plugView_->attached()\n", vst3DllPath_.c_str());
+    bool readJobs(const std::filesystem::path &path) {
+        std::ifstream     ifs(path, std::ios::binary);
+        const std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        JsonValue         root;
+        if (!ifs.is_open() || !JsonValue::parse(text, root) || root.getType() != JsonValue::Type::Array) {
+            MY_ERROR(L"Can't read the jobs in \"%ls\"\n", path.wstring().c_str());
+            return false;
+        }
+        for (const JsonValue &v : root.getElements()) {
+            if (!parseJob(v, jobs_.emplace_back())) {
+                MY_ERROR(L"Invalid job #%zu in \"%ls\"\n", jobs_.size() - 1, path.wstring().c_str());
+                return false;
+            }
+        }
+        if (jobs_.empty()) {
+            MY_ERROR(L"No jobs in \"%ls\"\n", path.wstring().c_str());
+            return false;
         }
+        return loadMidiFiles();
+    }
 
-        initialized_ = true;
-        MY_TRACE(L"\"%s\" (%s) is loaded from \"%s\"\n", name_.c_str(), isEffect() ? L"effect" : L"instrument",
-                 vst3DllPath_.c_str());
+    // Each MIDI file is parsed once, and shared by the jobs which play it
+    bool loadMidiFiles() {
+        for (Job &job : jobs_) {
+            if (job.midiPath.empty()) {
+                continue;
+            }
+            auto [it, added] = midiFiles_.try_emplace(job.midiPath);
+            if (added && !it->second.load(job.midiPath, options_.sampleRate)) {
+                return false;
+            }
+            job.midiFile = &it->second;
+        }
+        return true;
     }
 
-    void cleanup() const {
-        // Regarding release order, refer to the right side (upward arrows) of:
-        // Audio Processor Call Sequence
-        // https://steinbergmedia.github.io/vst3_dev_portal/pages/Technical+Documentation/Workflow+Diagrams/Audio+Processor+Call+Sequence.html
-        if (plugView_) {
-            plugView_->removed();
+    bool parseJob(const JsonValue &v, Job &job) const {
+        const auto num = [](const JsonValue &o, const char *key, const double fallback) {
+            const JsonValue *p = o.find(key);
+            return p && p->getType() == JsonValue::Type::Number ? p->getNumber() : fallback;
+        };
+        const auto strings = [&](const char *key) {
+            std::vector<std::string> out;
+            if (const JsonValue *p = v.find(key)) {
+                for (const JsonValue &s : p->getElements()) {
+                    out.push_back(s.getString());
+                }
+            }
+            return out;
+        };
+        const JsonValue *out = v.find("out");
+        if (!out || out->getType() != JsonValue::Type::String || out->getString().empty()) {
+            return false;
         }
-        if (processing_ && vstAudioProcessor_) {
-            vstAudioProcessor_->setProcessing(false);
+        const double blockSize = num(v, "blockSize", options_.bufferSize);
+        job.outPath            = out->getString();
+        job.seconds            = num(v, "seconds", options_.seconds);
+        job.blockSize          = blockSize >= 1.0 && blockSize <= MaxBlockSize ? static_cast<unsigned>(blockSize) : 0;
+        job.synthSpecs         = strings("synth");
+        for (const std::string &pluginPath : strings("plugins")) {
+            job.pluginPaths.emplace_back(pluginPath);
         }
-        if (vstComponent_ && vstEditController_ && !isSameObject(vstComponent_, vstEditController_)) {
-            Steinberg::IPtr<Steinberg::Vst::IConnectionPoint> cp1;
-            vstComponent_->queryInterface(Steinberg::Vst::IConnectionPoint::iid, reinterpret_cast<void **>(&cp1));
-            if (!cp1) {
-                return MY_ERROR(L"pluginPath=%s, cp1=%p\n", vst3DllPath_.c_str(), cp1.get());
+        if (const JsonValue *midi = v.find("midi")) {
+            if (midi->getType() != JsonValue::Type::String || midi->getString().empty()) {
+                return false;
             }
-
-            Steinberg::IPtr<Steinberg::Vst::IConnectionPoint> cp2;
-            vstEditController_->queryInterface(Steinberg::Vst::IConnectionPoint::iid, reinterpret_cast<void **>(&cp2));
-            if (!cp2) {
-                return MY_ERROR(L"pluginPath=%s, cp2=%p\n", vst3DllPath_.c_str(), cp2.get());
+            job.midiPath = midi->getString();
+        }
+        if (const JsonValue *notes = v.find("notes")) {
+            for (const JsonValue &n : notes->getElements()) {
+                job.notes.push_back({
+                    .timeSec   = num(n, "time", 0.0),
+                    .pitch     = static_cast<Steinberg::int16>(num(n, "pitch", 60.0)),
+                    .velocity  = static_cast<float>(num(n, "velocity", 0.8)),
+                    .lengthSec = num(n, "length", 0.5),
+                });
             }
+        }
+        const auto validSpec = [](const std::string &spec) {
+            SyntheticPlugin::Config config;
+            return SyntheticPlugin::parse(spec, config);
+        };
+        const auto validNote = [](const Note &n) {
+            return n.timeSec >= 0.0 && n.lengthSec >= 0.0 && n.pitch >= 0 && n.pitch < 128;
+        };
+        return job.seconds > 0.0 && job.blockSize > 0 && (!job.synthSpecs.empty() || !job.pluginPaths.empty()) &&
+               std::ranges::all_of(job.synthSpecs, validSpec) && std::ranges::all_of(job.notes, validNote);
+    }
 
-            cp2->disconnect(cp1);
-            cp1->disconnect(cp2);
+    // Runs the workers until the queue is empty, then prints the aggregate throughput
+    bool renderAll() {
+        const unsigned nCores   = std::max(std::thread::hardware_concurrency(), 1u);
+        const unsigned nWorkers = std::min<unsigned>(options_.batchWorkers ? options_.batchWorkers : nCores,
+                                                     static_cast<unsigned>(jobs_.size()));
+        MY_TRACE(L"Batch : %zu jobs on %u workers\n", jobs_.size(), nWorkers);
+        results_ = std::vector<Result>(jobs_.size());
+
+        using Clock                      = std::chrono::steady_clock;
+        const auto               startAt = Clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned iWorker = 0; iWorker < nWorkers; ++iWorker) {
+            workers.emplace_back([this, iWorker, nCores] { workerProc(iWorker, iWorker % nCores); });
         }
-        if (activated_ && vstComponent_) {
-            vstComponent_->setActive(false);
+        for (std::thread &worker : workers) {
+            worker.join();
         }
-        if (vstComponent_ && vstEditController_ && !isSameObject(vstComponent_, vstEditController_)) {
-            vstEditController_->terminate();
+        const double wallSec = std::chrono::duration<double>(Clock::now() - startAt).count();
+
+        size_t nRendered   = 0;
+        double renderedSec = 0.0;
+        for (const Result &result : results_) {
+            nRendered += result.rendered ? 1 : 0;
+            renderedSec += result.rendered ? result.renderedSec : 0.0;
         }
-        if (vstComponent_) {
-            vstComponent_->terminate();
+        const double factor = renderedSec / std::max(wallSec, 1e-9);
+        MY_TRACE(L"Batch : %zu of %zu jobs rendered in %.3f sec : %.3f sec of audio, %.1f jobs/sec, realtime factor"
+                 L" %.2fx (%.2fx per worker)\n",
+                 nRendered, jobs_.size(), wallSec, renderedSec,
+                 static_cast<double>(nRendered) / std::max(wallSec, 1e-9), factor, factor / nWorkers);
+        if (const uint64_t dropped = droppedEvents_.load(); dropped > 0) {
+            MY_ERROR(L"Batch : %llu note events didn't fit into their blocks\n",
+                     static_cast<unsigned long long>(dropped));
         }
-        if (hWnd_) {
-            DestroyWindow(hWnd_);
+        return nRendered == jobs_.size();
+    }
+
+    void workerProc(const unsigned iWorker, const unsigned core) {
+        TraceRecorder::registerThread(TraceRecorder::intern("batch worker #" + std::to_string(iWorker)));
+        if (!pinCurrentThreadToCore(core)) {
+            MY_ERROR(L"Failed to pin the batch worker #%u to core %u\n", iWorker, core);
+        }
+        MyHost myHost;
+        for (size_t i; !global_quitRequested && (i = next_.fetch_add(1)) < jobs_.size();) {
+            Result &result  = results_[i];
+            result.rendered = render(jobs_[i], myHost, result);
+            const std::lock_guard lock(printMutex_);
+            if (result.rendered) {
+                MY_TRACE(L"[%zu/%zu] \"%ls\" : %.3f sec in %.3f sec on worker #%u, realtime factor %.2fx\n", i + 1,
+                         jobs_.size(), jobs_[i].outPath.wstring().c_str(), result.renderedSec, result.elapsedSec,
+                         iWorker, result.renderedSec / std::max(result.elapsedSec, 1e-9));
+            } else {
+                MY_ERROR(L"[%zu/%zu] \"%ls\" : Failed\n", i + 1, jobs_.size(), jobs_[i].outPath.wstring().c_str());
+            }
         }
     }
 
-    void keyScan() {
-        if (GetKeyState(VK_ESCAPE) & 0x8000) {
-            PostQuitMessage(0);
+    // Renders one session on the calling thread. The graph runs serially, since each session has its own core.
+    bool render(const Job &job, MyHost &myHost, Result &result) {
+        std::vector<std::unique_ptr<SyntheticPluginFactory>> syntheticFactories; // Outlive the plugins
+        std::vector<std::unique_ptr<Vst3Plugin>>             plugins;
+        const bool loaded = loadPlugins(job, myHost, syntheticFactories, plugins);
+        // Unloads the plugins one session at a time, like loadPlugins()
+        const auto unload = [&] {
+            const std::lock_guard lock(loadMutex_);
+            plugins.clear();
+        };
+        WavFileWriter wavFileWriter;
+        if (!loaded || !wavFileWriter.open(job.outPath, options_.nChannels, options_.sampleRate, options_.wavFormat,
+                                           options_.dither)) {
+            unload();
+            return false;
         }
-        for (Key &key : keys) {
-            if (const bool newStatus = (GetKeyState(key.vk_) & 0x8000) != 0; key.status_ != newStatus) {
-                key.status_             = newStatus;
-                Steinberg::Vst::Event e = {};
-                e.busIndex              = 0;
-                e.sampleOffset          = 0;
-                e.ppqPosition           = 0;
-                e.flags                 = Steinberg::Vst::Event::kIsLive;
-                if (key.status_) {
-                    e.type            = Steinberg::Vst::Event::kNoteOnEvent;
-                    e.noteOn.channel  = 0;
-                    e.noteOn.pitch    = key.midiNote_;
-                    e.noteOn.velocity = 1.0f;
-                    e.noteOn.noteId   = key.midiNote_;
-                } else {
-                    e.type             = Steinberg::Vst::Event::kNoteOffEvent;
-                    e.noteOff.channel  = 0;
-                    e.noteOff.pitch    = key.midiNote_;
-                    e.noteOff.velocity = 0.0f;
-                    e.noteOff.noteId   = key.midiNote_;
-                }
-                MY_TRACE(L"Note %-3s:  %3d\n", key.status_ ? L"On" : L"Off", key.midiNote_);
-                if (!eventQueue_.push(e)) {
-                    MY_ERROR(L"  eventQueue_ is full\n");
+        const ProcessGraph::BuildParams buildParams{
+            .maxSamples = job.blockSize,
+            .nChannels  = options_.nChannels,
+            .nWorkers   = 0,
+            .nStages    = 1,
+            .skipIdle   = options_.skipIdle && !options_.rtCheck, // --rt-check watches every process()
+            .sidechains = {},
+        };
+        auto processGraph = std::make_unique<ProcessGraph>();
+        processGraph->build(plugins, buildParams);
+
+        const std::vector<ScriptEvent> events       = scheduleNotes(job.notes);
+        const uint64_t                 nTotalFrames = toFrame(job.seconds);
+        std::vector<float>             interleavedBuf(static_cast<size_t>(job.blockSize) * options_.nChannels);
+        MySimpleEventList              inputEvents;
+        MidiFile::Cursor               midiCursor(job.midiFile);
+        LatencyHistogram               hostTiming; // Per block (--golden)
+        const bool                     golden  = !options_.goldenPath.empty();
+        uint64_t                       hash    = Fnv1aOffset;
+        size_t                         iEvent  = 0;
+        bool                           good    = true;
+        const auto                     startAt = std::chrono::steady_clock::now();
+        for (uint64_t frame = 0; frame < nTotalFrames && good && !global_quitRequested;) {
+            const auto nSamples = static_cast<unsigned>(std::min<uint64_t>(job.blockSize, nTotalFrames - frame));
+            inputEvents.clear();
+            for (; iEvent < events.size() && events[iEvent].frame < frame + nSamples; ++iEvent) {
+                Steinberg::Vst::Event e = events[iEvent].event;
+                e.sampleOffset          = static_cast<Steinberg::int32>(events[iEvent].frame - frame);
+                if (inputEvents.addEvent(e) != Steinberg::kResultOk) {
+                    ++droppedEvents_;
                 }
             }
+            if (job.midiFile) {
+                droppedEvents_ += midiCursor.audioThreadFill(frame, nSamples, inputEvents);
+                inputEvents.sortBySampleOffset();
+            }
+            const ProcessGraph::BlockArgs blockArgs{
+                .nSamples        = nSamples,
+                .sampleRate      = options_.sampleRate,
+                .tempo           = job.midiFile ? job.midiFile->getTempoAt(frame) : Tempo,
+                .ppqPosition     = job.midiFile ? job.midiFile->getPpqAt(frame) : toPpq(frame),
+                .processMode     = Steinberg::Vst::kOffline,
+                .inputEvents     = &inputEvents,
+                .captureTimeNs   = 0,
+                .stateGeneration = 0,
+            };
+            const size_t   nValues    = static_cast<size_t>(nSamples) * options_.nChannels;
+            const auto     block      = std::span(interleavedBuf).first(nValues);
+            const uint64_t pluginNs   = golden ? getPluginNs(plugins) : 0;
+            const uint64_t startTicks = CycleClock::now();
+            processGraph->audioThreadProcess(blockArgs, block);
+            if (golden) {
+                const uint64_t blockNs = CycleClock::toNs(CycleClock::now() - startTicks);
+                hostTiming.record(blockNs - std::min(blockNs, getPluginNs(plugins) - pluginNs));
+                hash = fnv1a(hash, std::as_bytes(block));
+            }
+            good = wavFileWriter.write(block);
+            frame += nSamples;
+            result.renderedSec = static_cast<double>(frame) / options_.sampleRate;
         }
+        result.elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - startAt).count();
+        result.hash       = hash;
+        result.hostNs     = hostTiming.getPercentileNs(0.50);
+        wavFileWriter.close();
+        processGraph.reset(); // Refers to the plugins
+        unload();
+        if (!good) {
+            MY_ERROR(L"Failed to write \"%ls\"\n", job.outPath.wstring().c_str());
+        }
+        return good && !global_quitRequested;
     }
 
-    // ReSharper disable once CppParameterMayBeConst
-    static LRESULT CALLBACK s_wndProc(HWND hWnd, const UINT msg, const WPARAM wParam, const LPARAM lParam) {
-        if (msg == WM_NCCREATE) {
-            if (const auto cs = reinterpret_cast<CREATESTRUCT *>(lParam)) {
-                const auto lp = reinterpret_cast<LONG_PTR>(cs->lpCreateParams);
-                SetWindowLongPtrW(hWnd, GWLP_USERDATA, lp);
+    // Loads the plugins of the session like AppMain::loadPlugins(), but without a sandbox or an editor. The entry
+    // functions and the factories of some modules aren't thread-safe, so the sessions load them one at a time.
+    bool loadPlugins(const Job &job, MyHost &myHost, std::vector<std::unique_ptr<SyntheticPluginFactory>> &factories,
+                     std::vector<std::unique_ptr<Vst3Plugin>> &plugins) {
+        const std::lock_guard lock(loadMutex_);
+        for (const std::string &spec : job.synthSpecs) {
+            SyntheticPlugin::Config config;
+            (void)SyntheticPlugin::parse(spec, config); // Already validated by parseJob()
+            factories.push_back(std::make_unique<SyntheticPluginFactory>(config));
+        }
+        const size_t nPlugins = job.synthSpecs.empty() ? job.pluginPaths.size() : job.synthSpecs.size();
+        for (size_t i = 0; i < nPlugins; ++i) {
+            const Vst3Plugin::InitParams initParams{
+                .index           = static_cast<unsigned>(i),
+                .pluginPath      = job.synthSpecs.empty() ? std::filesystem::absolute(job.pluginPaths[i])
+                                                          : std::filesystem::path("synth:" + job.synthSpecs[i]),
+                .hostApplication = &myHost,
+                .bufferSize      = static_cast<int>(job.blockSize),
+                .sampleRate      = options_.sampleRate,
+                .nChannels       = options_.nChannels,
+                .processMode     = Steinberg::Vst::kOffline,
+                .pluginFactory   = job.synthSpecs.empty() ? nullptr : factories[i].get(),
+                .editorMode      = Vst3Plugin::EditorMode::None,
+            };
+            if (auto p = std::make_unique<Vst3Plugin>(initParams); p->good()) {
+                plugins.push_back(std::move(p));
+            } else {
+                return false;
             }
         }
-        auto *p = reinterpret_cast<Vst3Plugin *>(GetWindowLongPtrW(hWnd, GWLP_USERDATA));
-        return p ? p->wndProc(hWnd, msg, wParam, lParam) : DefWindowProcW(hWnd, msg, wParam, lParam);
+        return true;
     }
 
-    // ReSharper disable once CppParameterMayBeConst
-    LRESULT wndProc(HWND hWnd, const UINT msg, const WPARAM wParam, const LPARAM lParam) {
-        switch (msg) {
-        case WM_SIZE:
-            if (Steinberg::IPlugView *plugView = plugView_.get()) {
-                RECT rc;
-                GetClientRect(hWnd, &rc);
-                Steinberg::ViewRect viewRect = {0, 0, static_cast<int>(rc.right - rc.left),
-                                                static_cast<int>(rc.bottom - rc.top)};
-                plugView->onSize(&viewRect);
-            }
-            break;
-        case WM_CLOSE:
-            PostQuitMessage(0);
-            return 0;
-        case WM_KEYDOWN:
-        case WM_KEYUP:
-            keyScan();
-            break;
-        default:
-            break;
+    // Note on and note off events, in order of their frames. A note off comes before a note on at the same frame,
+    // so a note which is struck again isn't cut off.
+    [[nodiscard]] std::vector<ScriptEvent> scheduleNotes(const std::vector<Note> &notes) const {
+        std::vector<ScriptEvent> events;
+        for (const Note &note : notes) {
+            ScriptEvent on           = {.frame = toFrame(note.timeSec), .event = {}};
+            on.event.type            = Steinberg::Vst::Event::kNoteOnEvent;
+            on.event.noteOn.pitch    = note.pitch;
+            on.event.noteOn.velocity = note.velocity;
+            on.event.noteOn.noteId   = note.pitch;
+            ScriptEvent off          = {.frame = toFrame(note.timeSec + note.lengthSec), .event = {}};
+            off.event.type           = Steinberg::Vst::Event::kNoteOffEvent;
+            off.event.noteOff.pitch  = note.pitch;
+            off.event.noteOff.noteId = note.pitch;
+            events.push_back(on);
+            events.push_back(off);
         }
-        return DefWindowProcW(hWnd, msg, wParam, lParam);
+        std::ranges::stable_sort(events, [](const ScriptEvent &a, const ScriptEvent &b) {
+            const auto isOn = [](const ScriptEvent &e) { return e.event.type == Steinberg::Vst::Event::kNoteOnEvent; };
+            return a.frame != b.frame ? a.frame < b.frame : !isOn(a) && isOn(b);
+        });
+        for (ScriptEvent &e : events) {
+            e.event.ppqPosition = toPpq(e.frame);
+        }
+        return events;
     }
 
-    struct Key {
-        const int     vk_{};
-        const int16_t midiNote_{};
-        bool          status_{false};
-    };
-
-    EventQueue                                       eventQueue_;
-    Steinberg::IPtr<Steinberg::Vst::IComponent>      vstComponent_;
-    Steinberg::IPtr<Steinberg::Vst::IEditController> vstEditController_;
-    Steinberg::IPtr<Steinberg::Vst::IAudioProcessor> vstAudioProcessor_;
-    Steinberg::IPtr<Steinberg::IPlugView>            plugView_;
-    MyComponentHandler                               myComponentHandler_;
-    Vst3Dll                                          vst3Dll_;
-    HWND                                             hWnd_ = nullptr;
-    // clang-format off
-    std::vector<Key> keys{
-            {'2',61},{'3',63},         {'5',66},{'6',68},{'7',70},
-        {'Q',60},{'W',62},{'E',64},{'R',65},{'T',67},{'Y',69},{'U',71}, {'I',72},
-
-            {'S',49},{'D',51},         {'G',54},{'H',56},{'J',58},
-        {'Z',48},{'X',50},{'C',52},{'V',53},{'B',55},{'N',57},{'M',59}, {VK_OEM_COMMA,60},
-    };
-    // clang-format on
-    std::filesystem::path vst3DllPath_;
-    std::wstring          name_;
-    MyPlugFrame           myPlugFrame_;
-    bool                  isEffect_       = false;
-    bool                  hasEventOutput_ = false;
-    bool                  activated_      = false;
-    bool                  processing_     = false;
-    bool                  initialized_    = false;
-}; // class Vst3Plugin
-
-// Simple event list for passing events within AppMain::audioThreadAppRefill
-class MySimpleEventList : public Steinberg::Vst::IEventList {
-  public:
-    MySimpleEventList()          = default;
-    virtual ~MySimpleEventList() = default;
-    void clear() { eventCount_ = 0; }
+    // Compares each job with its entry of the golden file. The hash covers the samples before the conversion to the
+    // WAV format, so it only depends on the plugins and the host. The timing has a slack of HostSlackNs, since a few
+    // hundred nanoseconds are within the noise of a quiet machine. The timing is only checked with --golden-overhead on
+    // and an entry which has one, since it belongs to the machine which wrote the golden file.
+    bool checkGolden(const std::filesystem::path &path) const {
+        std::map<std::string, Golden> goldens;
+        if (!readGolden(path, goldens)) {
+            return false;
+        }
+        size_t nPassed = 0;
+        for (size_t i = 0; i < jobs_.size(); ++i) {
+            const std::string key = jobs_[i].outPath.generic_string();
+            const Result     &r   = results_[i];
+            const auto        it  = goldens.find(key);
+            if (it == goldens.end()) {
+                MY_ERROR(L"[%zu/%zu] \"%hs\" : No golden entry\n", i + 1, jobs_.size(), key.c_str());
+                continue;
+            }
+            const Golden  &g     = it->second;
+            const double   scale = 1.0 + options_.goldenTolerance / 100.0;
+            const auto     maxNs = static_cast<uint64_t>(static_cast<double>(g.hostNs) * scale) + HostSlackNs;
+            if (r.hash != g.hash) {
+                MY_ERROR(L"[%zu/%zu] \"%hs\" : The output differs from the golden render (%016llx, golden %016llx)\n",
+                         i + 1, jobs_.size(), key.c_str(), static_cast<unsigned long long>(r.hash),
+                         static_cast<unsigned long long>(g.hash));
+            } else if (options_.goldenOverhead && g.hasHostNs && r.hostNs > maxNs) {
+                MY_ERROR(L"[%zu/%zu] \"%hs\" : Host overhead %.2f usec per block, golden %.2f usec"
+                         L" (tolerance %.0f%%)\n",
+                         i + 1, jobs_.size(), key.c_str(), r.hostNs / 1e3, g.hostNs / 1e3, options_.goldenTolerance);
+            } else {
+                MY_TRACE(L"[%zu/%zu] \"%hs\" : Matches, host overhead %.2f usec per block (golden %.2f usec)\n", i + 1,
+                         jobs_.size(), key.c_str(), r.hostNs / 1e3, g.hostNs / 1e3);
+                ++nPassed;
+            }
+        }
+        MY_TRACE(L"Golden : %zu of %zu jobs match \"%ls\"\n", nPassed, jobs_.size(), path.wstring().c_str());
+        return nPassed == jobs_.size();
+    }
 
-    Steinberg::tresult PLUGIN_API addEvent(Steinberg::Vst::Event &e) override {
-        if (eventCount_ >= MaxEvents) {
-            return Steinberg::kResultFalse;
+    // The golden file is JSON, like the job file. The hashes are hex strings, since a JSON number is a double.
+    bool readGolden(const std::filesystem::path &path, std::map<std::string, Golden> &goldens) const {
+        std::ifstream     ifs(path, std::ios::binary);
+        const std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        JsonValue         root;
+        const JsonValue  *jobs = nullptr;
+        if (!ifs.is_open() || !JsonValue::parse(text, root) || !(jobs = root.find("jobs"))) {
+            MY_ERROR(L"Can't read the golden file \"%ls\"\n", path.wstring().c_str());
+            return false;
         }
-        events_[eventCount_++] = e;
-        return Steinberg::kResultOk;
+        const JsonValue *sampleRate = root.find("sampleRate");
+        const JsonValue *nChannels  = root.find("channels");
+        if (!sampleRate || sampleRate->getNumber() != options_.sampleRate || !nChannels ||
+            nChannels->getNumber() != options_.nChannels) {
+            MY_ERROR(L"\"%ls\" was rendered with another --sample-rate or --channels\n", path.wstring().c_str());
+            return false;
+        }
+        for (const JsonValue &job : jobs->getElements()) {
+            const JsonValue *out    = job.find("out");
+            const JsonValue *hash   = job.find("hash");
+            const JsonValue *hostNs = job.find("hostNsPerBlock"); // Optional
+            if (out && hash) {
+                goldens[out->getString()] = {
+                    .hash      = std::strtoull(hash->getString().c_str(), nullptr, 16),
+                    .hostNs    = hostNs ? static_cast<uint64_t>(hostNs->getNumber()) : 0,
+                    .hasHostNs = hostNs != nullptr,
+                };
+            }
+        }
+        return true;
     }
 
-  private:
-    uint32_t PLUGIN_API addRef() override { return 1; }
-    uint32_t PLUGIN_API release() override { return 1; }
-    int32_t PLUGIN_API  getEventCount() override { return eventCount_; }
+    // With --golden-overhead off, the file only has the hashes, which the other platforms can share
+    bool writeGolden(const std::filesystem::path &path) const {
+        const auto escape = [](const std::string &str) {
+            std::string out;
+            for (const char c : str) {
+                out += c == '"' || c == '\\' ? std::string{'\\', c} : std::string{c};
+            }
+            return out;
+        };
+        std::ofstream ofs(path, std::ios::binary);
+        ofs << "{\n  \"sampleRate\": " << options_.sampleRate << ",\n  \"channels\": " << options_.nChannels
+            << ",\n  \"jobs\": [\n";
+        for (size_t i = 0; i < jobs_.size(); ++i) {
+            std::array<char, 32> hash;
+            (void)snprintf(hash.data(), hash.size(), "%016llx", static_cast<unsigned long long>(results_[i].hash));
+            ofs << "    {\"out\": \"" << escape(jobs_[i].outPath.generic_string()) << "\", \"hash\": \"" << hash.data()
+                << "\"";
+            if (options_.goldenOverhead) {
+                ofs << ", \"hostNsPerBlock\": " << results_[i].hostNs;
+            }
+            ofs << "}" << (i + 1 < jobs_.size() ? ",\n" : "\n");
+        }
+        ofs << "  ]\n}\n";
+        if (!ofs.good()) {
+            MY_ERROR(L"Can't write the golden file \"%ls\"\n", path.wstring().c_str());
+            return false;
+        }
+        MY_TRACE(L"Golden : Wrote %zu jobs to \"%ls\"\n", jobs_.size(), path.wstring().c_str());
+        return true;
+    }
 
-    Steinberg::tresult PLUGIN_API getEvent(const Steinberg::int32 index, Steinberg::Vst::Event &e) override {
-        if (index < 0 || index >= eventCount_) {
-            return Steinberg::kResultFalse;
+    // Total time which the plugins of the session spent in process()
+    static uint64_t getPluginNs(const std::vector<std::unique_ptr<Vst3Plugin>> &plugins) {
+        uint64_t ns = 0;
+        for (const std::unique_ptr<Vst3Plugin> &plugin : plugins) {
+            ns += plugin->getProcessTiming().getSumNs();
         }
-        e = events_[index];
-        return Steinberg::kResultOk;
+        return ns;
     }
 
-    Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID tuid, void **obj) override {
-        if (Steinberg::FUnknownPrivate::iidEqual(tuid, Steinberg::Vst::IEventList::iid) ||
-            Steinberg::FUnknownPrivate::iidEqual(tuid, FUnknown::iid)) {
-            *obj = this;
-            return Steinberg::kResultOk;
+    static uint64_t fnv1a(uint64_t hash, const std::span<const std::byte> bytes) {
+        for (const std::byte b : bytes) {
+            hash = (hash ^ static_cast<uint64_t>(b)) * Fnv1aPrime;
         }
-        *obj = nullptr;
-        return Steinberg::kNoInterface;
+        return hash;
     }
 
-    static constexpr int32_t                     MaxEvents   = 1024;
-    int32_t                                      eventCount_ = 0;
-    std::array<Steinberg::Vst::Event, MaxEvents> events_     = {};
-}; // class MySimpleEventList
+    [[nodiscard]] uint64_t toFrame(const double sec) const {
+        return static_cast<uint64_t>(std::llround(sec * options_.sampleRate));
+    }
+
+    [[nodiscard]] double toPpq(const uint64_t frame) const {
+        return static_cast<double>(frame) / options_.sampleRate * Tempo / 60.0;
+    }
+
+    static constexpr double   Tempo        = 120.0;
+    static constexpr unsigned MaxBlockSize = 8192;
+    static constexpr uint64_t HostSlackNs  = 500;
+    static constexpr uint64_t Fnv1aOffset  = 0xcbf29ce484222325;
+    static constexpr uint64_t Fnv1aPrime   = 0x100000001b3;
+
+    const AppOptions                         &options_;
+    std::vector<Job>                          jobs_;
+    std::map<std::filesystem::path, MidiFile> midiFiles_;         // Read by the workers
+    std::vector<Result>                       results_;           // [job]. Written by the worker which took the job
+    std::atomic<size_t>                       next_          = 0; // Index of the next job in the queue
+    std::atomic<uint64_t>                     droppedEvents_ = 0; // Didn't fit into a block
+    std::mutex                                loadMutex_;
+    std::mutex                                printMutex_;
+}; // class RenderFarm
 
 // Main Application
 class AppMain final {
   public:
+    // End-to-end latency from a live input (a key or a knob) to the output of the device, in frames
+    struct Latency {
+        unsigned eventFrames;    // Live event scheduling : --event-latency, or one block
+        unsigned adapterFrames;  // Block adapter (--fixed-block), at most
+        unsigned pipelineFrames; // Pipelined execution (--pipeline)
+        unsigned pluginFrames;   // Plugins on the longest path. The other paths are delayed to match
+        unsigned outputFrames;   // Audio device
+        double   sampleRate;
+
+        [[nodiscard]] unsigned getTotalFrames() const {
+            return eventFrames + adapterFrames + pipelineFrames + pluginFrames + outputFrames;
+        }
+    };
+
     AppMain()  = default;
     ~AppMain() = default;
 
-    int mainLoop() {
-        Wasapi wasapi{};
-        if (!wasapi.good()) {
-            MY_ERROR(L"! wasapi.good()\n");
+    // Can be called by any thread while mainLoop() runs. Follows the latency changes of the plugins.
+    [[nodiscard]] Latency getLatency() const {
+        Latency latency      = latency_;
+        latency.pluginFrames = processGraph_.getPluginLatencyFrames();
+        return latency;
+    }
+
+    int mainLoop(const AppOptions &options) {
+        const std::unique_ptr<AudioBackend> audioBackend = createAudioBackend(options);
+        if (!audioBackend || !audioBackend->good()) {
+            MY_ERROR(L"!audioBackend->good()\n");
+            return EXIT_FAILURE;
+        }
+        // Free running backends (e.g. --offline) pump the plugin chain as fast as possible with kOffline.
+        const Steinberg::int32 processMode =
+            audioBackend->isRealtime() ? Steinberg::Vst::kRealtime : Steinberg::Vst::kOffline;
+        if (!loadPlugins(options, *audioBackend, processMode)) {
+            return EXIT_FAILURE;
+        }
+        buildProcessGraph(*audioBackend, options);
+        eventScheduler_.setFixedLatency(options.eventLatencyMsec / 1000.0);
+        if (!options.midiPath.empty() && !midiFile_.load(options.midiPath, audioBackend->getSampleRate())) {
+            return EXIT_FAILURE;
+        }
+        midiCursor_ = MidiFile::Cursor(&midiFile_);
+        // The preset is swapped in at the first block
+        if (!options.presetPath.empty() && !loadSnapshot(options.presetPath)) {
             return EXIT_FAILURE;
         }
-        for (const auto &pluginPath : global_pluginPaths) {
+        if (options.rtCheck) {
+            RtSafetyChecker::enable();
+        }
+        startConsoleReader(options.editorMode);
+
+        // Callback from the audio thread for each block. Calls the process methods of each plugin.
+        audioBackend->setAudioThreadRefillCallback(
+            [&](const AudioBackend::RefillArgs &x) { return audioThreadAppRefill(x); });
+        {
+            // audioThread runs the backend's loop. Triggers audioThreadAppRefill via the refill callback above.
+            std::thread audioThread([&] { audioBackend->audioThreadProc(); });
+            waitForQuit(*audioBackend, options);
+            // audioBackend->audioThreadProc() also terminates within audioBackend->stop()
+            audioBackend->stop();
+            audioThread.join();
+        }
+        (void)finishStateSwitches();
+        if (!options.presetOut.empty()) {
+            (void)saveSnapshot(options.presetOut);
+        }
+        for (const std::unique_ptr<Vst3Plugin> &vst3Plugin : vst3Plugins_) {
+            if (const uint64_t n = vst3Plugin->getParamMirror().getDroppedParams(); n > 0) {
+                MY_TRACE(L"\"%ls\" : %llu output parameters didn't fit into the mirror\n",
+                         vst3Plugin->getName().c_str(), static_cast<unsigned long long>(n));
+            }
+        }
+        for (const std::unique_ptr<SandboxPluginFactory> &sandboxFactory : sandboxFactories_) {
+            sandboxFactory->getSandbox().reportCrash();
+        }
+        printTiming();
+        RtSafetyChecker::printNewViolations(getPluginName_);
+        RtSafetyChecker::printCounts(getPluginName_);
+        if (eventScheduler_.getLateEvents() > 0 || eventScheduler_.getDroppedEvents() > 0) {
+            MY_TRACE(L"Live events : %llu late, %llu dropped\n",
+                     static_cast<unsigned long long>(eventScheduler_.getLateEvents()),
+                     static_cast<unsigned long long>(eventScheduler_.getDroppedEvents()));
+        }
+        if (droppedMidiEvents_ > 0) {
+            MY_ERROR(L"MIDI file : %llu events didn't fit into their blocks\n",
+                     static_cast<unsigned long long>(droppedMidiEvents_));
+        }
+        return EXIT_SUCCESS;
+    }
+
+  private:
+    static std::unique_ptr<AudioBackend> createAudioBackend(const AppOptions &options) {
+        const SoftwareBackend::Params params{
+            .sampleRate = options.sampleRate,
+            .bufferSize = options.bufferSize,
+            .nChannels  = options.nChannels,
+            .seconds    = options.seconds,
+        };
+        switch (options.backendType) {
+#if defined(_WIN32)
+        case AppOptions::BackendType::Wasapi:
+            return std::make_unique<Wasapi>();
+#endif
+        case AppOptions::BackendType::Null:
+            return std::make_unique<NullBackend>(params);
+        case AppOptions::BackendType::Timer:
+            return std::make_unique<TimerBackend>(params);
+        case AppOptions::BackendType::WavFile:
+            return std::make_unique<WavFileBackend>(params, options.wavPath, options.wavFormat, options.dither);
+        default:
+            return nullptr;
+        }
+    }
+
+    // Loads the synthetic plugins if there are any (--synth), otherwise the plugin modules of `--plugin`, or of
+    // global_pluginPaths if there's no `--plugin`. With `--sandbox on`, each plugin is loaded by a worker process.
+    bool loadPlugins(const AppOptions &options, const AudioBackend &audioBackend, const Steinberg::int32 processMode) {
+        const std::vector<std::string>           &synthSpecs  = options.synthSpecs;
+        const std::vector<std::filesystem::path> &pluginPaths =
+            options.pluginPaths.empty() ? global_pluginPaths : options.pluginPaths;
+        const unsigned bufferSize = getChainBlockSize(audioBackend, options);
+        const double   sampleRate = audioBackend.getSampleRate();
+        for (const std::string &spec : synthSpecs) {
+            SyntheticPlugin::Config config;
+            (void)SyntheticPlugin::parse(spec, config); // Already validated by AppOptions
+            syntheticFactories_.push_back(std::make_unique<SyntheticPluginFactory>(config));
+        }
+        const size_t nPlugins = synthSpecs.empty() ? pluginPaths.size() : synthSpecs.size();
+        for (size_t i = 0; i < nPlugins; ++i) {
+            const std::filesystem::path pluginPath    = synthSpecs.empty()
+                                                            ? std::filesystem::absolute(pluginPaths[i])
+                                                            : std::filesystem::path("synth:" + synthSpecs[i]);
+            Steinberg::IPluginFactory  *pluginFactory = synthSpecs.empty() ? nullptr : syntheticFactories_[i].get();
+            if (options.sandbox) {
+                const PluginSandbox::Params params{
+                    .pluginPath  = pluginPath,
+                    .sampleRate  = sampleRate,
+                    .maxSamples  = bufferSize,
+                    .nChannels   = audioBackend.getNumChannels(),
+                    .processMode = processMode,
+                };
+                sandboxFactories_.push_back(std::make_unique<SandboxPluginFactory>(params));
+                pluginFactory = sandboxFactories_.back().get();
+            }
             const Vst3Plugin::InitParams initParams{
                 .index           = static_cast<unsigned>(vst3Plugins_.size()),
-                .pluginPath      = std::filesystem::absolute(pluginPath),
+                .pluginPath      = pluginPath,
                 .hostApplication = &myHost_,
-                .bufferSize      = static_cast<int>(wasapi.getBufferSize()),
-                .sampleRate      = wasapi.getSampleRate(),
+                .bufferSize      = static_cast<int>(bufferSize),
+                .sampleRate      = sampleRate,
+                .nChannels       = audioBackend.getNumChannels(),
+                .processMode     = processMode,
+                .pluginFactory   = pluginFactory,
+                .editorMode      = options.editorMode,
             };
             if (auto p = std::make_unique<Vst3Plugin>(initParams); p->good()) {
                 vst3Plugins_.push_back(std::move(p));
@@ -922,131 +9103,464 @@ class AppMain final {
         }
         if (vst3Plugins_.empty()) {
             MY_ERROR(L"vst3Plugins_.empty()\n");
-            return EXIT_FAILURE;
+            return false;
         }
-        inpPtrs_.resize(wasapi.getNumChannels());
-        outPtrs_.resize(wasapi.getNumChannels());
-        pingPongAudioBuffers_[0].resize(static_cast<size_t>(wasapi.getBufferSize()) * wasapi.getNumChannels());
-        pingPongAudioBuffers_[1].resize(static_cast<size_t>(wasapi.getBufferSize() * wasapi.getNumChannels()));
+        processMode_ = processMode;
+        return true;
+    }
 
-        // Callback from the audio thread during WASAPI updates. Calls the process methods of each plugin.
-        wasapi.setAudioThreadRefillCallback([&](const Wasapi::RefillArgs &x) { return audioThreadAppRefill(x); });
-        {
-            // audioThread handles WASAPI updates. Triggers audioThreadAppRefill via the refill callback above.
-            std::thread audioThread([&] { wasapi.audioThreadProc(); });
-            MSG         msg;
-            while (GetMessageW(&msg, nullptr, 0, 0)) {
-                TranslateMessage(&msg);
-                DispatchMessageW(&msg);
-            }
-            // wasapi.audioThreadProc() also terminates within wasapi.stop()
-            wasapi.stop();
-            audioThread.join();
+    // The largest block of the plugin chain
+    static unsigned getChainBlockSize(const AudioBackend &audioBackend, const AppOptions &options) {
+        return options.fixedBlockSize > 0 ? options.fixedBlockSize : audioBackend.getBufferSize();
+    }
+
+    void buildProcessGraph(const AudioBackend &audioBackend, const AppOptions &options) {
+        const ProcessGraph::BuildParams buildParams{
+            .maxSamples = getChainBlockSize(audioBackend, options),
+            .nChannels  = audioBackend.getNumChannels(),
+            .nWorkers   = options.nWorkers,
+            .nStages    = options.nPipelineStages,
+            .skipIdle   = options.skipIdle && !options.rtCheck, // --rt-check watches every process()
+            .sidechains = options.sidechains,
+        };
+        processGraph_.build(vst3Plugins_, buildParams);
+        MY_TRACE(L"Process graph : %zu nodes, %u worker threads, %u pipeline stages\n", vst3Plugins_.size(),
+                 processGraph_.getNumWorkers(), processGraph_.getNumStages());
+        MY_TRACE(L"Buffer arena : %zu KB (%zu KB without sharing)\n", processGraph_.getArenaBytes() / 1024,
+                 processGraph_.getArenaRequestedBytes() / 1024);
+        if (const unsigned latency = processGraph_.getLatencyFrames(); latency > 0) {
+            MY_TRACE(L"Pipeline latency : +%u blocks (%u frames, %.2f msec)\n", processGraph_.getNumStages() - 1,
+                     latency, 1000.0 * latency / audioBackend.getSampleRate());
         }
-        return EXIT_SUCCESS;
+        if (options.fixedBlockSize > 0) {
+            blockAdapter_.init(options.fixedBlockSize, audioBackend.getBufferSize(), audioBackend.getNumChannels());
+            const unsigned extra = blockAdapter_.getExtraLatencyFrames();
+            MY_TRACE(L"Block adapter : %u-frame blocks, up to %u frames (%.2f msec) of extra live input latency\n",
+                     blockAdapter_.getBlockSize(), extra, 1000.0 * extra / audioBackend.getSampleRate());
+        }
+        const double   sampleRate  = audioBackend.getSampleRate();
+        const auto     fixedFrames = static_cast<unsigned>(std::lround(options.eventLatencyMsec * sampleRate / 1e3));
+        const unsigned eventFrames = fixedFrames > 0 ? fixedFrames : getChainBlockSize(audioBackend, options);
+        latency_ = {
+            .eventFrames    = eventFrames,
+            .adapterFrames  = blockAdapter_.getExtraLatencyFrames(),
+            .pipelineFrames = processGraph_.getLatencyFrames(),
+            .pluginFrames   = 0,
+            .outputFrames   = audioBackend.getOutputLatencyFrames(),
+            .sampleRate     = sampleRate,
+        };
+        printLatency();
     }
 
-  private:
-    void audioThreadAppRefill(const Wasapi::RefillArgs &refillArgs) {
-        pingPongEvents_[0].clear();
-        pingPongEvents_[1].clear();
-        MySimpleEventList *inpEvents = &pingPongEvents_[0];
-        MySimpleEventList *outEvents = &pingPongEvents_[1];
+    void printLatency() const {
+        const Latency  l     = getLatency();
+        const unsigned total = l.getTotalFrames();
+        MY_TRACE(L"Latency : %u frames (%.2f msec) = events %u + block adapter %u + pipeline %u + plugins %u"
+                 L" + output %u\n",
+                 total, 1000.0 * total / l.sampleRate, l.eventFrames, l.adapterFrames, l.pipelineFrames,
+                 l.pluginFrames, l.outputFrames);
+    }
 
-        // Retrieve events from UI
+    // UI thread : Restarts the plugins which have reported a new latency, and updates the compensation delays.
+    // `switched` : A state switch has completed, so the new instances may have other latencies.
+    void updateLatencies(const bool switched) {
+        bool changed = switched;
         for (const std::unique_ptr<Vst3Plugin> &vst3Plugin : vst3Plugins_) {
-            Steinberg::Vst::Event e = {};
-            while (vst3Plugin->getEventQueue().pop(e)) {
-                inpEvents->addEvent(e);
+            if (vst3Plugin->updateLatency()) {
+                MY_TRACE(L"\"%ls\" has restarted with a latency of %u frames\n", vst3Plugin->getName().c_str(),
+                         vst3Plugin->getLatencySamples());
+                changed = true;
+            }
+        }
+        if (!changed) {
+            return;
+        }
+        const unsigned pluginFrames = processGraph_.getPluginLatencyFrames();
+        (void)processGraph_.updateLatencies();
+        if (processGraph_.getPluginLatencyFrames() != pluginFrames) {
+            printLatency();
+        }
+    }
+
+    // Runs the GUI message loop until the user quits or the backend has no more blocks to render. Headless runs
+    // (--editor none) have no window, so they don't pump messages and are stopped by Ctrl+C. The output
+    // parameters of the plugins are passed to their controllers, and printed every `--param-monitor` msec if it's
+    // not 0. The timing is printed every `--timing-monitor` msec if it's not 0.
+    void waitForQuit(const AudioBackend &audioBackend, const AppOptions &options) {
+        using Clock                    = std::chrono::steady_clock;
+        const bool   headless          = options.editorMode == Vst3Plugin::EditorMode::None;
+        const double paramMonitorMsec  = options.paramMonitorMsec;
+        const double timingMonitorMsec = options.timingMonitorMsec;
+        const auto   monitorPeriod     = std::chrono::duration<double, std::milli>(paramMonitorMsec);
+        const auto   timingPeriod      = std::chrono::duration<double, std::milli>(timingMonitorMsec);
+        auto         nextMonitor       = Clock::now();
+        auto         nextTiming        = Clock::now() + std::chrono::duration_cast<Clock::duration>(timingPeriod);
+        while (!audioBackend.finished() && !global_quitRequested) {
+#if defined(_WIN32)
+            if (headless) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            } else {
+                MsgWaitForMultipleObjects(0, nullptr, FALSE, 10, QS_ALLINPUT);
+                if (!pumpMessages()) {
+                    break;
+                }
+            }
+#else
+            (void)headless;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+#endif
+            runConsoleCommands();
+            updateLatencies(finishStateSwitches());
+            for (const std::unique_ptr<Vst3Plugin> &vst3Plugin : vst3Plugins_) {
+                vst3Plugin->syncOutputParams();
+            }
+            RtSafetyChecker::printNewViolations(getPluginName_);
+            for (const std::unique_ptr<SandboxPluginFactory> &sandboxFactory : sandboxFactories_) {
+                sandboxFactory->getSandbox().reportCrash();
+            }
+            if (paramMonitorMsec > 0.0 && Clock::now() >= nextMonitor) {
+                nextMonitor += std::chrono::duration_cast<Clock::duration>(monitorPeriod);
+                printOutputParams();
+            }
+            if (timingMonitorMsec > 0.0 && Clock::now() >= nextTiming) {
+                nextTiming += std::chrono::duration_cast<Clock::duration>(timingPeriod);
+                printTiming();
+            }
+        }
+    }
+
+    // Reads the commands typed on the console. The thread is detached because it can't be woken up from fgets(), so
+    // it shares the queue with AppMain instead of referring to AppMain.
+    void startConsoleReader(const Vst3Plugin::EditorMode editorMode) {
+        consoleLines_ = std::make_shared<ConsoleQueue>();
+        if (editorMode == Vst3Plugin::EditorMode::Lazy) {
+            MY_TRACE(L"Type a plugin number and press Enter to open its editor\n");
+        }
+        MY_TRACE(L"Type \"save [file]\" to take a snapshot of the plugin states, \"load [file]\" to switch to it\n");
+        std::thread([lines = consoleLines_] {
+            for (char line[1024]; fgets(line, sizeof(line), stdin);) {
+                std::string str(line);
+                while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back()))) {
+                    str.pop_back();
+                }
+                if (!str.empty() && !lines->push(str)) {
+                    MY_ERROR(L"  consoleLines_ is full\n");
+                }
+            }
+        }).detach();
+    }
+
+    // Runs the commands read by startConsoleReader() on the UI thread.
+    //   <n>         : Opens the editor of plugin #n
+    //   save [file] : Takes a snapshot of the plugin states, and writes it into the file
+    //   load [file] : Switches to the snapshot, or to the snapshot in the file
+    void runConsoleCommands() {
+        for (std::string line; consoleLines_ && consoleLines_->pop(line);) {
+            const size_t      space   = line.find(' ');
+            const std::string command = line.substr(0, space);
+            const std::string arg     = space == std::string::npos ? std::string() : line.substr(space + 1);
+            char             *end     = nullptr;
+            const auto        index   = static_cast<unsigned>(std::strtoul(line.c_str(), &end, 10));
+            if (command == "save") {
+                (void)saveSnapshot(arg);
+            } else if (command == "load") {
+                (void)loadSnapshot(arg);
+            } else if (end != line.c_str() && *end == '\0') {
+                if (index >= vst3Plugins_.size()) {
+                    MY_ERROR(L"No plugin #%u\n", index);
+                } else if (!vst3Plugins_[index]->openEditor()) {
+                    MY_ERROR(L"Can't open the editor of \"%ls\"\n", vst3Plugins_[index]->getName().c_str());
+                }
+            } else {
+                MY_ERROR(L"Unknown command \"%hs\"\n", line.c_str());
             }
         }
+    }
 
-        // Prepare two sets of I/O buffers
-        float *inpPtr = pingPongAudioBuffers_[0].data();
-        float *outPtr = pingPongAudioBuffers_[1].data();
+    // UI thread : Captures the states of the chain into snapshot_, and writes them into the file if it's given
+    bool saveSnapshot(const std::filesystem::path &path) {
+        const uint64_t startTicks = CycleClock::now();
+        if (!snapshot_.capture(vst3Plugins_)) {
+            return false;
+        }
+        MY_TRACE(L"Snapshot of %zu plugins : %zu bytes in %.3f msec\n", vst3Plugins_.size(), snapshot_.getNumBytes(),
+                 CycleClock::toNs(CycleClock::now() - startTicks) / 1e6);
+        return path.empty() || snapshot_.save(path);
+    }
 
-        // Zero-clear the initial input buffer
-        const unsigned bufSize = refillArgs.nSamples * refillArgs.nChannels;
-        memset(inpPtr, 0, sizeof(inpPtr[0]) * bufSize);
+    // UI thread : Switches the chain to snapshot_, or to the snapshot in the file if it's given. The shadow instances
+    // are prepared here, and the audio thread swaps all of them in at the next block (stateGeneration_).
+    bool loadSnapshot(const std::filesystem::path &path) {
+        if (std::ranges::any_of(vst3Plugins_, [](const auto &p) { return p->isStateSwitchPending(); })) {
+            MY_ERROR(L"The previous state switch hasn't completed yet\n");
+            return false;
+        }
+        // A file which doesn't fit the chain leaves the current snapshot as is
+        ChainSnapshot loaded;
+        if (!path.empty() && !loaded.load(path)) {
+            return false;
+        }
+        const ChainSnapshot &snapshot = path.empty() ? snapshot_ : loaded;
+        if (snapshot.empty()) {
+            MY_ERROR(L"No snapshot to load\n");
+            return false;
+        }
+        const uint64_t startTicks = CycleClock::now();
+        if (!snapshot.prepareSwitch(vst3Plugins_)) {
+            return false;
+        }
+        if (!path.empty()) {
+            snapshot_ = std::move(loaded);
+        }
+        stateGeneration_.fetch_add(1, std::memory_order_release);
+        MY_TRACE(L"State switch prepared in %.3f msec\n", CycleClock::toNs(CycleClock::now() - startTicks) / 1e6);
+        return true;
+    }
 
-        // Process plugins in series
+    // UI thread : Releases the instances which the audio thread has swapped out
+    // Returns true if a plugin has switched its state
+    bool finishStateSwitches() {
+        bool switched = false;
         for (const std::unique_ptr<Vst3Plugin> &vst3Plugin : vst3Plugins_) {
-            // Set I/O buffer addresses for each channel. inpPtr points to the output of the previous plugin.
-            for (unsigned iChannel = 0; iChannel < refillArgs.nChannels; ++iChannel) {
-                inpPtrs_[iChannel] = inpPtr + iChannel * refillArgs.nSamples;
-                outPtrs_[iChannel] = outPtr + iChannel * refillArgs.nSamples;
+            if (vst3Plugin->finishStateSwitch()) {
+                MY_TRACE(L"\"%ls\" has switched its state\n", vst3Plugin->getName().c_str());
+                switched = true;
             }
+        }
+        return switched;
+    }
 
-            const Vst3Plugin::ProcessArgs processArgs{
-                .vstInChannelPtrs  = std::span(inpPtrs_),
-                .vstOutChannelPtrs = std::span(outPtrs_),
-                .nSamples          = refillArgs.nSamples,
-                .sampleRate        = refillArgs.sampleRate,
-                .tempo             = tempo_,
-                .inputEvents       = inpEvents,
-                .outputEvents      = outEvents,
-                .ppqPosition       = currentPpq_,
-            };
-            vst3Plugin->audioThreadVstProcess(processArgs);
-
-            // If the plugin outputs events, swap the event lists
-            if (vst3Plugin->hasEventOutput()) {
-                // Clear the processed event list
-                inpEvents->clear();
-                // Swap event lists
-                std::swap(inpEvents, outEvents);
-                // At this point, inpEvents contains the event output from the plugin just processed
+    // Prints the DSP load and the latency percentiles of the whole callback and of each plugin, and the xruns.
+    // The timings are lock-free, so it can be called while the audio thread runs.
+    void printTiming() const {
+        const auto print = [](const wchar_t *label, const std::wstring &name, const ProcessTiming::Report &r) {
+            MY_TRACE(L"%ls%ls : load %.1f%% (peak %.1f%%), p50 %.1f usec, p99 %.1f usec, max %.1f usec, %llu blocks,"
+                     L" %llu over the block period\n",
+                     label, name.c_str(), r.loadPercent, r.peakLoadPercent, r.p50Ns / 1e3, r.p99Ns / 1e3,
+                     r.maxNs / 1e3, static_cast<unsigned long long>(r.nBlocks),
+                     static_cast<unsigned long long>(r.overruns));
+        };
+        const ProcessTiming::Report callback = callbackTiming_.report();
+        if (callback.nBlocks == 0) {
+            return;
+        }
+        print(L"Callback", L"", callback);
+        for (size_t iPlugin = 0; iPlugin < vst3Plugins_.size(); ++iPlugin) {
+            const Vst3Plugin &vst3Plugin = *vst3Plugins_[iPlugin];
+            print((L"  [#" + std::to_wstring(iPlugin) + L"] ").c_str(), vst3Plugin.getName(),
+                  vst3Plugin.getProcessTiming().report());
+            if (const uint64_t skipped = vst3Plugin.getSkippedBlocks(); skipped > 0) {
+                MY_TRACE(L"    %llu blocks skipped while idle\n", static_cast<unsigned long long>(skipped));
             }
+        }
+        for (const std::unique_ptr<SandboxPluginFactory> &sandboxFactory : sandboxFactories_) {
+            const PluginSandbox    &sandbox  = sandboxFactory->getSandbox();
+            const LatencyHistogram &overhead = sandbox.getOverhead();
+            if (overhead.getCount() > 0) {
+                MY_TRACE(L"  Sandbox round trip of \"%hs\" : p50 %.1f usec, p99 %.1f usec, max %.1f usec\n",
+                         sandbox.getPluginName().c_str(), overhead.getPercentileNs(0.50) / 1e3,
+                         overhead.getPercentileNs(0.99) / 1e3, overhead.getMaxNs() / 1e3);
+            }
+        }
+        // Free running backends have no deadline
+        if (processMode_ == Steinberg::Vst::kRealtime) {
+            MY_TRACE(L"Xruns : %llu overruns, %llu late callbacks\n",
+                     static_cast<unsigned long long>(callback.overruns),
+                     static_cast<unsigned long long>(eventScheduler_.getLateCallbacks()));
+        }
+    }
 
-            // If the plugin is not an effect (e.g., an instrument), add its output to the input (summing)
-            if (!vst3Plugin->isEffect()) {
-                for (unsigned i = 0; i < bufSize; ++i) {
-                    outPtr[i] += inpPtr[i];
-                }
+    // Prints the output parameters of each plugin which have changed since the last call. Reads the lock-free
+    // mirrors, so it never waits for the audio thread.
+    void printOutputParams() {
+        monitoredVersions_.resize(vst3Plugins_.size(), 0);
+        for (size_t iPlugin = 0; iPlugin < vst3Plugins_.size(); ++iPlugin) {
+            const Vst3Plugin &vst3Plugin = *vst3Plugins_[iPlugin];
+            if (!vst3Plugin.getParamMirror().read(monitorParams_) ||
+                monitorParams_.version == monitoredVersions_[iPlugin]) {
+                continue;
             }
+            monitoredVersions_[iPlugin] = monitorParams_.version;
+            std::wstring line;
+            for (unsigned i = 0; i < monitorParams_.nParams; ++i) {
+                wchar_t buf[64];
+                (void)swprintf(buf, std::size(buf), L" %u=%.4f", monitorParams_.params[i].id,
+                               monitorParams_.params[i].value);
+                line += buf;
+            }
+            MY_TRACE(L"[#%zu] %ls :%ls\n", iPlugin, vst3Plugin.getName().c_str(), line.c_str());
+        }
+    }
 
-            // Buffer swapping
-            std::swap(inpPtr, outPtr);
-            // Now inpPtr points to the output of the plugin just processed
+#if defined(_WIN32)
+    // Dispatches pending window messages. Returns false when WM_QUIT has been posted.
+    static bool pumpMessages() {
+        MSG msg;
+        while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) {
+                return false;
+            }
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
         }
+        return true;
+    }
+#endif
+
+    void audioThreadAppRefill(const AudioBackend::RefillArgs &refillArgs) {
+        MY_TRACE_SPAN(refillSpan, "refill");
+        const uint64_t startTicks = CycleClock::now();
 
-        // Write the final result into the WASAPI interleaved buffer
-        for (unsigned iSample = 0; iSample < refillArgs.nSamples; ++iSample) {
-            for (unsigned iChannel = 0; iChannel < refillArgs.nChannels; ++iChannel) {
-                const unsigned outIndex                   = iSample * refillArgs.nChannels + iChannel;
-                const unsigned inpIndex                   = iChannel * refillArgs.nSamples + iSample;
-                refillArgs.wasapiInterleavedBuf[outIndex] = inpPtr[inpIndex];
+        // Retrieve events from UI. They're placed at the sample offsets which correspond to their capture time.
+        MY_TRACE_SPAN(eventQueueSpan, "event queue");
+        const int64_t nowNs = monotonicNowNs();
+        for (const std::unique_ptr<Vst3Plugin> &vst3Plugin : vst3Plugins_) {
+            std::array<TimedEvent, 64> batch;
+            while (const size_t n = vst3Plugin->getEventQueue().popN(batch)) {
+                for (const TimedEvent &te : std::span(batch).first(n)) {
+                    eventScheduler_.push(te);
+                }
             }
         }
+        MY_TRACE_END(eventQueueSpan);
+        if (blockAdapter_.enabled()) {
+            // Each fixed block is timed as if a callback had started at its stream position, which keeps the stream
+            // clock of the event scheduler linear
+            const double nsPerFrame = 1e9 / refillArgs.sampleRate;
+            blockAdapter_.refill(refillArgs, [&](const AudioBackend::RefillArgs &block) {
+                const uint64_t offset = block.streamPosition - refillArgs.streamPosition;
+                audioThreadProcessBlock(block, nowNs + static_cast<int64_t>(nsPerFrame * static_cast<double>(offset)));
+            });
+        } else {
+            audioThreadProcessBlock(refillArgs, nowNs);
+        }
+
+        callbackTiming_.record(CycleClock::toNs(CycleClock::now() - startTicks),
+                               static_cast<uint64_t>(1e9 * refillArgs.nSamples / refillArgs.sampleRate));
+    }
+
+    // Processes one block of the plugin chain into refillArgs.interleavedBuf
+    void audioThreadProcessBlock(const AudioBackend::RefillArgs &refillArgs, const int64_t nowNs) {
+        MySimpleEventList *inpEvents = &inputEvents_;
+        inpEvents->clear();
+
+        const LiveEventScheduler::BlockTiming blockTiming{
+            .streamPosition = refillArgs.streamPosition,
+            .nSamples       = refillArgs.nSamples,
+            .sampleRate     = refillArgs.sampleRate,
+            .nowNs          = nowNs,
+        };
+        MY_TRACE_SPAN(scheduleSpan, "schedule events");
+        eventScheduler_.schedule(blockTiming, *inpEvents);
+        if (!midiFile_.empty()) {
+            droppedMidiEvents_ +=
+                midiCursor_.audioThreadFill(refillArgs.streamPosition, refillArgs.nSamples, *inpEvents);
+            inpEvents->sortBySampleOffset();
+        }
+        MY_TRACE_END(scheduleSpan);
+
+        // Process the plugin graph. Independent nodes or pipeline stages run in parallel on the worker threads.
+        // The transport follows the tempo map of the MIDI file
+        const bool                    midi = !midiFile_.empty();
+        const ProcessGraph::BlockArgs blockArgs{
+            .nSamples        = refillArgs.nSamples,
+            .sampleRate      = refillArgs.sampleRate,
+            .tempo           = midi ? midiFile_.getTempoAt(refillArgs.streamPosition) : tempo_,
+            .ppqPosition     = midi ? midiFile_.getPpqAt(refillArgs.streamPosition) : currentPpq_,
+            .processMode     = processMode_,
+            .inputEvents     = inpEvents,
+            .captureTimeNs   = eventScheduler_.getCaptureTimeNs(),
+            .stateGeneration = stateGeneration_.load(std::memory_order_acquire),
+        };
+        // The final result is written into the backend's interleaved buffer
+        MY_TRACE_SPAN(graphSpan, "graph");
+        processGraph_.audioThreadProcess(blockArgs, refillArgs.interleavedBuf);
+        MY_TRACE_END(graphSpan);
 
         // PPQ per second is (tempo / 60). PPQ per sample is that multiplied by (1 / sampleRate).
         currentPpq_ += refillArgs.nSamples * tempo_ / 60.0 / refillArgs.sampleRate;
     }
 
-    double                                   tempo_      = 120.0;
-    double                                   currentPpq_ = 0.0;
-    MyHost                                   myHost_;
-    std::vector<std::unique_ptr<Vst3Plugin>> vst3Plugins_;
-    std::array<std::vector<float>, 2>        pingPongAudioBuffers_;
-    std::vector<float *>                     inpPtrs_;
-    std::vector<float *>                     outPtrs_;
-    std::array<MySimpleEventList, 2>         pingPongEvents_;
+    using ConsoleQueue = SpscQueue<std::string, 16>;
+
+    double                                               tempo_       = 120.0;
+    double                                               currentPpq_  = 0.0;
+    Steinberg::int32                                     processMode_ = Steinberg::Vst::kRealtime;
+    MyHost                                               myHost_;
+    std::vector<std::unique_ptr<SyntheticPluginFactory>> syntheticFactories_; // Outlive the plugins
+    std::vector<std::unique_ptr<SandboxPluginFactory>>   sandboxFactories_;   // Outlive the plugins
+    std::vector<std::unique_ptr<Vst3Plugin>>             vst3Plugins_;
+    MySimpleEventList                                    inputEvents_;
+    LiveEventScheduler                                   eventScheduler_;
+    MidiFile                                             midiFile_; // --midi
+    MidiFile::Cursor                                     midiCursor_;
+    uint64_t                                             droppedMidiEvents_ = 0; // Audio thread
+    ProcessGraph                                         processGraph_;
+    BlockAdapter                                         blockAdapter_; // --fixed-block
+    Latency                                              latency_ = {}; // pluginFrames : See getLatency()
+    ParamMirror::Snapshot                                monitorParams_;
+    std::vector<uint64_t>                                monitoredVersions_;
+    ProcessTiming                                        callbackTiming_; // Of audioThreadAppRefill
+    std::shared_ptr<ConsoleQueue>                        consoleLines_; // Commands typed on the console
+    ChainSnapshot                                        snapshot_;
+    std::atomic<uint32_t>                                stateGeneration_ = 0; // Bumped by each state switch
+    const std::function<std::wstring(unsigned)>          getPluginName_ = [this](const unsigned index) {
+        return index < vst3Plugins_.size() ? vst3Plugins_[index]->getName() : std::wstring(L"?");
+    };
 }; // class AppMain
 
-int main() {
+int main(const int argc, char *argv[]) {
     MY_TRACE(L"Start\n");
-    int result = EXIT_FAILURE;
+    int        result = EXIT_FAILURE;
+    AppOptions options;
+    if (!options.parse(argc, argv)) {
+        AppOptions::printUsage();
+        return result;
+    }
+    CycleClock::calibrate();
+    if (options.benchType == AppOptions::BenchType::Kernels) {
+        return KernelBench::run(options.bufferSize, options.nChannels);
+    }
+    if (options.benchType == AppOptions::BenchType::Queue) {
+        return QueueBench::run();
+    }
+    if (options.benchType == AppOptions::BenchType::Chain) {
+        return ChainBench::run(options);
+    }
+    if (options.benchType == AppOptions::BenchType::Sandbox) {
+        return SandboxBench::run(options);
+    }
+    if (!options.tracePath.empty() && !TraceRecorder::start(options.tracePath)) {
+        return result;
+    }
+    (void)std::signal(SIGINT, [](int) { global_quitRequested = 1; });
+#if defined(_WIN32)
     SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
     if (HRESULT hr = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED); FAILED(hr)) {
         MY_ERROR(L"FAILED(0x%08x), CoInitializeEx()", hr);
-    } else {
-        try {
-            result = std::make_unique<AppMain>()->mainLoop();
-        } catch (std::exception &e) {
-            printf("Exception: %s\n", e.what());
+        TraceRecorder::stop();
+        return result;
+    }
+#endif
+    try {
+        if (!options.sandboxWorker.empty()) {
+            result = PluginSandbox::runWorker(options.sandboxWorker, options.sandboxPlugin);
+        } else if (!options.scanModule.empty()) {
+            result = PluginScanner::runWorker(options.scanModule, options.scanOut);
+        } else if (!options.batchPath.empty()) {
+            result = RenderFarm::run(options);
+        } else if (!options.scanRoots.empty()) {
+            result = PluginScanner::run(options.scanRoots, options.scanCache, options.scanJobs);
+        } else {
+            result = std::make_unique<AppMain>()->mainLoop(options);
         }
-        CoUninitialize();
+    } catch (std::exception &e) {
+        printf("Exception: %s\n", e.what());
     }
+    TraceRecorder::stop();
+#if defined(_WIN32)
+    CoUninitialize();
+#endif
     MY_TRACE(L"End\n");
     return result;
 }